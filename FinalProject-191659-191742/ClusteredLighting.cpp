@@ -0,0 +1,472 @@
+#include "ClusteredLighting.h"
+#include "GlResources.h"
+#include "JobSystem.h"
+#include "Simd.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+
+/// <summary>
+/// Adds a light.
+/// </summary>
+/// <param name="position">World space position</param>
+/// <param name="radius">Distance at which the light has faded out completely</param>
+/// <param name="color">Color times intensity</param>
+/// <returns>Index of the new light</returns>
+size_t PointLights::Add(const glm::vec3& position, float radius, const glm::vec3& color)
+{
+    posX.push_back(position.x);
+    posY.push_back(position.y);
+    posZ.push_back(position.z);
+    this->radius.push_back(radius);
+    colorR.push_back(color.x);
+    colorG.push_back(color.y);
+    colorB.push_back(color.z);
+    return posX.size() - 1;
+}
+
+LightClusters::LightClusters()
+    : projection(0.0f), minX(clusterCount), minY(clusterCount), minZ(clusterCount),
+    maxX(clusterCount), maxY(clusterCount), maxZ(clusterCount), sliceLights(clusterGridZ),
+    counts(clusterCount, 0), indices(clusterCount * maxLightsPerCluster, 0), sliceDropped(clusterGridZ, 0)
+{
+}
+
+/// <summary>
+/// Works out the view space bounding box of every cluster. Only does any work when the projection changed.
+/// </summary>
+/// <param name="persp">Projection matrix (perspective)</param>
+void LightClusters::SetProjection(const glm::mat4& persp)
+{
+    if (persp == projection)
+    {
+        return;
+    }
+    projection = persp;
+
+    // near and far planes, back out of the depth row of the matrix
+    float zNear = persp[3][2] / (persp[2][2] - 1.0f);
+    float zFar = persp[3][2] / (persp[2][2] + 1.0f);
+
+    // slice k covers the depths from near * (far / near)^(k / clusterGridZ) to the next one,
+    // so slice = log(depth) * zScale + zBias
+    zScale = clusterGridZ / std::log(zFar / zNear);
+    zBias = -std::log(zNear) * zScale;
+
+    for (int z = 0; z < clusterGridZ; z++)
+    {
+        float depthNear = zNear * std::pow(zFar / zNear, static_cast<float>(z) / clusterGridZ);
+        float depthFar = zNear * std::pow(zFar / zNear, static_cast<float>(z + 1) / clusterGridZ);
+
+        for (int y = 0; y < clusterGridY; y++)
+        {
+            for (int x = 0; x < clusterGridX; x++)
+            {
+                // a point at view depth d on the edge of the tile at normalized device coordinate n is n * d / persp[0][0]
+                // away from the view axis, so the box spans the tile edges at both the near and the far depth
+                float ndcX0 = -1.0f + 2.0f * x / clusterGridX, ndcX1 = -1.0f + 2.0f * (x + 1) / clusterGridX;
+                float ndcY0 = -1.0f + 2.0f * y / clusterGridY, ndcY1 = -1.0f + 2.0f * (y + 1) / clusterGridY;
+
+                int cluster = (z * clusterGridY + y) * clusterGridX + x;
+                minX[cluster] = std::min(ndcX0 * depthNear, ndcX0 * depthFar) / persp[0][0];
+                maxX[cluster] = std::max(ndcX1 * depthNear, ndcX1 * depthFar) / persp[0][0];
+                minY[cluster] = std::min(ndcY0 * depthNear, ndcY0 * depthFar) / persp[1][1];
+                maxY[cluster] = std::max(ndcY1 * depthNear, ndcY1 * depthFar) / persp[1][1];
+                minZ[cluster] = depthNear;
+                maxZ[cluster] = depthFar;
+            }
+        }
+    }
+}
+
+/// <summary>
+/// Moves the lights into view space, and pads them to a multiple of the SIMD width.
+/// </summary>
+void LightClusters::TransformLights(const PointLights& lights, const glm::mat4& view)
+{
+    // the list format stores light indices in 16 bits
+    lightCount = std::min<size_t>(lights.Count(), 65535);
+    size_t padded = (lightCount + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+
+    // only grows, so a steady number of lights makes no allocations
+    if (lightX.size() < padded)
+    {
+        for (std::vector<float>* list : { &lightX, &lightY, &lightZ, &lightRadius, &lightRadiusSq })
+        {
+            list->resize(padded);
+        }
+        for (SliceLights& slice : sliceLights)
+        {
+            for (std::vector<float>* list : { &slice.x, &slice.y, &slice.z, &slice.radiusSq })
+            {
+                list->resize(padded);
+            }
+            slice.index.resize(padded);
+        }
+    }
+
+    for (size_t i = 0; i < lightCount; i++)
+    {
+        glm::vec4 position = view * glm::vec4(lights.posX[i], lights.posY[i], lights.posZ[i], 1.0f);
+        lightX[i] = position.x;
+        lightY[i] = position.y;
+        lightZ[i] = -position.z;
+        lightRadius[i] = lights.radius[i];
+        lightRadiusSq[i] = lights.radius[i] * lights.radius[i];
+    }
+
+    // padding lights sit far behind the camera and reach nothing
+    for (size_t i = lightCount; i < padded; i++)
+    {
+        lightX[i] = 0.0f;
+        lightY[i] = 0.0f;
+        lightZ[i] = -1e30f;
+        lightRadius[i] = 0.0f;
+        lightRadiusSq[i] = 0.0f;
+    }
+}
+
+/// <summary>
+/// Fills the light lists of the clusters of one depth slice.
+/// </summary>
+/// <returns>Number of light/cluster pairs dropped because a cluster was full</returns>
+size_t LightClusters::BuildSlice(int slice)
+{
+    int firstCluster = slice * clusterGridY * clusterGridX;
+    float sliceNear = minZ[firstCluster];
+    float sliceFar = maxZ[firstCluster];
+
+    // First keep only the lights that reach into the depth range of the slice. Most lights only touch a few slices,
+    // so the tiles below test far fewer lights than there are.
+    SliceLights& candidates = sliceLights[slice];
+    size_t candidateCount = 0;
+    for (size_t i = 0; i < lightCount; i++)
+    {
+        if (lightZ[i] + lightRadius[i] >= sliceNear && lightZ[i] - lightRadius[i] <= sliceFar)
+        {
+            candidates.x[candidateCount] = lightX[i];
+            candidates.y[candidateCount] = lightY[i];
+            candidates.z[candidateCount] = lightZ[i];
+            candidates.radiusSq[candidateCount] = lightRadiusSq[i];
+            candidates.index[candidateCount] = static_cast<uint16_t>(i);
+            candidateCount++;
+        }
+    }
+
+    // pad the candidates to whole batches with lights that reach nothing
+    size_t paddedCount = (candidateCount + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    for (size_t i = candidateCount; i < paddedCount; i++)
+    {
+        candidates.x[i] = 0.0f;
+        candidates.y[i] = 0.0f;
+        candidates.z[i] = -1e30f;
+        candidates.radiusSq[i] = 0.0f;
+    }
+
+    size_t droppedPairs = 0;
+    for (int cluster = firstCluster; cluster < firstCluster + clusterGridY * clusterGridX; cluster++)
+    {
+        uint16_t* list = indices.data() + static_cast<size_t>(cluster) * maxLightsPerCluster;
+        int count = 0;
+
+#if SIMD_WIDTH > 1
+        // distance from a sphere center to the box is the length of how far it sticks out on each axis
+        const SimdFloat boxMinX = SimdSet(minX[cluster]), boxMaxX = SimdSet(maxX[cluster]);
+        const SimdFloat boxMinY = SimdSet(minY[cluster]), boxMaxY = SimdSet(maxY[cluster]);
+        const SimdFloat boxMinZ = SimdSet(minZ[cluster]), boxMaxZ = SimdSet(maxZ[cluster]);
+        const SimdFloat zero = SimdSet(0.0f);
+
+        for (size_t i = 0; i < paddedCount; i += SIMD_WIDTH)
+        {
+            SimdFloat x = SimdLoad(&candidates.x[i]);
+            SimdFloat y = SimdLoad(&candidates.y[i]);
+            SimdFloat z = SimdLoad(&candidates.z[i]);
+            SimdFloat dx = SimdMax(SimdMax(SimdSub(boxMinX, x), SimdSub(x, boxMaxX)), zero);
+            SimdFloat dy = SimdMax(SimdMax(SimdSub(boxMinY, y), SimdSub(y, boxMaxY)), zero);
+            SimdFloat dz = SimdMax(SimdMax(SimdSub(boxMinZ, z), SimdSub(z, boxMaxZ)), zero);
+            SimdFloat distanceSq = SimdMulAdd(dx, dx, SimdMulAdd(dy, dy, SimdMul(dz, dz)));
+
+            // the padding lights have a radius of 0, and are always at least some distance away
+            int touching = SimdMoveMask(SimdLess(distanceSq, SimdLoad(&candidates.radiusSq[i])));
+            while (touching != 0)
+            {
+                int lane = 0;
+                while ((touching & (1 << lane)) == 0)
+                {
+                    lane++;
+                }
+                touching &= touching - 1;
+
+                if (count < maxLightsPerCluster)
+                {
+                    list[count++] = candidates.index[i + lane];
+                }
+                else
+                {
+                    droppedPairs++;
+                }
+            }
+        }
+#else
+        for (size_t i = 0; i < candidateCount; i++)
+        {
+            float dx = std::max(std::max(minX[cluster] - candidates.x[i], candidates.x[i] - maxX[cluster]), 0.0f);
+            float dy = std::max(std::max(minY[cluster] - candidates.y[i], candidates.y[i] - maxY[cluster]), 0.0f);
+            float dz = std::max(std::max(minZ[cluster] - candidates.z[i], candidates.z[i] - maxZ[cluster]), 0.0f);
+            if (dx * dx + dy * dy + dz * dz < candidates.radiusSq[i])
+            {
+                if (count < maxLightsPerCluster)
+                {
+                    list[count++] = candidates.index[i];
+                }
+                else
+                {
+                    droppedPairs++;
+                }
+            }
+        }
+#endif
+
+        counts[cluster] = static_cast<uint16_t>(count);
+    }
+
+    return droppedPairs;
+}
+
+/// <summary>
+/// Fills the light list of every cluster, one depth slice per job. Each slice first picks the lights that reach
+/// into its depth range, then tests them against its clusters SIMD_WIDTH lights at a time.
+/// </summary>
+/// <param name="lights">Lights in world space</param>
+/// <param name="view">View matrix</param>
+/// <param name="jobSystem">Job system to run the slices on</param>
+void LightClusters::Build(const PointLights& lights, const glm::mat4& view, JobSystem& jobSystem)
+{
+    TransformLights(lights, view);
+
+    jobSystem.ParallelFor("light clusters", clusterGridZ, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t slice = begin; slice < end; slice++)
+        {
+            sliceDropped[slice] = BuildSlice(static_cast<int>(slice));
+        }
+    });
+
+    dropped = 0;
+    for (size_t slice : sliceDropped)
+    {
+        dropped += slice;
+    }
+}
+
+/// <summary>
+/// Same as Build(), but tests every light against every cluster with plain scalar code on the calling thread.
+/// Used as a reference.
+/// </summary>
+void LightClusters::BuildScalar(const PointLights& lights, const glm::mat4& view)
+{
+    TransformLights(lights, view);
+
+    dropped = 0;
+    for (int cluster = 0; cluster < clusterCount; cluster++)
+    {
+        uint16_t* list = indices.data() + static_cast<size_t>(cluster) * maxLightsPerCluster;
+        int count = 0;
+        for (size_t i = 0; i < lightCount; i++)
+        {
+            float dx = std::max(std::max(minX[cluster] - lightX[i], lightX[i] - maxX[cluster]), 0.0f);
+            float dy = std::max(std::max(minY[cluster] - lightY[i], lightY[i] - maxY[cluster]), 0.0f);
+            float dz = std::max(std::max(minZ[cluster] - lightZ[i], lightZ[i] - maxZ[cluster]), 0.0f);
+            if (dx * dx + dy * dy + dz * dz < lightRadiusSq[i])
+            {
+                if (count < maxLightsPerCluster)
+                {
+                    list[count++] = static_cast<uint16_t>(i);
+                }
+                else
+                {
+                    dropped++;
+                }
+            }
+        }
+        counts[cluster] = static_cast<uint16_t>(count);
+    }
+}
+
+/// <summary>
+/// Returns what the shaders need to find the cluster of a fragment:
+/// tiles per pixel on x and y, then the scale and bias that turn log(view depth) into a slice.
+/// </summary>
+/// <param name="renderWidth">Width of the viewport in pixels</param>
+/// <param name="renderHeight">Height of the viewport in pixels</param>
+glm::vec4 LightClusters::GetShaderParams(int renderWidth, int renderHeight) const
+{
+    return glm::vec4(static_cast<float>(clusterGridX) / renderWidth, static_cast<float>(clusterGridY) / renderHeight,
+        zScale, zBias);
+}
+
+/// <summary>
+/// Creates one texture buffer.
+/// </summary>
+static void CreateTextureBuffer(GLenum format, const char* label, GLuint& buffer, GLuint& texture)
+{
+    buffer = CreateGlResource(GlResourceType::Buffer, label);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    SetGlResourceBytes(GlResourceType::Buffer, buffer, 16);
+
+    // (the texture only looks into the buffer, it has no storage of its own)
+    texture = CreateGlResource(GlResourceType::Texture, label);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+/// <summary>
+/// Creates the texture buffers for the clustered lights.
+/// </summary>
+ClusterTextures CreateClusterTextures()
+{
+    ClusterTextures textures;
+    CreateTextureBuffer(GL_RGBA32F, "point lights", textures.lightBuffer, textures.lightTexture);
+    CreateTextureBuffer(GL_R16UI, "cluster light counts", textures.countBuffer, textures.countTexture);
+    CreateTextureBuffer(GL_R16UI, "cluster light indices", textures.indexBuffer, textures.indexTexture);
+    return textures;
+}
+
+/// <summary>
+/// Replaces the contents of a texture buffer. Handing glBufferData() new data (instead of overwriting the old
+/// storage) lets the driver orphan the old contents, so the upload never waits for draws that still read them.
+/// </summary>
+static void UploadTextureBuffer(GLuint buffer, size_t bytes, const void* data)
+{
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, bytes, data, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    SetGlResourceBytes(GlResourceType::Buffer, buffer, bytes);
+}
+
+/// <summary>
+/// Uploads the lights and the cluster lists (orphaning the old contents, so the upload never waits for the GPU).
+/// </summary>
+void UploadClusterTextures(const ClusterTextures& textures, const PointLights& lights, const LightClusters& clusters)
+{
+    // two texels per light, so the shader finds light i at texels 2i and 2i + 1
+    std::vector<glm::vec4> lightTexels(std::max<size_t>(2 * lights.Count(), 2), glm::vec4(0.0f));
+    for (size_t i = 0; i < lights.Count(); i++)
+    {
+        lightTexels[2 * i] = glm::vec4(lights.posX[i], lights.posY[i], lights.posZ[i], lights.radius[i]);
+        lightTexels[2 * i + 1] = glm::vec4(lights.colorR[i], lights.colorG[i], lights.colorB[i], 0.0f);
+    }
+
+    UploadTextureBuffer(textures.lightBuffer, lightTexels.size() * sizeof(glm::vec4), lightTexels.data());
+    UploadTextureBuffer(textures.countBuffer, clusters.Counts().size() * sizeof(uint16_t), clusters.Counts().data());
+    UploadTextureBuffer(textures.indexBuffer, clusters.Indices().size() * sizeof(uint16_t), clusters.Indices().data());
+}
+
+/// <summary>
+/// Deletes the texture buffers.
+/// </summary>
+void DeleteClusterTextures(ClusterTextures& textures)
+{
+    for (GLuint* buffer : { &textures.lightBuffer, &textures.countBuffer, &textures.indexBuffer })
+    {
+        DeleteGlResource(GlResourceType::Buffer, *buffer);
+    }
+    for (GLuint* texture : { &textures.lightTexture, &textures.countTexture, &textures.indexTexture })
+    {
+        DeleteGlResource(GlResourceType::Texture, *texture);
+    }
+}
+
+/// <summary>
+/// Measures how long building the cluster lists takes for a sweep of light counts, with the scalar reference,
+/// with SIMD on one thread and with SIMD on every hardware thread, checks that all of them agree, and prints a table.
+/// </summary>
+/// <param name="maxLights">Largest number of lights to try</param>
+void RunLightingBenchmark(int maxLights)
+{
+    const int iterations = 20;
+    int threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    // same camera as the scene, looking over a table of lights
+    glm::mat4 view = glm::lookAt(glm::vec3(0.5f, 0.0f, 1.25f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 persp = glm::perspective(90.0f, 1.0f, 0.1f, 100.0f);
+
+    JobSystem singleThread(1);
+    JobSystem allThreads(threadCount);
+    LightClusters reference, simd;
+    reference.SetProjection(persp);
+    simd.SetProjection(persp);
+
+    std::cout << "clustered lighting benchmark: " << clusterGridX << "x" << clusterGridY << "x" << clusterGridZ
+        << " clusters, " << SIMD_WIDTH << " lights per batch, " << threadCount << " threads" << std::endl;
+    std::cout << std::setw(8) << "lights" << std::setw(14) << "scalar" << std::setw(14) << "SIMD"
+        << std::setw(14) << "SIMD+jobs" << std::setw(16) << "lights/cluster" << std::setw(10) << "results" << std::endl;
+
+    for (int lightCount = 16; lightCount <= std::max(maxLights, 16); lightCount *= 2)
+    {
+        std::mt19937 random(37);
+        std::uniform_real_distribution<float> across(-4.0f, 4.0f);
+        std::uniform_real_distribution<float> height(-1.0f, 0.5f);
+        std::uniform_real_distribution<float> along(-12.0f, 0.5f);
+        std::uniform_real_distribution<float> size(0.3f, 0.8f);
+        PointLights lights;
+        for (int i = 0; i < lightCount; i++)
+        {
+            lights.Add(glm::vec3(across(random), height(random), along(random)), size(random), glm::vec3(1.0f));
+        }
+
+        double ms[3] = {};
+        for (int variant = 0; variant < 3; variant++)
+        {
+            // one untimed build first, to warm up the caches and wake up the workers
+            for (int iteration = -1; iteration < iterations; iteration++)
+            {
+                auto start = std::chrono::steady_clock::now();
+                if (variant == 0)
+                {
+                    reference.BuildScalar(lights, view);
+                }
+                else
+                {
+                    simd.Build(lights, view, variant == 1 ? singleThread : allThreads);
+                }
+                if (iteration >= 0)
+                {
+                    ms[variant] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                }
+            }
+            ms[variant] /= iterations;
+        }
+
+        bool agree = reference.Counts() == simd.Counts() && reference.DroppedLights() == simd.DroppedLights();
+        size_t pairs = 0, litClusters = 0;
+        for (int cluster = 0; cluster < clusterCount && agree; cluster++)
+        {
+            size_t offset = static_cast<size_t>(cluster) * maxLightsPerCluster;
+            agree = std::equal(reference.Indices().begin() + offset, reference.Indices().begin() + offset + reference.Counts()[cluster],
+                simd.Indices().begin() + offset);
+            pairs += reference.Counts()[cluster];
+            litClusters += reference.Counts()[cluster] > 0 ? 1 : 0;
+        }
+
+        std::ostringstream average;
+        average << std::fixed << std::setprecision(1) << (litClusters > 0 ? double(pairs) / litClusters : 0.0);
+        std::cout << std::fixed << std::setprecision(3)
+            << std::setw(8) << lightCount << std::setw(12) << ms[0] << "ms" << std::setw(12) << ms[1] << "ms"
+            << std::setw(12) << ms[2] << "ms" << std::setw(16) << average.str()
+            << std::setw(10) << (agree ? "match" : "DIFFER") << std::endl;
+    }
+    std::cout << "(lights/cluster counts only clusters with at least one light)" << std::endl;
+}
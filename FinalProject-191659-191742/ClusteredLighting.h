@@ -0,0 +1,161 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+// The view frustum is split into clusterGridX x clusterGridY tiles on screen and clusterGridZ slices in depth
+// (the slices get deeper further away, so that every cluster is roughly as deep as it is wide).
+// Must match main.fsh and impostor.fsh.
+const int clusterGridX = 16;
+const int clusterGridY = 16;
+const int clusterGridZ = 24;
+const int clusterCount = clusterGridX * clusterGridY * clusterGridZ;
+
+// every cluster has room for this many lights; further lights touching it are dropped
+const int maxLightsPerCluster = 64;
+
+/// <summary>
+/// Stores the position, radius and color of every point light in separate arrays (structure of arrays),
+/// so that several lights can be tested against a cluster at once with SIMD
+/// </summary>
+struct PointLights
+{
+    std::vector<float> posX, posY, posZ;
+    std::vector<float> radius;              // the light reaches exactly this far
+    std::vector<float> colorR, colorG, colorB;
+
+    /// <summary>
+    /// Adds a light.
+    /// </summary>
+    /// <param name="position">World space position</param>
+    /// <param name="radius">Distance at which the light has faded out completely</param>
+    /// <param name="color">Color times intensity</param>
+    /// <returns>Index of the new light</returns>
+    size_t Add(const glm::vec3& position, float radius, const glm::vec3& color);
+
+    /// <summary>
+    /// Returns the number of lights.
+    /// </summary>
+    size_t Count() const { return posX.size(); }
+};
+
+/// <summary>
+/// Builds, every frame, the list of point lights whose sphere touches each cluster of the view frustum,
+/// so that a fragment only has to loop over the lights of its own cluster.
+/// </summary>
+class LightClusters
+{
+public:
+    LightClusters();
+
+    /// <summary>
+    /// Works out the view space bounding box of every cluster. Only does any work when the projection changed.
+    /// </summary>
+    /// <param name="persp">Projection matrix (perspective)</param>
+    void SetProjection(const glm::mat4& persp);
+
+    /// <summary>
+    /// Fills the light list of every cluster, one depth slice per job. Each slice first picks the lights that reach
+    /// into its depth range, then tests them against its clusters SIMD_WIDTH lights at a time.
+    /// </summary>
+    /// <param name="lights">Lights in world space</param>
+    /// <param name="view">View matrix</param>
+    /// <param name="jobSystem">Job system to run the slices on</param>
+    void Build(const PointLights& lights, const glm::mat4& view, JobSystem& jobSystem);
+
+    /// <summary>
+    /// Same as Build(), but tests every light against every cluster with plain scalar code on the calling thread.
+    /// Used as a reference.
+    /// </summary>
+    void BuildScalar(const PointLights& lights, const glm::mat4& view);
+
+    /// <summary>
+    /// Returns the number of lights of every cluster (clusters are numbered x first, then y, then depth).
+    /// </summary>
+    const std::vector<uint16_t>& Counts() const { return counts; }
+
+    /// <summary>
+    /// Returns the light indices of every cluster; cluster c owns maxLightsPerCluster entries starting at
+    /// c * maxLightsPerCluster, of which the first Counts()[c] are used.
+    /// </summary>
+    const std::vector<uint16_t>& Indices() const { return indices; }
+
+    /// <summary>
+    /// Returns how many light/cluster pairs were dropped by the last build because a cluster was full.
+    /// </summary>
+    size_t DroppedLights() const { return dropped; }
+
+    /// <summary>
+    /// Returns what the shaders need to find the cluster of a fragment:
+    /// tiles per pixel on x and y, then the scale and bias that turn log(view depth) into a slice.
+    /// </summary>
+    /// <param name="renderWidth">Width of the viewport in pixels</param>
+    /// <param name="renderHeight">Height of the viewport in pixels</param>
+    glm::vec4 GetShaderParams(int renderWidth, int renderHeight) const;
+
+private:
+    void TransformLights(const PointLights& lights, const glm::mat4& view);
+    size_t BuildSlice(int slice);
+
+    glm::mat4 projection;
+    float zScale = 0.0f, zBias = 0.0f;
+
+    // view space bounding box of every cluster (view depth is positive, growing away from the camera)
+    std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+
+    // lights in view space (x, y, depth) and their squared radius, padded with lights that reach nothing
+    // up to a multiple of the SIMD width
+    std::vector<float> lightX, lightY, lightZ, lightRadius, lightRadiusSq;
+    size_t lightCount = 0;
+
+    // per slice: the lights that reach into it, in the same layout
+    struct SliceLights
+    {
+        std::vector<float> x, y, z, radiusSq;
+        std::vector<uint16_t> index;
+    };
+    std::vector<SliceLights> sliceLights;
+
+    std::vector<uint16_t> counts;
+    std::vector<uint16_t> indices;
+    std::vector<size_t> sliceDropped;
+    size_t dropped = 0;
+};
+
+/// <summary>
+/// Struct containing the texture buffers the shaders read the clustered lights from
+/// </summary>
+struct ClusterTextures
+{
+    GLuint lightBuffer, lightTexture;   // RGBA32F, two texels per light: position and radius, then color
+    GLuint countBuffer, countTexture;   // R16UI, number of lights of every cluster
+    GLuint indexBuffer, indexTexture;   // R16UI, maxLightsPerCluster light indices per cluster
+};
+
+/// <summary>
+/// Creates the texture buffers for the clustered lights.
+/// </summary>
+ClusterTextures CreateClusterTextures();
+
+/// <summary>
+/// Uploads the lights and the cluster lists (orphaning the old contents, so the upload never waits for the GPU).
+/// </summary>
+void UploadClusterTextures(const ClusterTextures& textures, const PointLights& lights, const LightClusters& clusters);
+
+/// <summary>
+/// Deletes the texture buffers.
+/// </summary>
+void DeleteClusterTextures(ClusterTextures& textures);
+
+/// <summary>
+/// Measures how long building the cluster lists takes for a sweep of light counts, with the scalar reference,
+/// with SIMD on one thread and with SIMD on every hardware thread, checks that all of them agree, and prints a table.
+/// </summary>
+/// <param name="maxLights">Largest number of lights to try</param>
+void RunLightingBenchmark(int maxLights);
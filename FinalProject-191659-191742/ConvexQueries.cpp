@@ -0,0 +1,950 @@
+#include "ConvexQueries.h"
+#include "D20.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <utility>
+
+// GJK stops once a step brings the closest point less than this fraction of its squared distance closer
+// (float rounding keeps it from ever getting exactly there)
+static const float gjkTolerance = 1e-5f;
+static const int maxGjkIterations = 32;
+
+// EPA stops once the polytope is within this fraction of the shapes' size of the Minkowski difference,
+// or when it runs out of room (it keeps the best face so far)
+static const float epaTolerance = 1e-4f;
+static const int maxEpaIterations = 64;
+static const int maxEpaCorners = 64;
+static const int maxEpaFaces = 128;
+static const int maxEpaHorizon = 64;
+
+/// <summary>
+/// Builds a hull from its corners and triangles. The origin has to be inside it.
+/// </summary>
+/// <param name="corners">Corners in model space (at most maxConvexCorners)</param>
+/// <param name="cornerCount">Number of corners</param>
+/// <param name="faces">Three corner indices per triangle, counter-clockwise seen from outside</param>
+/// <param name="faceCount">Number of triangles</param>
+/// <returns>The hull with its edges and spheres</returns>
+ConvexHull BuildConvexHull(const glm::vec3* corners, int cornerCount, const int (*faces)[3], int faceCount)
+{
+    ConvexHull hull;
+    cornerCount = std::min(cornerCount, maxConvexCorners);
+    hull.corners.assign(corners, corners + cornerCount);
+
+    // every edge of a triangle is an edge between two corners, found twice (once from each side)
+    std::vector<std::vector<int>> adjacent(cornerCount);
+    hull.inradius = 1e30f;
+    for (int face = 0; face < faceCount; face++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            int from = faces[face][k];
+            int to = faces[face][(k + 1) % 3];
+            hull.faces.push_back(from);
+            if (std::find(adjacent[from].begin(), adjacent[from].end(), to) == adjacent[from].end())
+            {
+                adjacent[from].push_back(to);
+                adjacent[to].push_back(from);
+            }
+        }
+
+        const glm::vec3& a = corners[faces[face][0]];
+        glm::vec3 normal = glm::normalize(glm::cross(corners[faces[face][1]] - a, corners[faces[face][2]] - a));
+        hull.inradius = std::min(hull.inradius, glm::dot(normal, a));
+    }
+
+    for (int corner = 0; corner < cornerCount; corner++)
+    {
+        hull.neighborStart.push_back(static_cast<int>(hull.neighbors.size()));
+        hull.neighbors.insert(hull.neighbors.end(), adjacent[corner].begin(), adjacent[corner].end());
+        hull.circumradius = std::max(hull.circumradius, glm::length(corners[corner]));
+    }
+    hull.neighborStart.push_back(static_cast<int>(hull.neighbors.size()));
+    return hull;
+}
+
+/// <summary>
+/// Returns the hull of the d20 (built once, from GetD20Corner() and d20FaceIndices).
+/// </summary>
+const ConvexHull& GetD20Hull()
+{
+    static const ConvexHull hull = []()
+    {
+        glm::vec3 corners[d20CornerCount];
+        for (int corner = 0; corner < d20CornerCount; corner++)
+        {
+            corners[corner] = GetD20Corner(corner);
+        }
+        return BuildConvexHull(corners, d20CornerCount, d20FaceIndices, d20FaceCount);
+    }();
+    return hull;
+}
+
+/// <summary>
+/// Places a hull in the world.
+/// </summary>
+/// <param name="hull">Hull to place, has to outlive the shape</param>
+/// <param name="position">Position of its origin</param>
+/// <param name="rotation">Rotation (unit quaternion)</param>
+/// <param name="scale">Uniform scale</param>
+/// <returns>The placed shape</returns>
+ConvexShape PlaceConvexShape(const ConvexHull& hull, const glm::vec3& position, const glm::quat& rotation, float scale)
+{
+    ConvexShape shape;
+    shape.hull = &hull;
+    shape.center = position;
+    shape.radius = hull.circumradius * scale;
+    shape.inradius = hull.inradius * scale;
+
+    glm::mat3 rotationMatrix = glm::mat3_cast(rotation);
+    for (size_t corner = 0; corner < hull.corners.size(); corner++)
+    {
+        shape.corners[corner] = position + (rotationMatrix * hull.corners[corner]) * scale;
+    }
+    return shape;
+}
+
+/// <summary>
+/// Returns the corner of a shape furthest along a direction, walking from a starting corner to whichever neighbor
+/// is further along until none is (on a convex shape that is the furthest corner of all).
+/// Starting from the corner found for a nearby direction, as GJK and EPA do from one step to the next, it takes
+/// one or two steps.
+/// </summary>
+/// <param name="shape">Shape to search</param>
+/// <param name="direction">Direction (does not need to be normalized)</param>
+/// <param name="start">Corner to start from</param>
+/// <returns>Index of the furthest corner</returns>
+int GetSupportCorner(const ConvexShape& shape, const glm::vec3& direction, int start)
+{
+    const ConvexHull& hull = *shape.hull;
+    int best = start;
+    float bestDistance = glm::dot(shape.corners[best], direction);
+    for (;;)
+    {
+        int next = best;
+        for (int n = hull.neighborStart[best]; n < hull.neighborStart[best + 1]; n++)
+        {
+            int neighbor = hull.neighbors[n];
+            float distance = glm::dot(shape.corners[neighbor], direction);
+            if (distance > bestDistance)
+            {
+                bestDistance = distance;
+                next = neighbor;
+            }
+        }
+        if (next == best)
+        {
+            return best;
+        }
+        best = next;
+    }
+}
+
+/// <summary>
+/// Struct containing a point of the Minkowski difference a - b and the corners it came from
+/// </summary>
+struct MinkowskiPoint
+{
+    glm::vec3 w;
+    int a, b;
+};
+
+/// <summary>
+/// Struct containing the simplex GJK works with: up to 4 points, and the weights of the point closest to the origin
+/// </summary>
+struct Simplex
+{
+    MinkowskiPoint points[4];
+    float weights[4];
+    int count = 0;
+};
+
+/// <summary>
+/// Returns the point of the Minkowski difference furthest along a direction.
+/// </summary>
+static MinkowskiPoint GetMinkowskiSupport(const ConvexShape& a, const ConvexShape& b, const glm::vec3& direction, int hintA, int hintB)
+{
+    MinkowskiPoint point;
+    point.a = GetSupportCorner(a, direction, hintA);
+    point.b = GetSupportCorner(b, -direction, hintB);
+    point.w = a.corners[point.a] - b.corners[point.b];
+    return point;
+}
+
+/// <summary>
+/// Keeps the given points of a simplex (in this order), with their weights.
+/// </summary>
+static void ReduceSimplex(Simplex& simplex, int count, const int* keep, const float* weights)
+{
+    MinkowskiPoint points[4];
+    for (int i = 0; i < count; i++)
+    {
+        points[i] = simplex.points[keep[i]];
+    }
+    for (int i = 0; i < count; i++)
+    {
+        simplex.points[i] = points[i];
+        simplex.weights[i] = weights[i];
+    }
+    simplex.count = count;
+}
+
+/// <summary>
+/// Finds the point of a triangle of the simplex closest to the origin (Voronoi regions, as in Ericson's
+/// Real-Time Collision Detection), and reduces the simplex to the corners it depends on.
+/// </summary>
+/// <returns>Squared distance of the closest point</returns>
+static float SolveTriangle(Simplex& simplex, int i0, int i1, int i2)
+{
+    const glm::vec3& a = simplex.points[i0].w;
+    const glm::vec3& b = simplex.points[i1].w;
+    const glm::vec3& c = simplex.points[i2].w;
+    glm::vec3 ab = b - a, ac = c - a;
+
+    int keep[3];
+    float weights[3];
+    auto reduceTo = [&](int count, glm::vec3 closest) -> float
+    {
+        ReduceSimplex(simplex, count, keep, weights);
+        return glm::dot(closest, closest);
+    };
+
+    float d1 = -glm::dot(ab, a), d2 = -glm::dot(ac, a);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+    {
+        keep[0] = i0; weights[0] = 1.0f;
+        return reduceTo(1, a);
+    }
+    float d3 = -glm::dot(ab, b), d4 = -glm::dot(ac, b);
+    if (d3 >= 0.0f && d4 <= d3)
+    {
+        keep[0] = i1; weights[0] = 1.0f;
+        return reduceTo(1, b);
+    }
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    {
+        float t = d1 / (d1 - d3);
+        keep[0] = i0; keep[1] = i1; weights[0] = 1.0f - t; weights[1] = t;
+        return reduceTo(2, a + ab * t);
+    }
+    float d5 = -glm::dot(ab, c), d6 = -glm::dot(ac, c);
+    if (d6 >= 0.0f && d5 <= d6)
+    {
+        keep[0] = i2; weights[0] = 1.0f;
+        return reduceTo(1, c);
+    }
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+    {
+        float t = d2 / (d2 - d6);
+        keep[0] = i0; keep[1] = i2; weights[0] = 1.0f - t; weights[1] = t;
+        return reduceTo(2, a + ac * t);
+    }
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+    {
+        float t = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        keep[0] = i1; keep[1] = i2; weights[0] = 1.0f - t; weights[1] = t;
+        return reduceTo(2, b + (c - b) * t);
+    }
+
+    float denominator = 1.0f / (va + vb + vc);
+    float v = vb * denominator, w = vc * denominator;
+    keep[0] = i0; keep[1] = i1; keep[2] = i2;
+    weights[0] = 1.0f - v - w; weights[1] = v; weights[2] = w;
+    return reduceTo(3, a + ab * v + ac * w);
+}
+
+/// <summary>
+/// Finds the point of the simplex closest to the origin, and reduces the simplex to the smallest one containing it.
+/// </summary>
+/// <returns>Squared distance of the closest point, 0 if the simplex is a tetrahedron containing the origin</returns>
+static float SolveSimplex(Simplex& simplex)
+{
+    switch (simplex.count)
+    {
+    case 1:
+    {
+        simplex.weights[0] = 1.0f;
+        return glm::dot(simplex.points[0].w, simplex.points[0].w);
+    }
+    case 2:
+    {
+        const glm::vec3& a = simplex.points[0].w;
+        glm::vec3 ab = simplex.points[1].w - a;
+        float lengthSquared = glm::dot(ab, ab);
+        float t = lengthSquared > 0.0f ? -glm::dot(a, ab) / lengthSquared : 0.0f;
+        if (t <= 0.0f)
+        {
+            int keep[1] = { 0 };
+            float weights[1] = { 1.0f };
+            ReduceSimplex(simplex, 1, keep, weights);
+            return glm::dot(a, a);
+        }
+        if (t >= 1.0f)
+        {
+            int keep[1] = { 1 };
+            float weights[1] = { 1.0f };
+            ReduceSimplex(simplex, 1, keep, weights);
+            return glm::dot(simplex.points[0].w, simplex.points[0].w);
+        }
+        simplex.weights[0] = 1.0f - t;
+        simplex.weights[1] = t;
+        glm::vec3 closest = a + ab * t;
+        return glm::dot(closest, closest);
+    }
+    case 3:
+        return SolveTriangle(simplex, 0, 1, 2);
+    default:
+    {
+        // The origin is either inside the tetrahedron, or closest to one of the faces it is in front of
+        // (a face the fourth corner is behind). A flat tetrahedron tries every face.
+        static const int faces[4][4] = { { 0, 1, 2, 3 }, { 0, 2, 3, 1 }, { 0, 3, 1, 2 }, { 1, 3, 2, 0 } };
+        float bestDistance = -1.0f;
+        Simplex best;
+        for (const int* face : faces)
+        {
+            const glm::vec3& a = simplex.points[face[0]].w;
+            glm::vec3 normal = glm::cross(simplex.points[face[1]].w - a, simplex.points[face[2]].w - a);
+            float originSide = -glm::dot(normal, a);
+            float cornerSide = glm::dot(normal, simplex.points[face[3]].w - a);
+            bool flat = cornerSide * cornerSide <= 1e-12f * glm::dot(normal, normal);
+            if (!flat && originSide * cornerSide >= 0.0f)
+            {
+                continue;
+            }
+            Simplex candidate = simplex;
+            float distance = SolveTriangle(candidate, face[0], face[1], face[2]);
+            if (bestDistance < 0.0f || distance < bestDistance)
+            {
+                bestDistance = distance;
+                best = candidate;
+            }
+        }
+        if (bestDistance < 0.0f)
+        {
+            // behind every face: inside
+            return 0.0f;
+        }
+        simplex = best;
+        return bestDistance;
+    }
+    }
+}
+
+/// <summary>
+/// Runs GJK until it knows the distance, finds an overlap, or (with a clearance) finds a gap larger than the clearance.
+/// </summary>
+/// <param name="separatedBeyond">Whether to stop at a gap larger than the clearance</param>
+/// <param name="separated">Receives whether it stopped for that reason</param>
+static GjkResult RunGjk(const ConvexShape& a, const ConvexShape& b, GjkCache* cache, Simplex& simplex,
+    bool separatedBeyond, float clearance, bool& separated)
+{
+    GjkResult result = {};
+    separated = false;
+
+    // start from the cached simplex if there is one, or else from the line between the centers
+    glm::vec3 v = a.center - b.center;
+    int hintA = 0, hintB = 0;
+    simplex.count = 0;
+    float distanceSquared = glm::dot(v, v);
+    if (cache != nullptr && cache->count > 0)
+    {
+        for (int i = 0; i < cache->count; i++)
+        {
+            MinkowskiPoint& point = simplex.points[i];
+            point.a = cache->cornersA[i];
+            point.b = cache->cornersB[i];
+            point.w = a.corners[point.a] - b.corners[point.b];
+        }
+        simplex.count = cache->count;
+        distanceSquared = SolveSimplex(simplex);
+        v = glm::vec3(0.0f);
+        for (int i = 0; i < simplex.count; i++)
+        {
+            v += simplex.points[i].w * simplex.weights[i];
+        }
+        hintA = simplex.points[0].a;
+        hintB = simplex.points[0].b;
+    }
+
+    float clearanceSquared = clearance * clearance;
+    bool overlapping = simplex.count == 4 || distanceSquared <= 0.0f;
+    int iteration = 0;
+    while (!overlapping && iteration < maxGjkIterations)
+    {
+        iteration++;
+        MinkowskiPoint point = GetMinkowskiSupport(a, b, -v, hintA, hintB);
+        hintA = point.a;
+        hintB = point.b;
+
+        // the plane through the new point, facing the origin, bounds the distance from below
+        float vw = glm::dot(v, point.w);
+        if (separatedBeyond && vw > 0.0f && vw * vw > distanceSquared * clearanceSquared)
+        {
+            separated = true;
+            break;
+        }
+        if (simplex.count > 0 && distanceSquared - vw <= gjkTolerance * distanceSquared)
+        {
+            break;
+        }
+
+        // the same point again means no more progress
+        bool repeated = false;
+        for (int i = 0; i < simplex.count; i++)
+        {
+            repeated |= simplex.points[i].a == point.a && simplex.points[i].b == point.b;
+        }
+        if (repeated)
+        {
+            break;
+        }
+
+        simplex.points[simplex.count++] = point;
+        float newDistanceSquared = SolveSimplex(simplex);
+        if (newDistanceSquared <= 0.0f || (simplex.count == 4 && newDistanceSquared == 0.0f))
+        {
+            overlapping = true;
+            break;
+        }
+
+        v = glm::vec3(0.0f);
+        for (int i = 0; i < simplex.count; i++)
+        {
+            v += simplex.points[i].w * simplex.weights[i];
+        }
+        distanceSquared = glm::dot(v, v);
+
+        // touching counts as overlapping (the shapes are about a unit across, or a tenth of that)
+        if (distanceSquared <= 1e-14f)
+        {
+            overlapping = true;
+            break;
+        }
+    }
+
+    if (cache != nullptr)
+    {
+        cache->count = simplex.count;
+        for (int i = 0; i < simplex.count; i++)
+        {
+            cache->cornersA[i] = simplex.points[i].a;
+            cache->cornersB[i] = simplex.points[i].b;
+        }
+    }
+
+    result.iterations = iteration;
+    result.overlapping = overlapping;
+    if (!overlapping && simplex.count > 0)
+    {
+        result.distance = std::sqrt(distanceSquared);
+        result.pointA = glm::vec3(0.0f);
+        result.pointB = glm::vec3(0.0f);
+        for (int i = 0; i < simplex.count; i++)
+        {
+            result.pointA += a.corners[simplex.points[i].a] * simplex.weights[i];
+            result.pointB += b.corners[simplex.points[i].b] * simplex.weights[i];
+        }
+    }
+    return result;
+}
+
+/// <summary>
+/// Computes the distance between two shapes and their closest points with GJK
+/// (the closest point of their Minkowski difference to the origin).
+/// </summary>
+/// <param name="a">First shape</param>
+/// <param name="b">Second shape</param>
+/// <param name="cache">Simplex to start from and to store the last one in, or nullptr</param>
+/// <returns>Whether they overlap, and if not how far apart they are</returns>
+GjkResult GjkDistance(const ConvexShape& a, const ConvexShape& b, GjkCache* cache)
+{
+    Simplex simplex;
+    bool separated;
+    return RunGjk(a, b, cache, simplex, false, 0.0f, separated);
+}
+
+/// <summary>
+/// Returns whether two shapes are further apart than a clearance. Same as GjkDistance(), but stops as soon as
+/// a separating plane shows that the gap is larger than the clearance, which is usually after one or two steps.
+/// </summary>
+/// <param name="a">First shape</param>
+/// <param name="b">Second shape</param>
+/// <param name="clearance">Gap the shapes need to keep (0 for plain overlap tests)</param>
+/// <param name="cache">Simplex to start from and to store the last one in, or nullptr</param>
+/// <returns>Whether the gap between them is larger than the clearance</returns>
+bool GjkSeparated(const ConvexShape& a, const ConvexShape& b, float clearance, GjkCache* cache)
+{
+    Simplex simplex;
+    bool separated;
+    GjkResult result = RunGjk(a, b, cache, simplex, true, clearance, separated);
+    return separated || (!result.overlapping && result.distance > clearance);
+}
+
+/// <summary>
+/// Struct containing a triangle of the EPA polytope, facing away from the origin
+/// </summary>
+struct EpaFace
+{
+    int corners[3];
+    glm::vec3 normal;   // unit
+    float distance;     // of the plane from the origin
+};
+
+/// <summary>
+/// Makes a face of the EPA polytope from three of its corners (counter-clockwise seen from outside).
+/// </summary>
+/// <returns>Whether the face has an area (a face without one has no normal)</returns>
+static bool MakeEpaFace(const MinkowskiPoint* points, int i0, int i1, int i2, EpaFace& face)
+{
+    glm::vec3 normal = glm::cross(points[i1].w - points[i0].w, points[i2].w - points[i0].w);
+    float length = glm::length(normal);
+    if (length <= 1e-12f)
+    {
+        return false;
+    }
+    face.corners[0] = i0;
+    face.corners[1] = i1;
+    face.corners[2] = i2;
+    face.normal = normal / length;
+    face.distance = glm::dot(face.normal, points[i0].w);
+    return true;
+}
+
+/// <summary>
+/// Grows the simplex GJK ended with into a tetrahedron, when the origin was found on a corner, an edge or a face
+/// of it, by adding the furthest points in directions off that corner, edge or face.
+/// </summary>
+/// <returns>Whether it is a tetrahedron with a volume now</returns>
+static bool GrowToTetrahedron(const ConvexShape& a, const ConvexShape& b, Simplex& simplex)
+{
+    const float minimumSpread = 1e-6f * (a.radius + b.radius);
+    static const glm::vec3 axes[6] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+    };
+
+    if (simplex.count == 1)
+    {
+        for (const glm::vec3& axis : axes)
+        {
+            MinkowskiPoint point = GetMinkowskiSupport(a, b, axis, simplex.points[0].a, simplex.points[0].b);
+            if (glm::length(point.w - simplex.points[0].w) > minimumSpread)
+            {
+                simplex.points[simplex.count++] = point;
+                break;
+            }
+        }
+    }
+    if (simplex.count == 2)
+    {
+        // around the edge, 60 degrees at a time
+        glm::vec3 edge = glm::normalize(simplex.points[1].w - simplex.points[0].w);
+        glm::vec3 least = std::abs(edge.x) < 0.57f ? axes[0] : (std::abs(edge.y) < 0.57f ? axes[2] : axes[4]);
+        glm::vec3 side = glm::normalize(glm::cross(edge, least));
+        glm::vec3 up = glm::cross(edge, side);
+        for (int step = 0; step < 6; step++)
+        {
+            float angle = step * 1.04719755f;
+            glm::vec3 direction = side * std::cos(angle) + up * std::sin(angle);
+            MinkowskiPoint point = GetMinkowskiSupport(a, b, direction, simplex.points[0].a, simplex.points[0].b);
+            glm::vec3 offset = point.w - simplex.points[0].w;
+            if (glm::length(offset - edge * glm::dot(offset, edge)) > minimumSpread)
+            {
+                simplex.points[simplex.count++] = point;
+                break;
+            }
+        }
+    }
+    if (simplex.count == 3)
+    {
+        glm::vec3 normal = glm::cross(simplex.points[1].w - simplex.points[0].w, simplex.points[2].w - simplex.points[0].w);
+        if (glm::length(normal) > 0.0f)
+        {
+            normal = glm::normalize(normal);
+            for (float sign : { 1.0f, -1.0f })
+            {
+                MinkowskiPoint point = GetMinkowskiSupport(a, b, normal * sign, simplex.points[0].a, simplex.points[0].b);
+                if (std::abs(glm::dot(point.w - simplex.points[0].w, normal)) > minimumSpread)
+                {
+                    simplex.points[simplex.count++] = point;
+                    break;
+                }
+            }
+        }
+    }
+    return simplex.count == 4;
+}
+
+/// <summary>
+/// Computes how deep two shapes are in each other with EPA, grown out of the simplex GJK ends with
+/// when they overlap.
+/// </summary>
+/// <param name="a">First shape</param>
+/// <param name="b">Second shape</param>
+/// <returns>Whether they overlap, and if so the depth and direction that separates them</returns>
+PenetrationResult EpaPenetration(const ConvexShape& a, const ConvexShape& b)
+{
+    PenetrationResult result = {};
+    Simplex simplex;
+    bool separated;
+    GjkResult gjk = RunGjk(a, b, nullptr, simplex, false, 0.0f, separated);
+    if (!gjk.overlapping)
+    {
+        return result;
+    }
+    result.overlapping = true;
+    result.normal = glm::normalize(b.center - a.center + glm::vec3(0.0f, 0.0f, 1e-20f));
+
+    if (simplex.count == 0 || !GrowToTetrahedron(a, b, simplex))
+    {
+        // all the points found lie in one plane through the origin: the shapes only just touch
+        return result;
+    }
+
+    MinkowskiPoint points[maxEpaCorners];
+    int pointCount = 4;
+    std::copy(simplex.points, simplex.points + 4, points);
+
+    // wind the tetrahedron so that every face is counter-clockwise seen from outside
+    if (glm::dot(glm::cross(points[1].w - points[0].w, points[2].w - points[0].w), points[3].w - points[0].w) > 0.0f)
+    {
+        std::swap(points[1], points[2]);
+    }
+    EpaFace faces[maxEpaFaces];
+    int faceCount = 0;
+    static const int tetrahedronFaces[4][3] = { { 0, 1, 2 }, { 0, 3, 1 }, { 0, 2, 3 }, { 1, 3, 2 } };
+    for (const int* face : tetrahedronFaces)
+    {
+        if (MakeEpaFace(points, face[0], face[1], face[2], faces[faceCount]))
+        {
+            faceCount++;
+        }
+    }
+    if (faceCount < 4)
+    {
+        return result;
+    }
+
+    const float tolerance = epaTolerance * (a.radius + b.radius);
+    int closest = 0;
+    for (int iteration = 0; iteration < maxEpaIterations; iteration++)
+    {
+        closest = 0;
+        for (int face = 1; face < faceCount; face++)
+        {
+            if (faces[face].distance < faces[closest].distance)
+            {
+                closest = face;
+            }
+        }
+
+        // done once the furthest point along the nearest face is (nearly) on it
+        const EpaFace& nearest = faces[closest];
+        MinkowskiPoint point = GetMinkowskiSupport(a, b, nearest.normal,
+            points[nearest.corners[0]].a, points[nearest.corners[0]].b);
+        if (glm::dot(point.w, nearest.normal) - nearest.distance <= tolerance || pointCount == maxEpaCorners)
+        {
+            break;
+        }
+        int newPoint = pointCount++;
+        points[newPoint] = point;
+
+        // take out every face the new point is in front of, and keep the edges around the hole they leave
+        // (an edge shared by two removed faces shows up once in each direction, and cancels out)
+        int horizon[maxEpaHorizon][2];
+        int horizonCount = 0;
+        bool overflow = false;
+        for (int face = 0; face < faceCount;)
+        {
+            if (glm::dot(faces[face].normal, point.w - points[faces[face].corners[0]].w) <= 0.0f)
+            {
+                face++;
+                continue;
+            }
+            for (int k = 0; k < 3; k++)
+            {
+                int from = faces[face].corners[k];
+                int to = faces[face].corners[(k + 1) % 3];
+                int reverse = -1;
+                for (int e = 0; e < horizonCount; e++)
+                {
+                    if (horizon[e][0] == to && horizon[e][1] == from)
+                    {
+                        reverse = e;
+                    }
+                }
+                if (reverse >= 0)
+                {
+                    horizon[reverse][0] = horizon[horizonCount - 1][0];
+                    horizon[reverse][1] = horizon[horizonCount - 1][1];
+                    horizonCount--;
+                }
+                else if (horizonCount < maxEpaHorizon)
+                {
+                    horizon[horizonCount][0] = from;
+                    horizon[horizonCount][1] = to;
+                    horizonCount++;
+                }
+                else
+                {
+                    overflow = true;
+                }
+            }
+            faces[face] = faces[--faceCount];
+        }
+
+        // close the hole with a fan of faces around the new point
+        for (int e = 0; e < horizonCount && !overflow; e++)
+        {
+            if (faceCount == maxEpaFaces)
+            {
+                overflow = true;
+                break;
+            }
+            if (MakeEpaFace(points, horizon[e][0], horizon[e][1], newPoint, faces[faceCount]))
+            {
+                faceCount++;
+            }
+        }
+        if (overflow || faceCount == 0)
+        {
+            // out of room: the polytope has holes now, so stop with what the last good step found
+            return result;
+        }
+    }
+
+    const EpaFace& face = faces[closest];
+    result.depth = std::max(face.distance, 0.0f);
+    result.normal = face.normal;
+
+    // where the origin's projection lies on that face gives the deepest points of both shapes
+    const glm::vec3& p0 = points[face.corners[0]].w;
+    const glm::vec3& p1 = points[face.corners[1]].w;
+    const glm::vec3& p2 = points[face.corners[2]].w;
+    glm::vec3 projection = face.normal * face.distance;
+    glm::vec3 e0 = p1 - p0, e1 = p2 - p0, e2 = projection - p0;
+    float d00 = glm::dot(e0, e0), d01 = glm::dot(e0, e1), d11 = glm::dot(e1, e1);
+    float d20 = glm::dot(e2, e0), d21 = glm::dot(e2, e1);
+    float denominator = d00 * d11 - d01 * d01;
+    float v = denominator != 0.0f ? (d11 * d20 - d01 * d21) / denominator : 0.0f;
+    float w = denominator != 0.0f ? (d00 * d21 - d01 * d20) / denominator : 0.0f;
+    float u = 1.0f - v - w;
+    result.pointA = a.corners[points[face.corners[0]].a] * u + a.corners[points[face.corners[1]].a] * v
+        + a.corners[points[face.corners[2]].a] * w;
+    result.pointB = b.corners[points[face.corners[0]].b] * u + b.corners[points[face.corners[1]].b] * v
+        + b.corners[points[face.corners[2]].b] * w;
+    return result;
+}
+
+/// <summary>
+/// Same question as EpaPenetration(), answered by projecting both shapes onto every face normal and every
+/// cross product of two edges (the separating axis test). Slow, but exact, so it is used as a reference.
+/// </summary>
+/// <param name="a">First shape</param>
+/// <param name="b">Second shape</param>
+/// <param name="normal">Receives the axis with the least overlap (or the largest gap), pointing from a to b</param>
+/// <returns>The largest gap along any axis: negative when they overlap, by the penetration depth</returns>
+float GetSatSeparation(const ConvexShape& a, const ConvexShape& b, glm::vec3& normal)
+{
+    float best = -1e30f;
+    normal = glm::vec3(0.0f, 1.0f, 0.0f);
+
+    auto testAxis = [&](glm::vec3 axis)
+    {
+        float length = glm::length(axis);
+        if (length <= 1e-6f)
+        {
+            return;
+        }
+        axis /= length;
+        float minA = 1e30f, maxA = -1e30f, minB = 1e30f, maxB = -1e30f;
+        for (size_t corner = 0; corner < a.hull->corners.size(); corner++)
+        {
+            float distance = glm::dot(a.corners[corner], axis);
+            minA = std::min(minA, distance);
+            maxA = std::max(maxA, distance);
+        }
+        for (size_t corner = 0; corner < b.hull->corners.size(); corner++)
+        {
+            float distance = glm::dot(b.corners[corner], axis);
+            minB = std::min(minB, distance);
+            maxB = std::max(maxB, distance);
+        }
+        // the gap on the side b is on, or the other side (with the axis flipped)
+        float forward = minB - maxA;
+        float backward = minA - maxB;
+        if (forward > best)
+        {
+            best = forward;
+            normal = axis;
+        }
+        if (backward > best)
+        {
+            best = backward;
+            normal = -axis;
+        }
+    };
+
+    for (const ConvexShape* shape : { &a, &b })
+    {
+        const std::vector<int>& faces = shape->hull->faces;
+        for (size_t face = 0; face + 2 < faces.size(); face += 3)
+        {
+            testAxis(glm::cross(shape->corners[faces[face + 1]] - shape->corners[faces[face]],
+                shape->corners[faces[face + 2]] - shape->corners[faces[face]]));
+        }
+    }
+
+    const ConvexHull& hullA = *a.hull;
+    const ConvexHull& hullB = *b.hull;
+    for (size_t i = 0; i < hullA.corners.size(); i++)
+    {
+        for (int n = hullA.neighborStart[i]; n < hullA.neighborStart[i + 1]; n++)
+        {
+            if (hullA.neighbors[n] < static_cast<int>(i))
+            {
+                continue;
+            }
+            glm::vec3 edgeA = a.corners[hullA.neighbors[n]] - a.corners[i];
+            for (size_t j = 0; j < hullB.corners.size(); j++)
+            {
+                for (int m = hullB.neighborStart[j]; m < hullB.neighborStart[j + 1]; m++)
+                {
+                    if (hullB.neighbors[m] < static_cast<int>(j))
+                    {
+                        continue;
+                    }
+                    testAxis(glm::cross(edgeA, b.corners[hullB.neighbors[m]] - b.corners[j]));
+                }
+            }
+        }
+    }
+    return best;
+}
+
+/// <summary>
+/// Measures GJK (overlap tests and distances, with and without a warm start), EPA and the separating axis test
+/// on pairs of d20s placed about as close as they can be without their insides touching, checks that GJK and EPA
+/// agree with the separating axis test, and prints the result.
+/// </summary>
+/// <param name="pairCount">Number of pairs</param>
+void RunConvexQueryBenchmark(int pairCount)
+{
+    pairCount = std::max(pairCount, 1);
+    const ConvexHull& hull = GetD20Hull();
+
+    // The second die of every pair sits somewhere between the distance where the inspheres touch (closer always
+    // overlaps) and where the circumspheres touch (further never does): the pairs a sphere test cannot settle.
+    std::mt19937 random(50);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> band(2.0f * hull.inradius, 2.0f * hull.circumradius);
+    auto randomRotation = [&]()
+    {
+        glm::quat rotation(unit(random), unit(random), unit(random), unit(random));
+        return glm::normalize(rotation);
+    };
+    std::vector<std::pair<ConvexShape, ConvexShape>> pairs;
+    pairs.reserve(pairCount);
+    for (int i = 0; i < pairCount; i++)
+    {
+        glm::vec3 direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+        glm::vec3 position = direction * band(random);
+        pairs.push_back({ PlaceConvexShape(hull, glm::vec3(0.0f), randomRotation(), 1.0f),
+            PlaceConvexShape(hull, position, randomRotation(), 1.0f) });
+    }
+
+    using Clock = std::chrono::steady_clock;
+    auto nsPerQuery = [&](Clock::time_point start, size_t count)
+    {
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / std::max<size_t>(count, 1);
+    };
+
+    // overlap tests (what the spawner does), then distances, then the same distances from the simplex they ended with
+    size_t overlapping = 0;
+    auto start = Clock::now();
+    for (const auto& pair : pairs)
+    {
+        overlapping += GjkSeparated(pair.first, pair.second, 0.0f) ? 0 : 1;
+    }
+    double separatedNs = nsPerQuery(start, pairs.size());
+
+    std::vector<GjkCache> caches(pairs.size());
+    std::vector<GjkResult> distances(pairs.size());
+    size_t coldIterations = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < pairs.size(); i++)
+    {
+        distances[i] = GjkDistance(pairs[i].first, pairs[i].second, &caches[i]);
+        coldIterations += distances[i].iterations;
+    }
+    double distanceNs = nsPerQuery(start, pairs.size());
+
+    size_t warmIterations = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < pairs.size(); i++)
+    {
+        warmIterations += GjkDistance(pairs[i].first, pairs[i].second, &caches[i]).iterations;
+    }
+    double warmNs = nsPerQuery(start, pairs.size());
+
+    std::vector<PenetrationResult> penetrations(pairs.size());
+    start = Clock::now();
+    for (size_t i = 0; i < pairs.size(); i++)
+    {
+        if (distances[i].overlapping)
+        {
+            penetrations[i] = EpaPenetration(pairs[i].first, pairs[i].second);
+        }
+    }
+    double epaNs = nsPerQuery(start, overlapping);
+
+    std::vector<float> satSeparations(pairs.size());
+    start = Clock::now();
+    for (size_t i = 0; i < pairs.size(); i++)
+    {
+        glm::vec3 normal;
+        satSeparations[i] = GetSatSeparation(pairs[i].first, pairs[i].second, normal);
+    }
+    double satNs = nsPerQuery(start, pairs.size());
+
+    // GJK against the separating axis test: the overlap answer (pairs that just touch are left out),
+    // the gaps (the separating axis test only gives a lower bound for those), and the depths
+    const float touching = 1e-4f;
+    size_t overlapMismatches = 0, gapMismatches = 0, depthMismatches = 0;
+    float largestDepthError = 0.0f;
+    for (size_t i = 0; i < pairs.size(); i++)
+    {
+        float sat = satSeparations[i];
+        if (std::abs(sat) > touching && distances[i].overlapping != (sat < 0.0f))
+        {
+            overlapMismatches++;
+        }
+        if (!distances[i].overlapping && distances[i].distance < sat - touching)
+        {
+            gapMismatches++;
+        }
+        if (distances[i].overlapping && sat < -touching)
+        {
+            float error = std::abs(penetrations[i].depth + sat);
+            largestDepthError = std::max(largestDepthError, error);
+            depthMismatches += error > 1e-3f ? 1 : 0;
+        }
+    }
+
+    std::cout << "convex query benchmark: " << pairs.size() << " pairs of unit d20s, " << overlapping << " overlapping" << std::endl;
+    std::cout << "  GJK overlap test: " << separatedNs << " ns per pair (" << 1000.0 / separatedNs << " million per second)" << std::endl;
+    std::cout << "  GJK distance: " << distanceNs << " ns per pair, " << double(coldIterations) / pairs.size()
+        << " steps; from the cached simplex " << warmNs << " ns, " << double(warmIterations) / pairs.size() << " steps" << std::endl;
+    std::cout << "  EPA: " << epaNs << " ns per overlapping pair" << std::endl;
+    std::cout << "  separating axis test: " << satNs << " ns per pair" << std::endl;
+    std::cout << "  against the separating axis test: " << overlapMismatches << " overlap answers differ, "
+        << gapMismatches << " distances too small, " << depthMismatches << " depths differ (largest error "
+        << largestDepthError << ")" << std::endl;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <vector>
+
+// most corners a placed shape keeps (the d20 has 12), so that a ConvexShape needs no heap memory
+const int maxConvexCorners = 16;
+
+/// <summary>
+/// Struct containing a convex polyhedron in model space: its corners, its triangles (counter-clockwise seen from
+/// outside), and which corners share an edge, so that the support function can walk from corner to corner
+/// instead of looking at all of them
+/// </summary>
+struct ConvexHull
+{
+    std::vector<glm::vec3> corners;
+    std::vector<int> faces;             // three corners per triangle
+    std::vector<int> neighborStart;     // the neighbors of corner i are neighbors[neighborStart[i]] to neighbors[neighborStart[i + 1]]
+    std::vector<int> neighbors;
+    float circumradius = 0.0f;          // radius of the smallest sphere around the origin containing every corner
+    float inradius = 0.0f;              // radius of the largest sphere around the origin inside every face
+};
+
+/// <summary>
+/// Builds a hull from its corners and triangles. The origin has to be inside it.
+/// </summary>
+/// <param name="corners">Corners in model space (at most maxConvexCorners)</param>
+/// <param name="cornerCount">Number of corners</param>
+/// <param name="faces">Three corner indices per triangle, counter-clockwise seen from outside</param>
+/// <param name="faceCount">Number of triangles</param>
+/// <returns>The hull with its edges and spheres</returns>
+ConvexHull BuildConvexHull(const glm::vec3* corners, int cornerCount, const int (*faces)[3], int faceCount);
+
+/// <summary>
+/// Returns the hull of the d20 (built once, from GetD20Corner() and d20FaceIndices).
+/// </summary>
+const ConvexHull& GetD20Hull();
+
+/// <summary>
+/// Struct containing a hull placed in the world. The corners are transformed once when it is placed,
+/// so every support query on it after that is only dot products (the cache the queries below rely on).
+/// </summary>
+struct ConvexShape
+{
+    const ConvexHull* hull;
+    glm::vec3 center;       // where the origin of the hull ended up
+    float radius;           // circumradius, scaled
+    float inradius;         // inradius, scaled
+    glm::vec3 corners[maxConvexCorners];
+};
+
+/// <summary>
+/// Places a hull in the world.
+/// </summary>
+/// <param name="hull">Hull to place, has to outlive the shape</param>
+/// <param name="position">Position of its origin</param>
+/// <param name="rotation">Rotation (unit quaternion)</param>
+/// <param name="scale">Uniform scale</param>
+/// <returns>The placed shape</returns>
+ConvexShape PlaceConvexShape(const ConvexHull& hull, const glm::vec3& position, const glm::quat& rotation, float scale);
+
+/// <summary>
+/// Returns the corner of a shape furthest along a direction, walking from a starting corner to whichever neighbor
+/// is further along until none is (on a convex shape that is the furthest corner of all).
+/// Starting from the corner found for a nearby direction, as GJK and EPA do from one step to the next, it takes
+/// one or two steps.
+/// </summary>
+/// <param name="shape">Shape to search</param>
+/// <param name="direction">Direction (does not need to be normalized)</param>
+/// <param name="start">Corner to start from</param>
+/// <returns>Index of the furthest corner</returns>
+int GetSupportCorner(const ConvexShape& shape, const glm::vec3& direction, int start);
+
+/// <summary>
+/// Struct containing the corners of the last simplex GJK ended with for a pair of shapes. Handing it to the next query
+/// on the same pair (after they moved a little) starts from there, which usually leaves one or two steps to do.
+/// </summary>
+struct GjkCache
+{
+    int cornersA[4];
+    int cornersB[4];
+    int count = 0;
+};
+
+/// <summary>
+/// Struct containing what GJK found out about a pair of shapes
+/// </summary>
+struct GjkResult
+{
+    bool overlapping;
+    float distance;         // 0 when overlapping
+    glm::vec3 pointA;       // closest point on the first shape (when not overlapping)
+    glm::vec3 pointB;       // closest point on the second shape (when not overlapping)
+    int iterations;
+};
+
+/// <summary>
+/// Struct containing how deep two overlapping shapes are in each other
+/// </summary>
+struct PenetrationResult
+{
+    bool overlapping;
+    float depth;            // how far the second shape has to move along the normal to only touch the first one
+    glm::vec3 normal;       // unit direction from the first shape into the second
+    glm::vec3 pointA;       // deepest point of the first shape inside the second
+    glm::vec3 pointB;       // deepest point of the second shape inside the first
+};
+
+/// <summary>
+/// Computes the distance between two shapes and their closest points with GJK
+/// (the closest point of their Minkowski difference to the origin).
+/// </summary>
+/// <param name="a">First shape</param>
+/// <param name="b">Second shape</param>
+/// <param name="cache">Simplex to start from and to store the last one in, or nullptr</param>
+/// <returns>Whether they overlap, and if not how far apart they are</returns>
+GjkResult GjkDistance(const ConvexShape& a, const ConvexShape& b, GjkCache* cache = nullptr);
+
+/// <summary>
+/// Returns whether two shapes are further apart than a clearance. Same as GjkDistance(), but stops as soon as
+/// a separating plane shows that the gap is larger than the clearance, which is usually after one or two steps.
+/// </summary>
+/// <param name="a">First shape</param>
+/// <param name="b">Second shape</param>
+/// <param name="clearance">Gap the shapes need to keep (0 for plain overlap tests)</param>
+/// <param name="cache">Simplex to start from and to store the last one in, or nullptr</param>
+/// <returns>Whether the gap between them is larger than the clearance</returns>
+bool GjkSeparated(const ConvexShape& a, const ConvexShape& b, float clearance, GjkCache* cache = nullptr);
+
+/// <summary>
+/// Computes how deep two shapes are in each other with EPA, grown out of the simplex GJK ends with
+/// when they overlap.
+/// </summary>
+/// <param name="a">First shape</param>
+/// <param name="b">Second shape</param>
+/// <returns>Whether they overlap, and if so the depth and direction that separates them</returns>
+PenetrationResult EpaPenetration(const ConvexShape& a, const ConvexShape& b);
+
+/// <summary>
+/// Same question as EpaPenetration(), answered by projecting both shapes onto every face normal and every
+/// cross product of two edges (the separating axis test). Slow, but exact, so it is used as a reference.
+/// </summary>
+/// <param name="a">First shape</param>
+/// <param name="b">Second shape</param>
+/// <param name="normal">Receives the axis with the least overlap (or the largest gap), pointing from a to b</param>
+/// <returns>The largest gap along any axis: negative when they overlap, by the penetration depth</returns>
+float GetSatSeparation(const ConvexShape& a, const ConvexShape& b, glm::vec3& normal);
+
+/// <summary>
+/// Measures GJK (overlap tests and distances, with and without a warm start), EPA and the separating axis test
+/// on pairs of d20s placed about as close as they can be without their insides touching, checks that GJK and EPA
+/// agree with the separating axis test, and prints the result.
+/// </summary>
+/// <param name="pairCount">Number of pairs</param>
+void RunConvexQueryBenchmark(int pairCount);
@@ -0,0 +1,6 @@
+#pragma once
+
+/// <summary>
+/// Returns the CPU time (user + system) used by every thread of the process so far, in seconds.
+/// </summary>
+double GetProcessCpuSeconds();
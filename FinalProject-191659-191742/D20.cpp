@@ -0,0 +1,224 @@
+#include "D20.h"
+#include "SdfAtlas.h"
+
+#include <cmath>
+
+const float golden = ((1 + std::sqrt(5.0f)) / 2) / 2; // for icosahedron formula
+
+// every triangle is listed the same way it was drawn by hand:
+// 5 triangles around v0 (top), 5 triangles around v6 (bottom), then the 10 in the middle band
+const int d20FaceIndices[d20FaceCount][3] = {
+    { 0, 1, 2 }, { 0, 2, 3 }, { 0, 3, 4 }, { 0, 4, 5 }, { 0, 5, 1 },
+    { 6, 7, 8 }, { 6, 8, 9 }, { 6, 9, 10 }, { 6, 10, 11 }, { 6, 11, 7 },
+    { 1, 8, 2 }, { 2, 8, 7 }, { 2, 7, 3 }, { 3, 7, 11 }, { 3, 11, 4 },
+    { 4, 11, 10 }, { 4, 10, 5 }, { 5, 10, 9 }, { 5, 9, 1 }, { 1, 9, 8 }
+};
+
+// t0 - 18 on the die, t1 - 4 on the die, and so on
+const int d20FaceNumbers[d20FaceCount] = {
+    18, 4, 11, 13, 5,
+    8, 10, 17, 3, 16,
+    2, 20, 14, 6, 9,
+    19, 1, 7, 15, 12
+};
+
+/// <summary>
+/// Returns one of the 12 corners of the d20.
+/// </summary>
+/// <param name="index">Corner index, from 0 to 11</param>
+/// <returns>Position of the corner in model space</returns>
+glm::vec3 GetD20Corner(int index)
+{
+    // initial 12 vertices of the d20 using golden ratio value cut in half
+    switch (index)
+    {
+    case 0: return glm::vec3(0.0f, -golden, 0.5f);
+    case 1: return glm::vec3(-golden, -0.5f, 0.0f);
+    case 2: return glm::vec3(0.0f, -golden, -0.5f);
+    case 3: return glm::vec3(golden, -0.5f, 0.0f);
+    case 4: return glm::vec3(0.5f, 0.0f, golden);
+    case 5: return glm::vec3(-0.5f, 0.0f, golden);
+    case 6: return glm::vec3(0.0f, golden, -0.5f);
+    case 7: return glm::vec3(0.5f, 0.0f, -golden);
+    case 8: return glm::vec3(-0.5f, 0.0f, -golden);
+    case 9: return glm::vec3(-golden, 0.5f, 0.0f);
+    case 10: return glm::vec3(0.0f, golden, 0.5f);
+    default: return glm::vec3(golden, 0.5f, 0.0f);
+    }
+}
+
+/// <summary>
+/// Returns the (unnormalized) outward normal of one of the 20 triangles of the d20.
+/// </summary>
+/// <param name="face">Face index, from 0 to 19</param>
+/// <returns>Cross product of the edges of the triangle</returns>
+glm::vec3 GetD20FaceNormal(int face)
+{
+    glm::vec3 a = GetD20Corner(d20FaceIndices[face][0]);
+    glm::vec3 b = GetD20Corner(d20FaceIndices[face][1]);
+    glm::vec3 c = GetD20Corner(d20FaceIndices[face][2]);
+
+    // calculating normals using the cross function per triangle on the d20
+    return glm::cross((a - b), (b - c));
+}
+
+/// <summary>
+/// Struct containing the unit normal of every face of the d20 and the three faces that share an edge with it
+/// </summary>
+struct D20FaceTable
+{
+    glm::vec3 normals[d20FaceCount];
+    int neighbors[d20FaceCount][3];
+
+    D20FaceTable()
+    {
+        for (int face = 0; face < d20FaceCount; face++)
+        {
+            normals[face] = glm::normalize(GetD20FaceNormal(face));
+
+            // two faces share an edge when they share two corners
+            int found = 0;
+            for (int other = 0; other < d20FaceCount && found < 3; other++)
+            {
+                int shared = 0;
+                for (int a = 0; a < 3; a++)
+                {
+                    for (int b = 0; b < 3; b++)
+                    {
+                        shared += d20FaceIndices[face][a] == d20FaceIndices[other][b] ? 1 : 0;
+                    }
+                }
+                if (other != face && shared == 2)
+                {
+                    neighbors[face][found++] = other;
+                }
+            }
+        }
+    }
+};
+
+/// <summary>
+/// Returns the face table, built the first time it is needed.
+/// </summary>
+static const D20FaceTable& GetD20FaceTable()
+{
+    static const D20FaceTable table;
+    return table;
+}
+
+/// <summary>
+/// Returns which way is up (+y of the die's parent) in the die's own space, for a die with the given rotation.
+/// </summary>
+/// <param name="x">x of the rotation (unit quaternion)</param>
+/// <param name="y">y of the rotation</param>
+/// <param name="z">z of the rotation</param>
+/// <param name="w">w of the rotation</param>
+/// <returns>Unit up vector in model space</returns>
+glm::vec3 GetD20Up(float x, float y, float z, float w)
+{
+    // (0, 1, 0) rotated by the inverse (conjugate) rotation
+    glm::vec3 u = glm::vec3(-x, -y, -z);
+    glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+    return up + 2.0f * glm::cross(u, glm::cross(u, up) + w * up);
+}
+
+/// <summary>
+/// Returns the face of the d20 that points up the most, i.e. the face showing the number rolled.
+/// </summary>
+/// <param name="up">Up vector in model space (see GetD20Up())</param>
+/// <param name="guess">Face to start the search from, such as the face that was on top the frame before</param>
+/// <returns>Face index, from 0 to 19 (d20FaceNumbers gives the number on it)</returns>
+int GetD20TopFace(const glm::vec3& up, int guess)
+{
+    // All faces are as far from the center as each other, so the top face is the one the up direction passes through,
+    // and moving to a neighbor that points up more always ends up there: starting from a good guess, usually only
+    // its three neighbors have to be looked at.
+    const D20FaceTable& table = GetD20FaceTable();
+    int top = guess;
+    float topDot = glm::dot(table.normals[top], up);
+    for (bool moved = true; moved;)
+    {
+        moved = false;
+        for (int neighbor : table.neighbors[top])
+        {
+            float d = glm::dot(table.normals[neighbor], up);
+            if (d > topDot)
+            {
+                topDot = d;
+                top = neighbor;
+                moved = true;
+                break;
+            }
+        }
+    }
+    return top;
+}
+
+/// <summary>
+/// Fills in the 60 vertices (20 triangles) of the d20, with flat normals and
+/// UV coordinates pointing into the numeral atlas.
+/// </summary>
+/// <param name="vertices">Array of 60 vertices to fill in</param>
+void BuildD20Vertices(Vertex vertices[d20VertexCount])
+{
+    for (int face = 0; face < d20FaceCount; face++)
+    {
+        glm::vec3 normal = GetD20FaceNormal(face);
+
+        for (int corner = 0; corner < 3; corner++)
+        {
+            Vertex& vertex = vertices[face * 3 + corner];
+            glm::vec3 position = GetD20Corner(d20FaceIndices[face][corner]);
+            glm::vec2 uv = GetNumeralTriangleUV(d20FaceNumbers[face], corner);
+
+            vertex.x = position.x;
+            vertex.y = position.y;
+            vertex.z = position.z;
+            vertex.r = 255;
+            vertex.g = 255;
+            vertex.b = 255;
+            vertex.u = uv.x;
+            vertex.v = uv.y;
+            vertex.nx = normal.x;
+            vertex.ny = normal.y;
+            vertex.nz = normal.z;
+        }
+    }
+}
+
+/// <summary>
+/// Counts the triangles of an indexed mesh that are not counter-clockwise seen from the side their vertex normals
+/// point to. Back-face culling drops exactly those triangles when they face the camera.
+/// Triangles with no area are not counted.
+/// </summary>
+/// <param name="vertices">Vertices the indices point into</param>
+/// <param name="indices">Three indices per triangle</param>
+/// <param name="indexCount">Number of indices</param>
+/// <returns>Number of triangles wound the wrong way</returns>
+size_t CountMiswoundTriangles(const Vertex* vertices, const GLushort* indices, size_t indexCount)
+{
+    size_t miswound = 0;
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        const Vertex& a = vertices[indices[i]];
+        const Vertex& b = vertices[indices[i + 1]];
+        const Vertex& c = vertices[indices[i + 2]];
+        glm::vec3 pa = glm::vec3(a.x, a.y, a.z);
+        glm::vec3 pb = glm::vec3(b.x, b.y, b.z);
+        glm::vec3 pc = glm::vec3(c.x, c.y, c.z);
+
+        // the winding gives the front of the triangle (counter-clockwise, like OpenGL's default glFrontFace),
+        // the vertex normals say which side is meant to be the outside
+        glm::vec3 windingNormal = glm::cross(pb - pa, pc - pa);
+        glm::vec3 vertexNormal = glm::vec3(a.nx + b.nx + c.nx, a.ny + b.ny + c.ny, a.nz + b.nz + c.nz);
+        if (glm::dot(windingNormal, windingNormal) < 1e-14f)
+        {
+            continue;
+        }
+        if (glm::dot(windingNormal, vertexNormal) <= 0.0f)
+        {
+            miswound++;
+        }
+    }
+    return miswound;
+}
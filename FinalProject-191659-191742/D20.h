@@ -0,0 +1,81 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+/// <summary>
+/// Struct containing data about a vertex
+/// </summary>
+struct Vertex
+{
+    GLfloat x, y, z;    // Position
+    GLubyte r, g, b;    // Color
+    GLfloat u, v;        // UV coordinates
+    GLfloat nx, ny, nz; // normal vector
+};
+
+// number of corners, faces and drawn vertices of the icosahedron
+const int d20CornerCount = 12;
+const int d20FaceCount = 20;
+const int d20VertexCount = 60;
+
+// golden ratio value cut in half, used by the icosahedron formula
+extern const float golden;
+
+// indices into the 12 corners for each of the 20 triangles, in counter-clockwise order
+extern const int d20FaceIndices[d20FaceCount][3];
+
+// number printed on each of the 20 triangles
+extern const int d20FaceNumbers[d20FaceCount];
+
+/// <summary>
+/// Returns one of the 12 corners of the d20.
+/// </summary>
+/// <param name="index">Corner index, from 0 to 11</param>
+/// <returns>Position of the corner in model space</returns>
+glm::vec3 GetD20Corner(int index);
+
+/// <summary>
+/// Returns the (unnormalized) outward normal of one of the 20 triangles of the d20.
+/// </summary>
+/// <param name="face">Face index, from 0 to 19</param>
+/// <returns>Cross product of the edges of the triangle</returns>
+glm::vec3 GetD20FaceNormal(int face);
+
+/// <summary>
+/// Returns which way is up (+y of the die's parent) in the die's own space, for a die with the given rotation.
+/// </summary>
+/// <param name="x">x of the rotation (unit quaternion)</param>
+/// <param name="y">y of the rotation</param>
+/// <param name="z">z of the rotation</param>
+/// <param name="w">w of the rotation</param>
+/// <returns>Unit up vector in model space</returns>
+glm::vec3 GetD20Up(float x, float y, float z, float w);
+
+/// <summary>
+/// Returns the face of the d20 that points up the most, i.e. the face showing the number rolled.
+/// </summary>
+/// <param name="up">Up vector in model space (see GetD20Up())</param>
+/// <param name="guess">Face to start the search from, such as the face that was on top the frame before</param>
+/// <returns>Face index, from 0 to 19 (d20FaceNumbers gives the number on it)</returns>
+int GetD20TopFace(const glm::vec3& up, int guess = 0);
+
+/// <summary>
+/// Fills in the 60 vertices (20 triangles) of the d20, with flat normals and
+/// UV coordinates pointing into the numeral atlas.
+/// </summary>
+/// <param name="vertices">Array of 60 vertices to fill in</param>
+void BuildD20Vertices(Vertex vertices[d20VertexCount]);
+
+/// <summary>
+/// Counts the triangles of an indexed mesh that are not counter-clockwise seen from the side their vertex normals
+/// point to. Back-face culling drops exactly those triangles when they face the camera.
+/// Triangles with no area are not counted.
+/// </summary>
+/// <param name="vertices">Vertices the indices point into</param>
+/// <param name="indices">Three indices per triangle</param>
+/// <param name="indexCount">Number of indices</param>
+/// <returns>Number of triangles wound the wrong way</returns>
+size_t CountMiswoundTriangles(const Vertex* vertices, const GLushort* indices, size_t indexCount);
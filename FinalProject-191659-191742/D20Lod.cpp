@@ -0,0 +1,294 @@
+#include "D20Lod.h"
+#include "SdfAtlas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+const int d20LodSubdivisions[d20LodCount] = { 16, 8, 4, 1 };
+const float d20LodPixelRadius[d20LodCount] = { 60.0f, 25.0f, 10.0f, 0.0f };
+
+/// <summary>
+/// Returns the point of triangle abc closest to p.
+/// </summary>
+static glm::vec3 ClosestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+    // walk the corner, edge and face regions of the triangle in turn (Ericson, Real-Time Collision Detection 5.1.5)
+    glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+    {
+        return a;
+    }
+
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3)
+    {
+        return b;
+    }
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    {
+        return a + ab * (d1 / (d1 - d3));
+    }
+
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6)
+    {
+        return c;
+    }
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+    {
+        return a + ac * (d2 / (d2 - d6));
+    }
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+    {
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    }
+
+    float denominator = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+/// <summary>
+/// Appends one face of the d20, split into a grid of subdivisions x subdivisions small triangles.
+/// </summary>
+/// <param name="face">Face index, from 0 to 19</param>
+/// <param name="subdivisions">How many times each edge is split</param>
+/// <param name="bevelRadius">Radius of the rounded edges</param>
+/// <param name="innerScale">Scale of the icosahedron the rounded surface keeps its distance from</param>
+/// <param name="mesh">Mesh to append to</param>
+/// <param name="baseVertex">First vertex of the level (indices are relative to it)</param>
+static void AddRoundedFace(int face, int subdivisions, float bevelRadius, float innerScale, D20LodMesh& mesh, size_t baseVertex)
+{
+    glm::vec3 corners[3];
+    glm::vec2 uvs[3];
+    for (int corner = 0; corner < 3; corner++)
+    {
+        corners[corner] = GetD20Corner(d20FaceIndices[face][corner]);
+        uvs[corner] = GetNumeralTriangleUV(d20FaceNumbers[face], corner);
+    }
+    glm::vec3 faceNormal = glm::normalize(GetD20FaceNormal(face));
+
+    size_t firstVertex = mesh.vertices.size() - baseVertex;
+    int n = subdivisions;
+
+    // vertex (i, j) sits i steps from the first corner towards the second, and j steps towards the third
+    for (int i = 0; i <= n; i++)
+    {
+        for (int j = 0; j <= n - i; j++)
+        {
+            float u = static_cast<float>(i) / n;
+            float v = static_cast<float>(j) / n;
+            glm::vec3 flat = corners[0] + (corners[1] - corners[0]) * u + (corners[2] - corners[0]) * v;
+            glm::vec2 uv = uvs[0] + (uvs[1] - uvs[0]) * u + (uvs[2] - uvs[0]) * v;
+
+            // pull the point onto the surface bevelRadius away from the inner icosahedron:
+            // in the middle of a face that leaves it where it is, near an edge or corner it rolls it around
+            glm::vec3 position = flat;
+            glm::vec3 normal = faceNormal;
+            if (bevelRadius > 0.0f)
+            {
+                glm::vec3 closest;
+                float closestDistance = 1e30f;
+                for (int innerFace = 0; innerFace < d20FaceCount; innerFace++)
+                {
+                    glm::vec3 candidate = ClosestPointOnTriangle(flat,
+                        GetD20Corner(d20FaceIndices[innerFace][0]) * innerScale,
+                        GetD20Corner(d20FaceIndices[innerFace][1]) * innerScale,
+                        GetD20Corner(d20FaceIndices[innerFace][2]) * innerScale);
+                    float distance = glm::length(flat - candidate);
+                    if (distance < closestDistance)
+                    {
+                        closestDistance = distance;
+                        closest = candidate;
+                    }
+                }
+
+                normal = (flat - closest) * (1.0f / closestDistance);
+                position = closest + normal * bevelRadius;
+            }
+
+            Vertex vertex;
+            vertex.x = position.x;
+            vertex.y = position.y;
+            vertex.z = position.z;
+            vertex.r = 255;
+            vertex.g = 255;
+            vertex.b = 255;
+            vertex.u = uv.x;
+            vertex.v = uv.y;
+            vertex.nx = normal.x;
+            vertex.ny = normal.y;
+            vertex.nz = normal.z;
+            mesh.vertices.push_back(vertex);
+        }
+    }
+
+    // rows get one vertex shorter every step, so row i starts after the (n + 1) + n + ... vertices before it
+    auto index = [&](int i, int j) {
+        return static_cast<GLushort>(firstVertex + i * (n + 1) - i * (i - 1) / 2 + j);
+    };
+
+    // same winding as the face itself: counter-clockwise seen from outside
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n - i; j++)
+        {
+            mesh.indices.push_back(index(i, j));
+            mesh.indices.push_back(index(i + 1, j));
+            mesh.indices.push_back(index(i, j + 1));
+
+            if (i + j < n - 1)
+            {
+                mesh.indices.push_back(index(i + 1, j));
+                mesh.indices.push_back(index(i + 1, j + 1));
+                mesh.indices.push_back(index(i, j + 1));
+            }
+        }
+    }
+}
+
+/// <summary>
+/// Builds all the detail levels of the d20. Every face is split into a grid of small triangles,
+/// and the edges and corners are rounded off by pulling the grid onto a surface that keeps a fixed distance
+/// from a slightly smaller icosahedron (flat on the faces, cylinders along the edges, spheres at the corners).
+/// </summary>
+/// <param name="bevelRadius">Radius of the rounded edges (the edges of the d20 are 1 long)</param>
+/// <returns>The packed detail levels</returns>
+D20LodMesh BuildD20LodMesh(float bevelRadius)
+{
+    D20LodMesh mesh;
+
+    // the faces of the inner icosahedron sit bevelRadius inside the real ones, so the flat middle of every face
+    // stays exactly where it was and the numerals keep their size
+    float inradius = glm::dot(glm::normalize(GetD20FaceNormal(0)), GetD20Corner(d20FaceIndices[0][0]));
+    float innerScale = (inradius - bevelRadius) / inradius;
+
+    for (int lod = 0; lod < d20LodCount; lod++)
+    {
+        D20LodRange& range = mesh.lods[lod];
+        range.baseVertex = static_cast<GLint>(mesh.vertices.size());
+        range.firstIndex = static_cast<GLsizei>(mesh.indices.size());
+
+        if (d20LodSubdivisions[lod] == 1)
+        {
+            // the lowest level is the plain d20, with the sharp edges and flat normals it always had
+            Vertex vertices[d20VertexCount];
+            BuildD20Vertices(vertices);
+            mesh.vertices.insert(mesh.vertices.end(), vertices, vertices + d20VertexCount);
+            for (int i = 0; i < d20VertexCount; i++)
+            {
+                mesh.indices.push_back(static_cast<GLushort>(i));
+            }
+        }
+        else
+        {
+            for (int face = 0; face < d20FaceCount; face++)
+            {
+                AddRoundedFace(face, d20LodSubdivisions[lod], bevelRadius, innerScale, mesh, range.baseVertex);
+            }
+        }
+
+        range.indexCount = static_cast<GLsizei>(mesh.indices.size()) - range.firstIndex;
+    }
+
+    return mesh;
+}
+
+/// <summary>
+/// Checks the winding of the d20 before back-face culling relies on it: every corner triple in d20FaceIndices has to
+/// go counter-clockwise seen from outside the die (its GetD20FaceNormal() pointing away from the center), and every
+/// triangle of every detail level has to be counter-clockwise relative to its normals. Prints what is wrong.
+/// </summary>
+/// <param name="mesh">Detail levels from BuildD20LodMesh()</param>
+/// <returns>Whether every triangle is wound counter-clockwise</returns>
+bool ValidateD20Winding(const D20LodMesh& mesh)
+{
+    bool valid = true;
+
+    // the die is centered on the origin, so the center of an outside face is also a direction out of the die
+    for (int face = 0; face < d20FaceCount; face++)
+    {
+        glm::vec3 center = (GetD20Corner(d20FaceIndices[face][0]) + GetD20Corner(d20FaceIndices[face][1])
+            + GetD20Corner(d20FaceIndices[face][2])) / 3.0f;
+        if (glm::dot(GetD20FaceNormal(face), center) <= 0.0f)
+        {
+            std::cerr << "Failed to validate the winding of d20 face " << face << " (showing "
+                << d20FaceNumbers[face] << "): its corners go clockwise seen from outside!" << std::endl;
+            valid = false;
+        }
+    }
+
+    for (int lod = 0; lod < d20LodCount; lod++)
+    {
+        const D20LodRange& range = mesh.lods[lod];
+        size_t miswound = CountMiswoundTriangles(mesh.vertices.data() + range.baseVertex,
+            mesh.indices.data() + range.firstIndex, range.indexCount);
+        if (miswound > 0)
+        {
+            std::cerr << "Failed to validate the winding of d20 detail level " << lod << ": " << miswound << " of "
+                << range.indexCount / 3 << " triangles go clockwise relative to their normals!" << std::endl;
+            valid = false;
+        }
+    }
+    return valid;
+}
+
+/// <summary>
+/// Returns the ratio between world space radius and view depth below which a die covers fewer than the given number of
+/// pixels on screen.
+/// </summary>
+/// <param name="persp">Projection matrix</param>
+/// <param name="viewportHeight">Height of the viewport in pixels</param>
+/// <param name="pixelRadius">Screen space radius in pixels</param>
+float GetRadiusPerDepth(const glm::mat4& persp, int viewportHeight, float pixelRadius)
+{
+    // a sphere of radius r at view depth d covers about r / d * persp[1][1] * (viewportHeight / 2) pixels
+    return 2.0f * pixelRadius / (persp[1][1] * viewportHeight);
+}
+
+/// <summary>
+/// Sorts a list of dice into detail levels by how large they look on screen. A die goes to the first level
+/// whose ratio from GetRadiusPerDepth() it reaches, and to the last level if it reaches none.
+/// </summary>
+/// <param name="transforms">Transform system holding the dice</param>
+/// <param name="parent">World matrix of the node the dice are attached to (uniform scale only)</param>
+/// <param name="depthPlane">Plane whose equation gives the view depth of a world space point</param>
+/// <param name="radiusPerDepth">Smallest ratio of bounding radius to view depth for each level but the last</param>
+/// <param name="levelCount">Number of levels</param>
+/// <param name="indices">Indices of the dice to sort, in increasing order</param>
+/// <param name="count">Number of indices</param>
+/// <param name="levels">One list per level, the dice are appended in increasing order</param>
+/// <param name="levelCounts">Number of dice in each list, incremented as dice are appended</param>
+void SortDiceByScreenSize(const TransformSystem& transforms, const glm::mat4& parent, const glm::vec4& depthPlane,
+    const float* radiusPerDepth, int levelCount, const uint32_t* indices, size_t count, uint32_t* const* levels, size_t* levelCounts)
+{
+    // move the depth plane into the space of the parent, like the frustum planes when culling
+    glm::vec4 plane(glm::dot(depthPlane, parent[0]), glm::dot(depthPlane, parent[1]),
+        glm::dot(depthPlane, parent[2]), glm::dot(depthPlane, parent[3]));
+    float parentScale = std::max(glm::length(glm::vec3(parent[0])),
+        std::max(glm::length(glm::vec3(parent[1])), glm::length(glm::vec3(parent[2]))));
+    float radiusScale = glm::length(GetD20Corner(0)) * parentScale;
+
+    for (size_t n = 0; n < count; n++)
+    {
+        uint32_t i = indices[n];
+        float depth = plane.x * transforms.posX[i] + plane.y * transforms.posY[i] + plane.z * transforms.posZ[i] + plane.w;
+        float radius = transforms.scale[i] * radiusScale;
+
+        int level = 0;
+        while (level < levelCount - 1 && radius < radiusPerDepth[level] * depth)
+        {
+            level++;
+        }
+        levels[level][levelCounts[level]++] = i;
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "D20.h"
+#include "TransformSystem.h"
+
+// number of mesh detail levels, from the rounded close-up mesh (0) down to the plain 20-triangle d20
+const int d20LodCount = 4;
+
+// how many times each edge of a face is split at every level (the last level is the original sharp d20)
+extern const int d20LodSubdivisions[d20LodCount];
+
+// smallest on-screen radius (in pixels) at which a die still uses each level
+extern const float d20LodPixelRadius[d20LodCount];
+
+/// <summary>
+/// Struct containing where one detail level lives in the shared vertex and index buffers
+/// </summary>
+struct D20LodRange
+{
+    GLint baseVertex;   // added to every index of the level
+    GLsizei firstIndex; // first index of the level in the index buffer
+    GLsizei indexCount;
+};
+
+/// <summary>
+/// Struct containing every detail level of the d20, packed into one vertex list and one index list
+/// </summary>
+struct D20LodMesh
+{
+    std::vector<Vertex> vertices;
+    std::vector<GLushort> indices;
+    D20LodRange lods[d20LodCount];
+};
+
+/// <summary>
+/// Builds all the detail levels of the d20. Every face is split into a grid of small triangles,
+/// and the edges and corners are rounded off by pulling the grid onto a surface that keeps a fixed distance
+/// from a slightly smaller icosahedron (flat on the faces, cylinders along the edges, spheres at the corners).
+/// </summary>
+/// <param name="bevelRadius">Radius of the rounded edges (the edges of the d20 are 1 long)</param>
+/// <returns>The packed detail levels</returns>
+D20LodMesh BuildD20LodMesh(float bevelRadius);
+
+/// <summary>
+/// Checks the winding of the d20 before back-face culling relies on it: every corner triple in d20FaceIndices has to
+/// go counter-clockwise seen from outside the die (its GetD20FaceNormal() pointing away from the center), and every
+/// triangle of every detail level has to be counter-clockwise relative to its normals. Prints what is wrong.
+/// </summary>
+/// <param name="mesh">Detail levels from BuildD20LodMesh()</param>
+/// <returns>Whether every triangle is wound counter-clockwise</returns>
+bool ValidateD20Winding(const D20LodMesh& mesh);
+
+/// <summary>
+/// Returns the ratio between world space radius and view depth below which a die covers fewer than the given number of
+/// pixels on screen.
+/// </summary>
+/// <param name="persp">Projection matrix</param>
+/// <param name="viewportHeight">Height of the viewport in pixels</param>
+/// <param name="pixelRadius">Screen space radius in pixels</param>
+float GetRadiusPerDepth(const glm::mat4& persp, int viewportHeight, float pixelRadius);
+
+/// <summary>
+/// Sorts a list of dice into detail levels by how large they look on screen. A die goes to the first level
+/// whose ratio from GetRadiusPerDepth() it reaches, and to the last level if it reaches none.
+/// </summary>
+/// <param name="transforms">Transform system holding the dice</param>
+/// <param name="parent">World matrix of the node the dice are attached to (uniform scale only)</param>
+/// <param name="depthPlane">Plane whose equation gives the view depth of a world space point</param>
+/// <param name="radiusPerDepth">Smallest ratio of bounding radius to view depth for each level but the last</param>
+/// <param name="levelCount">Number of levels</param>
+/// <param name="indices">Indices of the dice to sort, in increasing order</param>
+/// <param name="count">Number of indices</param>
+/// <param name="levels">One list per level, the dice are appended in increasing order</param>
+/// <param name="levelCounts">Number of dice in each list, incremented as dice are appended</param>
+void SortDiceByScreenSize(const TransformSystem& transforms, const glm::mat4& parent, const glm::vec4& depthPlane,
+    const float* radiusPerDepth, int levelCount, const uint32_t* indices, size_t count, uint32_t* const* levels, size_t* levelCounts);
@@ -0,0 +1,422 @@
+#include "DiceSpawner.h"
+#include "ConvexQueries.h"
+#include "JobSystem.h"
+
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+static const float pi = 3.14159265f;
+
+// cells of one phase handed to a job at a time
+static const size_t spawnGrainSize = 64;
+
+/// <summary>
+/// Clears the grid and sizes its table for an expected number of items.
+/// </summary>
+/// <param name="cellSize">Edge length of a cell (at least the distance lookups care about)</param>
+/// <param name="expectedItems">Number of items it will probably hold</param>
+void UniformSpatialHash::Reset(float cellSize, size_t expectedItems)
+{
+    inverseCellSize = 1.0f / cellSize;
+
+    // about two buckets per item keeps the lists short
+    size_t bucketCount = 64;
+    while (bucketCount < 2 * expectedItems)
+    {
+        bucketCount *= 2;
+    }
+    bucketMask = static_cast<uint32_t>(bucketCount - 1);
+    heads.assign(bucketCount, -1);
+    next.clear();
+    next.reserve(expectedItems);
+}
+
+/// <summary>
+/// Adds an item. Its index has to be the number of items inserted before it.
+/// </summary>
+/// <param name="position">Position of the item</param>
+void UniformSpatialHash::Insert(const glm::vec3& position)
+{
+    uint32_t bucket = GetBucket(GetCell(position));
+    next.push_back(heads[bucket]);
+    heads[bucket] = static_cast<int>(next.size() - 1);
+}
+
+/// <summary>
+/// Returns the cell a position is in.
+/// </summary>
+glm::ivec3 UniformSpatialHash::GetCell(const glm::vec3& position) const
+{
+    return glm::ivec3(static_cast<int>(std::floor(position.x * inverseCellSize)),
+        static_cast<int>(std::floor(position.y * inverseCellSize)),
+        static_cast<int>(std::floor(position.z * inverseCellSize)));
+}
+
+/// <summary>
+/// Returns the bucket a cell hashes to (the spatial hash of Teschner et al., a large prime per axis).
+/// </summary>
+uint32_t UniformSpatialHash::GetBucket(const glm::ivec3& cell) const
+{
+    uint32_t hash = (static_cast<uint32_t>(cell.x) * 73856093u) ^ (static_cast<uint32_t>(cell.y) * 19349663u)
+        ^ (static_cast<uint32_t>(cell.z) * 83492791u);
+    return hash & bucketMask;
+}
+
+/// <summary>
+/// Returns the next value of a splitmix64 sequence (a fast generator whose outputs for consecutive states are independent).
+/// Every cell seeds its own, which costs nothing, unlike seeding a std::mt19937 per cell.
+/// </summary>
+static uint64_t SplitMix64(uint64_t& state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/// <summary>
+/// Returns a float from 0 (inclusive) to 1 (exclusive) made from the top 24 bits.
+/// </summary>
+static float ToUnitFloat(uint64_t bits)
+{
+    return static_cast<float>(bits >> 40) * (1.0f / 16777216.0f);
+}
+
+/// <summary>
+/// Struct containing a placed die, with its rotation ready for building its shape
+/// </summary>
+struct PlacedDie
+{
+    SpawnedDie die;
+    glm::quat rotation;
+};
+
+/// <summary>
+/// Places dice in a box so that no two of them intersect (and every pair keeps the clearance).
+/// See DiceSpawner.h for how.
+/// </summary>
+/// <param name="settings">Where and how to place the dice</param>
+/// <param name="count">Number of dice wanted (fewer are placed if the box is too crowded)</param>
+/// <param name="jobSystem">Job system to fill the cells on</param>
+/// <param name="stats">Receives what it did, or nullptr</param>
+/// <returns>The dice placed</returns>
+std::vector<SpawnedDie> SpawnDice(const SpawnSettings& settings, size_t count, JobSystem& jobSystem, SpawnStats* stats)
+{
+    auto start = std::chrono::steady_clock::now();
+    const ConvexHull& hull = GetD20Hull();
+    const float outerRadius = hull.circumradius * settings.scale;
+    const float innerRadius = hull.inradius * settings.scale;
+    const float clearance = std::max(settings.clearance, 0.0f);
+
+    // two dice further apart than this never touch: the cells are that wide, so only neighboring cells interact
+    const float reach = 2.0f * outerRadius + clearance;
+    const float acceptSquared = reach * reach;
+    // and two dice closer than this always do
+    const float rejectSquared = (2.0f * innerRadius + clearance) * (2.0f * innerRadius + clearance);
+
+    // The cells, and how much of each lies inside the box. An axis along which the box is flat
+    // has one cell and does not count towards the volume.
+    glm::vec3 extent = glm::max(settings.regionMax - settings.regionMin, glm::vec3(0.0f));
+    glm::ivec3 cellCounts;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        cellCounts[axis] = std::max(1, static_cast<int>(std::ceil(extent[axis] / reach)));
+    }
+    const size_t cellCount = static_cast<size_t>(cellCounts.x) * cellCounts.y * cellCounts.z;
+    auto getCellBox = [&](size_t cell, glm::vec3& boxMin, glm::vec3& boxSize)
+    {
+        glm::ivec3 coordinates(static_cast<int>(cell % cellCounts.x), static_cast<int>((cell / cellCounts.x) % cellCounts.y),
+            static_cast<int>(cell / (static_cast<size_t>(cellCounts.x) * cellCounts.y)));
+        boxMin = settings.regionMin + glm::vec3(coordinates) * reach;
+        boxSize = glm::min(boxMin + glm::vec3(reach), settings.regionMax) - boxMin;
+    };
+
+    // Every cell gets its share of the dice from a running total, so the shares add up to exactly count,
+    // and a slice of one buffer big enough for it
+    std::vector<size_t> quota(cellCount), firstSlot(cellCount + 1), placedCount(cellCount, 0);
+    {
+        double totalMeasure = 1.0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            totalMeasure *= extent[axis] > 0.0f ? extent[axis] : 1.0f;
+        }
+        double runningMeasure = 0.0;
+        size_t runningQuota = 0;
+        for (size_t cell = 0; cell < cellCount; cell++)
+        {
+            glm::vec3 boxMin, boxSize;
+            getCellBox(cell, boxMin, boxSize);
+            double measure = 1.0;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                measure *= extent[axis] > 0.0f ? std::max(boxSize[axis], 0.0f) : 1.0f;
+            }
+            runningMeasure += measure;
+            size_t total = std::min(count, static_cast<size_t>(count * runningMeasure / totalMeasure + 0.5));
+            quota[cell] = total - runningQuota;
+            firstSlot[cell] = runningQuota;
+            runningQuota = total;
+        }
+        // rounding can leave the last cell a die short
+        quota[cellCount - 1] += count - runningQuota;
+        firstSlot[cellCount] = count;
+    }
+    std::vector<PlacedDie> slots(count);
+
+    // the dice of the phases done so far, in the order they went into the hash
+    std::vector<PlacedDie> placed;
+    placed.reserve(count);
+    UniformSpatialHash hash;
+    hash.Reset(reach, count);
+
+    // the cells of each phase, by the parity of their coordinates
+    std::vector<size_t> phaseCells[8];
+    for (size_t cell = 0; cell < cellCount; cell++)
+    {
+        if (quota[cell] == 0)
+        {
+            continue;
+        }
+        size_t x = cell % cellCounts.x;
+        size_t y = (cell / cellCounts.x) % cellCounts.y;
+        size_t z = cell / (static_cast<size_t>(cellCounts.x) * cellCounts.y);
+        phaseCells[(x & 1) | ((y & 1) << 1) | ((z & 1) << 2)].push_back(cell);
+    }
+
+    std::atomic<size_t> candidates(0), pairTests(0), sphereAccepts(0), sphereRejects(0), gjkTests(0);
+    for (const std::vector<size_t>& cells : phaseCells)
+    {
+        jobSystem.ParallelFor("spawn dice", cells.size(), spawnGrainSize, [&](size_t begin, size_t end)
+        {
+            size_t localCandidates = 0, localPairTests = 0, localAccepts = 0, localRejects = 0, localGjk = 0;
+            for (size_t c = begin; c < end; c++)
+            {
+                size_t cell = cells[c];
+                glm::vec3 boxMin, boxSize;
+                getCellBox(cell, boxMin, boxSize);
+                uint64_t state = (static_cast<uint64_t>(settings.seed) << 32) ^ cell;
+                PlacedDie* cellDice = &slots[firstSlot[cell]];
+                size_t& cellPlaced = placedCount[cell];
+
+                size_t attempts = quota[cell] * static_cast<size_t>(std::max(settings.attemptsPerDie, 1));
+                for (size_t attempt = 0; attempt < attempts && cellPlaced < quota[cell]; attempt++)
+                {
+                    localCandidates++;
+                    PlacedDie candidate;
+                    candidate.die.position = boxMin + boxSize * glm::vec3(ToUnitFloat(SplitMix64(state)),
+                        ToUnitFloat(SplitMix64(state)), ToUnitFloat(SplitMix64(state)));
+                    float z = 2.0f * ToUnitFloat(SplitMix64(state)) - 1.0f;
+                    float angle = 2.0f * pi * ToUnitFloat(SplitMix64(state));
+                    float r = std::sqrt(std::max(1.0f - z * z, 0.0f));
+                    candidate.die.spinAxis = glm::vec3(r * std::cos(angle), r * std::sin(angle), z);
+                    candidate.die.spinPhase = pi * (2.0f * ToUnitFloat(SplitMix64(state)) - 1.0f);
+                    candidate.rotation = glm::angleAxis(candidate.die.spinPhase, candidate.die.spinAxis);
+
+                    // the exact shape is only needed once a pair gets past the sphere tests
+                    ConvexShape candidateShape;
+                    bool shapeReady = false;
+                    auto fits = [&](const PlacedDie& other)
+                    {
+                        localPairTests++;
+                        glm::vec3 offset = other.die.position - candidate.die.position;
+                        float distanceSquared = glm::dot(offset, offset);
+                        if (distanceSquared >= acceptSquared)
+                        {
+                            localAccepts++;
+                            return true;
+                        }
+                        if (distanceSquared < rejectSquared)
+                        {
+                            localRejects++;
+                            return false;
+                        }
+                        if (!shapeReady)
+                        {
+                            candidateShape = PlaceConvexShape(hull, candidate.die.position, candidate.rotation, settings.scale);
+                            shapeReady = true;
+                        }
+                        localGjk++;
+                        ConvexShape otherShape = PlaceConvexShape(hull, other.die.position, other.rotation, settings.scale);
+                        return GjkSeparated(candidateShape, otherShape, clearance);
+                    };
+
+                    bool accepted = true;
+                    for (size_t i = 0; i < cellPlaced && accepted; i++)
+                    {
+                        accepted = fits(cellDice[i]);
+                    }
+                    if (accepted)
+                    {
+                        hash.ForEachNeighbor(candidate.die.position, [&](size_t item)
+                        {
+                            accepted = accepted && fits(placed[item]);
+                        });
+                    }
+                    if (accepted)
+                    {
+                        cellDice[cellPlaced++] = candidate;
+                    }
+                }
+            }
+            candidates += localCandidates;
+            pairTests += localPairTests;
+            sphereAccepts += localAccepts;
+            sphereRejects += localRejects;
+            gjkTests += localGjk;
+        });
+
+        // the next phase sees this one's dice (in cell order, whichever thread placed them)
+        for (size_t cell : cells)
+        {
+            for (size_t i = 0; i < placedCount[cell]; i++)
+            {
+                placed.push_back(slots[firstSlot[cell] + i]);
+                hash.Insert(placed.back().die.position);
+            }
+        }
+    }
+
+    std::vector<SpawnedDie> dice;
+    dice.reserve(placed.size());
+    for (const PlacedDie& die : placed)
+    {
+        dice.push_back(die.die);
+    }
+
+    if (stats != nullptr)
+    {
+        stats->candidates = candidates;
+        stats->pairTests = pairTests;
+        stats->sphereAccepts = sphereAccepts;
+        stats->sphereRejects = sphereRejects;
+        stats->gjkTests = gjkTests;
+        stats->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    return dice;
+}
+
+/// <summary>
+/// Counts the pairs of spawned dice that intersect or come closer than the clearance, found with GJK,
+/// and checks the first few thousand close pairs with the separating axis test too.
+/// </summary>
+/// <param name="dice">Spawned dice</param>
+/// <param name="settings">Settings they were spawned with</param>
+/// <param name="closePairs">Receives the number of pairs whose bounding spheres overlap</param>
+/// <param name="satMismatches">Receives the number of checked pairs the separating axis test finds too close</param>
+/// <returns>The number of pairs GJK finds too close</returns>
+static size_t CountSpawnOverlaps(const std::vector<SpawnedDie>& dice, const SpawnSettings& settings, size_t& closePairs,
+    size_t& satMismatches)
+{
+    const size_t satPairLimit = 5000;
+    const ConvexHull& hull = GetD20Hull();
+    const float reach = 2.0f * hull.circumradius * settings.scale + settings.clearance;
+
+    UniformSpatialHash hash;
+    hash.Reset(reach, dice.size());
+    for (const SpawnedDie& die : dice)
+    {
+        hash.Insert(die.position);
+    }
+
+    size_t overlaps = 0;
+    closePairs = 0;
+    satMismatches = 0;
+    for (size_t i = 0; i < dice.size(); i++)
+    {
+        ConvexShape shape = PlaceConvexShape(hull, dice[i].position, glm::angleAxis(dice[i].spinPhase, dice[i].spinAxis), settings.scale);
+        hash.ForEachNeighbor(dice[i].position, [&](size_t j)
+        {
+            if (j <= i || glm::length(dice[j].position - dice[i].position) >= reach)
+            {
+                return;
+            }
+            closePairs++;
+            ConvexShape other = PlaceConvexShape(hull, dice[j].position, glm::angleAxis(dice[j].spinPhase, dice[j].spinAxis), settings.scale);
+            GjkResult result = GjkDistance(shape, other);
+            if (result.overlapping || result.distance < settings.clearance)
+            {
+                overlaps++;
+            }
+            if (closePairs <= satPairLimit)
+            {
+                glm::vec3 normal;
+                satMismatches += GetSatSeparation(shape, other, normal) < settings.clearance - 1e-5f ? 1 : 0;
+            }
+        });
+    }
+    return overlaps;
+}
+
+/// <summary>
+/// Spawns dice into a flat layer and into a box, with one thread and with every hardware thread, prints the candidates
+/// and pair tests per second per core (against a target of a million per second per core), and checks that no two dice
+/// placed intersect and that both thread counts placed the same dice.
+/// </summary>
+/// <param name="diceCount">Number of dice to spawn into each region</param>
+void RunSpawnBenchmark(int diceCount)
+{
+    diceCount = std::max(diceCount, 1);
+    const int threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    const ConvexHull& hull = GetD20Hull();
+
+    // Both regions are crowded enough that many candidates land between the inscribed and the bounding spheres
+    // of a placed die: a flat layer with four squared bounding radii of floor per die, and a box with a cube
+    // as wide as a bounding sphere per die.
+    SpawnSettings layer;
+    layer.scale = 0.1f;
+    float radius = hull.circumradius * layer.scale;
+    float layerSide = std::sqrt(4.0f * radius * radius * diceCount);
+    layer.regionMin = glm::vec3(-0.5f * layerSide, 0.0f, -0.5f * layerSide);
+    layer.regionMax = glm::vec3(0.5f * layerSide, 0.0f, 0.5f * layerSide);
+    layer.seed = 51;
+
+    SpawnSettings box = layer;
+    float boxSide = std::cbrt(8.0f * radius * radius * radius * diceCount);
+    box.regionMin = glm::vec3(-0.5f * boxSide);
+    box.regionMax = glm::vec3(0.5f * boxSide);
+    box.seed = 52;
+
+    std::cout << "spawn benchmark: " << diceCount << " d20s of radius " << radius << ", up to " << layer.attemptsPerDie
+        << " candidates per die, " << threadCount << " hardware threads (target: 1 million candidates per second per core)" << std::endl;
+
+    const struct
+    {
+        const char* name;
+        const SpawnSettings* settings;
+    } regions[] = { { "layer", &layer }, { "box", &box } };
+    for (const auto& region : regions)
+    {
+        std::vector<SpawnedDie> results[2];
+        int threadCounts[2] = { 1, threadCount };
+        for (int run = 0; run < 2; run++)
+        {
+            JobSystem jobSystem(threadCounts[run]);
+            SpawnStats stats;
+            results[run] = SpawnDice(*region.settings, diceCount, jobSystem, &stats);
+            double perCoreSecond = 1000.0 / (stats.ms * threadCounts[run]);
+            std::cout << "  " << region.name << ", " << threadCounts[run] << " threads: " << results[run].size() << " placed in "
+                << stats.ms << " ms, " << stats.candidates << " candidates (" << stats.candidates * perCoreSecond / 1e6
+                << " million per second per core), " << stats.pairTests << " pair tests (" << stats.pairTests * perCoreSecond / 1e6
+                << " million per second per core): " << stats.sphereAccepts << " settled by bounding spheres, "
+                << stats.sphereRejects << " by inscribed spheres, " << stats.gjkTests << " by GJK" << std::endl;
+        }
+
+        bool identical = results[0].size() == results[1].size();
+        for (size_t i = 0; identical && i < results[0].size(); i++)
+        {
+            identical = results[0][i].position == results[1][i].position && results[0][i].spinPhase == results[1][i].spinPhase;
+        }
+        size_t closePairs, satMismatches;
+        size_t overlaps = CountSpawnOverlaps(results[1], *region.settings, closePairs, satMismatches);
+        std::cout << "  " << region.name << ": " << closePairs << " pairs closer than their bounding spheres, " << overlaps
+            << " intersecting (GJK), " << satMismatches << " of the first " << std::min<size_t>(closePairs, 5000)
+            << " intersecting (separating axis test); " << (identical ? "same" : "DIFFERENT")
+            << " dice with 1 and " << threadCount << " threads" << std::endl;
+    }
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+/// <summary>
+/// Struct containing a die placed by SpawnDice(): where it is, and the spin axis and phase that give its rotation
+/// (angleAxis(spinPhase, spinAxis), the rotation the transform system gives it at time 0)
+/// </summary>
+struct SpawnedDie
+{
+    glm::vec3 position;
+    glm::vec3 spinAxis;     // unit length
+    float spinPhase;
+};
+
+/// <summary>
+/// Struct containing where and how SpawnDice() places dice
+/// </summary>
+struct SpawnSettings
+{
+    glm::vec3 regionMin = glm::vec3(0.0f);  // box the die centers are placed in (flat along an axis where min == max)
+    glm::vec3 regionMax = glm::vec3(1.0f);
+    float scale = 0.1f;                     // uniform scale of the dice
+    float clearance = 0.0f;                 // gap every pair of dice keeps
+    int attemptsPerDie = 30;                // candidates thrown per die before a cell gives up on the rest
+    uint32_t seed = 1;
+};
+
+/// <summary>
+/// Struct containing what SpawnDice() did
+/// </summary>
+struct SpawnStats
+{
+    size_t candidates = 0;      // positions and rotations thrown
+    size_t pairTests = 0;       // candidate against placed die, bounding spheres first
+    size_t sphereAccepts = 0;   // pairs far enough apart that their bounding spheres settled it
+    size_t sphereRejects = 0;   // pairs close enough that their inscribed spheres overlap
+    size_t gjkTests = 0;        // the rest, settled with GJK
+    double ms = 0.0;
+};
+
+/// <summary>
+/// Hash grid of points in uniform cells: a table of buckets, each the head of a linked list of the items
+/// whose cell hashes to it (one next index per item). Cells that share a bucket share its list, so a lookup checks
+/// the items it gets back. Items are inserted from one thread, and looked up from any number of threads in between.
+/// </summary>
+class UniformSpatialHash
+{
+public:
+    /// <summary>
+    /// Clears the grid and sizes its table for an expected number of items.
+    /// </summary>
+    /// <param name="cellSize">Edge length of a cell (at least the distance lookups care about)</param>
+    /// <param name="expectedItems">Number of items it will probably hold</param>
+    void Reset(float cellSize, size_t expectedItems);
+
+    /// <summary>
+    /// Adds an item. Its index has to be the number of items inserted before it.
+    /// </summary>
+    /// <param name="position">Position of the item</param>
+    void Insert(const glm::vec3& position);
+
+    /// <summary>
+    /// Calls visit(item) for every item in the cell of a position and the 26 cells around it (and any other item
+    /// that shares a bucket with them), once each.
+    /// </summary>
+    template <typename Visit>
+    void ForEachNeighbor(const glm::vec3& position, Visit&& visit) const
+    {
+        glm::ivec3 cell = GetCell(position);
+        uint32_t buckets[27];
+        int bucketCount = 0;
+        for (int z = -1; z <= 1; z++)
+        {
+            for (int y = -1; y <= 1; y++)
+            {
+                for (int x = -1; x <= 1; x++)
+                {
+                    uint32_t bucket = GetBucket(cell + glm::ivec3(x, y, z));
+
+                    // two of the cells landing in one bucket would visit its items twice
+                    bool seen = false;
+                    for (int b = 0; b < bucketCount; b++)
+                    {
+                        seen |= buckets[b] == bucket;
+                    }
+                    if (seen)
+                    {
+                        continue;
+                    }
+                    buckets[bucketCount++] = bucket;
+
+                    for (int item = heads[bucket]; item >= 0; item = next[item])
+                    {
+                        visit(static_cast<size_t>(item));
+                    }
+                }
+            }
+        }
+    }
+
+    /// <summary>
+    /// Returns the cell a position is in.
+    /// </summary>
+    glm::ivec3 GetCell(const glm::vec3& position) const;
+
+private:
+    /// <summary>
+    /// Returns the bucket a cell hashes to.
+    /// </summary>
+    uint32_t GetBucket(const glm::ivec3& cell) const;
+
+    float inverseCellSize = 1.0f;
+    uint32_t bucketMask = 0;
+    std::vector<int> heads;     // first item of every bucket, -1 if empty
+    std::vector<int> next;      // next item in the same bucket, -1 at the end
+};
+
+/// <summary>
+/// Places dice in a box so that no two of them intersect (and every pair keeps the clearance): Poisson disk sampling
+/// by dart throwing, with the exact shape of the d20 instead of a disk. The box is split into cells at least as wide
+/// as two bounding spheres plus the clearance, and every cell gets a share of the dice proportional to its volume.
+/// The cells are filled in 8 phases, one per parity of their coordinates: cells of the same phase are at least a cell
+/// apart, so whatever lands in one cannot touch what lands in another, and each phase fills its cells in parallel
+/// on the job system. A candidate is checked against the dice already placed around it, found through a uniform
+/// spatial hash: bounding spheres apart accept the pair, inscribed spheres overlapping reject it, and GJK settles
+/// the rest. Every cell has its own random numbers and the results are merged in cell order, so the same settings
+/// place the same dice with any number of threads.
+/// </summary>
+/// <param name="settings">Where and how to place the dice</param>
+/// <param name="count">Number of dice wanted (fewer are placed if the box is too crowded)</param>
+/// <param name="jobSystem">Job system to fill the cells on</param>
+/// <param name="stats">Receives what it did, or nullptr</param>
+/// <returns>The dice placed</returns>
+std::vector<SpawnedDie> SpawnDice(const SpawnSettings& settings, size_t count, JobSystem& jobSystem, SpawnStats* stats = nullptr);
+
+/// <summary>
+/// Spawns dice into a flat layer and into a box, with one thread and with every hardware thread, prints the candidates
+/// and pair tests per second per core (against a target of a million per second per core), and checks that no two dice
+/// placed intersect and that both thread counts placed the same dice.
+/// </summary>
+/// <param name="diceCount">Number of dice to spawn into each region</param>
+void RunSpawnBenchmark(int diceCount);
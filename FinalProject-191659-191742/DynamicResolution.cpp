@@ -0,0 +1,183 @@
+#include "DynamicResolution.h"
+#include "GlResources.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// the scale never goes below half the window resolution (a quarter of the pixels), and moves in steps of 5%
+static const float minScale = 0.5f;
+static const float maxScale = 1.0f;
+static const float scaleStep = 0.05f;
+
+/// <summary>
+/// Creates the GPU timer queries. The framebuffer is created by the first BeginFrame().
+/// </summary>
+/// <param name="budgetMs">GPU time one frame may take, in milliseconds</param>
+/// <param name="enabled">Whether to adjust the scale at all (if not, the scene is always drawn at full size)</param>
+DynamicResolution::DynamicResolution(float budgetMs, bool enabled)
+    : budgetMs(budgetMs), enabled(enabled)
+{
+    glGenQueries(queryCount, queries);
+}
+
+/// <summary>
+/// Deletes the framebuffer and the queries. Must be called while the context is still current.
+/// </summary>
+void DynamicResolution::Delete()
+{
+    glDeleteQueries(queryCount, queries);
+    DeleteGlResource(GlResourceType::Framebuffer, framebuffer);
+    DeleteGlResource(GlResourceType::Texture, colorTexture);
+    DeleteGlResource(GlResourceType::Renderbuffer, depthBuffer);
+    allocatedWidth = allocatedHeight = 0;
+}
+
+/// <summary>
+/// (Re)creates the offscreen framebuffer at the given size.
+/// </summary>
+void DynamicResolution::Resize(int width, int height)
+{
+    if (framebuffer == 0)
+    {
+        framebuffer = CreateGlResource(GlResourceType::Framebuffer, "offscreen framebuffer");
+        colorTexture = CreateGlResource(GlResourceType::Texture, "offscreen color");
+        depthBuffer = CreateGlResource(GlResourceType::Renderbuffer, "offscreen depth");
+    }
+    SetGlResourceBytes(GlResourceType::Texture, colorTexture, GetGlTextureBytes(GL_RGBA8, width, height, false));
+    SetGlResourceBytes(GlResourceType::Renderbuffer, depthBuffer, GetGlTextureBytes(GL_DEPTH_COMPONENT24, width, height, false));
+
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "Failed to create the dynamic resolution framebuffer!" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    allocatedWidth = width;
+    allocatedHeight = height;
+}
+
+/// <summary>
+/// Feeds the GPU time of one frame to the controller, and changes the scale if the frames have been over
+/// or well under the budget for long enough.
+/// </summary>
+void DynamicResolution::UpdateScale(float gpuMs)
+{
+    if (cooldownFrames > 0)
+    {
+        // frames drawn before the last change are still coming in, so start the average over once they are through
+        cooldownFrames--;
+        smoothedGpuMs = gpuMs;
+        return;
+    }
+    smoothedGpuMs = smoothedGpuMs == 0.0f ? gpuMs : smoothedGpuMs * 0.9f + gpuMs * 0.1f;
+    if (!enabled)
+    {
+        return;
+    }
+
+    // Hysteresis: going down takes a few frames over the budget, going up takes a second well under it, and
+    // anything between 75% and 100% of the budget leaves the scale alone. Without that gap, a scale that just fits
+    // would step up, miss the budget, step down, and so on.
+    overBudgetFrames = smoothedGpuMs > budgetMs ? overBudgetFrames + 1 : 0;
+    underBudgetFrames = smoothedGpuMs < budgetMs * 0.75f ? underBudgetFrames + 1 : 0;
+
+    float newScale = scale;
+    if (overBudgetFrames >= 5)
+    {
+        // the cost is mostly per pixel, so aim for the pixel count that would just have fit (with a little room)
+        newScale = scale * std::sqrt(budgetMs * 0.9f / smoothedGpuMs);
+        newScale = std::floor(newScale / scaleStep) * scaleStep;
+    }
+    else if (underBudgetFrames >= 60)
+    {
+        newScale = scale + scaleStep;
+    }
+
+    newScale = std::min(std::max(newScale, minScale), maxScale);
+    if (newScale != scale)
+    {
+        scale = newScale;
+        overBudgetFrames = 0;
+        underBudgetFrames = 0;
+        cooldownFrames = queryCount;
+    }
+}
+
+/// <summary>
+/// Picks up the GPU times of earlier frames, updates the scale, binds the offscreen framebuffer with the viewport
+/// set to the scaled size, and starts timing the frame.
+/// </summary>
+/// <param name="windowWidth">Width of the window framebuffer in pixels</param>
+/// <param name="windowHeight">Height of the window framebuffer in pixels</param>
+void DynamicResolution::BeginFrame(int windowWidth, int windowHeight)
+{
+    this->windowWidth = std::max(windowWidth, 1);
+    this->windowHeight = std::max(windowHeight, 1);
+    if (this->windowWidth > allocatedWidth || this->windowHeight > allocatedHeight)
+    {
+        Resize(std::max(this->windowWidth, allocatedWidth), std::max(this->windowHeight, allocatedHeight));
+    }
+
+    // The query about to be reused was issued queryCount frames ago, so its result is almost always there.
+    // If it is not, the result is dropped rather than waited for.
+    if (queryPending[currentQuery])
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(queries[currentQuery], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(queries[currentQuery], GL_QUERY_RESULT, &nanoseconds);
+            UpdateScale(static_cast<float>(nanoseconds * 1e-6));
+        }
+        queryPending[currentQuery] = false;
+    }
+
+    renderWidth = std::max(1, static_cast<int>(this->windowWidth * scale));
+    renderHeight = std::max(1, static_cast<int>(this->windowHeight * scale));
+
+    Bind();
+
+    glBeginQuery(GL_TIME_ELAPSED, queries[currentQuery]);
+}
+
+/// <summary>
+/// Binds the offscreen framebuffer again, with the viewport set to the scaled size (after drawing into another one).
+/// </summary>
+void DynamicResolution::Bind() const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, renderWidth, renderHeight);
+}
+
+/// <summary>
+/// Stops timing the frame and stretches the rendered image over the window framebuffer, which is bound afterwards.
+/// </summary>
+void DynamicResolution::EndFrame()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    queryPending[currentQuery] = true;
+    currentQuery = (currentQuery + 1) % queryCount;
+
+    // bilinear upscale straight from the used corner of the offscreen image
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, windowWidth, windowHeight);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <glad/glad.h>
+
+/// <summary>
+/// Renders the scene into an offscreen framebuffer at a fraction of the window resolution, and picks that fraction
+/// from the measured GPU time of the frames, so that the frames fit into a time budget.
+/// The framebuffer is allocated at the full window size and only a corner of it is used, so changing the scale
+/// never reallocates anything. The result is stretched over the window with a linear blit.
+/// </summary>
+class DynamicResolution
+{
+public:
+    /// <summary>
+    /// Creates the GPU timer queries. The framebuffer is created by the first BeginFrame().
+    /// </summary>
+    /// <param name="budgetMs">GPU time one frame may take, in milliseconds</param>
+    /// <param name="enabled">Whether to adjust the scale at all (if not, the scene is always drawn at full size)</param>
+    DynamicResolution(float budgetMs, bool enabled);
+
+    DynamicResolution(const DynamicResolution&) = delete;
+    DynamicResolution& operator=(const DynamicResolution&) = delete;
+
+    /// <summary>
+    /// Deletes the framebuffer and the queries. Must be called while the context is still current.
+    /// </summary>
+    void Delete();
+
+    /// <summary>
+    /// Picks up the GPU times of earlier frames, updates the scale, binds the offscreen framebuffer with the viewport
+    /// set to the scaled size, and starts timing the frame.
+    /// </summary>
+    /// <param name="windowWidth">Width of the window framebuffer in pixels</param>
+    /// <param name="windowHeight">Height of the window framebuffer in pixels</param>
+    void BeginFrame(int windowWidth, int windowHeight);
+
+    /// <summary>
+    /// Binds the offscreen framebuffer again, with the viewport set to the scaled size (after drawing into another one).
+    /// </summary>
+    void Bind() const;
+
+    /// <summary>
+    /// Stops timing the frame and stretches the rendered image over the window framebuffer, which is bound afterwards.
+    /// </summary>
+    void EndFrame();
+
+    /// <summary>
+    /// Returns the fraction of the window resolution (on each axis) the scene is rendered at.
+    /// </summary>
+    float Scale() const { return scale; }
+
+    /// <summary>
+    /// Returns the width of the scene in pixels this frame.
+    /// </summary>
+    int RenderWidth() const { return renderWidth; }
+
+    /// <summary>
+    /// Returns the height of the scene in pixels this frame.
+    /// </summary>
+    int RenderHeight() const { return renderHeight; }
+
+    /// <summary>
+    /// Returns the smoothed GPU time of the recent frames, in milliseconds.
+    /// </summary>
+    float GpuMs() const { return smoothedGpuMs; }
+
+private:
+    static const int queryCount = 4;        // frames the GPU may be behind before a result is dropped
+
+    void Resize(int width, int height);
+    void UpdateScale(float gpuMs);
+
+    float budgetMs;
+    bool enabled;
+    float scale = 1.0f;
+    float smoothedGpuMs = 0.0f;
+    int overBudgetFrames = 0;
+    int underBudgetFrames = 0;
+    int cooldownFrames = 0;                 // frames to ignore after a change, while older frames are still measured
+
+    GLuint framebuffer = 0;
+    GLuint colorTexture = 0;
+    GLuint depthBuffer = 0;
+    int allocatedWidth = 0, allocatedHeight = 0;
+    int windowWidth = 0, windowHeight = 0;
+    int renderWidth = 0, renderHeight = 0;
+
+    GLuint queries[queryCount] = {};
+    bool queryPending[queryCount] = {};
+    int currentQuery = 0;
+};
@@ -0,0 +1,168 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+/// <summary>
+/// Reserves the memory of every region up front.
+/// </summary>
+/// <param name="bytesPerFrame">Size of each region</param>
+/// <param name="frameCount">Number of regions, i.e. frames an allocation lives for</param>
+FrameArena::FrameArena(size_t bytesPerFrame, int frameCount)
+    : capacity(bytesPerFrame), frameCount(std::max(1, frameCount)), overflowBlocks(std::max(1, frameCount))
+{
+    memory = static_cast<char*>(::operator new(capacity * this->frameCount));
+}
+
+FrameArena::~FrameArena()
+{
+    for (std::vector<void*>& blocks : overflowBlocks)
+    {
+        for (void* block : blocks)
+        {
+            ::operator delete(block);
+        }
+    }
+    ::operator delete(memory);
+}
+
+/// <summary>
+/// Moves on to the next region and forgets everything that was allocated in it frameCount frames ago.
+/// Must be called while no other thread is allocating.
+/// </summary>
+void FrameArena::BeginFrame()
+{
+    highWaterMark = std::max(highWaterMark, used.load(std::memory_order_relaxed));
+
+    currentFrame = (currentFrame + 1) % frameCount;
+    used.store(0, std::memory_order_relaxed);
+
+    // the frame that last used this region is frameCount frames old, so its overflow blocks can go too
+    std::vector<void*>& blocks = overflowBlocks[currentFrame];
+    for (void* block : blocks)
+    {
+        ::operator delete(block);
+    }
+    blocks.clear();
+}
+
+/// <summary>
+/// Returns memory that stays valid until the region is reused. Safe to call from several threads at once.
+/// If the region is full, the memory comes from the heap instead (and is counted in OverflowBytes()).
+/// </summary>
+/// <param name="bytes">Number of bytes</param>
+/// <param name="alignment">Alignment of the returned address (a power of two)</param>
+void* FrameArena::Allocate(size_t bytes, size_t alignment)
+{
+    uintptr_t region = reinterpret_cast<uintptr_t>(memory + currentFrame * capacity);
+
+    // align the address rather than the offset, so that alignments above the one of the region itself work as well
+    size_t offset = used.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        uintptr_t start = (region + offset + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+        size_t end = static_cast<size_t>(start - region) + bytes;
+        if (end > capacity)
+        {
+            break;
+        }
+        if (used.compare_exchange_weak(offset, end, std::memory_order_relaxed))
+        {
+            return reinterpret_cast<void*>(start);
+        }
+    }
+
+    // out of room: fall back to the heap so that the frame still works, and remember the block so it can be freed
+    // when this region comes around again
+    overflowBytes.fetch_add(bytes, std::memory_order_relaxed);
+    void* block = ::operator new(bytes + alignment);
+    uintptr_t start = (reinterpret_cast<uintptr_t>(block) + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    overflowBlocks[currentFrame].push_back(block);
+    return reinterpret_cast<void*>(start);
+}
+
+/// <summary>
+/// Returns the most bytes any frame has used since the arena was created.
+/// </summary>
+size_t FrameArena::HighWaterMark() const
+{
+    return std::max(highWaterMark, used.load(std::memory_order_relaxed));
+}
+
+#ifndef NDEBUG
+
+// Debug builds replace the global operator new and delete with versions that count every allocation.
+// The array and nothrow forms call these, so they are counted too.
+static std::atomic<uint64_t> heapAllocationCount{ 0 };
+
+void* operator new(size_t bytes)
+{
+    heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* block = std::malloc(bytes == 0 ? 1 : bytes);
+    if (block == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+void operator delete(void* block) noexcept
+{
+    std::free(block);
+}
+
+void operator delete(void* block, size_t) noexcept
+{
+    std::free(block);
+}
+
+// Over-aligned types (like the job system workers) go through the aligned forms. The start of the malloc block is
+// kept just in front of the aligned address, so that delete can find it again without any platform-specific calls.
+void* operator new(size_t bytes, std::align_val_t alignment)
+{
+    heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    size_t align = static_cast<size_t>(alignment);
+    void* block = std::malloc(bytes + align + sizeof(void*));
+    if (block == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    uintptr_t start = (reinterpret_cast<uintptr_t>(block) + sizeof(void*) + align - 1) & ~static_cast<uintptr_t>(align - 1);
+    reinterpret_cast<void**>(start)[-1] = block;
+    return reinterpret_cast<void*>(start);
+}
+
+void operator delete(void* block, std::align_val_t) noexcept
+{
+    if (block != nullptr)
+    {
+        std::free(static_cast<void**>(block)[-1]);
+    }
+}
+
+void operator delete(void* block, size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(block, alignment);
+}
+
+/// <summary>
+/// Returns how many times operator new has been called since the program started, on any thread.
+/// Only counted in debug builds (when NDEBUG is not defined); release builds always return 0.
+/// Used to check that a frame makes no heap allocations once it is warmed up.
+/// </summary>
+uint64_t GetHeapAllocationCount()
+{
+    return heapAllocationCount.load(std::memory_order_relaxed);
+}
+
+#else
+
+uint64_t GetHeapAllocationCount()
+{
+    return 0;
+}
+
+#endif
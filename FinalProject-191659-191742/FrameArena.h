@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/// <summary>
+/// Linear allocator for data that only lives for a frame (culling outputs, draw lists, staging data).
+/// Allocating is a single atomic bump of an offset, so worker threads can allocate too, and nothing is ever freed
+/// on its own: the whole region is reset when it comes around again.
+/// The arena keeps frameCount regions and moves to the next one every frame, so memory handed out in a frame stays
+/// valid while the GPU may still be reading it, for frameCount - 1 more frames.
+/// </summary>
+class FrameArena
+{
+public:
+    /// <summary>
+    /// Reserves the memory of every region up front.
+    /// </summary>
+    /// <param name="bytesPerFrame">Size of each region</param>
+    /// <param name="frameCount">Number of regions, i.e. frames an allocation lives for</param>
+    FrameArena(size_t bytesPerFrame, int frameCount = 3);
+    ~FrameArena();
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    /// <summary>
+    /// Moves on to the next region and forgets everything that was allocated in it frameCount frames ago.
+    /// Must be called while no other thread is allocating.
+    /// </summary>
+    void BeginFrame();
+
+    /// <summary>
+    /// Returns memory that stays valid until the region is reused. Safe to call from several threads at once.
+    /// If the region is full, the memory comes from the heap instead (and is counted in OverflowBytes()).
+    /// </summary>
+    /// <param name="bytes">Number of bytes</param>
+    /// <param name="alignment">Alignment of the returned address (a power of two)</param>
+    void* Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+    /// <summary>
+    /// Returns room for count objects of type T, which are left uninitialized.
+    /// </summary>
+    template <typename T>
+    T* AllocateArray(size_t count)
+    {
+        return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+    }
+
+    /// <summary>
+    /// Returns the bytes used so far in the current frame (including alignment padding).
+    /// </summary>
+    size_t BytesUsed() const { return used.load(std::memory_order_relaxed); }
+
+    /// <summary>
+    /// Returns the most bytes any frame has used since the arena was created.
+    /// </summary>
+    size_t HighWaterMark() const;
+
+    /// <summary>
+    /// Returns the size of each region.
+    /// </summary>
+    size_t Capacity() const { return capacity; }
+
+    /// <summary>
+    /// Returns the bytes that did not fit into their region and came from the heap, since the arena was created.
+    /// Anything but 0 means the regions should be made larger.
+    /// </summary>
+    size_t OverflowBytes() const { return overflowBytes.load(std::memory_order_relaxed); }
+
+private:
+    size_t capacity;
+    int frameCount;
+    int currentFrame = 0;
+    char* memory;                           // frameCount regions of capacity bytes, one after the other
+    std::atomic<size_t> used{ 0 };          // offset of the first free byte in the current region
+    size_t highWaterMark = 0;               // largest offset of the frames that are already over
+
+    // heap blocks handed out when a region ran full, freed when that region is reused
+    std::mutex overflowMutex;
+    std::vector<std::vector<void*>> overflowBlocks;
+    std::atomic<size_t> overflowBytes{ 0 };
+};
+
+/// <summary>
+/// Standard library allocator that takes its memory from a FrameArena, so that containers built during a frame
+/// do not touch the heap. Freeing does nothing; the memory goes back when the arena reuses the region.
+/// </summary>
+template <typename T>
+struct FrameAllocator
+{
+    typedef T value_type;
+
+    FrameArena* arena;
+
+    explicit FrameAllocator(FrameArena& arena) : arena(&arena) {}
+
+    template <typename U>
+    FrameAllocator(const FrameAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) { return arena->AllocateArray<T>(count); }
+    void deallocate(T*, size_t) {}
+};
+
+template <typename T, typename U>
+bool operator==(const FrameAllocator<T>& a, const FrameAllocator<U>& b) { return a.arena == b.arena; }
+
+template <typename T, typename U>
+bool operator!=(const FrameAllocator<T>& a, const FrameAllocator<U>& b) { return a.arena != b.arena; }
+
+/// <summary>
+/// Vector whose memory lives in a FrameArena, for the length of a frame
+/// </summary>
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+/// <summary>
+/// Returns how many times operator new has been called since the program started, on any thread.
+/// Only counted in debug builds (when NDEBUG is not defined); release builds always return 0.
+/// Used to check that a frame makes no heap allocations once it is warmed up.
+/// </summary>
+uint64_t GetHeapAllocationCount();
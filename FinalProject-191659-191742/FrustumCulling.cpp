@@ -0,0 +1,228 @@
+#include "FrustumCulling.h"
+#include "D20.h"
+#include "Simd.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+/// <summary>
+/// Struct containing the frustum planes moved into the space of a parent node, ready for testing dice positions
+/// </summary>
+struct LocalFrustum
+{
+    glm::vec4 planes[6];
+    float radiusScale; // d20 circumradius times the scale of the parent
+};
+
+/// <summary>
+/// Moves the frustum planes into the space of the parent node, so that the dice positions can be tested
+/// as they are stored, without building their world positions first.
+/// </summary>
+/// <param name="frustum">Frustum in world space</param>
+/// <param name="parent">World matrix of the node the dice are attached to</param>
+/// <returns>Frustum planes in the space of the parent</returns>
+static LocalFrustum ToParentSpace(const Frustum& frustum, const glm::mat4& parent)
+{
+    // the distance of a world point parent * p from a plane is plane . (parent * p),
+    // which is the same as (plane * parent) . p, so each plane turns into its dot product with the parent's columns.
+    // The planes keep measuring world space distances, so only the radius has to pick up the parent's scale.
+    LocalFrustum local;
+    for (int i = 0; i < 6; i++)
+    {
+        const glm::vec4& plane = frustum.planes[i];
+        local.planes[i] = glm::vec4(glm::dot(plane, parent[0]), glm::dot(plane, parent[1]),
+            glm::dot(plane, parent[2]), glm::dot(plane, parent[3]));
+    }
+
+    float parentScale = std::max(glm::length(glm::vec3(parent[0])),
+        std::max(glm::length(glm::vec3(parent[1])), glm::length(glm::vec3(parent[2]))));
+    local.radiusScale = glm::length(GetD20Corner(0)) * parentScale;
+    return local;
+}
+
+/// <summary>
+/// Extracts the frustum planes from a projection * view matrix, in world space.
+/// </summary>
+/// <param name="viewProj">Projection matrix multiplied by the view matrix</param>
+/// <returns>Frustum with normalized planes</returns>
+Frustum ExtractFrustum(const glm::mat4& viewProj)
+{
+    // A point is inside when -w <= x, y, z <= w in clip space. Each of those six conditions is a plane,
+    // made from the rows of the matrix (glm stores columns, so row i is viewProj[0][i], viewProj[1][i], ...).
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+    {
+        rows[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+    }
+
+    Frustum frustum;
+    frustum.planes[0] = rows[3] + rows[0];  // left
+    frustum.planes[1] = rows[3] - rows[0];  // right
+    frustum.planes[2] = rows[3] + rows[1];  // bottom
+    frustum.planes[3] = rows[3] - rows[1];  // top
+    frustum.planes[4] = rows[3] + rows[2];  // near
+    frustum.planes[5] = rows[3] - rows[2];  // far
+
+    // normalize, so that the plane equations give distances that can be compared with a radius
+    for (glm::vec4& plane : frustum.planes)
+    {
+        plane *= 1.0f / glm::length(glm::vec3(plane));
+    }
+
+    return frustum;
+}
+
+/// <summary>
+/// Tests the bounding sphere of every die in a range (the circumsphere of the d20, scaled with the die)
+/// against the frustum, and writes the indices of the dice that are at least partly inside it.
+/// Tests SIMD_WIDTH dice at once straight from the structure of arrays in the transform system.
+/// </summary>
+/// <param name="frustum">Frustum to test against</param>
+/// <param name="transforms">Transform system holding the dice</param>
+/// <param name="parent">World matrix of the node the dice are attached to (uniform scale only)</param>
+/// <param name="begin">First die to test</param>
+/// <param name="end">One past the last die to test</param>
+/// <param name="visible">Receives the indices of the visible dice in increasing order, needs room for (end - begin)</param>
+/// <returns>Number of visible dice</returns>
+size_t CullDice(const Frustum& frustum, const TransformSystem& transforms, const glm::mat4& parent, size_t begin, size_t end, uint32_t* visible)
+{
+    size_t i = begin;
+    size_t count = 0;
+
+#if SIMD_WIDTH > 1
+    LocalFrustum local = ToParentSpace(frustum, parent);
+
+    SimdFloat planes[6][4];
+    for (int p = 0; p < 6; p++)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            planes[p][k] = SimdSet(local.planes[p][k]);
+        }
+    }
+    const SimdFloat negativeRadiusScale = SimdSet(-local.radiusScale);
+
+    for (; i + SIMD_WIDTH <= end; i += SIMD_WIDTH)
+    {
+        SimdFloat x = SimdLoad(&transforms.posX[i]);
+        SimdFloat y = SimdLoad(&transforms.posY[i]);
+        SimdFloat z = SimdLoad(&transforms.posZ[i]);
+        SimdFloat negativeRadius = SimdMul(SimdLoad(&transforms.scale[i]), negativeRadiusScale);
+
+        // a die is culled as soon as its sphere lies completely behind any one plane
+        SimdFloat outside = SimdLess(SimdMulAdd(planes[0][0], x, SimdMulAdd(planes[0][1], y, SimdMulAdd(planes[0][2], z, planes[0][3]))), negativeRadius);
+        for (int p = 1; p < 6; p++)
+        {
+            SimdFloat distance = SimdMulAdd(planes[p][0], x, SimdMulAdd(planes[p][1], y, SimdMulAdd(planes[p][2], z, planes[p][3])));
+            outside = SimdOr(outside, SimdLess(distance, negativeRadius));
+        }
+
+        // write out the survivors of the batch one after the other
+        int inside = ~SimdMoveMask(outside) & ((1 << SIMD_WIDTH) - 1);
+        while (inside != 0)
+        {
+            int lane = 0;
+            while ((inside & (1 << lane)) == 0)
+            {
+                lane++;
+            }
+            inside &= inside - 1;
+            visible[count++] = static_cast<uint32_t>(i + lane);
+        }
+    }
+#endif
+
+    // leftover dice that do not fill a whole batch
+    return count + CullDiceScalar(frustum, transforms, parent, i, end, visible + count);
+}
+
+/// <summary>
+/// Same as CullDice(), but always uses plain scalar code. Used as a reference and for leftover dice.
+/// </summary>
+size_t CullDiceScalar(const Frustum& frustum, const TransformSystem& transforms, const glm::mat4& parent, size_t begin, size_t end, uint32_t* visible)
+{
+    if (begin >= end)
+    {
+        return 0;
+    }
+
+    LocalFrustum local = ToParentSpace(frustum, parent);
+
+    size_t count = 0;
+    for (size_t i = begin; i < end; i++)
+    {
+        glm::vec4 position(transforms.posX[i], transforms.posY[i], transforms.posZ[i], 1.0f);
+        float radius = transforms.scale[i] * local.radiusScale;
+
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++)
+        {
+            inside = glm::dot(local.planes[p], position) >= -radius;
+        }
+
+        if (inside)
+        {
+            visible[count++] = static_cast<uint32_t>(i);
+        }
+    }
+
+    return count;
+}
+
+/// <summary>
+/// Measures the cost of culling a field of dice scattered around the camera with CullDice() and CullDiceScalar(),
+/// checks that both agree, and prints the result.
+/// </summary>
+/// <param name="diceCount">Number of dice to cull</param>
+void RunCullingBenchmark(int diceCount)
+{
+    const int iterations = 50;
+
+    // scatter the dice in a box around the camera, so that a good part of them ends up behind or beside it
+    std::mt19937 random(30);
+    std::uniform_real_distribution<float> coordinate(-20.0f, 20.0f);
+    TransformSystem transforms;
+    for (int i = 0; i < diceCount; i++)
+    {
+        glm::vec3 position(coordinate(random), coordinate(random), coordinate(random));
+        transforms.Add(position, 0.1f, glm::vec3(0.0f, 1.0f, 0.0f), 1.0f, 0.0f);
+    }
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.5f, 0.0f, 1.25f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 persp = glm::perspective(90.0f, 1.0f, 0.1f, 100.0f);
+    Frustum frustum = ExtractFrustum(persp * view);
+    glm::mat4 parent = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, -1.0f));
+
+    std::vector<uint32_t> simdVisible(diceCount), scalarVisible(diceCount);
+    size_t simdCount = 0, scalarCount = 0;
+
+    auto simdStart = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        simdCount = CullDice(frustum, transforms, parent, 0, transforms.Count(), simdVisible.data());
+    }
+    auto simdEnd = std::chrono::steady_clock::now();
+
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        scalarCount = CullDiceScalar(frustum, transforms, parent, 0, transforms.Count(), scalarVisible.data());
+    }
+    auto scalarEnd = std::chrono::steady_clock::now();
+
+    bool agree = simdCount == scalarCount && std::equal(simdVisible.begin(), simdVisible.begin() + simdCount, scalarVisible.begin());
+
+    double simdNs = std::chrono::duration<double, std::nano>(simdEnd - simdStart).count() / (double(iterations) * diceCount);
+    double scalarNs = std::chrono::duration<double, std::nano>(scalarEnd - simdEnd).count() / (double(iterations) * diceCount);
+
+    std::cout << "culling benchmark: " << diceCount << " dice, " << SIMD_WIDTH << " dice per batch" << std::endl;
+    std::cout << "  visible: " << simdCount << ", culled: " << diceCount - simdCount << std::endl;
+    std::cout << "  scalar: " << scalarNs << " ns per die" << std::endl;
+    std::cout << "  SIMD: " << simdNs << " ns per die (" << scalarNs / simdNs << "x)" << std::endl;
+    std::cout << "  results " << (agree ? "match" : "DO NOT match") << std::endl;
+}
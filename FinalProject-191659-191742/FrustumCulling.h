@@ -0,0 +1,51 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "TransformSystem.h"
+
+/// <summary>
+/// Struct containing the six planes of a view frustum (left, right, bottom, top, near, far).
+/// Every plane is stored as (normal, distance) with a unit normal pointing into the frustum,
+/// so dot(normal, point) + distance is the signed distance of a point from the plane.
+/// </summary>
+struct Frustum
+{
+    glm::vec4 planes[6];
+};
+
+/// <summary>
+/// Extracts the frustum planes from a projection * view matrix, in world space.
+/// </summary>
+/// <param name="viewProj">Projection matrix multiplied by the view matrix</param>
+/// <returns>Frustum with normalized planes</returns>
+Frustum ExtractFrustum(const glm::mat4& viewProj);
+
+/// <summary>
+/// Tests the bounding sphere of every die in a range (the circumsphere of the d20, scaled with the die)
+/// against the frustum, and writes the indices of the dice that are at least partly inside it.
+/// Tests SIMD_WIDTH dice at once straight from the structure of arrays in the transform system.
+/// </summary>
+/// <param name="frustum">Frustum to test against</param>
+/// <param name="transforms">Transform system holding the dice</param>
+/// <param name="parent">World matrix of the node the dice are attached to (uniform scale only)</param>
+/// <param name="begin">First die to test</param>
+/// <param name="end">One past the last die to test</param>
+/// <param name="visible">Receives the indices of the visible dice in increasing order, needs room for (end - begin)</param>
+/// <returns>Number of visible dice</returns>
+size_t CullDice(const Frustum& frustum, const TransformSystem& transforms, const glm::mat4& parent, size_t begin, size_t end, uint32_t* visible);
+
+/// <summary>
+/// Same as CullDice(), but always uses plain scalar code. Used as a reference and for leftover dice.
+/// </summary>
+size_t CullDiceScalar(const Frustum& frustum, const TransformSystem& transforms, const glm::mat4& parent, size_t begin, size_t end, uint32_t* visible);
+
+/// <summary>
+/// Measures the cost of culling a field of dice scattered around the camera with CullDice() and CullDiceScalar(),
+/// checks that both agree, and prints the result.
+/// </summary>
+/// <param name="diceCount">Number of dice to cull</param>
+void RunCullingBenchmark(int diceCount);
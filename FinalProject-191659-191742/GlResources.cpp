@@ -0,0 +1,268 @@
+#include "GlResources.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+/// <summary>
+/// Struct containing what the registry knows about one live object
+/// </summary>
+struct GlResourceEntry
+{
+    std::string label;
+    size_t bytes;
+};
+
+/// <summary>
+/// Struct containing the live objects of one kind and their totals
+/// </summary>
+struct GlResourceTable
+{
+    std::unordered_map<GLuint, GlResourceEntry> live;
+    size_t bytes = 0;
+    size_t peakBytes = 0;
+    size_t created = 0;
+};
+
+static GlResourceTable glResourceTables[glResourceTypeCount];
+
+static const char* glResourceTypeNames[glResourceTypeCount] = {
+    "buffer", "texture", "program", "vertex array", "framebuffer", "renderbuffer"
+};
+
+/// <summary>
+/// Creates an OpenGL object and registers it.
+/// </summary>
+/// <param name="type">Kind of object</param>
+/// <param name="label">What the object is for, shown in the summary and the leak report</param>
+/// <returns>OpenGL handle to the object</returns>
+GLuint CreateGlResource(GlResourceType type, const std::string& label)
+{
+    GLuint name = 0;
+    switch (type)
+    {
+    case GlResourceType::Buffer: glGenBuffers(1, &name); break;
+    case GlResourceType::Texture: glGenTextures(1, &name); break;
+    case GlResourceType::Program: name = glCreateProgram(); break;
+    case GlResourceType::VertexArray: glGenVertexArrays(1, &name); break;
+    case GlResourceType::Framebuffer: glGenFramebuffers(1, &name); break;
+    case GlResourceType::Renderbuffer: glGenRenderbuffers(1, &name); break;
+    }
+
+    if (name == 0)
+    {
+        std::cerr << "Failed to create " << label << "!" << std::endl;
+        return 0;
+    }
+
+    GlResourceTable& table = glResourceTables[static_cast<int>(type)];
+    table.live[name] = { label, 0 };
+    table.created++;
+    return name;
+}
+
+/// <summary>
+/// Deletes an OpenGL object created by CreateGlResource() and sets the handle to 0. A handle of 0 is ignored.
+/// </summary>
+/// <param name="type">Kind of object</param>
+/// <param name="name">OpenGL handle to the object</param>
+void DeleteGlResource(GlResourceType type, GLuint& name)
+{
+    if (name == 0)
+    {
+        return;
+    }
+
+    switch (type)
+    {
+    case GlResourceType::Buffer: glDeleteBuffers(1, &name); break;
+    case GlResourceType::Texture: glDeleteTextures(1, &name); break;
+    case GlResourceType::Program: glDeleteProgram(name); break;
+    case GlResourceType::VertexArray: glDeleteVertexArrays(1, &name); break;
+    case GlResourceType::Framebuffer: glDeleteFramebuffers(1, &name); break;
+    case GlResourceType::Renderbuffer: glDeleteRenderbuffers(1, &name); break;
+    }
+
+    GlResourceTable& table = glResourceTables[static_cast<int>(type)];
+    auto entry = table.live.find(name);
+    if (entry == table.live.end())
+    {
+        // deleted twice, or created without the registry: either way the totals would be off from here on
+        std::cerr << "Deleted a " << glResourceTypeNames[static_cast<int>(type)] << " (" << name
+            << ") that the resource registry does not know about!" << std::endl;
+    }
+    else
+    {
+        table.bytes -= entry->second.bytes;
+        table.live.erase(entry);
+    }
+    name = 0;
+}
+
+/// <summary>
+/// Records how much memory an object's storage takes, replacing what was recorded before.
+/// </summary>
+/// <param name="type">Kind of object</param>
+/// <param name="name">OpenGL handle to the object</param>
+/// <param name="bytes">Size of its storage in bytes</param>
+void SetGlResourceBytes(GlResourceType type, GLuint name, size_t bytes)
+{
+    GlResourceTable& table = glResourceTables[static_cast<int>(type)];
+    auto entry = table.live.find(name);
+    if (entry == table.live.end())
+    {
+        return;
+    }
+    table.bytes = table.bytes - entry->second.bytes + bytes;
+    table.peakBytes = std::max(table.peakBytes, table.bytes);
+    entry->second.bytes = bytes;
+}
+
+/// <summary>
+/// Estimates the memory of a texture or renderbuffer (drivers pad 3-component and 24-bit formats to 4 bytes per texel).
+/// </summary>
+/// <param name="internalFormat">Sized internal format, such as GL_RGBA8</param>
+/// <param name="width">Width of level 0 in texels</param>
+/// <param name="height">Height of level 0 in texels</param>
+/// <param name="mipmapped">Whether it has a full mipmap chain</param>
+/// <returns>Estimated size in bytes</returns>
+size_t GetGlTextureBytes(GLenum internalFormat, int width, int height, bool mipmapped)
+{
+    size_t texelBytes;
+    switch (internalFormat)
+    {
+    case GL_R8:
+        texelBytes = 1;
+        break;
+    case GL_RG8: case GL_R16F: case GL_R16UI: case GL_DEPTH_COMPONENT16:
+        texelBytes = 2;
+        break;
+    case GL_RG16F: case GL_R32F: case GL_R32UI:
+        texelBytes = 4;
+        break;
+    case GL_RGB16F: case GL_RGBA16F: case GL_RG32F:
+        texelBytes = 8;
+        break;
+    case GL_RGB32F: case GL_RGBA32F:
+        texelBytes = 16;
+        break;
+    default:
+        // GL_RGBA8, GL_RGB8, GL_SRGB8_ALPHA8, GL_DEPTH_COMPONENT24, GL_DEPTH24_STENCIL8, GL_DEPTH_COMPONENT32F, ...
+        texelBytes = 4;
+        break;
+    }
+
+    size_t bytes = 0;
+    for (;;)
+    {
+        bytes += static_cast<size_t>(width) * height * texelBytes;
+        if (!mipmapped || (width == 1 && height == 1))
+        {
+            return bytes;
+        }
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+    }
+}
+
+/// <summary>
+/// Returns the total memory of the live objects of one kind.
+/// </summary>
+size_t GetGlResourceBytes(GlResourceType type)
+{
+    return glResourceTables[static_cast<int>(type)].bytes;
+}
+
+/// <summary>
+/// Prints, for every kind of object, how many are alive and how much memory they hold (now and at most so far),
+/// and the memory held per label.
+/// </summary>
+void PrintGlResourceSummary(std::ostream& out)
+{
+    const double mb = 1024.0 * 1024.0;
+    size_t totalBytes = 0;
+
+    out << std::fixed << std::setprecision(2);
+    out << "gl resources:" << std::endl;
+    for (int type = 0; type < glResourceTypeCount; type++)
+    {
+        const GlResourceTable& table = glResourceTables[type];
+        out << "  " << std::left << std::setw(14) << std::string(glResourceTypeNames[type]) + "s" << std::right << std::setw(6) << table.live.size()
+            << " live (" << table.created << " created), " << std::setw(8) << table.bytes / mb << " MB, peak "
+            << table.peakBytes / mb << " MB" << std::endl;
+        totalBytes += table.bytes;
+    }
+    out << "  total " << totalBytes / mb << " MB" << std::endl;
+
+    // what the memory is spent on, biggest first (objects with the same label are added up)
+    std::map<std::string, std::pair<size_t, size_t>> labels;    // label -> count, bytes
+    for (const GlResourceTable& table : glResourceTables)
+    {
+        for (const auto& entry : table.live)
+        {
+            std::pair<size_t, size_t>& label = labels[entry.second.label];
+            label.first++;
+            label.second += entry.second.bytes;
+        }
+    }
+    std::vector<std::pair<std::string, std::pair<size_t, size_t>>> sorted(labels.begin(), labels.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second.second > b.second.second; });
+    for (const auto& label : sorted)
+    {
+        if (label.second.second > 0)
+        {
+            out << "    " << std::setw(8) << label.second.second / mb << " MB  " << label.first;
+            if (label.second.first > 1)
+            {
+                out << " (" << label.second.first << ")";
+            }
+            out << std::endl;
+        }
+    }
+    out << std::defaultfloat << std::setprecision(6);
+}
+
+/// <summary>
+/// Prints every object that is still alive. Meant for shutdown, after everything should have been deleted.
+/// </summary>
+/// <returns>Number of objects still alive</returns>
+size_t ReportGlResourceLeaks(std::ostream& out)
+{
+    size_t leaked = 0;
+    size_t leakedBytes = 0;
+    for (int type = 0; type < glResourceTypeCount; type++)
+    {
+        // sorted by handle, so the report reads in creation order (more or less)
+        std::vector<std::pair<GLuint, const GlResourceEntry*>> live;
+        for (const auto& entry : glResourceTables[type].live)
+        {
+            live.push_back({ entry.first, &entry.second });
+        }
+        std::sort(live.begin(), live.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        for (const auto& entry : live)
+        {
+            out << "gl resources: leaked " << glResourceTypeNames[type] << " " << entry.first << " (" << entry.second->label;
+            if (entry.second->bytes > 0)
+            {
+                out << ", " << entry.second->bytes / 1024 << " KB";
+            }
+            out << ")" << std::endl;
+            leaked++;
+            leakedBytes += entry.second->bytes;
+        }
+    }
+
+    if (leaked == 0)
+    {
+        out << "gl resources: everything was deleted" << std::endl;
+    }
+    else
+    {
+        out << "gl resources: " << leaked << " objects (" << leakedBytes / 1024 << " KB) were never deleted" << std::endl;
+    }
+    return leaked;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+
+/// <summary>
+/// Kinds of OpenGL objects the resource registry keeps track of
+/// </summary>
+enum class GlResourceType
+{
+    Buffer,
+    Texture,
+    Program,
+    VertexArray,
+    Framebuffer,
+    Renderbuffer
+};
+
+const int glResourceTypeCount = 6;
+
+// Every buffer, texture, program, vertex array, framebuffer and renderbuffer is created with CreateGlResource() and
+// deleted with DeleteGlResource(), so the registry knows what is alive, what it is for, and roughly how much GPU memory
+// it holds (as told by SetGlResourceBytes() whenever its storage is (re)specified). Like the GL calls themselves,
+// these functions may only be called from the thread the context is current on.
+
+/// <summary>
+/// Creates an OpenGL object and registers it.
+/// </summary>
+/// <param name="type">Kind of object</param>
+/// <param name="label">What the object is for, shown in the summary and the leak report</param>
+/// <returns>OpenGL handle to the object</returns>
+GLuint CreateGlResource(GlResourceType type, const std::string& label);
+
+/// <summary>
+/// Deletes an OpenGL object created by CreateGlResource() and sets the handle to 0. A handle of 0 is ignored.
+/// </summary>
+/// <param name="type">Kind of object</param>
+/// <param name="name">OpenGL handle to the object</param>
+void DeleteGlResource(GlResourceType type, GLuint& name);
+
+/// <summary>
+/// Records how much memory an object's storage takes, replacing what was recorded before.
+/// </summary>
+/// <param name="type">Kind of object</param>
+/// <param name="name">OpenGL handle to the object</param>
+/// <param name="bytes">Size of its storage in bytes</param>
+void SetGlResourceBytes(GlResourceType type, GLuint name, size_t bytes);
+
+/// <summary>
+/// Estimates the memory of a texture or renderbuffer (drivers pad 3-component and 24-bit formats to 4 bytes per texel).
+/// </summary>
+/// <param name="internalFormat">Sized internal format, such as GL_RGBA8</param>
+/// <param name="width">Width of level 0 in texels</param>
+/// <param name="height">Height of level 0 in texels</param>
+/// <param name="mipmapped">Whether it has a full mipmap chain</param>
+/// <returns>Estimated size in bytes</returns>
+size_t GetGlTextureBytes(GLenum internalFormat, int width, int height, bool mipmapped);
+
+/// <summary>
+/// Returns the total memory of the live objects of one kind.
+/// </summary>
+size_t GetGlResourceBytes(GlResourceType type);
+
+/// <summary>
+/// Prints, for every kind of object, how many are alive and how much memory they hold (now and at most so far),
+/// and the memory held per label.
+/// </summary>
+void PrintGlResourceSummary(std::ostream& out);
+
+/// <summary>
+/// Prints every object that is still alive. Meant for shutdown, after everything should have been deleted.
+/// </summary>
+/// <returns>Number of objects still alive</returns>
+size_t ReportGlResourceLeaks(std::ostream& out);
@@ -0,0 +1,426 @@
+#include "GpuCulling.h"
+#include "FrustumCulling.h"
+#include "GlResources.h"
+#include "JobSystem.h"
+#include "TransformSystem.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+const char* const gpuCullVaryings[gpuCullVaryingCount] = {
+    "feedbackBase", "feedbackSpin", "feedbackSpinPhase", "feedbackMaterial"
+};
+
+// smallest room a level starts with, so that a level with few dice does not overflow over and over while the camera moves
+static const size_t minLevelCapacity = 256;
+
+/// <summary>
+/// Points vertex attributes 8 to 14 of the currently bound vertex array object at a buffer of SpinInstances,
+/// like BindSpinAttributes() in Main.cpp, but as plain per-vertex attributes: the culling passes draw one point per die.
+/// </summary>
+/// <param name="buffer">Buffer containing one SpinInstance per die</param>
+/// <param name="firstInstance">Index of the instance the first point reads</param>
+static void BindCullAttributes(GLuint buffer, size_t firstInstance)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+    size_t base = firstInstance * sizeof(SpinInstance);
+    for (GLuint column = 0; column < 4; column++)
+    {
+        glVertexAttribPointer(8 + column, 4, GL_FLOAT, GL_FALSE, sizeof(SpinInstance),
+            (void*)(base + offsetof(SpinInstance, base) + column * sizeof(glm::vec4)));
+    }
+    glVertexAttribIPointer(12, 1, GL_UNSIGNED_INT, sizeof(SpinInstance), (void*)(base + offsetof(SpinInstance, material)));
+    glVertexAttribPointer(13, 4, GL_FLOAT, GL_FALSE, sizeof(SpinInstance), (void*)(base + offsetof(SpinInstance, spin)));
+    glVertexAttribPointer(14, 1, GL_FLOAT, GL_FALSE, sizeof(SpinInstance), (void*)(base + offsetof(SpinInstance, spinPhase)));
+}
+
+/// <summary>
+/// Creates the vertex array the passes read the instances through, and the queries.
+/// </summary>
+/// <param name="program">Program made of cull.vsh and cull.gsh, linked with gpuCullVaryings captured interleaved</param>
+GpuCuller::GpuCuller(GLuint program)
+    : program(program)
+{
+    std::fill(levelCapacity, levelCapacity + d20LodCount, 0);
+
+    vao = CreateGlResource(GlResourceType::VertexArray, "gpu cull instances");
+    glBindVertexArray(vao);
+    for (GLuint location = 8; location < 15; location++)
+    {
+        glEnableVertexAttribArray(location);
+    }
+    glBindVertexArray(0);
+
+    for (Slot& slot : slots)
+    {
+        slot.buffer = CreateGlResource(GlResourceType::Buffer, "gpu cull survivors");
+        glGenQueries(d20LodCount, slot.writtenQueries);
+        glGenQueries(d20LodCount, slot.generatedQueries);
+        glGenQueries(2, slot.timeQueries);
+    }
+}
+
+/// <summary>
+/// Deletes the buffers, the vertex array and the queries. Must be called while the context is still current.
+/// </summary>
+void GpuCuller::Delete()
+{
+    for (Slot& slot : slots)
+    {
+        DeleteGlResource(GlResourceType::Buffer, slot.buffer);
+        glDeleteQueries(d20LodCount, slot.writtenQueries);
+        glDeleteQueries(d20LodCount, slot.generatedQueries);
+        glDeleteQueries(2, slot.timeQueries);
+        slot.issued = false;
+    }
+    DeleteGlResource(GlResourceType::VertexArray, vao);
+}
+
+/// <summary>
+/// Forgets every pass issued so far, so that FetchResult() has nothing until gpuCullLatency frames of new passes.
+/// Call it whenever the instances change, or when frames go by without culling.
+/// </summary>
+void GpuCuller::Invalidate()
+{
+    for (Slot& slot : slots)
+    {
+        slot.issued = false;
+    }
+}
+
+/// <summary>
+/// Picks up the survivors of the passes issued gpuCullLatency frames ago. Call it once per frame, before Cull().
+/// </summary>
+/// <param name="result">Receives the survivors</param>
+/// <returns>Whether there are survivors to draw: false for the first frames, if the GPU has not finished the passes
+/// yet, or if a level overflowed (draw every die then)</returns>
+bool GpuCuller::FetchResult(GpuCullResult& result)
+{
+    // The slot after the one Cull() writes next holds the oldest passes. Its buffer is drawn from this frame
+    // and only written again the frame after, so drawing and writing it never overlap.
+    Slot& slot = slots[(nextSlot + 1) % slotCount];
+    if (!slot.issued)
+    {
+        return false;
+    }
+    slot.issued = false;
+
+    // Like the GPU timer of the dynamic resolution, a result that is not there yet is dropped rather than waited for
+    // (every die is drawn instead). The passes ran gpuCullLatency frames ago, so that almost never happens.
+    GLint available = 0;
+    for (int level = 0; level < d20LodCount; level++)
+    {
+        glGetQueryObjectiv(slot.writtenQueries[level], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            return false;
+        }
+        glGetQueryObjectiv(slot.generatedQueries[level], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            return false;
+        }
+    }
+    glGetQueryObjectiv(slot.timeQueries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+    {
+        return false;
+    }
+
+    // A level whose range was too small stops writing when it is full, so some of its dice are missing:
+    // that frame draws every die instead, and the level gets a quarter more room than it needed from the next passes on.
+    bool overflowed = false;
+    size_t firstInstance = 0;
+    for (int level = 0; level < d20LodCount; level++)
+    {
+        GLuint written = 0, generated = 0;
+        glGetQueryObjectuiv(slot.writtenQueries[level], GL_QUERY_RESULT, &written);
+        glGetQueryObjectuiv(slot.generatedQueries[level], GL_QUERY_RESULT, &generated);
+        if (generated > written)
+        {
+            overflowed = true;
+            levelCapacity[level] = std::max(levelCapacity[level], static_cast<size_t>(generated) + generated / 4);
+        }
+        result.levelFirstInstance[level] = firstInstance;
+        result.levelInstanceCount[level] = written;
+        firstInstance += slot.capacity[level];
+    }
+
+    GLuint64 start = 0, end = 0;
+    glGetQueryObjectui64v(slot.timeQueries[0], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(slot.timeQueries[1], GL_QUERY_RESULT, &end);
+    result.buffer = slot.buffer;
+    result.gpuMs = (end - start) * 1e-6;
+    return !overflowed;
+}
+
+/// <summary>
+/// Issues this frame's culling passes over a range of the static instances. Leaves no program, vertex array
+/// or transform feedback buffer bound.
+/// </summary>
+/// <param name="spinVbo">Buffer containing one SpinInstance per die</param>
+/// <param name="firstDie">First die to cull</param>
+/// <param name="dieCount">Number of dice to cull</param>
+/// <param name="viewProj">Projection matrix multiplied by the view matrix</param>
+/// <param name="depthPlane">Plane whose equation gives the view depth of a world space point</param>
+/// <param name="radiusPerDepth">Smallest ratio of bounding radius to view depth for each level but the last</param>
+void GpuCuller::Cull(GLuint spinVbo, size_t firstDie, size_t dieCount, const glm::mat4& viewProj, const glm::vec4& depthPlane,
+    const float* radiusPerDepth)
+{
+    Slot& slot = slots[nextSlot];
+    nextSlot = (nextSlot + 1) % slotCount;
+    slot.issued = false;
+    if (dieCount == 0)
+    {
+        return;
+    }
+
+    // every level starts with an even share of the dice, and grows when it overflows (but never past every die)
+    bool resized = false;
+    size_t totalCapacity = 0;
+    for (int level = 0; level < d20LodCount; level++)
+    {
+        if (levelCapacity[level] == 0)
+        {
+            levelCapacity[level] = std::max(dieCount / d20LodCount, minLevelCapacity);
+        }
+        size_t capacity = std::min(levelCapacity[level], dieCount);
+        resized |= capacity != slot.capacity[level];
+        slot.capacity[level] = capacity;
+        totalCapacity += capacity;
+    }
+    if (resized)
+    {
+        glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, slot.buffer);
+        glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, totalCapacity * sizeof(SpinInstance), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+        SetGlResourceBytes(GlResourceType::Buffer, slot.buffer, totalCapacity * sizeof(SpinInstance));
+    }
+
+    // (timestamps rather than a GL_TIME_ELAPSED query, which cannot nest inside the one the dynamic resolution keeps open)
+    glQueryCounter(slot.timeQueries[0], GL_TIMESTAMP);
+
+    Frustum frustum = ExtractFrustum(viewProj);
+    glUseProgram(program);
+    glUniform4fv(glGetUniformLocation(program, "frustumPlanes"), 6, glm::value_ptr(frustum.planes[0]));
+    glUniform4fv(glGetUniformLocation(program, "depthPlane"), 1, glm::value_ptr(depthPlane));
+    glUniform1fv(glGetUniformLocation(program, "radiusPerDepth"), d20LodCount - 1, radiusPerDepth);
+    glUniform1f(glGetUniformLocation(program, "circumradius"), glm::length(GetD20Corner(0)));
+
+    glBindVertexArray(vao);
+    BindCullAttributes(spinVbo, firstDie);
+
+    // One point per die, with nothing drawn: the geometry shader passes on the dice of one level, and transform feedback
+    // appends them to that level's range. The queries count how many it wrote, and how many it would have written.
+    glEnable(GL_RASTERIZER_DISCARD);
+    size_t firstInstance = 0;
+    for (int level = 0; level < d20LodCount; level++)
+    {
+        glUniform1i(glGetUniformLocation(program, "lodLevel"), level);
+        glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, slot.buffer, firstInstance * sizeof(SpinInstance),
+            slot.capacity[level] * sizeof(SpinInstance));
+        glBeginQuery(GL_PRIMITIVES_GENERATED, slot.generatedQueries[level]);
+        glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, slot.writtenQueries[level]);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(dieCount));
+        glEndTransformFeedback();
+        glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+        glEndQuery(GL_PRIMITIVES_GENERATED);
+        firstInstance += slot.capacity[level];
+    }
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
+
+    glQueryCounter(slot.timeQueries[1], GL_TIMESTAMP);
+    slot.issued = true;
+}
+
+/// <summary>
+/// Compares culling dice scattered in front of the camera on the CPU (frustum culling and sorting into detail levels
+/// on the job system) and on the GPU (issued and waited for), for growing numbers of dice up to maxDice, checks that both
+/// keep the same dice in every level, and prints from which count on the GPU takes less time.
+/// Needs a current OpenGL context.
+/// </summary>
+/// <param name="program">Program made of cull.vsh and cull.gsh (see GpuCuller)</param>
+/// <param name="jobSystem">Job system for the CPU culling</param>
+/// <param name="maxDice">Largest number of dice to cull</param>
+void RunGpuCullingBenchmark(GLuint program, JobSystem& jobSystem, int maxDice)
+{
+    const int iterations = 50;
+    // frames before the GPU timings count: the first results arrive gpuCullLatency frames late, and the levels may
+    // still have to grow
+    const int warmupFrames = 4 * (gpuCullLatency + 1);
+    const size_t grainSize = 1024;
+    const int viewportHeight = 800;
+
+    // the same camera as the culling benchmark, with the dice in a box around it
+    glm::mat4 view = glm::lookAt(glm::vec3(0.5f, 0.0f, 1.25f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 persp = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 100.0f);
+    glm::mat4 viewProj = persp * view;
+    Frustum frustum = ExtractFrustum(viewProj);
+    glm::vec4 depthPlane = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+    glm::mat4 parent(1.0f);
+    float radiusPerDepth[d20LodCount - 1];
+    for (int level = 0; level < d20LodCount - 1; level++)
+    {
+        radiusPerDepth[level] = GetRadiusPerDepth(persp, viewportHeight, d20LodPixelRadius[level]);
+    }
+
+    std::vector<int> diceCounts;
+    for (int count = 1024; count < maxDice; count *= 4)
+    {
+        diceCounts.push_back(count);
+    }
+    diceCounts.push_back(std::max(maxDice, 1));
+
+    GpuCuller culler(program);
+    GLuint instanceVbo = CreateGlResource(GlResourceType::Buffer, "gpu cull benchmark instances");
+
+    std::cout << "GPU culling benchmark: " << iterations << " frames per count, " << jobSystem.ThreadCount()
+        << " threads for the CPU" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    int crossover = 0;
+    for (int diceCount : diceCounts)
+    {
+        std::mt19937 random(30);
+        std::uniform_real_distribution<float> coordinate(-20.0f, 20.0f);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        TransformSystem transforms;
+        for (int i = 0; i < diceCount; i++)
+        {
+            glm::vec3 position(coordinate(random), coordinate(random), coordinate(random));
+            glm::vec3 axis = glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.0f, 0.0f, 0.01f);
+            transforms.Add(position, 0.1f, axis, 1.0f, 0.0f);
+        }
+
+        std::vector<SpinInstance> spinInstances(diceCount);
+        transforms.ComposeSpin(parent, 0, diceCount, spinInstances.data());
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+        glBufferData(GL_ARRAY_BUFFER, spinInstances.size() * sizeof(SpinInstance), spinInstances.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        SetGlResourceBytes(GlResourceType::Buffer, instanceVbo, spinInstances.size() * sizeof(SpinInstance));
+
+        // CPU: frustum culling and sorting into levels in parallel chunks, as every frame does
+        size_t chunkCount = (diceCount + grainSize - 1) / grainSize;
+        std::vector<uint32_t> visibleDice(diceCount);
+        std::vector<uint32_t> levelDice[d20LodCount];
+        for (std::vector<uint32_t>& dice : levelDice)
+        {
+            dice.resize(diceCount);
+        }
+        std::vector<size_t> chunkLevelCount(chunkCount * d20LodCount);
+        auto cpuStart = std::chrono::steady_clock::now();
+        for (int iteration = 0; iteration < iterations; iteration++)
+        {
+            jobSystem.ParallelFor("cull", diceCount, grainSize, [&](size_t begin, size_t end)
+            {
+                size_t chunk = begin / grainSize;
+                size_t visible = CullDice(frustum, transforms, parent, begin, end, visibleDice.data() + begin);
+
+                uint32_t* levels[d20LodCount];
+                size_t* counts = chunkLevelCount.data() + chunk * d20LodCount;
+                for (int level = 0; level < d20LodCount; level++)
+                {
+                    levels[level] = levelDice[level].data() + begin;
+                    counts[level] = 0;
+                }
+                SortDiceByScreenSize(transforms, parent, depthPlane, radiusPerDepth, d20LodCount, visibleDice.data() + begin,
+                    visible, levels, counts);
+            });
+        }
+        double cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpuStart).count() / iterations;
+        size_t cpuLevelCount[d20LodCount] = {};
+        for (size_t chunk = 0; chunk < chunkCount; chunk++)
+        {
+            for (int level = 0; level < d20LodCount; level++)
+            {
+                cpuLevelCount[level] += chunkLevelCount[chunk * d20LodCount + level];
+            }
+        }
+
+        // GPU: one frame after another, each waited for, so that every timing covers the passes alone.
+        // The CPU side is only the time to issue them. Some drivers (software ones in particular) do the work while it
+        // is issued, which the timer queries miss, so the cost that counts is the time until glFinish() returns.
+        culler.Invalidate();
+        GpuCullResult result;
+        size_t gpuLevelCount[d20LodCount] = {};
+        double gpuMs = 0.0, issueMs = 0.0, finishMs = 0.0;
+        int gpuFrames = 0;
+        for (int frame = 0; frame < warmupFrames + iterations; frame++)
+        {
+            bool fetched = culler.FetchResult(result);
+            if (fetched && frame >= warmupFrames)
+            {
+                gpuMs += result.gpuMs;
+                gpuFrames++;
+                std::copy(result.levelInstanceCount, result.levelInstanceCount + d20LodCount, gpuLevelCount);
+            }
+
+            auto issueStart = std::chrono::steady_clock::now();
+            culler.Cull(instanceVbo, 0, diceCount, viewProj, depthPlane, radiusPerDepth);
+            auto issueEnd = std::chrono::steady_clock::now();
+            glFinish();
+            if (frame >= warmupFrames)
+            {
+                issueMs += std::chrono::duration<double, std::milli>(issueEnd - issueStart).count();
+                finishMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - issueStart).count();
+            }
+        }
+        gpuMs /= std::max(gpuFrames, 1);
+        issueMs /= iterations;
+        finishMs /= iterations;
+
+        size_t cpuVisible = 0, gpuVisible = 0;
+        bool levelsAgree = true;
+        for (int level = 0; level < d20LodCount; level++)
+        {
+            cpuVisible += cpuLevelCount[level];
+            gpuVisible += gpuLevelCount[level];
+            levelsAgree &= cpuLevelCount[level] == gpuLevelCount[level];
+        }
+
+        std::cout << "  " << std::setw(8) << diceCount << " dice: CPU " << cpuMs << " ms, GPU " << finishMs << " ms until finished ("
+            << issueMs << " ms to issue, " << gpuMs << " ms GPU timer), " << cpuVisible << " visible on the CPU, " << gpuVisible << " on the GPU";
+        if (gpuFrames == 0)
+        {
+            std::cout << " (no GPU result arrived)";
+        }
+        else if (!levelsAgree)
+        {
+            std::cout << " (levels differ)";
+        }
+        std::cout << std::endl;
+
+        if (crossover == 0 && gpuFrames > 0 && finishMs < cpuMs)
+        {
+            crossover = diceCount;
+        }
+    }
+    std::cout << std::defaultfloat << std::setprecision(6);
+
+    if (crossover > 0)
+    {
+        std::cout << "  crossover: GPU culling takes less time than CPU culling from " << crossover << " dice on" << std::endl;
+    }
+    else
+    {
+        std::cout << "  crossover: CPU culling stays cheaper up to " << diceCounts.back() << " dice" << std::endl;
+    }
+
+    culler.Delete();
+    DeleteGlResource(GlResourceType::Buffer, instanceVbo);
+}
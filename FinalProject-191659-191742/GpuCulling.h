@@ -0,0 +1,119 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+#include "D20Lod.h"
+
+class JobSystem;
+
+// Outputs of cull.gsh captured by transform feedback, in the order of the members of SpinInstance,
+// so that the survivors can be drawn with the same vertex attributes as the static instances
+extern const char* const gpuCullVaryings[];
+const int gpuCullVaryingCount = 4;
+
+// How many frames pass between issuing the culling passes and drawing their survivors: the query results
+// that say how many survived are only read that late, so reading them (almost) never waits for the GPU
+const int gpuCullLatency = 2;
+
+/// <summary>
+/// Struct containing the survivors of one frame's culling passes, ready to be drawn from
+/// </summary>
+struct GpuCullResult
+{
+    GLuint buffer = 0;                          // one SpinInstance per survivor, level after level
+    size_t levelFirstInstance[d20LodCount];     // where each level starts in the buffer, in instances
+    size_t levelInstanceCount[d20LodCount];     // how many dice of each level survived
+    double gpuMs = 0.0;                         // GPU time of the passes
+};
+
+/// <summary>
+/// Culls the dice of GPU spin mode on the GPU. A vertex shader (cull.vsh) tests the bounding sphere of every static
+/// instance against the view frustum and picks its detail level from its size on screen, and a geometry shader
+/// (cull.gsh) writes the instances of one level into a buffer with transform feedback, with the rasterizer off.
+/// OpenGL 3.3 has a single transform feedback stream, so there is one pass per level, each into its own range.
+/// The number of survivors of each level comes from GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN queries, read
+/// gpuCullLatency frames later: the buffers and queries form a ring, and the dice drawn in a frame are the ones that
+/// survived culling that many frames before (their spin still comes from the current time, so they are drawn where
+/// they are now). A level that did not fit into its range makes that frame fall back to drawing every die,
+/// and the range grows.
+/// </summary>
+class GpuCuller
+{
+public:
+    /// <summary>
+    /// Creates the vertex array the passes read the instances through, and the queries.
+    /// </summary>
+    /// <param name="program">Program made of cull.vsh and cull.gsh, linked with gpuCullVaryings captured interleaved</param>
+    explicit GpuCuller(GLuint program);
+
+    GpuCuller(const GpuCuller&) = delete;
+    GpuCuller& operator=(const GpuCuller&) = delete;
+
+    /// <summary>
+    /// Deletes the buffers, the vertex array and the queries. Must be called while the context is still current.
+    /// </summary>
+    void Delete();
+
+    /// <summary>
+    /// Forgets every pass issued so far, so that FetchResult() has nothing until gpuCullLatency frames of new passes.
+    /// Call it whenever the instances change, or when frames go by without culling.
+    /// </summary>
+    void Invalidate();
+
+    /// <summary>
+    /// Picks up the survivors of the passes issued gpuCullLatency frames ago. Call it once per frame, before Cull().
+    /// </summary>
+    /// <param name="result">Receives the survivors</param>
+    /// <returns>Whether there are survivors to draw: false for the first frames, if the GPU has not finished the passes
+    /// yet, or if a level overflowed (draw every die then)</returns>
+    bool FetchResult(GpuCullResult& result);
+
+    /// <summary>
+    /// Issues this frame's culling passes over a range of the static instances. Leaves no program, vertex array
+    /// or transform feedback buffer bound.
+    /// </summary>
+    /// <param name="spinVbo">Buffer containing one SpinInstance per die</param>
+    /// <param name="firstDie">First die to cull</param>
+    /// <param name="dieCount">Number of dice to cull</param>
+    /// <param name="viewProj">Projection matrix multiplied by the view matrix</param>
+    /// <param name="depthPlane">Plane whose equation gives the view depth of a world space point</param>
+    /// <param name="radiusPerDepth">Smallest ratio of bounding radius to view depth for each level but the last</param>
+    void Cull(GLuint spinVbo, size_t firstDie, size_t dieCount, const glm::mat4& viewProj, const glm::vec4& depthPlane,
+        const float* radiusPerDepth);
+
+private:
+    /// <summary>
+    /// Struct containing one entry of the ring: the buffer the passes write into, and their queries
+    /// </summary>
+    struct Slot
+    {
+        GLuint buffer = 0;
+        size_t capacity[d20LodCount] = {};      // room for each level, in instances (the levels lie one after the other)
+        GLuint writtenQueries[d20LodCount] = {};
+        GLuint generatedQueries[d20LodCount] = {};
+        GLuint timeQueries[2] = {};             // timestamps before and after the passes
+        bool issued = false;
+    };
+
+    static const int slotCount = gpuCullLatency + 1;
+
+    GLuint program;
+    GLuint vao = 0;
+    Slot slots[slotCount];
+    int nextSlot = 0;
+    size_t levelCapacity[d20LodCount];  // room every level gets the next time a buffer is (re)allocated
+};
+
+/// <summary>
+/// Compares culling dice scattered in front of the camera on the CPU (frustum culling and sorting into detail levels
+/// on the job system) and on the GPU (issued and waited for), for growing numbers of dice up to maxDice, checks that both
+/// keep the same dice in every level, and prints from which count on the GPU takes less time.
+/// Needs a current OpenGL context.
+/// </summary>
+/// <param name="program">Program made of cull.vsh and cull.gsh (see GpuCuller)</param>
+/// <param name="jobSystem">Job system for the CPU culling</param>
+/// <param name="maxDice">Largest number of dice to cull</param>
+void RunGpuCullingBenchmark(GLuint program, JobSystem& jobSystem, int maxDice);
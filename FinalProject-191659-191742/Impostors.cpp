@@ -0,0 +1,188 @@
+#include "Impostors.h"
+#include "D20.h"
+#include "GlResources.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+
+/// <summary>
+/// Turns a point of the octahedral map (0 to 1 on both axes) back into a unit direction.
+/// The upper half of the sphere fills the diamond in the middle of the map, and the lower half is folded out into the corners.
+/// Must match OctahedralDecode() in impostor.vsh.
+/// </summary>
+static glm::vec3 OctahedralDecode(const glm::vec2& uv)
+{
+    glm::vec2 f = uv * 2.0f - glm::vec2(1.0f);
+    glm::vec3 n(f.x, f.y, 1.0f - std::fabs(f.x) - std::fabs(f.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+/// <summary>
+/// Returns the direction (from the die towards the viewer, in the die's own space) that one frame of the atlas was baked from.
+/// The frames are spread over the whole sphere with an octahedral mapping, so that a spinning die can be seen from any side.
+/// </summary>
+/// <param name="x">Column of the frame</param>
+/// <param name="y">Row of the frame</param>
+/// <param name="gridSize">Frames per row and column</param>
+/// <returns>Unit direction</returns>
+glm::vec3 GetImpostorFrameDirection(int x, int y, int gridSize)
+{
+    return OctahedralDecode(glm::vec2((x + 0.5f) / gridSize, (y + 0.5f) / gridSize));
+}
+
+/// <summary>
+/// Creates one of the atlas textures, with mipmaps down to 8 texels per frame.
+/// </summary>
+static GLuint CreateAtlasTexture(GLint internalFormat, GLenum format, int size, const char* label)
+{
+    GLuint texture = CreateGlResource(GlResourceType::Texture, label);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size, size, 0, format, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // the die never reaches the corners of its frame, so a few mip levels can be averaged without bleeding into a neighbour
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 3);
+    SetGlResourceBytes(GlResourceType::Texture, texture, GetGlTextureBytes(internalFormat, size, size, true));
+    return texture;
+}
+
+/// <summary>
+/// Renders the d20 from every direction of the octahedral grid into an impostor atlas.
+/// Changes the framebuffer, viewport and vertex array bindings while baking, and restores them afterwards.
+/// </summary>
+/// <param name="vbo">Vertex buffer holding the detail levels of the d20</param>
+/// <param name="ibo">Index buffer holding the detail levels of the d20</param>
+/// <param name="lod">Detail level to bake from</param>
+/// <param name="bakeProgram">Shader program made from impostorBake.vsh and impostorBake.fsh</param>
+/// <param name="numeralAtlas">Numeral distance field texture</param>
+/// <returns>The baked atlas (textures are 0 if the framebuffer could not be created)</returns>
+ImpostorAtlas BakeImpostorAtlas(GLuint vbo, GLuint ibo, const D20LodRange& lod, GLuint bakeProgram, GLuint numeralAtlas)
+{
+    ImpostorAtlas atlas;
+    atlas.gridSize = impostorGridSize;
+    atlas.frameRadius = glm::length(GetD20Corner(0)) * 1.02f; // a little margin so that filtering never clips a corner
+
+    int atlasSize = impostorGridSize * impostorFrameSize;
+    atlas.coverage = CreateAtlasTexture(GL_RG8, GL_RG, atlasSize, "impostor coverage");
+    atlas.normalDepth = CreateAtlasTexture(GL_RGBA8, GL_RGBA, atlasSize, "impostor normal + depth");
+
+    GLuint depthBuffer = CreateGlResource(GlResourceType::Renderbuffer, "impostor bake depth");
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, atlasSize, atlasSize);
+    SetGlResourceBytes(GlResourceType::Renderbuffer, depthBuffer, GetGlTextureBytes(GL_DEPTH_COMPONENT24, atlasSize, atlasSize, false));
+
+    GLuint framebuffer = CreateGlResource(GlResourceType::Framebuffer, "impostor bake");
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, atlas.coverage, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, atlas.normalDepth, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+    GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "Failed to create the impostor framebuffer!" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        DeleteGlResource(GlResourceType::Framebuffer, framebuffer);
+        DeleteGlResource(GlResourceType::Renderbuffer, depthBuffer);
+        DeleteImpostorAtlas(atlas);
+        return atlas;
+    }
+
+    // remember the state we are about to change
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    GLboolean blend = glIsEnabled(GL_BLEND);
+
+    glEnable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // the bake only needs positions, UVs and normals of the d20 mesh
+    GLuint vao = CreateGlResource(GlResourceType::VertexArray, "impostor bake");
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, x));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, u));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, nx));
+
+    glUseProgram(bakeProgram);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, numeralAtlas);
+    glUniform1i(glGetUniformLocation(bakeProgram, "tex0"), 0);
+    glUniform1f(glGetUniformLocation(bakeProgram, "frameRadius"), atlas.frameRadius);
+
+    // every frame looks at the die along its grid direction with an orthographic camera that just fits the die
+    float r = atlas.frameRadius;
+    glm::mat4 ortho = glm::ortho(-r, r, -r, r, 0.5f * r, 3.5f * r);
+    for (int y = 0; y < impostorGridSize; y++)
+    {
+        for (int x = 0; x < impostorGridSize; x++)
+        {
+            glm::vec3 direction = GetImpostorFrameDirection(x, y, impostorGridSize);
+
+            // same up vector as FrameBasis() in impostor.vsh, so the quads line up with what was baked
+            glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            glm::mat4 view = glm::lookAt(direction * (2.0f * r), glm::vec3(0.0f), up);
+            glm::mat4 mvp = ortho * view;
+
+            glViewport(x * impostorFrameSize, y * impostorFrameSize, impostorFrameSize, impostorFrameSize);
+            glUniformMatrix4fv(glGetUniformLocation(bakeProgram, "mvp"), 1, GL_FALSE, glm::value_ptr(mvp));
+            glUniform3fv(glGetUniformLocation(bakeProgram, "viewDir"), 1, glm::value_ptr(direction));
+            glDrawElementsBaseVertex(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_SHORT,
+                (void*)(lod.firstIndex * sizeof(GLushort)), lod.baseVertex);
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, atlas.coverage);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, atlas.normalDepth);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // put everything back the way it was
+    glBindVertexArray(0);
+    DeleteGlResource(GlResourceType::VertexArray, vao);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    DeleteGlResource(GlResourceType::Framebuffer, framebuffer);
+    DeleteGlResource(GlResourceType::Renderbuffer, depthBuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (!depthTest)
+    {
+        glDisable(GL_DEPTH_TEST);
+    }
+    if (blend)
+    {
+        glEnable(GL_BLEND);
+    }
+
+    return atlas;
+}
+
+/// <summary>
+/// Deletes the textures of an impostor atlas.
+/// </summary>
+void DeleteImpostorAtlas(ImpostorAtlas& atlas)
+{
+    DeleteGlResource(GlResourceType::Texture, atlas.coverage);
+    DeleteGlResource(GlResourceType::Texture, atlas.normalDepth);
+}
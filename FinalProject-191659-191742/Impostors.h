@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "D20Lod.h"
+
+// the impostor atlas holds impostorGridSize x impostorGridSize views of the d20, impostorFrameSize texels each
+const int impostorGridSize = 16;
+const int impostorFrameSize = 64;
+
+/// <summary>
+/// Struct containing the textures of a baked impostor atlas
+/// </summary>
+struct ImpostorAtlas
+{
+    GLuint coverage;    // RG8: r = numeral, g = inside the silhouette of the die
+    GLuint normalDepth; // RGBA8: object space normal in rgb, height of the surface towards the viewer in a
+    float frameRadius;  // half the width of a frame, in the die's own units
+    int gridSize;       // views per row and column
+};
+
+/// <summary>
+/// Returns the direction (from the die towards the viewer, in the die's own space) that one frame of the atlas was baked from.
+/// The frames are spread over the whole sphere with an octahedral mapping, so that a spinning die can be seen from any side.
+/// </summary>
+/// <param name="x">Column of the frame</param>
+/// <param name="y">Row of the frame</param>
+/// <param name="gridSize">Frames per row and column</param>
+/// <returns>Unit direction</returns>
+glm::vec3 GetImpostorFrameDirection(int x, int y, int gridSize);
+
+/// <summary>
+/// Renders the d20 from every direction of the octahedral grid into an impostor atlas.
+/// Changes the framebuffer, viewport and vertex array bindings while baking, and restores them afterwards.
+/// </summary>
+/// <param name="vbo">Vertex buffer holding the detail levels of the d20</param>
+/// <param name="ibo">Index buffer holding the detail levels of the d20</param>
+/// <param name="lod">Detail level to bake from</param>
+/// <param name="bakeProgram">Shader program made from impostorBake.vsh and impostorBake.fsh</param>
+/// <param name="numeralAtlas">Numeral distance field texture</param>
+/// <returns>The baked atlas (textures are 0 if the framebuffer could not be created)</returns>
+ImpostorAtlas BakeImpostorAtlas(GLuint vbo, GLuint ibo, const D20LodRange& lod, GLuint bakeProgram, GLuint numeralAtlas);
+
+/// <summary>
+/// Deletes the textures of an impostor atlas.
+/// </summary>
+void DeleteImpostorAtlas(ImpostorAtlas& atlas);
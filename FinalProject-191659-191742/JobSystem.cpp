@@ -0,0 +1,637 @@
+#include "JobSystem.h"
+#include "Trace.h"
+#include "TransformSystem.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+// which job system (if any) the current thread works for, and as which worker
+static thread_local const JobSystem* currentJobSystem = nullptr;
+static thread_local int currentWorkerIndex = -1;
+
+// ---------------
+// JobDeque
+// (Chase-Lev deque with the memory orderings from "Correct and Efficient Work-Stealing for Weak Memory Models")
+// ---------------
+
+/// <summary>
+/// Adds a job at the bottom of the deque. Only the owning worker may call this.
+/// </summary>
+/// <returns>False if the deque is full</returns>
+bool JobDeque::Push(Job* job)
+{
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    if (b - t >= capacity)
+    {
+        return false;
+    }
+
+    buffer[b & (capacity - 1)].store(job, std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+/// <summary>
+/// Takes the most recently pushed job. Only the owning worker may call this.
+/// </summary>
+/// <returns>The job, or null if the deque is empty (or a thief took the last job)</returns>
+Job* JobDeque::Pop()
+{
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+
+    if (t > b)
+    {
+        // empty
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Job* job = buffer[b & (capacity - 1)].load(std::memory_order_relaxed);
+    if (t == b)
+    {
+        // last job: race the thieves for it
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            job = nullptr;
+        }
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+/// <summary>
+/// Takes the oldest job. Any worker may call this.
+/// </summary>
+/// <returns>The job, or null if the deque is empty or another thread got there first</returns>
+Job* JobDeque::Steal()
+{
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+
+    if (t >= b)
+    {
+        return nullptr;
+    }
+
+    Job* job = buffer[t & (capacity - 1)].load(std::memory_order_relaxed);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    {
+        return nullptr;
+    }
+    return job;
+}
+
+// ---------------
+// JobSystem
+// ---------------
+
+/// <summary>
+/// Starts the worker threads.
+/// </summary>
+/// <param name="threadCount">Total number of threads running jobs, including the calling thread</param>
+JobSystem::JobSystem(int threadCount)
+    : startTime(std::chrono::steady_clock::now())
+{
+    threadCount = std::max(1, threadCount);
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        Worker* worker = new Worker();
+        worker->timings.reserve(maxTimings);
+        worker->randomState = 0x9E3779B9u * (i + 1);
+        workers.push_back(worker);
+    }
+
+    // the calling thread is worker 0
+    currentJobSystem = this;
+    currentWorkerIndex = 0;
+
+    for (int i = 1; i < threadCount; i++)
+    {
+        workers[i]->thread = std::thread(&JobSystem::WorkerLoop, this, i);
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    quit.store(true);
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wakeUp.notify_all();
+    }
+
+    // every worker may still be stealing from the others, so stop them all before freeing any
+    for (Worker* worker : workers)
+    {
+        if (worker->thread.joinable())
+        {
+            worker->thread.join();
+        }
+    }
+    for (Worker* worker : workers)
+    {
+        delete worker;
+    }
+
+    if (currentJobSystem == this)
+    {
+        currentJobSystem = nullptr;
+        currentWorkerIndex = -1;
+    }
+}
+
+/// <summary>
+/// Returns nanoseconds since the job system started (the clock used by the timings).
+/// </summary>
+uint64_t JobSystem::Now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+/// <summary>
+/// Returns the index of the worker the calling thread is, or -1 if it is not a worker of this job system.
+/// </summary>
+int JobSystem::CurrentWorker() const
+{
+    return currentJobSystem == this ? currentWorkerIndex : -1;
+}
+
+/// <summary>
+/// Queues a job. The counter is incremented right away and decremented when the job is done.
+/// If a dependency is given, the job only starts once the dependency counter reaches zero,
+/// so all the jobs of the dependency should be submitted first.
+/// </summary>
+void JobSystem::Submit(const char* name, JobFunction function, void* context, size_t begin, size_t end,
+    JobCounter* counter, JobCounter* dependency)
+{
+    if (counter != nullptr)
+    {
+        counter->pending.fetch_add(1);
+    }
+    Queue(name, function, context, begin, end, counter, dependency);
+}
+
+/// <summary>
+/// Fills in a job from the pool of the calling worker, and either queues it or parks it on its dependency.
+/// </summary>
+void JobSystem::Queue(const char* name, JobFunction function, void* context, size_t begin, size_t end,
+    JobCounter* counter, JobCounter* dependency)
+{
+    int worker = CurrentWorker();
+    if (worker < 0)
+    {
+        // not one of our threads: it has no deque to push to, so do the work right here
+        if (dependency != nullptr)
+        {
+            while (dependency->pending.load(std::memory_order_acquire) > 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+        Job job = { function, context, begin, end, counter, name };
+        Execute(-1, &job);
+        return;
+    }
+
+    // The pool is a ring: the next slot is the oldest one, and it may still hold a job that is queued, parked or
+    // running (a ParallelFor with more chunks than the pool has slots gets there). Do the work right here then too.
+    Worker& w = *workers[worker];
+    Job* job = &w.jobPool[w.nextJob & (jobPoolSize - 1)];
+    if (job->inUse.load(std::memory_order_acquire))
+    {
+        if (dependency != nullptr)
+        {
+            Wait(dependency);
+        }
+        Job inlineJob = { function, context, begin, end, counter, name };
+        Execute(worker, &inlineJob);
+        return;
+    }
+    w.nextJob++;
+    job->function = function;
+    job->context = context;
+    job->begin = begin;
+    job->end = end;
+    job->counter = counter;
+    job->name = name;
+    job->inUse.store(true, std::memory_order_relaxed);
+
+    if (dependency != nullptr)
+    {
+        while (dependency->lock.test_and_set(std::memory_order_acquire))
+        {
+        }
+
+        bool parked = false;
+        if (dependency->pending.load(std::memory_order_acquire) > 0
+            && dependency->continuationCount < JobCounter::maxContinuations)
+        {
+            dependency->continuations[dependency->continuationCount++] = job;
+            parked = true;
+        }
+        dependency->lock.clear(std::memory_order_release);
+
+        if (parked)
+        {
+            return;
+        }
+
+        // no room left to park the job: wait for the dependency here instead
+        Wait(dependency);
+    }
+
+    Push(worker, job);
+}
+
+/// <summary>
+/// Pushes a job to a worker's deque (running it right away if the deque is full) and wakes up sleeping workers.
+/// </summary>
+void JobSystem::Push(int worker, Job* job)
+{
+    if (!workers[worker]->deque.Push(job))
+    {
+        Execute(worker, job);
+        return;
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepingWorkers.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wakeUp.notify_all();
+    }
+}
+
+/// <summary>
+/// Takes a job from the worker's own deque, or steals one from another worker.
+/// </summary>
+Job* JobSystem::FindJob(int worker)
+{
+    Worker& w = *workers[worker];
+    Job* job = w.deque.Pop();
+    if (job != nullptr)
+    {
+        return job;
+    }
+
+    // start stealing from a random worker so the thieves spread out
+    int count = static_cast<int>(workers.size());
+    w.randomState ^= w.randomState << 13;
+    w.randomState ^= w.randomState >> 17;
+    w.randomState ^= w.randomState << 5;
+    int first = static_cast<int>(w.randomState % count);
+
+    for (int i = 0; i < count; i++)
+    {
+        int victim = (first + i) % count;
+        if (victim == worker)
+        {
+            continue;
+        }
+
+        job = workers[victim]->deque.Steal();
+        if (job != nullptr)
+        {
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+/// <summary>
+/// Runs a job, records its timing, and releases the jobs waiting on its counter when it was the last one.
+/// A worker index of -1 means the job runs on a thread that is not one of our workers.
+/// </summary>
+void JobSystem::Execute(int worker, Job* job)
+{
+    uint64_t start = Now();
+    TraceScope scope(job->name);
+    job->function(job->context, job->begin, job->end);
+    scope.End();
+    uint64_t end = Now();
+
+    if (worker >= 0)
+    {
+        Worker& w = *workers[worker];
+        if (w.timings.size() < maxTimings)
+        {
+            w.timings.push_back({ job->name, worker, start, end });
+        }
+        else
+        {
+            w.droppedTimings++;
+        }
+    }
+
+    // nothing reads the job after this, so its pool slot can be reused
+    JobCounter* counter = job->counter;
+    job->inUse.store(false, std::memory_order_release);
+    if (counter == nullptr)
+    {
+        return;
+    }
+
+    // decrement under the lock, so that whoever parks a continuation sees a consistent count,
+    // and so that Wait() can tell when we stopped touching the counter
+    Job* ready[JobCounter::maxContinuations];
+    int readyCount = 0;
+
+    while (counter->lock.test_and_set(std::memory_order_acquire))
+    {
+    }
+    if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        readyCount = counter->continuationCount;
+        std::copy(counter->continuations, counter->continuations + readyCount, ready);
+        counter->continuationCount = 0;
+    }
+    counter->lock.clear(std::memory_order_release);
+
+    for (int i = 0; i < readyCount; i++)
+    {
+        if (worker >= 0)
+        {
+            Push(worker, ready[i]);
+        }
+        else
+        {
+            Execute(-1, ready[i]);
+        }
+    }
+}
+
+/// <summary>
+/// Runs other jobs until the counter reaches zero.
+/// </summary>
+void JobSystem::Wait(JobCounter* counter)
+{
+    int worker = CurrentWorker();
+
+    while (counter->pending.load(std::memory_order_acquire) > 0)
+    {
+        Job* job = worker >= 0 ? FindJob(worker) : nullptr;
+        if (job != nullptr)
+        {
+            Execute(worker, job);
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    // the last job may still be releasing the counter's lock; once we get it, nobody touches the counter anymore
+    while (counter->lock.test_and_set(std::memory_order_acquire))
+    {
+    }
+    counter->lock.clear(std::memory_order_release);
+}
+
+/// <summary>
+/// Main loop of every worker thread except worker 0.
+/// </summary>
+void JobSystem::WorkerLoop(int worker)
+{
+    currentJobSystem = this;
+    currentWorkerIndex = worker;
+    SetTraceThreadName("worker " + std::to_string(worker));
+
+    int idleSpins = 0;
+    while (!quit.load(std::memory_order_relaxed))
+    {
+        Job* job = FindJob(worker);
+        if (job != nullptr)
+        {
+            Execute(worker, job);
+            idleSpins = 0;
+            continue;
+        }
+
+        // spin for a little while in case more work shows up, then go to sleep
+        if (++idleSpins < 64)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepingWorkers.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        bool workQueued = false;
+        for (Worker* other : workers)
+        {
+            // a non-empty looking deque is enough of a hint to stay awake
+            Job* stolen = other->deque.Steal();
+            if (stolen != nullptr)
+            {
+                lock.unlock();
+                sleepingWorkers.fetch_sub(1);
+                Execute(worker, stolen);
+                workQueued = true;
+                break;
+            }
+        }
+
+        if (!workQueued)
+        {
+            // the timeout is only a safety net, Push() wakes us up as soon as jobs are queued
+            wakeUp.wait_for(lock, std::chrono::milliseconds(5));
+            sleepingWorkers.fetch_sub(1);
+        }
+        idleSpins = 0;
+    }
+}
+
+/// <summary>
+/// Forgets the timings of the previous frame. Must be called while no jobs are running.
+/// </summary>
+void JobSystem::BeginFrame()
+{
+    for (Worker* worker : workers)
+    {
+        worker->timings.clear();
+        worker->droppedTimings = 0;
+    }
+}
+
+/// <summary>
+/// Prints, for the jobs run since BeginFrame(), how long each kind of job took, how busy each
+/// worker was, and how much of the frame was spent with workers idle.
+/// </summary>
+void JobSystem::PrintTimings(std::ostream& out) const
+{
+    struct JobStats
+    {
+        int count = 0;
+        uint64_t total = 0;
+        uint64_t longest = 0;
+    };
+
+    std::map<std::string, JobStats> byName;
+    std::vector<uint64_t> busy(workers.size(), 0);
+    uint64_t first = UINT64_MAX, last = 0;
+    size_t dropped = 0;
+
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        for (const JobTiming& timing : workers[w]->timings)
+        {
+            uint64_t duration = timing.end - timing.start;
+            JobStats& stats = byName[timing.name];
+            stats.count++;
+            stats.total += duration;
+            stats.longest = std::max(stats.longest, duration);
+            busy[w] += duration;
+            first = std::min(first, timing.start);
+            last = std::max(last, timing.end);
+        }
+        dropped += workers[w]->droppedTimings;
+    }
+
+    if (first > last)
+    {
+        out << "job timings: no jobs ran this frame" << std::endl;
+        return;
+    }
+
+    uint64_t span = last - first;
+    uint64_t totalBusy = 0;
+    for (uint64_t b : busy)
+    {
+        totalBusy += b;
+    }
+
+    out << std::fixed << std::setprecision(3);
+    out << "job timings: " << span / 1e6 << " ms from first job start to last job end, "
+        << workers.size() << " threads, parallel efficiency "
+        << 100.0 * totalBusy / (double(span) * workers.size()) << "%" << std::endl;
+
+    for (const auto& entry : byName)
+    {
+        out << "  " << entry.first << ": " << entry.second.count << " jobs, "
+            << entry.second.total / 1e6 << " ms total, "
+            << entry.second.longest / 1e6 << " ms longest" << std::endl;
+    }
+
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        out << "  worker " << w << ": busy " << 100.0 * busy[w] / double(span) << "%" << std::endl;
+    }
+
+    if (dropped > 0)
+    {
+        out << "  (" << dropped << " timings dropped)" << std::endl;
+    }
+    out << std::defaultfloat << std::setprecision(6);
+}
+
+/// <summary>
+/// Measures how the per-frame dice work (spin + compose) scales from 1 thread up to maxThreads,
+/// for a sweep of dice counts, and prints a table of frame times and speedups.
+/// </summary>
+/// <param name="maxThreads">Largest number of threads to try (at most 64)</param>
+void RunJobScalingBenchmark(int maxThreads)
+{
+    const size_t diceCounts[] = { 1000, 10000, 100000, 1000000 };
+    const size_t grainSize = 1024;
+
+    glm::mat4 viewProj = glm::mat4(1.0f);
+    maxThreads = std::min(std::max(maxThreads, 1), 64);
+
+    std::vector<TransformSystem> scenes(sizeof(diceCounts) / sizeof(diceCounts[0]));
+    std::vector<std::vector<DieInstance>> instances(scenes.size());
+    for (size_t s = 0; s < scenes.size(); s++)
+    {
+        for (size_t i = 0; i < diceCounts[s]; i++)
+        {
+            scenes[s].Add(glm::vec3(0.01f * i, 0.0f, -1.0f), 0.1f, glm::vec3(1.0f, -1.0f, 0.1f * (i % 10)), 1.0f, 0.0f);
+        }
+        instances[s].resize(diceCounts[s]);
+    }
+
+    std::cout << "job system scaling (spin + compose, " << grainSize << " dice per job, "
+        << std::thread::hardware_concurrency() << " hardware threads)" << std::endl;
+    std::cout << std::setw(8) << "threads";
+    for (size_t diceCount : diceCounts)
+    {
+        std::cout << std::setw(24) << (std::to_string(diceCount) + " dice");
+    }
+    std::cout << std::endl;
+
+    // powers of two, then maxThreads itself if it is not one
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+    {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    std::vector<double> singleThreadMs(scenes.size(), 0.0);
+    for (int threads : threadCounts)
+    {
+        JobSystem jobs(threads);
+        std::cout << std::setw(8) << threads;
+
+        for (size_t s = 0; s < scenes.size(); s++)
+        {
+            TransformSystem& transforms = scenes[s];
+            DieInstance* out = instances[s].data();
+            int frames = static_cast<int>(std::max<size_t>(3, 4000000 / diceCounts[s]));
+
+            double totalMs = 0.0;
+            double efficiency = 0.0;
+            for (int frame = -1; frame < frames; frame++)
+            {
+                float time = 0.016f * frame;
+                jobs.BeginFrame();
+                uint64_t start = jobs.Now();
+                jobs.ParallelFor("spin + compose", transforms.Count(), grainSize, [&](size_t begin, size_t end)
+                {
+                    transforms.UpdateSpin(time, begin, end);
+                    transforms.Compose(viewProj, glm::mat4(1.0f), begin, end, out + begin);
+                });
+                uint64_t end = jobs.Now();
+
+                // frame -1 warms up the caches and wakes up the workers
+                if (frame >= 0)
+                {
+                    totalMs += (end - start) / 1e6;
+
+                    uint64_t busy = 0;
+                    for (int w = 0; w < threads; w++)
+                    {
+                        for (const JobTiming& timing : jobs.GetTimings(w))
+                        {
+                            busy += timing.end - timing.start;
+                        }
+                    }
+                    efficiency += double(busy) / (double(end - start) * threads);
+                }
+            }
+
+            double ms = totalMs / frames;
+            if (threads == 1)
+            {
+                singleThreadMs[s] = ms;
+            }
+
+            std::ostringstream cell;
+            cell << std::fixed << std::setprecision(3) << ms << "ms "
+                << std::setprecision(1) << singleThreadMs[s] / ms << "x "
+                << std::setprecision(0) << 100.0 * efficiency / frames << "%";
+            std::cout << std::setw(24) << cell.str();
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "(each cell: frame time, speedup over 1 thread, share of thread time spent inside jobs)" << std::endl;
+}
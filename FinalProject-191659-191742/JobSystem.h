@@ -0,0 +1,216 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct Job;
+
+/// <summary>
+/// Counts the jobs that still have to finish. Jobs submitted with a dependency on a counter
+/// are held back until the counter reaches zero, and Wait() blocks until it does.
+/// </summary>
+struct JobCounter
+{
+    static const int maxContinuations = 16;
+
+    std::atomic<int> pending{ 0 };
+
+    // jobs waiting for this counter to reach zero (guarded by the lock flag)
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    Job* continuations[maxContinuations];
+    int continuationCount = 0;
+};
+
+/// <summary>
+/// Function run by a job, over the index range [begin, end)
+/// </summary>
+typedef void (*JobFunction)(void* context, size_t begin, size_t end);
+
+/// <summary>
+/// Struct containing a unit of work for the job system
+/// </summary>
+struct Job
+{
+    JobFunction function;
+    void* context;
+    size_t begin, end;
+    JobCounter* counter;    // decremented when the job is done, may be null
+    const char* name;       // used for the per-job timings, must outlive the frame
+
+    // whether the job is queued, parked on a dependency or running, so that its pool slot must not be reused yet
+    std::atomic<bool> inUse{ false };
+};
+
+/// <summary>
+/// Struct containing when and where a job ran, in nanoseconds since the job system started
+/// </summary>
+struct JobTiming
+{
+    const char* name;
+    int worker;
+    uint64_t start, end;
+};
+
+/// <summary>
+/// Fixed-size Chase-Lev work-stealing deque. The owning worker pushes and pops at the bottom,
+/// every other worker steals from the top, and none of them take a lock.
+/// </summary>
+class JobDeque
+{
+public:
+    static const int64_t capacity = 4096;   // power of two
+
+    bool Push(Job* job);
+    Job* Pop();
+    Job* Steal();
+
+private:
+    alignas(64) std::atomic<int64_t> top{ 0 };
+    alignas(64) std::atomic<int64_t> bottom{ 0 };
+    std::atomic<Job*> buffer[capacity];
+};
+
+/// <summary>
+/// Fixed pool of worker threads that run jobs from per-worker deques and steal from each other when idle.
+/// The thread that creates the job system is worker 0 and helps out whenever it waits on a counter.
+/// Only worker threads (including worker 0) may submit jobs.
+/// </summary>
+class JobSystem
+{
+public:
+    /// <summary>
+    /// Starts the worker threads.
+    /// </summary>
+    /// <param name="threadCount">Total number of threads running jobs, including the calling thread</param>
+    explicit JobSystem(int threadCount);
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    /// <summary>
+    /// Returns the number of threads running jobs, including the thread that created the job system.
+    /// </summary>
+    int ThreadCount() const { return static_cast<int>(workers.size()); }
+
+    /// <summary>
+    /// Queues a job. The counter is incremented right away and decremented when the job is done.
+    /// If a dependency is given, the job only starts once the dependency counter reaches zero,
+    /// so all the jobs of the dependency should be submitted first.
+    /// </summary>
+    void Submit(const char* name, JobFunction function, void* context, size_t begin, size_t end,
+        JobCounter* counter, JobCounter* dependency = nullptr);
+
+    /// <summary>
+    /// Runs other jobs until the counter reaches zero.
+    /// </summary>
+    void Wait(JobCounter* counter);
+
+    /// <summary>
+    /// Splits [0, count) into chunks of grainSize indices and queues one job per chunk.
+    /// The body is called as body(begin, end) and must stay alive until the counter reaches zero.
+    /// </summary>
+    template <typename Body>
+    void ParallelForAsync(const char* name, size_t count, size_t grainSize, Body& body,
+        JobCounter* counter, JobCounter* dependency = nullptr)
+    {
+        if (grainSize == 0)
+        {
+            grainSize = 1;
+        }
+
+        // count every chunk before queueing any, so the counter cannot hit zero halfway through
+        size_t chunks = (count + grainSize - 1) / grainSize;
+        counter->pending.fetch_add(static_cast<int>(chunks));
+
+        for (size_t begin = 0; begin < count; begin += grainSize)
+        {
+            size_t end = begin + grainSize < count ? begin + grainSize : count;
+            Queue(name, &RunBody<Body>, &body, begin, end, counter, dependency);
+        }
+    }
+
+    /// <summary>
+    /// Same as ParallelForAsync(), but waits for all the chunks to finish before returning.
+    /// </summary>
+    template <typename Body>
+    void ParallelFor(const char* name, size_t count, size_t grainSize, Body&& body, JobCounter* dependency = nullptr)
+    {
+        JobCounter counter;
+        ParallelForAsync(name, count, grainSize, body, &counter, dependency);
+        Wait(&counter);
+    }
+
+    /// <summary>
+    /// Forgets the timings of the previous frame. Must be called while no jobs are running.
+    /// </summary>
+    void BeginFrame();
+
+    /// <summary>
+    /// Returns the jobs that ran on a worker since BeginFrame().
+    /// </summary>
+    const std::vector<JobTiming>& GetTimings(int worker) const { return workers[worker]->timings; }
+
+    /// <summary>
+    /// Prints, for the jobs run since BeginFrame(), how long each kind of job took, how busy each
+    /// worker was, and how much of the frame was spent with workers idle.
+    /// </summary>
+    void PrintTimings(std::ostream& out) const;
+
+    /// <summary>
+    /// Returns nanoseconds since the job system started (the clock used by the timings).
+    /// </summary>
+    uint64_t Now() const;
+
+private:
+    static const int jobPoolSize = 4096;    // power of two, jobs in flight per worker (more run right away)
+    static const size_t maxTimings = 8192;  // timings kept per worker and frame
+
+    struct Worker
+    {
+        JobDeque deque;
+        Job jobPool[jobPoolSize];
+        uint32_t nextJob = 0;
+        std::vector<JobTiming> timings;
+        size_t droppedTimings = 0;
+        uint32_t randomState = 0;
+        std::thread thread;
+    };
+
+    template <typename Body>
+    static void RunBody(void* context, size_t begin, size_t end)
+    {
+        (*static_cast<Body*>(context))(begin, end);
+    }
+
+    void Queue(const char* name, JobFunction function, void* context, size_t begin, size_t end,
+        JobCounter* counter, JobCounter* dependency);
+    void Push(int worker, Job* job);
+    Job* FindJob(int worker);
+    void Execute(int worker, Job* job);
+    void WorkerLoop(int worker);
+    int CurrentWorker() const;
+
+    std::vector<Worker*> workers;
+    std::chrono::steady_clock::time_point startTime;
+
+    // idle workers sleep on the condition variable until new jobs are queued
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    std::atomic<int> sleepingWorkers{ 0 };
+    std::atomic<bool> quit{ false };
+};
+
+/// <summary>
+/// Measures how the per-frame dice work (spin + compose) scales from 1 thread up to maxThreads,
+/// for a sweep of dice counts, and prints a table of frame times and speedups.
+/// </summary>
+/// <param name="maxThreads">Largest number of threads to try (at most 64)</param>
+void RunJobScalingBenchmark(int maxThreads);
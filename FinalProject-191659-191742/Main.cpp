@@ -6,13 +6,44 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <numeric>
+#include <random>
 #include <string>
-
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
+#include <thread>
+#include <vector>
+
+#include "ClusteredLighting.h"
+#include "ConvexQueries.h"
+#include "CpuTime.h"
+#include "D20.h"
+#include "D20Lod.h"
+#include "DiceSpawner.h"
+#include "DynamicResolution.h"
+#include "FrameArena.h"
+#include "FrustumCulling.h"
+#include "GpuCulling.h"
+#include "GlResources.h"
+#include "Impostors.h"
+#include "JobSystem.h"
+#include "Materials.h"
+#include "OcclusionCulling.h"
+#include "Picking.h"
+#include "Recording.h"
+#include "RollServer.h"
+#include "SceneGraph.h"
+#include "SdfAtlas.h"
+#include "Shadows.h"
+#include "SphericalHarmonics.h"
+#include "StreamBuffer.h"
+#include "Trace.h"
+#include "TransformSystem.h"
+#include "Tray.h"
 
 // ---------------
 // Function declarations
@@ -26,6 +57,18 @@
 /// <returns>OpenGL handle to the created shader program</returns>
 GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath);
 
+/// <summary>
+/// Creates a shader program that draws nothing and writes the outputs of its geometry shader into buffers instead
+/// (transform feedback), interleaved in the given order.
+/// </summary>
+/// <param name="vertexShaderFilePath">Vertex shader file path</param>
+/// <param name="geometryShaderFilePath">Geometry shader file path</param>
+/// <param name="varyings">Names of the geometry shader outputs to capture</param>
+/// <param name="varyingCount">Number of names</param>
+/// <returns>OpenGL handle to the created shader program</returns>
+GLuint CreateFeedbackProgram(const std::string& vertexShaderFilePath, const std::string& geometryShaderFilePath,
+    const char* const* varyings, int varyingCount);
+
 /// <summary>
 /// Creates a shader based on the provided shader type and the path to the file containing the shader source.
 /// </summary>
@@ -51,18 +94,84 @@ GLuint CreateShaderFromSource(const GLuint& shaderType, const std::string& shade
 void FramebufferSizeChangedCallback(GLFWwindow* window, int width, int height);
 
 /// <summary>
-/// Struct containing data about a vertex
+/// Function for handling the event when the contents of the window were damaged and need to be drawn again.
+/// </summary>
+/// <param name="window">Reference to the window</param>
+void WindowRefreshCallback(GLFWwindow* window);
+
+/// <summary>
+/// Function for handling mouse button presses: a left click asks the next frame to pick the die under the cursor.
+/// </summary>
+/// <param name="window">Reference to the window</param>
+/// <param name="button">Mouse button</param>
+/// <param name="action">Pressed or released</param>
+/// <param name="mods">Modifier keys held down</param>
+void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+
+/// <summary>
+/// Points the per-instance vertex attributes (locations 4 to 12) of the currently bound vertex array object
+/// at the instance buffer, starting from the given instance.
+/// (OpenGL 3.3 has no base instance for instanced draws, so a draw that starts in the middle of the buffer
+/// moves the attribute offsets instead.)
+/// </summary>
+/// <param name="instanceVbo">Buffer containing one DieInstance per die</param>
+/// <param name="firstInstance">Index of the instance the next draw should start from</param>
+void BindInstanceAttributes(GLuint instanceVbo, size_t firstInstance);
+
+/// <summary>
+/// Same as BindInstanceAttributes(), but for the static buffer of GPU spin mode (locations 8 to 14).
+/// </summary>
+/// <param name="spinVbo">Buffer containing one SpinInstance per die</param>
+/// <param name="firstInstance">Index of the instance the next draw should start from</param>
+void BindSpinAttributes(GLuint spinVbo, size_t firstInstance);
+
+/// <summary>
+/// Adds a grid of small spinning dice (a "tray"), laid out around the origin of the tray node.
+/// </summary>
+/// <param name="transforms">Transform system to add the dice to</param>
+/// <param name="count">Number of dice to add</param>
+/// <param name="materialCount">Number of materials the dice take turns using</param>
+void AddTrayDice(TransformSystem& transforms, int count, int materialCount);
+
+/// <summary>
+/// Same as AddTrayDice(), but the dice are scattered over the area of the grid, at rest, instead of lined up.
+/// </summary>
+/// <param name="transforms">Transform system to add the dice to</param>
+/// <param name="count">Number of dice to add</param>
+/// <param name="materialCount">Number of materials the dice take turns using</param>
+/// <param name="jobSystem">Job system to spawn the dice on</param>
+void AddScatteredTrayDice(TransformSystem& transforms, int count, int materialCount, JobSystem& jobSystem);
+
+/// <summary>
+/// Scatters small colored point lights over and around the tray of dice.
 /// </summary>
-struct Vertex
+/// <param name="lights">Light list to add the lights to</param>
+/// <param name="count">Number of lights to add</param>
+void AddTableLights(PointLights& lights, int count);
+
+/// <summary>
+/// Struct containing the per-frame values shared by every shader, laid out like the FrameData uniform block (std140,
+/// where every vec3 takes the room of a vec4)
+/// </summary>
+struct FrameData
 {
-    GLfloat x, y, z;    // Position
-    GLubyte r, g, b;    // Color
-    GLfloat u, v;        // UV coordinates
-    GLfloat nx, ny, nz; // normal vector
+    glm::mat4 viewProj;
+    glm::vec4 viewPos;
+    glm::vec4 lightPos;
+    glm::vec4 ambientLight;
+    glm::vec4 diffuseLight;
+    glm::vec4 specularLight;
+    glm::vec4 depthPlane;       // view depth of a world space position (see the culling)
+    glm::vec4 clusterParams;    // from LightClusters::GetShaderParams()
+    glm::mat4 shadowMatrix;     // from ShadowMaps::ShadowMatrix()
 };
 
-int current = 0; // texture in use
-float golden = ((1 + sqrt(5)) / 2) / 2; // for icosahedron formula
+// uniform buffer binding points of the FrameData, AmbientSH and MaterialTable blocks
+const GLuint frameDataBinding = 0;
+const GLuint ambientShBinding = 1;
+const GLuint materialTableBinding = 2;
+
+int current = 0; // skin in use (0 = opaque, 1 = translucent)
 // specular, diffuse, bg color variables for turning lights on and off
 // initially set to off
 // diffuse is not 0 so that it looks more realistic, especially against black bg
@@ -76,11 +185,30 @@ float bgc_r = 0.0f;
 float bgc_g = 0.0f;
 float bgc_b = 0.0f;
 float bgc_a = 1;
+bool printJobTimings = false; // set by pressing J, prints the job timings of the next frame
+bool printGlResources = false; // set by pressing G, prints the GPU objects and their memory after the next frame
+bool printCullingStats = false; // toggled by pressing C, prints the culling results once per second
+bool impostorsEnabled = true; // toggled by pressing I, draws small far-away dice as impostors
+bool printResolutionScale = false; // toggled by pressing R, prints the dynamic resolution scale every frame
+bool animationPaused = false; // toggled by pressing P, stops the dice from spinning
+bool gpuSpinEnabled = false; // toggled by pressing U, spins the dice in the vertex shader instead of on the CPU
+bool occlusionCullingEnabled = true; // toggled by pressing V, skips the dice hidden behind the tray or the dice nearest the camera
+bool gpuCullingEnabled = false; // toggled by pressing K, culls the tray dice of GPU spin mode on the GPU (see GpuCulling.h)
+bool redrawRequested = true; // set by input and window events, makes the idle loop draw one more frame
+bool spotShadows = false; // toggled by pressing L, switches the shadows of lightPos between a directional and a spot light
+bool lightOrbiting = false; // toggled by pressing O, moves lightPos around the scene (so the cached shadows are redrawn)
+bool pickRequested = false; // set by a left click, makes the next frame print the die under pickCursorX/Y
+double pickCursorX = 0.0, pickCursorY = 0.0; // cursor position of the last left click, in screen coordinates
+int replaySeekFrames = 0; // changed by the left/right arrow keys, how many frames the replay should jump
+std::string tracePath = "trace.json"; // where the trace goes when T is pressed the second time (or at exit)
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
+    // any key may change what is on screen, so the idle loop has to draw again
+    redrawRequested = true;
+
     // press space to reveal smaller D20 inside
-    // by making big D20 translucent via translucent texture
+    // by making big D20 translucent via translucent skin
     // also turns lights on/off
     
     if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
@@ -116,19 +244,344 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
             bgc_a = 1;
         };
     }
+
+    // press J to print how long the jobs of the next frame took on each worker thread
+    if (key == GLFW_KEY_J && action == GLFW_PRESS)
+    {
+        printJobTimings = true;
+    }
+
+    // press G to print how many buffers, textures, ... are alive and how much memory they take
+    if (key == GLFW_KEY_G && action == GLFW_PRESS)
+    {
+        printGlResources = true;
+    }
+
+    // press C to start/stop printing how many dice were culled and how long culling took
+    if (key == GLFW_KEY_C && action == GLFW_PRESS)
+    {
+        printCullingStats = !printCullingStats;
+    }
+
+    // press I to switch between drawing far-away dice as impostors and as full meshes
+    if (key == GLFW_KEY_I && action == GLFW_PRESS)
+    {
+        impostorsEnabled = !impostorsEnabled;
+    }
+
+    // press R to start/stop printing the resolution the scene is drawn at, every frame
+    if (key == GLFW_KEY_R && action == GLFW_PRESS)
+    {
+        printResolutionScale = !printResolutionScale;
+    }
+
+    // press P to pause/resume the spinning; while paused, nothing is drawn until something changes
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+    {
+        animationPaused = !animationPaused;
+    }
+
+    // press U to switch between spinning the dice on the CPU and in the vertex shader
+    if (key == GLFW_KEY_U && action == GLFW_PRESS)
+    {
+        gpuSpinEnabled = !gpuSpinEnabled;
+        std::cout << "spin: " << (gpuSpinEnabled ? "in the vertex shader" : "on the CPU") << std::endl;
+    }
+
+    // press V to switch occlusion culling on/off
+    if (key == GLFW_KEY_V && action == GLFW_PRESS)
+    {
+        occlusionCullingEnabled = !occlusionCullingEnabled;
+        std::cout << "occlusion culling: " << (occlusionCullingEnabled ? "on" : "off") << std::endl;
+    }
+
+    // press K to switch GPU culling on/off (only used in GPU spin mode)
+    if (key == GLFW_KEY_K && action == GLFW_PRESS)
+    {
+        gpuCullingEnabled = !gpuCullingEnabled;
+        std::cout << "GPU culling: " << (gpuCullingEnabled ? "on" : "off") << (gpuSpinEnabled ? "" : " (takes effect in GPU spin mode)") << std::endl;
+    }
+
+    // press L to switch the shadows between a directional light and a spot light
+    if (key == GLFW_KEY_L && action == GLFW_PRESS)
+    {
+        spotShadows = !spotShadows;
+    }
+
+    // press O to start/stop moving the light around the scene
+    if (key == GLFW_KEY_O && action == GLFW_PRESS)
+    {
+        lightOrbiting = !lightOrbiting;
+    }
+
+    // press T to start recording a trace of every frame scope and job, and again to write it to tracePath
+    if (key == GLFW_KEY_T && action == GLFW_PRESS)
+    {
+        if (IsTracing())
+        {
+            StopTracing(tracePath);
+        }
+        else
+        {
+            StartTracing();
+            std::cout << "trace: recording, press T again to write " << tracePath << std::endl;
+        }
+    }
+
+    // press the left/right arrow keys while replaying a recording to jump 5 seconds (300 frames) back/ahead
+    if ((key == GLFW_KEY_LEFT || key == GLFW_KEY_RIGHT) && action == GLFW_PRESS)
+    {
+        replaySeekFrames += key == GLFW_KEY_LEFT ? -300 : 300;
+    }
 }
 
 
 /// <summary>
 /// Main function.
+/// Command line options:
+///   --dice N              adds a tray of N small dice to the scene
+///   --scatter             scatters the tray dice at random, without any two of them intersecting, instead of lining
+///                         them up in a grid (they rest, since spinning dice placed that close could run into each other)
+///   --threads N           number of threads running per-frame jobs (default: one per hardware thread)
+///   --impostor-pixels N   dice smaller than N pixels (radius) on screen are drawn as impostors (default: 6)
+///   --no-persistent-map   streams per-frame data with unsynchronized mapping and orphaning even on GL 4.4
+///   --no-idle             keeps redrawing at full speed even when nothing changes
+///   --gpu-spin            starts with the dice spun in the vertex shader (U switches back), instead of culled and
+///                         composed on the CPU every frame; recording and replaying always spin on the CPU
+///   --gpu-cull            starts in GPU spin mode with the tray dice culled and sorted into detail levels on the GPU
+///                         (K switches the culling off)
+///   --no-occlusion        starts with occlusion culling off (V switches it on)
+///   --frame-budget MS     GPU time per frame the dynamic resolution aims for (default: 16)
+///   --fixed-resolution    always draws the scene at the full window resolution
+///   --lights N            adds N small point lights around the tray, shaded with clustered forward lighting
+///   --materials N         gives the tray dice N different materials (resin, metal, bone, then blends of them; up to 256)
+///   --environment FILE    equirectangular image (HDR or LDR) the ambient light is baked from (default: a built-in sky)
+///   --record FILE         records the session (input state, rotation of every die, numbers rolled) into FILE
+///   --replay FILE         plays back a recorded session instead of spinning the dice (arrow keys jump 5 seconds)
+///   --serve SOCKET        runs the roll service on a Unix domain socket instead of opening a window (uses --threads)
+///   --roll-load SOCKET    sends load to the roll service and prints throughput and latency, then exits
+///   --load-clients N      clients the load generator runs at once (default: 16)
+///   --load-requests N     requests each client sends (default: 1000)
+///   --load-rolls N        rolls per request (default: 256)
+///   --tumble              makes the load generator ask for tumbled d20 rolls instead of random numbers
+///   --trace FILE          traces startup and every frame from the start, and writes the trace to FILE (instead of
+///                         trace.json) when T is pressed or at exit
+///   --bench-transforms N  compares the glm and SIMD transform paths for N dice, then exits
+///   --bench-spin N        compares what spinning N dice costs per frame on the CPU and with GPU spin, then exits
+///   --bench-jobs N        measures job system scaling from 1 to N threads over a sweep of dice counts, then exits
+///   --bench-cull N        compares the SIMD and scalar frustum culling of N scattered dice, then exits
+///   --bench-occlusion N   times drawing the occluders and testing a tray of N dice seen from low above it, then exits
+///   --bench-gpu-cull N    compares culling 1024 up to N scattered dice on the CPU and on the GPU, then exits
+///   --bench-lights N      times building the light clusters for 16 up to N point lights, then exits
+///   --bench-pick N        times building, refitting and ray picking the tree over N scattered dice, then exits
+///   --bench-record N      records and replays 10 seconds of N spinning dice, times it and checks the result, then exits
+///   --bench-trace N       times N trace scopes with tracing off and on, then exits
+///   --bench-gjk N         times GJK, EPA and the separating axis test on N pairs of close d20s and compares them, then exits
+///   --bench-spawn N       spawns N non-intersecting d20s into a layer and a box with 1 and all threads, then exits
 /// </summary>
 /// <returns>An integer indicating whether the program ended successfully or not.
 /// A value of 0 indicates the program ended succesfully, while a non-zero value indicates
 /// something wrong happened during execution.</returns>
-int main()
+int main(int argc, char** argv)
 {
+    int trayDiceCount = 0;
+    bool scatterTrayDice = false;
+    int threadCount = static_cast<int>(std::thread::hardware_concurrency());
+    float impostorPixelRadius = 6.0f;
+    bool allowPersistentMap = true;
+    bool idleModeEnabled = true;
+    float frameBudgetMs = 16.0f;
+    bool dynamicResolutionEnabled = true;
+    int pointLightCount = 0;
+    int materialCount = 1;
+    std::string environmentPath;
+    std::string recordPath, replayPath;
+    std::string servePath, rollLoadPath;
+    int loadClients = 16, loadRequests = 1000, loadRolls = 256;
+    RollMode loadMode = RollMode::Random;
+    bool traceStartup = false;
+    int gpuCullBenchDice = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--dice" && i + 1 < argc)
+        {
+            trayDiceCount = std::atoi(argv[++i]);
+        }
+        else if (arg == "--scatter")
+        {
+            scatterTrayDice = true;
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            threadCount = std::atoi(argv[++i]);
+        }
+        else if (arg == "--impostor-pixels" && i + 1 < argc)
+        {
+            impostorPixelRadius = static_cast<float>(std::atof(argv[++i]));
+        }
+        else if (arg == "--no-persistent-map")
+        {
+            allowPersistentMap = false;
+        }
+        else if (arg == "--no-idle")
+        {
+            idleModeEnabled = false;
+        }
+        else if (arg == "--no-occlusion")
+        {
+            occlusionCullingEnabled = false;
+        }
+        else if (arg == "--gpu-spin")
+        {
+            gpuSpinEnabled = true;
+        }
+        else if (arg == "--gpu-cull")
+        {
+            gpuSpinEnabled = true;
+            gpuCullingEnabled = true;
+        }
+        else if (arg == "--frame-budget" && i + 1 < argc)
+        {
+            frameBudgetMs = static_cast<float>(std::atof(argv[++i]));
+        }
+        else if (arg == "--fixed-resolution")
+        {
+            dynamicResolutionEnabled = false;
+        }
+        else if (arg == "--lights" && i + 1 < argc)
+        {
+            pointLightCount = std::atoi(argv[++i]);
+        }
+        else if (arg == "--materials" && i + 1 < argc)
+        {
+            materialCount = std::min(std::max(std::atoi(argv[++i]), 1), maxMaterials);
+        }
+        else if (arg == "--environment" && i + 1 < argc)
+        {
+            environmentPath = argv[++i];
+        }
+        else if (arg == "--record" && i + 1 < argc)
+        {
+            recordPath = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            replayPath = argv[++i];
+        }
+        else if (arg == "--serve" && i + 1 < argc)
+        {
+            servePath = argv[++i];
+        }
+        else if (arg == "--roll-load" && i + 1 < argc)
+        {
+            rollLoadPath = argv[++i];
+        }
+        else if (arg == "--load-clients" && i + 1 < argc)
+        {
+            loadClients = std::atoi(argv[++i]);
+        }
+        else if (arg == "--load-requests" && i + 1 < argc)
+        {
+            loadRequests = std::atoi(argv[++i]);
+        }
+        else if (arg == "--load-rolls" && i + 1 < argc)
+        {
+            loadRolls = std::atoi(argv[++i]);
+        }
+        else if (arg == "--tumble")
+        {
+            loadMode = RollMode::Tumble;
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            tracePath = argv[++i];
+            traceStartup = true;
+        }
+        else if (arg == "--bench-transforms" && i + 1 < argc)
+        {
+            RunTransformBenchmark(std::atoi(argv[++i]));
+            return 0;
+        }
+        else if (arg == "--bench-spin" && i + 1 < argc)
+        {
+            RunSpinBenchmark(std::atoi(argv[++i]));
+            return 0;
+        }
+        else if (arg == "--bench-jobs" && i + 1 < argc)
+        {
+            RunJobScalingBenchmark(std::atoi(argv[++i]));
+            return 0;
+        }
+        else if (arg == "--bench-cull" && i + 1 < argc)
+        {
+            RunCullingBenchmark(std::atoi(argv[++i]));
+            return 0;
+        }
+        else if (arg == "--bench-occlusion" && i + 1 < argc)
+        {
+            RunOcclusionBenchmark(std::atoi(argv[++i]));
+            return 0;
+        }
+        else if (arg == "--bench-gpu-cull" && i + 1 < argc)
+        {
+            // needs an OpenGL context, so it runs once there is one
+            gpuCullBenchDice = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (arg == "--bench-lights" && i + 1 < argc)
+        {
+            RunLightingBenchmark(std::atoi(argv[++i]));
+            return 0;
+        }
+        else if (arg == "--bench-pick" && i + 1 < argc)
+        {
+            RunPickingBenchmark(std::atoi(argv[++i]));
+            return 0;
+        }
+        else if (arg == "--bench-record" && i + 1 < argc)
+        {
+            RunRecordingBenchmark(std::atoi(argv[++i]));
+            return 0;
+        }
+        else if (arg == "--bench-trace" && i + 1 < argc)
+        {
+            RunTraceBenchmark(std::atoi(argv[++i]));
+            return 0;
+        }
+        else if (arg == "--bench-gjk" && i + 1 < argc)
+        {
+            RunConvexQueryBenchmark(std::atoi(argv[++i]));
+            return 0;
+        }
+        else if (arg == "--bench-spawn" && i + 1 < argc)
+        {
+            RunSpawnBenchmark(std::atoi(argv[++i]));
+            return 0;
+        }
+    }
+
+    // the roll service and its load generator run without a window
+    if (!servePath.empty())
+    {
+        return RunRollServer(servePath, threadCount);
+    }
+    if (!rollLoadPath.empty())
+    {
+        return RunRollLoadGenerator(rollLoadPath, loadClients, loadRequests, loadRolls, loadMode);
+    }
+
+    // With --trace, everything from here to the first frame on screen is traced as "startup", phase by phase
+    SetTraceThreadName("main");
+    if (traceStartup)
+    {
+        StartTracing();
+    }
+    TraceScope startupScope("startup");
+
     // Initialize GLFW
+    TraceScope glfwInitScope("glfwInit");
     int glfwInitStatus = glfwInit();
+    glfwInitScope.End();
     if (glfwInitStatus == GLFW_FALSE)
     {
         std::cerr << "Failed to initialize GLFW!" << std::endl;
@@ -146,7 +599,9 @@ int main()
     // Tell GLFW to create a window
     int windowWidth = 800;
     int windowHeight = 800;
+    TraceScope createWindowScope("glfwCreateWindow");
     GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "Final Project: Rolling D20s", nullptr, nullptr);
+    createWindowScope.End();
     if (window == nullptr)
     {
         std::cerr << "Failed to create GLFW window!" << std::endl;
@@ -160,1087 +615,67 @@ int main()
     // Register the callback function that handles when the framebuffer size has changed
     glfwSetFramebufferSizeCallback(window, FramebufferSizeChangedCallback);
 
+    // Register the callback function that handles when the window has to be drawn again (e.g., uncovered)
+    glfwSetWindowRefreshCallback(window, WindowRefreshCallback);
+
     // Register the callback function that handles keyboard input
     glfwSetKeyCallback(window, key_callback);
 
+    // Register the callback function that handles mouse clicks (picking)
+    glfwSetMouseButtonCallback(window, MouseButtonCallback);
+
     // Tell GLAD to load the OpenGL function pointers
+    TraceScope gladScope("gladLoadGLLoader");
     if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress)))
     {
         std::cerr << "Failed to initialize GLAD!" << std::endl;
         return 1;
     }
+    gladScope.End();
+
+    // the GPU culling benchmark only needs the context, not the scene
+    if (gpuCullBenchDice > 0)
+    {
+        JobSystem benchJobSystem(threadCount);
+        GLuint benchCullProgram = CreateFeedbackProgram("cull.vsh", "cull.gsh", gpuCullVaryings, gpuCullVaryingCount);
+        RunGpuCullingBenchmark(benchCullProgram, benchJobSystem, gpuCullBenchDice);
+        DeleteGlResource(GlResourceType::Program, benchCullProgram);
+        glfwTerminate();
+        return 0;
+    }
 
     // --- Vertex specification ---
 
-    // initial 12 vertices of the d20 using golden ratio value cut in half
-    glm::vec3 v0 = glm::vec3(0.0f, -golden, 0.5f);
-    glm::vec3 v1 = glm::vec3(-golden, -0.5f, 0.0f);
-    glm::vec3 v2 = glm::vec3(0.0f, -golden, -0.5f);
-    glm::vec3 v3 = glm::vec3(golden, -0.5f, 0.0f);
-    glm::vec3 v4 = glm::vec3(0.5f, 0.0f, golden);
-    glm::vec3 v5 = glm::vec3(-0.5f, 0.0f, golden);
-    glm::vec3 v6 = glm::vec3(0.0f, golden, -0.5f);
-    glm::vec3 v7 = glm::vec3(0.5f, 0.0f, -golden);
-    glm::vec3 v8 = glm::vec3(-0.5f, 0.0f, -golden);
-    glm::vec3 v9 = glm::vec3(-golden, 0.5f, 0.0f);
-    glm::vec3 v10 = glm::vec3(0.0f, golden, 0.5f);
-    glm::vec3 v11 = glm::vec3(golden, 0.5f, 0.0f);
-    
-    // adding vertices to an array for easier assignment via iteration
-    glm::vec3 vecArray[12] = { v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11 };
-
-    // calculating normals using the cross function per triangle on the d20
-    glm::vec3 normalt0 = cross((v0 - v1), (v1 - v2));
-    glm::vec3 normalt1 = cross((v0 - v2), (v2 - v3));
-    glm::vec3 normalt2 = cross((v0 - v3), (v3 - v4));
-    glm::vec3 normalt3 = cross((v0 - v4), (v4 - v5));
-    glm::vec3 normalt4 = cross((v0 - v5), (v5 - v1));
-    glm::vec3 normalt5 = cross((v6 - v7), (v7 - v8));
-    glm::vec3 normalt6 = cross((v6 - v8), (v8 - v9));
-    glm::vec3 normalt7 = cross((v6 - v9), (v9 - v10));
-    glm::vec3 normalt8 = cross((v6 - v10), (v10 - v11));
-    glm::vec3 normalt9 = cross((v6 - v11), (v11 - v7));
-    glm::vec3 normalt10 = cross((v1 - v8), (v8 - v2));
-    glm::vec3 normalt11 = cross((v2 - v8), (v8 - v7));
-    glm::vec3 normalt12 = cross((v2 - v7), (v7 - v3));
-    glm::vec3 normalt13 = cross((v3 - v7), (v7 - v11));
-    glm::vec3 normalt14 = cross((v3 - v11), (v11 - v4));
-    glm::vec3 normalt15 = cross((v4 - v11), (v11 - v10));
-    glm::vec3 normalt16 = cross((v4 - v10), (v10 - v5));
-    glm::vec3 normalt17 = cross((v5 - v10), (v10 - v9));
-    glm::vec3 normalt18 = cross((v5 - v9), (v9 - v1));
-    glm::vec3 normalt19 = cross((v1 - v9), (v9 - v8));
-
-    // adding normals to an array for easier assignment via iteration
-    glm::vec3 normalFaces[20] = {
-        normalt0, normalt1, normalt2, normalt3, normalt4,
-        normalt5, normalt6, normalt7, normalt8, normalt9,
-        normalt10, normalt11, normalt12, normalt13, normalt14,
-        normalt15, normalt16, normalt17, normalt18, normalt19
-    };
-
-    // Set up the data for each vertex of the triangle
-    Vertex vertices[60];
-
-    // t0 - 18 on the die
-    // indices 0, 1, 2 (change vecArray[i][constant])
-    // 0 = pix 600, 95
-    // u, v = 1.0f, 0.667f
-    // 1 = pix 545.5, 0
-    // u, v = 0.909f, 1.0f
-    // 2 = pix 491, 95
-    // u, v = 0.818f, 0.667f
-
-    vertices[0].x = vecArray[0][0];
-    vertices[0].y = vecArray[0][1];
-    vertices[0].z = vecArray[0][2];
-    vertices[0].r = 255;
-    vertices[0].g = 255;
-    vertices[0].b = 255;
-    vertices[0].u = 1.0f;
-    vertices[0].v = 0.667f;
-    vertices[0].nx = 0.0f;
-    vertices[0].ny = 0.0f;
-    vertices[0].nz = 0.0f;
-
-    vertices[1].x = vecArray[1][0];
-    vertices[1].y = vecArray[1][1];
-    vertices[1].z = vecArray[1][2];
-    vertices[1].r = 255;
-    vertices[1].g = 255;
-    vertices[1].b = 255;
-    vertices[1].u = 0.909f;
-    vertices[1].v = 1.0f;
-    vertices[1].nx = 0.0f;
-    vertices[1].ny = 0.0f;
-    vertices[1].nz = 0.0f;
-
-    vertices[2].x = vecArray[2][0];
-    vertices[2].y = vecArray[2][1];
-    vertices[2].z = vecArray[2][2];
-    vertices[2].r = 255;
-    vertices[2].g = 255;
-    vertices[2].b = 255;
-    vertices[2].u = 0.8183f;
-    vertices[2].v = 0.667f;
-    vertices[2].nx = 0.0f;
-    vertices[2].ny = 0.0f;
-    vertices[2].nz = 0.0f;
-
-    // t1 - 4 on the die
-    // indices 0, 2, 3 (change vecArray[i][constant])
-    // 0 = pix 600, 95
-    // u, v = 1.0f, 0.667f
-    // 2 = pix 491, 95
-    // u, v = 0.818f, 0.667f
-    // 3 = pix 545.5, 190
-    // u, v = 0.909f, 0.333f
-
-    vertices[3].x = vecArray[0][0];
-    vertices[3].y = vecArray[0][1];
-    vertices[3].z = vecArray[0][2];
-    vertices[3].r = 255;
-    vertices[3].g = 255;
-    vertices[3].b = 255;
-    vertices[3].u = 1.0f;
-    vertices[3].v = 0.667f;
-    vertices[3].nx = 0.0f;
-    vertices[3].ny = 0.0f;
-    vertices[3].nz = 0.0f;
-
-    vertices[4].x = vecArray[2][0];
-    vertices[4].y = vecArray[2][1];
-    vertices[4].z = vecArray[2][2];
-    vertices[4].r = 255;
-    vertices[4].g = 255;
-    vertices[4].b = 255;
-    vertices[4].u = 0.818f;
-    vertices[4].v = 0.667f;
-    vertices[4].nx = 0.0f;
-    vertices[4].ny = 0.0f;
-    vertices[4].nz = 0.0f;
-
-    vertices[5].x = vecArray[3][0];
-    vertices[5].y = vecArray[3][1];
-    vertices[5].z = vecArray[3][2];
-    vertices[5].r = 255;
-    vertices[5].g = 255;
-    vertices[5].b = 255;
-    vertices[5].u = 0.909f;
-    vertices[5].v = 0.333f;
-    vertices[5].nx = 0.0f;
-    vertices[5].ny = 0.0f;
-    vertices[5].nz = 0.0f;
-
-    // t2 - 11 on the die
-    // indices 0, 3, 4 (change vecArray[i][constant])
-    // 0 = pix 55, 95
-    // u, v = 0.0917f, 0.667f
-    // 3 = pix 0.5, 190
-    // u, v = 0.0008f, 0.333f
-    // 4 = pix 109.5, 190
-    // u, v = 0.1825f, 0.333f
-
-
-    vertices[6].x = vecArray[0][0];
-    vertices[6].y = vecArray[0][1];
-    vertices[6].z = vecArray[0][2];
-    vertices[6].r = 255;
-    vertices[6].g = 255;
-    vertices[6].b = 255;
-    vertices[6].u = 0.0917f;
-    vertices[6].v = 0.667f;
-    vertices[6].nx = 0.0f;
-    vertices[6].ny = 0.0f;
-    vertices[6].nz = 0.0f;
-
-    vertices[7].x = vecArray[3][0];
-    vertices[7].y = vecArray[3][1];
-    vertices[7].z = vecArray[3][2];
-    vertices[7].r = 255;
-    vertices[7].g = 255;
-    vertices[7].b = 255;
-    vertices[7].u = 0.0008f;
-    vertices[7].v = 0.333f;
-    vertices[7].nx = 0.0f;
-    vertices[7].ny = 0.0f;
-    vertices[7].nz = 0.0f;
-
-    vertices[8].x = vecArray[4][0];
-    vertices[8].y = vecArray[4][1];
-    vertices[8].z = vecArray[4][2];
-    vertices[8].r = 255;
-    vertices[8].g = 255;
-    vertices[8].b = 255;
-    vertices[8].u = 0.1825f;
-    vertices[8].v = 0.333f;
-    vertices[8].nx = 0.0f;
-    vertices[8].ny = 0.0f;
-    vertices[8].nz = 0.0f;
-
-    // t3 - 13 on the die
-    // indices 0, 4, 5 (change vecArray[i][constant])
-    // 0 = pix 55, 95
-    // u, v = 0.0917f, 0.667f
-    // 4 = pix 109.5, 190
-    // u, v = 0.1825f, 0.333f
-    // 5 = pix 164, 95
-    // u, v = 0.273f, 0.667f
-
-    vertices[9].x = vecArray[0][0];
-    vertices[9].y = vecArray[0][1];
-    vertices[9].z = vecArray[0][2];
-    vertices[9].r = 255;
-    vertices[9].g = 255;
-    vertices[9].b = 255;
-    vertices[9].u = 0.0917f;
-    vertices[9].v = 0.667f;
-    vertices[9].nx = 0.0f;
-    vertices[9].ny = 0.0f;
-    vertices[9].nz = 0.0f;
-
-    vertices[10].x = vecArray[4][0];
-    vertices[10].y = vecArray[4][1];
-    vertices[10].z = vecArray[4][2];
-    vertices[10].r = 255;
-    vertices[10].g = 255;
-    vertices[10].b = 255;
-    vertices[10].u = 0.1825f;
-    vertices[10].v = 0.333f;
-    vertices[10].nx = 0.0f;
-    vertices[10].ny = 0.0f;
-    vertices[10].nz = 0.0f;
-
-    vertices[11].x = vecArray[5][0];
-    vertices[11].y = vecArray[5][1];
-    vertices[11].z = vecArray[5][2];
-    vertices[11].r = 255;
-    vertices[11].g = 255;
-    vertices[11].b = 255;
-    vertices[11].u = 0.273f;
-    vertices[11].v = 0.667f;
-    vertices[11].nx = 0.0f;
-    vertices[11].ny = 0.0f;
-    vertices[11].nz = 0.0f;
-
-    // t4 - 5 on the die
-    // indices 0, 5, 1
-    // 0 = pix 55, 95
-    // u, v = 0.0917f, 0.667f
-    // 5 = pix 164, 95
-    // u, v = 0.273f, 0.667f
-    // 1 = pix 109.5, 0
-    // u, v = 0.1825f, 1.0f
-
-    vertices[12].x = vecArray[0][0];
-    vertices[12].y = vecArray[0][1];
-    vertices[12].z = vecArray[0][2];
-    vertices[12].r = 255;
-    vertices[12].g = 255;
-    vertices[12].b = 255;
-    vertices[12].u = 0.0917f;
-    vertices[12].v = 0.667f;
-    vertices[12].nx = 0.0f;
-    vertices[12].ny = 0.0f;
-    vertices[12].nz = 0.0f;
-
-    vertices[13].x = vecArray[5][0];
-    vertices[13].y = vecArray[5][1];
-    vertices[13].z = vecArray[5][2];
-    vertices[13].r = 255;
-    vertices[13].g = 255;
-    vertices[13].b = 255;
-    vertices[13].u = 0.273f;
-    vertices[13].v = 0.667f;
-    vertices[13].nx = 0.0f;
-    vertices[13].ny = 0.0f;
-    vertices[13].nz = 0.0f;
-
-    vertices[14].x = vecArray[1][0];
-    vertices[14].y = vecArray[1][1];
-    vertices[14].z = vecArray[1][2];
-    vertices[14].r = 255;
-    vertices[14].g = 255;
-    vertices[14].b = 255;
-    vertices[14].u = 0.1825f;
-    vertices[14].v = 1.0f;
-    vertices[14].nx = 0.0f;
-    vertices[14].ny = 0.0f;
-    vertices[14].nz = 0.0f;
-
-    // t5 - 8 on the die
-    // indices 6, 7, 8
-    // 6 = pix 327.5, 190
-    // u, v = 0.546f, 0.333f
-    // 7 = pix 436.5, 190
-    // u, v = 0.7275f, 0.333f
-    // 8 = pix 382, 95
-    // u, v = 0.637f, 0.667f
-
-    vertices[15].x = vecArray[6][0];
-    vertices[15].y = vecArray[6][1];
-    vertices[15].z = vecArray[6][2];
-    vertices[15].r = 255;
-    vertices[15].g = 255;
-    vertices[15].b = 255;
-    vertices[15].u = 0.546f;
-    vertices[15].v = 0.333f;
-    vertices[15].nx = 0.0f;
-    vertices[15].ny = 0.0f;
-    vertices[15].nz = 0.0f;
-
-    vertices[16].x = vecArray[7][0];
-    vertices[16].y = vecArray[7][1];
-    vertices[16].z = vecArray[7][2];
-    vertices[16].r = 255;
-    vertices[16].g = 255;
-    vertices[16].b = 255;
-    vertices[16].u = 0.7275f;
-    vertices[16].v = 0.333f;
-    vertices[16].nx = 0.0f;
-    vertices[16].ny = 0.0f;
-    vertices[16].nz = 0.0f;
-
-    vertices[17].x = vecArray[8][0];
-    vertices[17].y = vecArray[8][1];
-    vertices[17].z = vecArray[8][2];
-    vertices[17].r = 255;
-    vertices[17].g = 255;
-    vertices[17].b = 255;
-    vertices[17].u = 0.637f;
-    vertices[17].v = 0.667f;
-    vertices[17].nx = 0.0f;
-    vertices[17].ny = 0.0f;
-    vertices[17].nz = 0.0f;
-
-    // t6 - 10 on the die
-    // indices 6, 8, 9
-    // 6 = pix 327.5, 190
-    // u, v = 0.546f, 0.333f
-    // 8 = pix 382, 95
-    // u, v = 0.637f, 0.667f
-    // 9 = pix 273, 95
-    // u, v = 0.455f, 0.667f
-
-    vertices[18].x = vecArray[6][0];
-    vertices[18].y = vecArray[6][1];
-    vertices[18].z = vecArray[6][2];
-    vertices[18].r = 255;
-    vertices[18].g = 255;
-    vertices[18].b = 255;
-    vertices[18].u = 0.546f;
-    vertices[18].v = 0.333f;
-    vertices[18].nx = 0.0f;
-    vertices[18].ny = 0.0f;
-    vertices[18].nz = 0.0f;
-
-    vertices[19].x = vecArray[8][0];
-    vertices[19].y = vecArray[8][1];
-    vertices[19].z = vecArray[8][2];
-    vertices[19].r = 255;
-    vertices[19].g = 255;
-    vertices[19].b = 255;
-    vertices[19].u = 0.637f;
-    vertices[19].v = 0.667f;
-    vertices[19].nx = 0.0f;
-    vertices[19].ny = 0.0f;
-    vertices[19].nz = 0.0f;
-
-    vertices[20].x = vecArray[9][0];
-    vertices[20].y = vecArray[9][1];
-    vertices[20].z = vecArray[9][2];
-    vertices[20].r = 255;
-    vertices[20].g = 255;
-    vertices[20].b = 255;
-    vertices[20].u = 0.455f;
-    vertices[20].v = 0.667f;
-    vertices[20].nx = 0.0f;
-    vertices[20].ny = 0.0f;
-    vertices[20].nz = 0.0f;
-
-    // t7 - 17 on the die
-    // indices 6, 9, 10
-    // 6 = pix 327.5, 190
-    // u, v = 0.546f, 0.333f
-    // 9 = pix 273, 95
-    // u, v = 0.455f, 0.667f
-    // 10 = pix 218.5, 190
-    // u, v = 0.364f, 0.333f
-
-    vertices[21].x = vecArray[6][0];
-    vertices[21].y = vecArray[6][1];
-    vertices[21].z = vecArray[6][2];
-    vertices[21].r = 255;
-    vertices[21].g = 255;
-    vertices[21].b = 255;
-    vertices[21].u = 0.546f;
-    vertices[21].v = 0.333f;
-    vertices[21].nx = 0.0f;
-    vertices[21].ny = 0.0f;
-    vertices[21].nz = 0.0f;
-
-    vertices[22].x = vecArray[9][0];
-    vertices[22].y = vecArray[9][1];
-    vertices[22].z = vecArray[9][2];
-    vertices[22].r = 255;
-    vertices[22].g = 255;
-    vertices[22].b = 255;
-    vertices[22].u = 0.455f;
-    vertices[22].v = 0.667f;
-    vertices[22].nx = 0.0f;
-    vertices[22].ny = 0.0f;
-    vertices[22].nz = 0.0f;
-
-    vertices[23].x = vecArray[10][0];
-    vertices[23].y = vecArray[10][1];
-    vertices[23].z = vecArray[10][2];
-    vertices[23].r = 255;
-    vertices[23].g = 255;
-    vertices[23].b = 255;
-    vertices[23].u = 0.364f;
-    vertices[23].v = 0.333f;
-    vertices[23].nx = 0.0f;
-    vertices[23].ny = 0.0f;
-    vertices[23].nz = 0.0f;
-
-    // t8 - 3 on the die
-    // indices 6, 10, 11
-    // 6 = pix 327.5, 190
-    // u, v = 0.546f, 0.333f
-    // 10 = pix 218.5, 190
-    // u, v = 0.364f, 0.333f
-    // 11 = pix 272.5, 285
-    // u, v = 0.454f, 0.0f
-
-    vertices[24].x = vecArray[6][0];
-    vertices[24].y = vecArray[6][1];
-    vertices[24].z = vecArray[6][2];
-    vertices[24].r = 255;
-    vertices[24].g = 255;
-    vertices[24].b = 255;
-    vertices[24].u = 0.546f;
-    vertices[24].v = 0.333f;
-    vertices[24].nx = 0.0f;
-    vertices[24].ny = 0.0f;
-    vertices[24].nz = 0.0f;
-
-    vertices[25].x = vecArray[10][0];
-    vertices[25].y = vecArray[10][1];
-    vertices[25].z = vecArray[10][2];
-    vertices[25].r = 255;
-    vertices[25].g = 255;
-    vertices[25].b = 255;
-    vertices[25].u = 0.364f;
-    vertices[25].v = 0.333f;
-    vertices[25].nx = 0.0f;
-    vertices[25].ny = 0.0f;
-    vertices[25].nz = 0.0f;
-
-    vertices[26].x = vecArray[11][0];
-    vertices[26].y = vecArray[11][1];
-    vertices[26].z = vecArray[11][2];
-    vertices[26].r = 255;
-    vertices[26].g = 255;
-    vertices[26].b = 255;
-    vertices[26].u = 0.454f;
-    vertices[26].v = 0.0f;
-    vertices[26].nx = 0.0f;
-    vertices[26].ny = 0.0f;
-    vertices[26].nz = 0.0f;
-
-    // t9 - 16 on the die
-    // indices 6, 11, 7
-    // 6 = pix 327.5, 190
-    // u, v = 0.546f, 0.333f
-    // 11 = pix 382, 285
-    // u, v = 0.637f, 0.0f
-    // 7 = pix 436.5, 190
-    // u, v = 0.7275f, 0.333f
-
-    vertices[27].x = vecArray[6][0];
-    vertices[27].y = vecArray[6][1];
-    vertices[27].z = vecArray[6][2];
-    vertices[27].r = 255;
-    vertices[27].g = 255;
-    vertices[27].b = 255;
-    vertices[27].u = 0.546f;
-    vertices[27].v = 0.333f;
-    vertices[27].nx = 0.0f;
-    vertices[27].ny = 0.0f;
-    vertices[27].nz = 0.0f;
-
-    vertices[28].x = vecArray[11][0];
-    vertices[28].y = vecArray[11][1];
-    vertices[28].z = vecArray[11][2];
-    vertices[28].r = 255;
-    vertices[28].g = 255;
-    vertices[28].b = 255;
-    vertices[28].u = 0.637f;
-    vertices[28].v = 0.0f;
-    vertices[28].nx = 0.0f;
-    vertices[28].ny = 0.0f;
-    vertices[28].nz = 0.0f;
-
-    vertices[29].x = vecArray[7][0];
-    vertices[29].y = vecArray[7][1];
-    vertices[29].z = vecArray[7][2];
-    vertices[29].r = 255;
-    vertices[29].g = 255;
-    vertices[29].b = 255;
-    vertices[29].u = 0.7275f;
-    vertices[29].v = 0.333f;
-    vertices[29].nx = 0.0f;
-    vertices[29].ny = 0.0f;
-    vertices[29].nz = 0.0f;
-
-    // t10 - 2 on the die
-    // indices 1, 8, 2
-    // 1 = pix 436.5, 0
-    // u, v = 0.7275f, 1.0f
-    // 8 = pix 382, 95
-    // u, v = 0.637f, 0.667f
-    // 2 = pix 491, 95
-    // u, v = 0.818f, 0.667f
-
-    vertices[30].x = vecArray[1][0];
-    vertices[30].y = vecArray[1][1];
-    vertices[30].z = vecArray[1][2];
-    vertices[30].r = 255;
-    vertices[30].g = 255;
-    vertices[30].b = 255;
-    vertices[30].u = 0.7275f;
-    vertices[30].v = 1.0f;
-    vertices[30].nx = 0.0f;
-    vertices[30].ny = 0.0f;
-    vertices[30].nz = 0.0f;
-
-    vertices[31].x = vecArray[8][0];
-    vertices[31].y = vecArray[8][1];
-    vertices[31].z = vecArray[8][2];
-    vertices[31].r = 255;
-    vertices[31].g = 255;
-    vertices[31].b = 255;
-    vertices[31].u = 0.637f;
-    vertices[31].v = 0.667f;
-    vertices[31].nx = 0.0f;
-    vertices[31].ny = 0.0f;
-    vertices[31].nz = 0.0f;
-
-    vertices[32].x = vecArray[2][0];
-    vertices[32].y = vecArray[2][1];
-    vertices[32].z = vecArray[2][2];
-    vertices[32].r = 255;
-    vertices[32].g = 255;
-    vertices[32].b = 255;
-    vertices[32].u = 0.818f;
-    vertices[32].v = 0.667f;
-    vertices[32].nx = 0.0f;
-    vertices[32].ny = 0.0f;
-    vertices[32].nz = 0.0f;
-
-    // t11 - 20 on the die
-    // indices 2, 8, 7
-    // 2 = pix 491, 95
-    // u, v = 0.818f, 0.667f
-    // 8 = pix 382, 95
-    // u, v = 0.637f, 0.667f
-    // 7 = pix 436.5, 190
-    // u, v = 0.7275f, 0.333f
-
-    vertices[33].x = vecArray[2][0];
-    vertices[33].y = vecArray[2][1];
-    vertices[33].z = vecArray[2][2];
-    vertices[33].r = 255;
-    vertices[33].g = 255;
-    vertices[33].b = 255;
-    vertices[33].u = 0.818f;
-    vertices[33].v = 0.667f;
-    vertices[33].nx = 0.0f;
-    vertices[33].ny = 0.0f;
-    vertices[33].nz = 0.0f;
-
-    vertices[34].x = vecArray[8][0];
-    vertices[34].y = vecArray[8][1];
-    vertices[34].z = vecArray[8][2];
-    vertices[34].r = 255;
-    vertices[34].g = 255;
-    vertices[34].b = 255;
-    vertices[34].u = 0.637f;
-    vertices[34].v = 0.667f;
-    vertices[34].nx = 0.0f;
-    vertices[34].ny = 0.0f;
-    vertices[34].nz = 0.0f;
-
-    vertices[35].x = vecArray[7][0];
-    vertices[35].y = vecArray[7][1];
-    vertices[35].z = vecArray[7][2];
-    vertices[35].r = 255;
-    vertices[35].g = 255;
-    vertices[35].b = 255;
-    vertices[35].u = 0.7275f;
-    vertices[35].v = 0.333f;
-    vertices[35].nx = 0.0f;
-    vertices[35].ny = 0.0f;
-    vertices[35].nz = 0.0f;
-
-    // t12 - 14 on the die
-    // indices 2, 7, 3
-    // 2 = pix 491, 95
-    // u, v = 0.818f, 0.667f
-    // 7 = pix 436.5, 190
-    // u, v = 0.7275f, 0.333f
-    // 3 = pix 545.5, 190
-    // u, v = 0.909f, 0.333f
-
-    vertices[36].x = vecArray[2][0];
-    vertices[36].y = vecArray[2][1];
-    vertices[36].z = vecArray[2][2];
-    vertices[36].r = 255;
-    vertices[36].g = 255;
-    vertices[36].b = 255;
-    vertices[36].u = 0.818f;
-    vertices[36].v = 0.667f;
-    vertices[36].nx = 0.0f;
-    vertices[36].ny = 0.0f;
-    vertices[36].nz = 0.0f;
-
-    vertices[37].x = vecArray[7][0];
-    vertices[37].y = vecArray[7][1];
-    vertices[37].z = vecArray[7][2];
-    vertices[37].r = 255;
-    vertices[37].g = 255;
-    vertices[37].b = 255;
-    vertices[37].u = 0.7275f;
-    vertices[37].v = 0.333f;
-    vertices[37].nx = 0.0f;
-    vertices[37].ny = 0.0f;
-    vertices[37].nz = 0.0f;
-
-    vertices[38].x = vecArray[3][0];
-    vertices[38].y = vecArray[3][1];
-    vertices[38].z = vecArray[3][2];
-    vertices[38].r = 255;
-    vertices[38].g = 255;
-    vertices[38].b = 255;
-    vertices[38].u = 0.909f;
-    vertices[38].v = 0.333f;
-    vertices[38].nx = 0.0f;
-    vertices[38].ny = 0.0f;
-    vertices[38].nz = 0.0f;
-
-    // t13 - 6 on the die
-    // indices 3, 7, 11
-    // 3 = pix 545.5, 190
-    // u, v = 0.909f, 0.333f
-    // 7 = pix 436.5, 190
-    // u, v = 0.7275f, 0.333f
-    // 11 = pix 490.5, 285
-    // u, v = 0.8175f, 0.0f
-
-    vertices[39].x = vecArray[3][0];
-    vertices[39].y = vecArray[3][1];
-    vertices[39].z = vecArray[3][2];
-    vertices[39].r = 255;
-    vertices[39].g = 255;
-    vertices[39].b = 255;
-    vertices[39].u = 0.909f;
-    vertices[39].v = 0.333f;
-    vertices[39].nx = 0.0f;
-    vertices[39].ny = 0.0f;
-    vertices[39].nz = 0.0f;
-
-    vertices[40].x = vecArray[7][0];
-    vertices[40].y = vecArray[7][1];
-    vertices[40].z = vecArray[7][2];
-    vertices[40].r = 255;
-    vertices[40].g = 255;
-    vertices[40].b = 255;
-    vertices[40].u = 0.7275f;
-    vertices[40].v = 0.333f;
-    vertices[40].nx = 0.0f;
-    vertices[40].ny = 0.0f;
-    vertices[40].nz = 0.0f;
-
-    vertices[41].x = vecArray[11][0];
-    vertices[41].y = vecArray[11][1];
-    vertices[41].z = vecArray[11][2];
-    vertices[41].r = 255;
-    vertices[41].g = 255;
-    vertices[41].b = 255;
-    vertices[41].u = 0.8175f;
-    vertices[41].v = 0.0f;
-    vertices[41].nx = 0.0f;
-    vertices[41].ny = 0.0f;
-    vertices[41].nz = 0.0f;
-
-    // t14 - 9 on the die
-    // indices 3, 11, 4
-    // 3 = pix 0, 190
-    // u, v = 0.0f, 0.333f
-    // 11 = pix 54.5, 285
-    // u, v = 0.0908f, 0.0f
-    // 4 = pix 109, 190
-    // u, v = 0.1817f, 0.333f
-
-    vertices[42].x = vecArray[3][0];
-    vertices[42].y = vecArray[3][1];
-    vertices[42].z = vecArray[3][2];
-    vertices[42].r = 255;
-    vertices[42].g = 255;
-    vertices[42].b = 255;
-    vertices[42].u = 0.0f;
-    vertices[42].v = 0.333f;
-    vertices[42].nx = 0.0f;
-    vertices[42].ny = 0.0f;
-    vertices[42].nz = 0.0f;
-
-    vertices[43].x = vecArray[11][0];
-    vertices[43].y = vecArray[11][1];
-    vertices[43].z = vecArray[11][2];
-    vertices[43].r = 255;
-    vertices[43].g = 255;
-    vertices[43].b = 255;
-    vertices[43].u = 0.0908f;
-    vertices[43].v = 0.0f;
-    vertices[43].nx = 0.0f;
-    vertices[43].ny = 0.0f;
-    vertices[43].nz = 0.0f;
-
-    vertices[44].x = vecArray[4][0];
-    vertices[44].y = vecArray[4][1];
-    vertices[44].z = vecArray[4][2];
-    vertices[44].r = 255;
-    vertices[44].g = 255;
-    vertices[44].b = 255;
-    vertices[44].u = 0.1817f;
-    vertices[44].v = 0.333f;
-    vertices[44].nx = 0.0f;
-    vertices[44].ny = 0.0f;
-    vertices[44].nz = 0.0f;
-
-    // t15 - 19 on the die
-    // indices 4, 11, 10
-    // 4 = pix 109, 190
-    // u, v = 0.1817f, 0.333f
-    // 11 = pix 163.5, 285
-    // u, v = 0.2725f, 0.0f
-    // 10 = pix 218, 190
-    // u, v = 0.363f, 0.333f
-
-    vertices[45].x = vecArray[4][0];
-    vertices[45].y = vecArray[4][1];
-    vertices[45].z = vecArray[4][2];
-    vertices[45].r = 255;
-    vertices[45].g = 255;
-    vertices[45].b = 255;
-    vertices[45].u = 0.1817f;
-    vertices[45].v = 0.333f;
-    vertices[45].nx = 0.0f;
-    vertices[45].ny = 0.0f;
-    vertices[45].nz = 0.0f;
-
-    vertices[46].x = vecArray[11][0];
-    vertices[46].y = vecArray[11][1];
-    vertices[46].z = vecArray[11][2];
-    vertices[46].r = 255;
-    vertices[46].g = 255;
-    vertices[46].b = 255;
-    vertices[46].u = 0.2725f;
-    vertices[46].v = 0.0f;
-    vertices[46].nx = 0.0f;
-    vertices[46].ny = 0.0f;
-    vertices[46].nz = 0.0f;
-
-    vertices[47].x = vecArray[10][0];
-    vertices[47].y = vecArray[10][1];
-    vertices[47].z = vecArray[10][2];
-    vertices[47].r = 255;
-    vertices[47].g = 255;
-    vertices[47].b = 255;
-    vertices[47].u = 0.363f;
-    vertices[47].v = 0.333f;
-    vertices[47].nx = 0.0f;
-    vertices[47].ny = 0.0f;
-    vertices[47].nz = 0.0f;
-
-    // t16 - 1 on the die
-    // indices 4, 10, 5
-    // 4 = pix 109, 190
-    // u, v = 0.1817f, 0.333f
-    // 10 = pix 218, 190
-    // u, v = 0.363f, 0.333f
-    // 5 = pix 164, 95
-    // u, v = 0.273f, 0.667f
-
-    vertices[48].x = vecArray[4][0];
-    vertices[48].y = vecArray[4][1];
-    vertices[48].z = vecArray[4][2];
-    vertices[48].r = 255;
-    vertices[48].g = 255;
-    vertices[48].b = 255;
-    vertices[48].u = 0.1817f;
-    vertices[48].v = 0.333f;
-    vertices[48].nx = 0.0f;
-    vertices[48].ny = 0.0f;
-    vertices[48].nz = 0.0f;
-
-    vertices[49].x = vecArray[10][0];
-    vertices[49].y = vecArray[10][1];
-    vertices[49].z = vecArray[10][2];
-    vertices[49].r = 255;
-    vertices[49].g = 255;
-    vertices[49].b = 255;
-    vertices[49].u = 0.363f;
-    vertices[49].v = 0.333f;
-    vertices[49].nx = 0.0f;
-    vertices[49].ny = 0.0f;
-    vertices[49].nz = 0.0f;
-
-    vertices[50].x = vecArray[5][0];
-    vertices[50].y = vecArray[5][1];
-    vertices[50].z = vecArray[5][2];
-    vertices[50].r = 255;
-    vertices[50].g = 255;
-    vertices[50].b = 255;
-    vertices[50].u = 0.273f;
-    vertices[50].v = 0.667f;
-    vertices[50].nx = 0.0f;
-    vertices[50].ny = 0.0f;
-    vertices[50].nz = 0.0f;
-
-    // t17 - 7 on the die
-    // indices 5, 10, 9
-    // 5 = pix 164, 95
-    // u, v = 0.273f, 0.667f
-    // 10 = pix 218, 190
-    // u, v = 0.363f, 0.333f
-    // 9 = pix 273, 95
-    // u, v = 0.455f, 0.667f
-
-    vertices[51].x = vecArray[5][0];
-    vertices[51].y = vecArray[5][1];
-    vertices[51].z = vecArray[5][2];
-    vertices[51].r = 255;
-    vertices[51].g = 255;
-    vertices[51].b = 255;
-    vertices[51].u = 0.273f;
-    vertices[51].v = 0.667f;
-    vertices[51].nx = 0.0f;
-    vertices[51].ny = 0.0f;
-    vertices[51].nz = 0.0f;
-
-    vertices[52].x = vecArray[10][0];
-    vertices[52].y = vecArray[10][1];
-    vertices[52].z = vecArray[10][2];
-    vertices[52].r = 255;
-    vertices[52].g = 255;
-    vertices[52].b = 255;
-    vertices[52].u = 0.363f;
-    vertices[52].v = 0.333f;
-    vertices[52].nx = 0.0f;
-    vertices[52].ny = 0.0f;
-    vertices[52].nz = 0.0f;
-
-    vertices[53].x = vecArray[9][0];
-    vertices[53].y = vecArray[9][1];
-    vertices[53].z = vecArray[9][2];
-    vertices[53].r = 255;
-    vertices[53].g = 255;
-    vertices[53].b = 255;
-    vertices[53].u = 0.455f;
-    vertices[53].v = 0.667f;
-    vertices[53].nx = 0.0f;
-    vertices[53].ny = 0.0f;
-    vertices[53].nz = 0.0f;
-
-    // t18 - 15 on the die
-    // indices 5, 9, 1
-    // 5 = pix 164, 95
-    // u, v = 0.273f, 0.667f
-    // 9 = pix 273, 95
-    // u, v = 0.455f, 0.667f
-    // 1 = pix 218.5, 0
-    // u, v = 0.364f, 1.0f
-
-    vertices[54].x = vecArray[5][0];
-    vertices[54].y = vecArray[5][1];
-    vertices[54].z = vecArray[5][2];
-    vertices[54].r = 255;
-    vertices[54].g = 255;
-    vertices[54].b = 255;
-    vertices[54].u = 0.273f;
-    vertices[54].v = 0.667f;
-    vertices[54].nx = 0.0f;
-    vertices[54].ny = 0.0f;
-    vertices[54].nz = 0.0f;
-
-    vertices[55].x = vecArray[9][0];
-    vertices[55].y = vecArray[9][1];
-    vertices[55].z = vecArray[9][2];
-    vertices[55].r = 255;
-    vertices[55].g = 255;
-    vertices[55].b = 255;
-    vertices[55].u = 0.455f;
-    vertices[55].v = 0.667f;
-    vertices[55].nx = 0.0f;
-    vertices[55].ny = 0.0f;
-    vertices[55].nz = 0.0f;
-
-    vertices[56].x = vecArray[1][0];
-    vertices[56].y = vecArray[1][1];
-    vertices[56].z = vecArray[1][2];
-    vertices[56].r = 255;
-    vertices[56].g = 255;
-    vertices[56].b = 255;
-    vertices[56].u = 0.364f;
-    vertices[56].v = 1.0f;
-    vertices[56].nx = 0.0f;
-    vertices[56].ny = 0.0f;
-    vertices[56].nz = 0.0f;
-
-    // t19 - 12 on the die
-    // indices 1, 9, 8
-    // 1 = pix 327.5, 0
-    // u, v = 0.5458f, 1.0f
-    // 9 = pix 273, 95
-    // u, v = 0.455f, 0.667f
-    // 8 = pix 382, 95
-    // u, v = 0.637f, 0.667f
-
-    vertices[57].x = vecArray[1][0];
-    vertices[57].y = vecArray[1][1];
-    vertices[57].z = vecArray[1][2];
-    vertices[57].r = 255;
-    vertices[57].g = 255;
-    vertices[57].b = 255;
-    vertices[57].u = 0.5458f;
-    vertices[57].v = 1.0f;
-    vertices[57].nx = 0.0f;
-    vertices[57].ny = 0.0f;
-    vertices[57].nz = 0.0f;
-
-    vertices[58].x = vecArray[9][0];
-    vertices[58].y = vecArray[9][1];
-    vertices[58].z = vecArray[9][2];
-    vertices[58].r = 255;
-    vertices[58].g = 255;
-    vertices[58].b = 255;
-    vertices[58].u = 0.455f;
-    vertices[58].v = 0.667f;
-    vertices[58].nx = 0.0f;
-    vertices[58].ny = 0.0f;
-    vertices[58].nz = 0.0f;
-
-    vertices[59].x = vecArray[8][0];
-    vertices[59].y = vecArray[8][1];
-    vertices[59].z = vecArray[8][2];
-    vertices[59].r = 255;
-    vertices[59].g = 255;
-    vertices[59].b = 255;
-    vertices[59].u = 0.637f;
-    vertices[59].v = 0.667f;
-    vertices[59].nx = 0.0f;
-    vertices[59].ny = 0.0f;
-    vertices[59].nz = 0.0f;
-
-
-    // assigning normals per triangle
-    
-    for (int i = 0; i < 3; i++) {
-        vertices[i].nx = normalFaces[0][0];
-        vertices[i].ny = normalFaces[0][1];
-        vertices[i].nz = normalFaces[0][2];
-    };
-    for (int i = 3; i < 6; i++) {
-        vertices[i].nx = normalFaces[1][0];
-        vertices[i].ny = normalFaces[1][1];
-        vertices[i].nz = normalFaces[1][2];
-    };
-    for (int i = 6; i < 9; i++) {
-        vertices[i].nx = normalFaces[2][0];
-        vertices[i].ny = normalFaces[2][1];
-        vertices[i].nz = normalFaces[2][2];
-    };
-    for (int i = 9; i < 12; i++) {
-        vertices[i].nx = normalFaces[3][0];
-        vertices[i].ny = normalFaces[3][1];
-        vertices[i].nz = normalFaces[3][2];
-    };
-    for (int i = 12; i < 15; i++) {
-        vertices[i].nx = normalFaces[4][0];
-        vertices[i].ny = normalFaces[4][1];
-        vertices[i].nz = normalFaces[4][2];
-    };
-    for (int i = 15; i < 18; i++) {
-        vertices[i].nx = normalFaces[5][0];
-        vertices[i].ny = normalFaces[5][1];
-        vertices[i].nz = normalFaces[5][2];
-    };
-    for (int i = 18; i < 21; i++) {
-        vertices[i].nx = normalFaces[6][0];
-        vertices[i].ny = normalFaces[6][1];
-        vertices[i].nz = normalFaces[6][2];
-    };
-    for (int i = 21; i < 24; i++) {
-        vertices[i].nx = normalFaces[7][0];
-        vertices[i].ny = normalFaces[7][1];
-        vertices[i].nz = normalFaces[7][2];
-    };
-    for (int i = 24; i < 27; i++) {
-        vertices[i].nx = normalFaces[8][0];
-        vertices[i].ny = normalFaces[8][1];
-        vertices[i].nz = normalFaces[8][2];
-    };
-    for (int i = 27; i < 30; i++) {
-        vertices[i].nx = normalFaces[9][0];
-        vertices[i].ny = normalFaces[9][1];
-        vertices[i].nz = normalFaces[9][2];
-    };
-    for (int i = 30; i < 33; i++) {
-        vertices[i].nx = normalFaces[10][0];
-        vertices[i].ny = normalFaces[10][1];
-        vertices[i].nz = normalFaces[10][2];
-    };
-    for (int i = 33; i < 36; i++) {
-        vertices[i].nx = normalFaces[11][0];
-        vertices[i].ny = normalFaces[11][1];
-        vertices[i].nz = normalFaces[11][2];
-    };
-    for (int i = 36; i < 39; i++) {
-        vertices[i].nx = normalFaces[12][0];
-        vertices[i].ny = normalFaces[12][1];
-        vertices[i].nz = normalFaces[12][2];
-    };
-    for (int i = 39; i < 42; i++) {
-        vertices[i].nx = normalFaces[13][0];
-        vertices[i].ny = normalFaces[13][1];
-        vertices[i].nz = normalFaces[13][2];
-    };
-    for (int i = 42; i < 45; i++) {
-        vertices[i].nx = normalFaces[14][0];
-        vertices[i].ny = normalFaces[14][1];
-        vertices[i].nz = normalFaces[14][2];
-    };
-    for (int i = 45; i < 48; i++) {
-        vertices[i].nx = normalFaces[15][0];
-        vertices[i].ny = normalFaces[15][1];
-        vertices[i].nz = normalFaces[15][2];
-    };
-    for (int i = 48; i < 51; i++) {
-        vertices[i].nx = normalFaces[16][0];
-        vertices[i].ny = normalFaces[16][1];
-        vertices[i].nz = normalFaces[16][2];
-    };
-    for (int i = 51; i < 54; i++) {
-        vertices[i].nx = normalFaces[17][0];
-        vertices[i].ny = normalFaces[17][1];
-        vertices[i].nz = normalFaces[17][2];
-    };
-    for (int i = 54; i < 57; i++) {
-        vertices[i].nx = normalFaces[18][0];
-        vertices[i].ny = normalFaces[18][1];
-        vertices[i].nz = normalFaces[18][2];
-    };
-    for (int i = 57; i < 60; i++) {
-        vertices[i].nx = normalFaces[19][0];
-        vertices[i].ny = normalFaces[19][1];
-        vertices[i].nz = normalFaces[19][2];
-    };
-
-
-    // Create a vertex buffer object (VBO), and upload our vertices data to the VBO
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
+    TraceScope vertexScope("vertex specification");
+
+    // Set up every detail level of the d20, from finely subdivided with rounded edges down to the plain 20 triangles
+    // (positions and normals come from the icosahedron formula, UVs point into the numeral atlas)
+    D20LodMesh lodMesh = BuildD20LodMesh(0.08f);
+
+    // The scene is drawn with back-face culling, which is only safe if every triangle is wound counter-clockwise
+    // seen from outside. A mesh that fails the check is drawn with culling off instead of with holes.
+    bool backFaceCulling = ValidateD20Winding(lodMesh);
+
+    // Create a vertex buffer object (VBO) and an index buffer object (IBO), and upload all the levels into them,
+    // one after the other. A draw picks its level with the index range and base vertex from lodMesh.lods.
+    GLuint vbo = CreateGlResource(GlResourceType::Buffer, "d20 vertices");
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, lodMesh.vertices.size() * sizeof(Vertex), lodMesh.vertices.data(), GL_STATIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
+    SetGlResourceBytes(GlResourceType::Buffer, vbo, lodMesh.vertices.size() * sizeof(Vertex));
+
+    GLuint ibo = CreateGlResource(GlResourceType::Buffer, "d20 indices");
 
     // Create a vertex array object that contains data on how to map vertex attributes
     // (e.g., position, color) to vertex shader properties.
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
+    GLuint vao = CreateGlResource(GlResourceType::VertexArray, "d20");
     glBindVertexArray(vao);
 
+    // the index buffer binding is part of the vertex array object
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, lodMesh.indices.size() * sizeof(GLushort), lodMesh.indices.data(), GL_STATIC_DRAW);
+    SetGlResourceBytes(GlResourceType::Buffer, ibo, lodMesh.indices.size() * sizeof(GLushort));
+
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
     // Vertex attribute 0 - Position
@@ -1260,164 +695,554 @@ int main()
     glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, nx)));
 
     glEnableVertexAttribArray(0);
+    vertexScope.End();
 
-    // Create a shader program
-    // for windows:
-    GLuint program = CreateShaderProgram("main.vsh", "main.fsh");
+    // --- Dice transforms ---
 
-    // for mac:
-//    GLuint program = CreateShaderProgram("/Users/carmen/Downloads/OpenGL/Projects/testing/testing/main.vs", "/Users/carmen/Downloads/OpenGL/Projects/testing/testing/main.fs");
+    TraceScope diceScope("dice setup");
 
-    // Tell OpenGL the dimensions of the region where stuff will be drawn.
-    // For now, tell OpenGL to use the whole screen
-    glViewport(0, 0, windowWidth, windowHeight);
+    // Worker threads for the per-frame work (this thread is worker 0 and joins in while it waits),
+    // and for scattering the tray dice
+    JobSystem jobSystem(threadCount);
 
-    // Create a variable that will contain the ID for our texture,
-    // and use glGenTextures() to generate the texture itself
-    GLuint tex0; // normal d20
-    glGenTextures(1, &tex0);
-    GLuint tex1; // translucent d20
-    glGenTextures(1, &tex1);
+    // The scene is a small hierarchy: the big die and the small die nested inside it hang off one node,
+    // so moving that node moves both, and the tray of dice hangs off its own node below and behind them.
+    SceneGraph scene;
+    const int sceneRoot = scene.AddNode(SceneGraph::noParent, glm::mat4(1.0f));
+    const int heroDiceNode = scene.AddNode(sceneRoot, glm::translate(glm::mat4(1.0f), glm::vec3(-0.5f, 0.0f, 0.0f)));
+    const int trayNode = scene.AddNode(sceneRoot, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, -1.0f)));
 
-    // --- Load our image using stb_image ---
-
-    // Im image-space (pixels), (0, 0) is the upper-left corner of the image
-    // However, in u-v coordinates, (0, 0) is the lower-left corner of the image
-    // This means that the image will appear upside-down when we use the image data as is
-    // This function tells stbi to flip the image vertically so that it is not upside-down when we use it
-    stbi_set_flip_vertically_on_load(true);
+    // Every die is stored in the transform system, positioned relative to its node. The big translucent die comes first,
+    // followed by all the opaque dice, so that the opaque ones can be drawn with a single instanced draw.
+    // A replayed session brings its own dice: the two big ones and a tray of the rest.
+    RecordingReader replay;
+    if (!replayPath.empty())
+    {
+        if (!replay.Open(replayPath))
+        {
+            glfwTerminate();
+            return 1;
+        }
+        if (replay.DiceCount() < 2 || replay.FrameCount() == 0)
+        {
+            std::cerr << "The recording " << replayPath << " has " << replay.DiceCount() << " dice and " << replay.FrameCount()
+                << " frames, nothing to replay!" << std::endl;
+            glfwTerminate();
+            return 1;
+        }
+        trayDiceCount = static_cast<int>(replay.DiceCount()) - 2;
+        std::cout << "replay: " << replay.FrameCount() << " frames of " << replay.DiceCount() << " dice" << std::endl;
+    }
+    const bool replaying = !replayPath.empty();
+    uint64_t replayFrame = 0;
 
-    // 'imageWidth' and imageHeight will contain the width and height of the loaded image respectively
-    int imageWidth, imageHeight, numChannels;  // normal d20
-    int imageWidth1, imageHeight1, numChannels1;  // translucent d20
+    TransformSystem transforms;
+    const size_t bigDie = transforms.Add(glm::vec3(0.0f, 0.0f, 0.0f), 0.9f, glm::vec3(-1.0f, 1.0f, 1.0f), 1.0f, 0.0f);
+    const size_t smallDie = transforms.Add(glm::vec3(0.0f, 0.0f, 0.0f), 0.4f, glm::vec3(1.0f, -1.0f, -1.0f), 1.0f, 0.0f);
+    scene.AttachDice(heroDiceNode, bigDie, smallDie + 1);
 
-    // Read the image data and store it in an unsigned char array
+    const size_t firstTrayDie = transforms.Count();
+    if (scatterTrayDice && !replaying)
+    {
+        AddScatteredTrayDice(transforms, trayDiceCount, materialCount, jobSystem);
+    }
+    else
+    {
+        AddTrayDice(transforms, trayDiceCount, materialCount);
+    }
+    scene.AttachDice(trayNode, firstTrayDie, transforms.Count());
+    if (replaying && !replay.RestoreDice(transforms))
+    {
+        glfwTerminate();
+        return 1;
+    }
 
-    // for windows:
-    unsigned char* imageData = stbi_load("d20.png", &imageWidth, &imageHeight, &numChannels, 0);
-    unsigned char* imageData1 = stbi_load("d20 transparent.png", &imageWidth1, &imageHeight1, &numChannels1, 0);
+    // Dice that never spin (such as the scattered tray dice) cast the same shadow every frame, so they go into the cached
+    // static shadow map with the tray, and only the spinning dice are drawn into the shadow map every frame.
+    // (A replay sets every rotation from the recording, so no die rests then.)
+    std::vector<uint8_t> dieRests(transforms.Count(), 0);
+    std::vector<uint32_t> restingDice;
+    std::vector<std::pair<size_t, size_t>> spinningDiceRuns;    // [begin, end) ranges of spinning dice, for GPU spin mode
+    for (size_t i = 0; i < transforms.Count(); i++)
+    {
+        if (!replaying && transforms.IsResting(i))
+        {
+            dieRests[i] = 1;
+            restingDice.push_back(static_cast<uint32_t>(i));
+        }
+        else if (!spinningDiceRuns.empty() && spinningDiceRuns.back().second == i)
+        {
+            spinningDiceRuns.back().second++;
+        }
+        else
+        {
+            spinningDiceRuns.push_back({ i, i + 1 });
+        }
+    }
 
-    // for mac:
-//    unsigned char* imageData = stbi_load("/Users/carmen/Downloads/OpenGL/Projects/testing/testing/d20.png", &imageWidth, &imageHeight, &numChannels, 0);
-//    unsigned char* imageData1 = stbi_load("/Users/carmen/Downloads/OpenGL/Projects/testing/testing/d20 transparent.png", &imageWidth1, &imageHeight1, &numChannels1, 0);
+    // the recording is written by its own thread, this one only copies the rotations every frame
+    RecordingWriter recorder;
+    if (!recordPath.empty() && !recorder.Open(recordPath, transforms))
+    {
+        glfwTerminate();
+        return 1;
+    }
 
+    // The tray under the dice never moves. It is drawn with the same shaders as the dice, as one instance placed at the
+    // tray node, and it is the static geometry whose shadow map is cached.
+    // The floor covers the grid of AddTrayDice() with a margin, and at least the area under the big die.
+    int trayColumns = 1;
+    while (trayColumns * trayColumns < trayDiceCount)
+    {
+        trayColumns++;
+    }
+    int trayRows = (trayDiceCount + trayColumns - 1) / trayColumns;
+    float trayHalfWidth = std::max(0.5f * (trayColumns - 1) * 0.3f + 0.3f, 1.5f);
+    float trayBack = std::min(-(trayRows - 1) * 0.3f - 0.3f, -1.0f);
+    TrayMesh trayMesh = BuildTrayMesh(glm::vec2(-trayHalfWidth, trayBack), glm::vec2(trayHalfWidth, 2.0f), -0.1f);
+    size_t miswoundTrayTriangles = CountMiswoundTriangles(trayMesh.vertices.data(), trayMesh.indices.data(), trayMesh.indices.size());
+    if (miswoundTrayTriangles > 0)
+    {
+        std::cerr << "Failed to validate the winding of the tray: " << miswoundTrayTriangles << " triangles go clockwise!" << std::endl;
+        backFaceCulling = false;
+    }
+    if (!backFaceCulling)
+    {
+        std::cerr << "Back-face culling is off, since not every triangle is wound counter-clockwise!" << std::endl;
+    }
 
-    // Make sure that we actually loaded the image before uploading the data to the GPU
-    if (imageData != nullptr)
+    // shadows are fitted to a sphere around the tray and whatever stands on it
+    glm::vec3 trayOrigin = glm::vec3((scene.Local(sceneRoot) * scene.Local(trayNode))[3]);
+    glm::vec3 shadowCenter = trayOrigin + glm::vec3(0.0f, 0.5f, 0.5f * (trayBack + 2.0f));
+    float shadowRadius = glm::length(glm::vec3(trayHalfWidth, 1.0f, 0.5f * (2.0f - trayBack))) + 0.2f;
+    diceScope.End();
+
+    // Culling works on chunks of dice. Every chunk writes the indices of its visible dice
+    // into its own slice of visibleDice, and the chunks are then packed one after the other into the instance buffer.
+    const size_t cullGrainSize = 1024;
+    const size_t cullChunkCount = (transforms.Count() + cullGrainSize - 1) / cullGrainSize;
+    // The visible dice are then sorted by their size on screen into the same slice of one list per level:
+    // the mesh detail levels first, and the dice too small for any mesh last, drawn as impostors.
+    // The instance buffer holds all the dice of level 0, then all of level 1, and so on.
+    const int levelCount = d20LodCount + 1;
+    const int impostorLevel = d20LodCount;
+    // Then the dice hidden behind the tray, or behind the dice nearest the camera, are taken out of the level lists:
+    // those occluders are drawn into a small depth buffer (in parallel bands of rows), and every survivor of the frustum
+    // is tested against it (in the same chunks). The biggest dice on screen are the occluders, up to maxDieOccluders.
+    OcclusionBuffer occlusionBuffer;
+    const size_t maxDieOccluders = 512;
+    const size_t occlusionBandRows = 16;
+    // All of these lists only live for a frame, so they come from the frame arena instead of the heap:
+    // room for the visible dice and every level list, the bounding spheres for occlusion culling, the per-chunk counts,
+    // the visible spinning dice and their per-chunk counts (when some dice rest), plus some spare for other per-frame data.
+    size_t frameArenaBytes = (levelCount + 2) * transforms.Count() * sizeof(uint32_t) + transforms.Count() * sizeof(glm::vec4)
+        + (2 * levelCount + 2) * cullChunkCount * sizeof(size_t) + 64 * 1024;
+    FrameArena frameArena(frameArenaBytes);
+
+    // culling results, summed up until they are printed
+    size_t statsFrames = 0, statsVisible = 0, statsImpostors = 0, statsOccluded = 0;
+    uint64_t statsHeapAllocations = 0;
+    size_t statsStreamedBytes = 0, statsLitClusters = 0, statsClusterLights = 0, statsShadowCasters = 0;
+    double statsCullMs = 0.0, statsFenceWaitMs = 0.0, statsLightBuildMs = 0.0, statsGpuCullMs = 0.0;
+    size_t statsGpuCullFrames = 0;
+    double statsStartTime = glfwGetTime();
+
+    // CPU time of the whole process (all threads) per wall-clock second, measured whether or not frames are drawn
+    double cpuStatsStartTime = glfwGetTime();
+    double cpuStatsStartSeconds = GetProcessCpuSeconds();
+    size_t cpuStatsFrames = 0;
+
+    // the dice spin with their own clock, which stands still while the animation is paused
+    double animationTime = 0.0;
+    double lastFrameTime = glfwGetTime();
+
+    // Create the stream buffer that receives the matrices of every die and the shared uniforms each frame.
+    // It holds three frames' worth, so that writing the next frame never waits for the GPU to finish the last one.
+    GLint uniformAlignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    size_t streamBytesPerFrame = transforms.Count() * sizeof(DieInstance) + sizeof(DieInstance)
+        + sizeof(FrameData) + uniformAlignment + 2 * sizeof(DieInstance);
+    StreamBuffer stream(streamBytesPerFrame, 3, allowPersistentMap);
+    GLuint instanceVbo = stream.Buffer();
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+
+    // Vertex attributes 4 to 7 - MVP matrix, 8 to 11 - model matrix, 12 - material (one per instance)
+    for (GLuint location = 4; location < 13; location++)
     {
-        // Our texture is 2D, so we bind our texture to the GL_TEXTURE_2D target
-        glBindTexture(GL_TEXTURE_2D, tex0);
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
+    }
+    BindInstanceAttributes(instanceVbo, 0);
 
-        // Set the filtering methods for magnification and minification
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-        // Set the wrapping method for the s-axis (x-axis) and t-axis (y-axis)
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+    // The tray has its own buffers, and reads its one instance from the stream buffer too
+    GLuint trayVbo = CreateGlResource(GlResourceType::Buffer, "tray vertices");
+    GLuint trayIbo = CreateGlResource(GlResourceType::Buffer, "tray indices");
+    GLuint trayVao = CreateGlResource(GlResourceType::VertexArray, "tray");
+    glBindVertexArray(trayVao);
 
-        // Upload the image data to GPU memory
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, imageWidth, imageHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, imageData);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trayIbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, trayMesh.indices.size() * sizeof(GLushort), trayMesh.indices.data(), GL_STATIC_DRAW);
+    SetGlResourceBytes(GlResourceType::Buffer, trayIbo, trayMesh.indices.size() * sizeof(GLushort));
+    glBindBuffer(GL_ARRAY_BUFFER, trayVbo);
+    glBufferData(GL_ARRAY_BUFFER, trayMesh.vertices.size() * sizeof(Vertex), trayMesh.vertices.data(), GL_STATIC_DRAW);
+    SetGlResourceBytes(GlResourceType::Buffer, trayVbo, trayMesh.vertices.size() * sizeof(Vertex));
 
-        // If we set minification to use mipmaps, we can tell OpenGL to generate the mipmaps for us
-        //glGenerateMipmap(GL_TEXTURE_2D);
+    // same vertex attributes as the dice
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, x));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)(offsetof(Vertex, r)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, u)));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, nx)));
 
-        // Once we have copied the data over to the GPU, we can delete
-        // the data on the CPU side, since we won't be using it anymore
-        stbi_image_free(imageData);
-        imageData = nullptr;
-    }
-    else
+    for (GLuint location = 4; location < 13; location++)
     {
-        std::cerr << "Failed to load image" << std::endl;
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
     }
+    BindInstanceAttributes(instanceVbo, 0);
 
-    if (imageData1 != nullptr)
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Impostors are camera-facing quads that read the same instance buffer as the full dice
+    GLfloat quadCorners[8] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+    GLuint impostorVbo = CreateGlResource(GlResourceType::Buffer, "impostor quad");
+    glBindBuffer(GL_ARRAY_BUFFER, impostorVbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quadCorners), quadCorners, GL_STATIC_DRAW);
+    SetGlResourceBytes(GlResourceType::Buffer, impostorVbo, sizeof(quadCorners));
+
+    GLuint impostorVao = CreateGlResource(GlResourceType::VertexArray, "impostor quad");
+    glBindVertexArray(impostorVao);
+
+    // Vertex attribute 0 - quad corner
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (void*)0);
+
+    for (GLuint location = 4; location < 13; location++)
     {
-        // Our texture is 2D, so we bind our texture to the GL_TEXTURE_2D target
-        glBindTexture(GL_TEXTURE_2D, tex1);
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
+    }
+    BindInstanceAttributes(instanceVbo, 0);
 
-        // Set the filtering methods for magnification and minification
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-        // Set the wrapping method for the s-axis (x-axis) and t-axis (y-axis)
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+    // GPU spin mode reads the dice from a static buffer of SpinInstances instead of the stream buffer (see main.vsh),
+    // with the same meshes. It is filled when the mode is first used, and again whenever the dice move with their nodes.
+    GLuint spinVbo = CreateGlResource(GlResourceType::Buffer, "spin instances");
+    GLuint spinVao = CreateGlResource(GlResourceType::VertexArray, "d20 (GPU spin)");
+    bool spinInstancesValid = false;
+    glBindVertexArray(spinVao);
 
-        // Upload the image data to GPU memory
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, imageWidth1, imageHeight1, 0, GL_RGBA, GL_UNSIGNED_BYTE, imageData1);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
-        // If we set minification to use mipmaps, we can tell OpenGL to generate the mipmaps for us
-        //glGenerateMipmap(GL_TEXTURE_2D);
+    // same vertex attributes as the dice
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, x));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)(offsetof(Vertex, r)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, u)));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, nx)));
 
-        // Once we have copied the data over to the GPU, we can delete
-        // the data on the CPU side, since we won't be using it anymore
-        stbi_image_free(imageData1);
-        imageData1 = nullptr;
+    // Vertex attributes 8 to 11 - model matrix without the spin, 12 - material, 13 - spin axis and speed, 14 - spin phase
+    // (one per instance; there is no MVP matrix, so 4 to 7 stay off)
+    for (GLuint location = 8; location < 15; location++)
+    {
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
     }
-    else
+    BindSpinAttributes(spinVbo, 0);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Create a shader program
+    // for windows:
+    GLuint program = CreateShaderProgram("main.vsh", "main.fsh");
+    GLuint impostorProgram = CreateShaderProgram("impostor.vsh", "impostor.fsh");
+    for (GLuint shader : { program, impostorProgram })
     {
-        std::cerr << "Failed to load image" << std::endl;
+        glUniformBlockBinding(shader, glGetUniformBlockIndex(shader, "FrameData"), frameDataBinding);
+        glUniformBlockBinding(shader, glGetUniformBlockIndex(shader, "AmbientSH"), ambientShBinding);
+        glUniformBlockBinding(shader, glGetUniformBlockIndex(shader, "MaterialTable"), materialTableBinding);
     }
 
+    // for mac:
+//    GLuint program = CreateShaderProgram("/Users/carmen/Downloads/OpenGL/Projects/testing/testing/main.vs", "/Users/carmen/Downloads/OpenGL/Projects/testing/testing/main.fs");
+
+    // Tell OpenGL the dimensions of the region where stuff will be drawn.
+    // For now, tell OpenGL to use the whole screen
+    glViewport(0, 0, windowWidth, windowHeight);
+
+    // Create a variable that will contain the ID for our texture,
+    // and use the resource registry to generate the texture itself
+    GLuint tex0 = CreateGlResource(GlResourceType::Texture, "numeral atlas"); // numeral atlas shared by every d20
+
+    // --- Build the numeral atlas ---
+
+    // Instead of a full-color picture of the unfolded d20 (plus a second copy for the translucent die),
+    // we only store how far each texel is from the outline of a numeral.
+    // The colors of the die and its translucency come from uniforms, so one small atlas serves every skin,
+    // and the fragment shader can rebuild sharp numerals no matter how close the die gets to the camera.
+    int atlasWidth, atlasHeight;
+    TraceScope atlasScope("BuildNumeralSdfAtlas");
+    std::vector<unsigned char> atlasData = BuildNumeralSdfAtlas(64, atlasWidth, atlasHeight);
+    atlasScope.End();
+    TraceScope atlasUploadScope("atlas upload");
+
+    // Our texture is 2D, so we bind our texture to the GL_TEXTURE_2D target
+    glBindTexture(GL_TEXTURE_2D, tex0);
+
+    // Set the filtering methods for magnification and minification
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+    // Each numeral sits in its own cell, so clamp instead of repeating into the opposite edge
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Upload the single-channel atlas data to GPU memory (rows are tightly packed bytes)
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, atlasWidth, atlasHeight, 0, GL_RED, GL_UNSIGNED_BYTE, atlasData.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    // Distance fields survive minification well, so let the far-away dice use mipmaps
+    glGenerateMipmap(GL_TEXTURE_2D);
+    SetGlResourceBytes(GlResourceType::Texture, tex0, GetGlTextureBytes(GL_R8, atlasWidth, atlasHeight, true));
+    atlasUploadScope.End();
+
+    // --- Bake the impostor atlas ---
+
+    // Render the d20 once from 256 directions around it. Far-away dice are then drawn as a single quad
+    // showing the closest of those pictures, lit with the baked normals, instead of as 20 lit triangles.
+    // The bake uses the most detailed level, so the impostors keep the rounded edges of the close-up dice.
+    GLuint impostorBakeProgram = CreateShaderProgram("impostorBake.vsh", "impostorBake.fsh");
+    TraceScope impostorScope("BakeImpostorAtlas");
+    ImpostorAtlas impostorAtlas = BakeImpostorAtlas(vbo, ibo, lodMesh.lods[0], impostorBakeProgram, tex0);
+    impostorScope.End();
+    DeleteGlResource(GlResourceType::Program, impostorBakeProgram);
+
+    // d20 skin colors: pink faces with purple numerals
+    glm::vec3 skinColor = glm::vec3(1.0f, 0.89f, 0.89f);
+    glm::vec3 numeralColor = glm::vec3(0.286f, 0.067f, 0.361f);
+    float translucentSkinAlpha = 0.4f;
+
     glEnable(GL_DEPTH_TEST);
     
     // allows for translucent textures
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+    // --- Point lights ---
+
+    // Any number of small lights can light the dice: the view frustum is split into clusters, every frame lists
+    // the lights that reach into each cluster, and a fragment only loops over the lights of its own cluster.
+    PointLights pointLights;
+    AddTableLights(pointLights, pointLightCount);
+    LightClusters lightClusters;
+    ClusterTextures clusterTextures = CreateClusterTextures();
+    // (with no lights every cluster stays empty, so the lists are only uploaded once)
+    UploadClusterTextures(clusterTextures, pointLights, lightClusters);
+
+    // --- Ambient light ---
+
+    // Instead of one flat ambient color, the ambient light comes from an environment image, projected once at startup
+    // onto 9 spherical harmonics coefficients. The shaders turn those into the light arriving from around the normal,
+    // so the sides of a die facing the sky and the floor get different light, without sampling the image per fragment.
+    EnvironmentImage environment;
+    TraceScope environmentScope("LoadEnvironmentImage");
+    if (environmentPath.empty() || !LoadEnvironmentImage(environmentPath, environment))
+    {
+        environment = BuildDefaultEnvironment(512, 256);
+    }
+    environmentScope.End();
+    auto bakeStart = std::chrono::steady_clock::now();
+    TraceScope shScope("ProjectEnvironmentToSh");
+    ShCoefficients ambientSh = GetShaderIrradiance(ProjectEnvironmentToSh(environment, jobSystem));
+    shScope.End();
+    double bakeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - bakeStart).count();
+    std::cout << "ambient: projected a " << environment.width << "x" << environment.height << " environment onto "
+        << shCoefficientCount << " SH coefficients in " << bakeMs << " ms" << std::endl;
+    GLuint ambientShBuffer = CreateAmbientShBuffer(ambientSh);
+    glBindBufferBase(GL_UNIFORM_BUFFER, ambientShBinding, ambientShBuffer);
+
+    // Every die reads its material from one table by the index in its instance, so dice of different materials
+    // still go out in one instanced draw, with no uniforms set between them
+    GLuint materialBuffer = CreateMaterialBuffer(BuildMaterialLibrary(materialCount));
+    glBindBufferBase(GL_UNIFORM_BUFFER, materialTableBinding, materialBuffer);
+
+    // --- Shadows ---
+
+    // Shadow maps of the lightPos light: the tray and the resting dice are drawn into a cached map only when the light
+    // moves, and every frame only the spinning dice are drawn on top of a copy of it.
+    // The resting dice are drawn from their own static instances, composed the first time the cached map is drawn.
+    GLuint shadowProgram = CreateShaderProgram("shadow.vsh", "shadow.fsh");
+    ShadowMaps shadowMaps(2048);
+    GLuint restingCasterVbo = CreateGlResource(GlResourceType::Buffer, "resting dice shadow casters");
+    bool restingCastersValid = false;
+    double lightAngle = 0.0;
+
+    // GPU culling of the tray dice in GPU spin mode: every frame culls the static instances into a buffer of survivors,
+    // sorted by detail level, and the scene draws the survivors of gpuCullLatency frames before (see GpuCulling.h)
+    GLuint cullProgram = CreateFeedbackProgram("cull.vsh", "cull.gsh", gpuCullVaryings, gpuCullVaryingCount);
+    GpuCuller gpuCuller(cullProgram);
+
+    // Picking: a bounding volume hierarchy over all dice, refitted every frame, that a left click casts a ray into
+    DicePicker picker;
+
+    // The scene is drawn into an offscreen framebuffer whose resolution follows the measured GPU time,
+    // then stretched over the window
+    DynamicResolution dynamicResolution(frameBudgetMs, dynamicResolutionEnabled);
+
     // Render loop
     while (!glfwWindowShouldClose(window))
     {
-        
+        double now = glfwGetTime();
+        if (now - cpuStatsStartTime >= 1.0)
+        {
+            if (printCullingStats)
+            {
+                double cpuMs = (GetProcessCpuSeconds() - cpuStatsStartSeconds) * 1000.0 / (now - cpuStatsStartTime);
+                std::cout << "cpu: " << cpuMs << " ms per second (" << cpuMs / 10.0 << "% of one core), "
+                    << cpuStatsFrames << " frames drawn" << (animationPaused ? ", paused" : "") << std::endl;
+            }
+            cpuStatsStartTime = now;
+            cpuStatsStartSeconds = GetProcessCpuSeconds();
+            cpuStatsFrames = 0;
+        }
+
+        // Idle mode: with the animation paused, a frame looks exactly like the last one until some input or window
+        // event arrives, so block until one does instead of drawing. The timeout only wakes us up for the CPU report.
+        if (idleModeEnabled && animationPaused && !lightOrbiting && !replaying && !redrawRequested)
+        {
+            TraceScope waitScope("wait for events");
+            glfwWaitEventsTimeout(std::max(0.0, 1.0 - (now - cpuStatsStartTime)));
+            continue;
+        }
+        redrawRequested = false;
+        cpuStatsFrames++;
+
+        // every phase of the frame below shows up inside this scope when tracing
+        TraceScope frameScope("frame");
+
+        // (a long gap, e.g. right after resuming, is clamped so that the dice do not jump ahead)
+        if (!animationPaused)
+        {
+            animationTime += std::min(now - lastFrameTime, 0.1);
+        }
+        if (lightOrbiting)
+        {
+            lightAngle += std::min(now - lastFrameTime, 0.1) * 0.5;
+        }
+        lastFrameTime = now;
+
+        // A replay sets everything a recorded frame depends on, and the dice get their recorded rotations instead of
+        // being spun below. It plays one recorded frame per drawn frame, and starts over at the end.
+        if (replaying)
+        {
+            TraceScope replayScope("read replay frame");
+            int64_t seekTo = static_cast<int64_t>(replayFrame) + replaySeekFrames;
+            if (replaySeekFrames != 0)
+            {
+                replaySeekFrames = 0;
+                replayFrame = static_cast<uint64_t>(std::min(std::max<int64_t>(seekTo, 0), static_cast<int64_t>(replay.FrameCount()) - 1));
+                std::cout << "replay: frame " << replayFrame << " of " << replay.FrameCount() << std::endl;
+            }
+            if (replayFrame >= replay.FrameCount())
+            {
+                replayFrame = 0;
+            }
+
+            RecordedInput input;
+            if (replay.ReadFrame(replayFrame++, transforms, input))
+            {
+                animationTime = input.time;
+                lightAngle = input.lightAngle;
+                specX = input.specular[0];
+                specY = input.specular[1];
+                specZ = input.specular[2];
+                diffX = input.diffuse[0];
+                diffY = input.diffuse[1];
+                diffZ = input.diffuse[2];
+                bgc_r = input.background[0];
+                bgc_g = input.background[1];
+                bgc_b = input.background[2];
+                bgc_a = input.background[3];
+                current = input.skin;
+                spotShadows = input.spotShadows != 0;
+                impostorsEnabled = input.impostors != 0;
+            }
+        }
+
+        // everything allocated from the arena three frames ago is released here
+        frameArena.BeginFrame();
+        uint64_t frameStartAllocations = GetHeapAllocationCount();
+
+        // the same goes for the part of the stream buffer written three frames ago (this may wait for the GPU)
+        TraceScope streamScope("wait for stream buffer");
+        stream.BeginFrame();
+        streamScope.End();
+
+        // draw into the offscreen framebuffer, at the resolution picked from the GPU time of the last frames
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        dynamicResolution.BeginFrame(framebufferWidth, framebufferHeight);
+        if (printResolutionScale)
+        {
+            std::cout << "resolution: scale " << dynamicResolution.Scale() << " (" << dynamicResolution.RenderWidth() << "x"
+                << dynamicResolution.RenderHeight() << " of " << framebufferWidth << "x" << framebufferHeight << "), gpu "
+                << dynamicResolution.GpuMs() << " ms" << std::endl;
+        }
+
         // set the background to purple
         glClearColor(bgc_r, bgc_g, bgc_b, bgc_a);
 
         // Clear the colors in our off-screen framebuffer
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // Use the shader program that we created
-        glUseProgram(program);
-
-        // Use the vertex array object that we created
-        glBindVertexArray(vao);
-        
-        // NOW DRAWING THE SMALL, OPAQUE D20
-
-        // Bind tex0 to texture unit 0, and set our tex0 uniform to texture unit 0
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, tex0);
-        glUniform1i(glGetUniformLocation(program, "tex0"), 0);
-        
-        // setting light values
-        glm::vec3 lightPos = glm::vec3(-20.0f, 10.0f, -10.0f);
-        glUniform3fv(glGetUniformLocation(program, "lightPos"), 1, glm::value_ptr(lightPos));
-        glm::vec3 specularLight = glm::vec3(specX, specY, specZ);
-        glUniform3fv(glGetUniformLocation(program, "specularLight"), 1, glm::value_ptr(specularLight));
-        glm::vec3 diffuseLight = glm::vec3(diffX, diffY, diffZ);
-        glUniform3fv(glGetUniformLocation(program, "diffuseLight"), 1, glm::value_ptr(diffuseLight));
-        glm::vec3 ambientLight = 0.1f * glm::vec3(1.0f, 0.8f, 0.9f);
-        glUniform3fv(glGetUniformLocation(program, "ambientLight"), 1, glm::value_ptr(ambientLight));
-
-        // setting material values
-        glm::vec3 matlAmbient = glm::vec3(0.1f, 0.1f, 0.1f);
-        glm::vec3 matlDiffuse = glm::vec3(0.2f, 0.2f, 0.2f);
-        glm::vec3 matlSpecular = glm::vec3(2.0f, 2.0f, 2.0f);
-        float matlShiny = 1.5f;
-
-        glUniform3fv(glGetUniformLocation(program, "matlAmbient"), 1, glm::value_ptr(matlAmbient));
-        glUniform3fv(glGetUniformLocation(program, "matlDiffuse"), 1, glm::value_ptr(matlDiffuse));
-        glUniform3fv(glGetUniformLocation(program, "matlSpecular"), 1, glm::value_ptr(matlSpecular));
-        glUniform1f(glGetUniformLocation(program, "matlShiny"), matlShiny);
-
-        // setting model matrix for transformations
-        glm::mat4 mat = glm::mat4(1.0f);
-        mat = glm::translate(mat, glm::vec3(-0.5f, 0.0f, -0.0f));
-        mat = glm::rotate(mat, (float)glfwGetTime(), glm::vec3(1.0f, -1.0f, -1.0f));
-        mat = glm::scale(mat, glm::vec3(0.4f, 0.4f, 0.4f));
+        // the full dice and the impostors share the materials and skin colors
+        // (the main program goes last, so it is the one in use afterwards)
+        for (GLuint shader : { impostorProgram, program })
+        {
+            // Use the shader program that we created
+            glUseProgram(shader);
+
+            // Bind tex0 to texture unit 0, and set our tex0 uniform to texture unit 0
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, tex0);
+            glUniform1i(glGetUniformLocation(shader, "tex0"), 0);
+
+            // the point lights and the cluster lists go to texture units 3 to 5
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_BUFFER, clusterTextures.lightTexture);
+            glUniform1i(glGetUniformLocation(shader, "pointLights"), 3);
+            glActiveTexture(GL_TEXTURE4);
+            glBindTexture(GL_TEXTURE_BUFFER, clusterTextures.countTexture);
+            glUniform1i(glGetUniformLocation(shader, "clusterLightCounts"), 4);
+            glActiveTexture(GL_TEXTURE5);
+            glBindTexture(GL_TEXTURE_BUFFER, clusterTextures.indexTexture);
+            glUniform1i(glGetUniformLocation(shader, "clusterLightIndices"), 5);
+
+            // and the shadow map to unit 6
+            glActiveTexture(GL_TEXTURE6);
+            glBindTexture(GL_TEXTURE_2D, shadowMaps.Texture());
+            glUniform1i(glGetUniformLocation(shader, "shadowMap"), 6);
+            glActiveTexture(GL_TEXTURE0);
+
+            // setting skin values
+            glUniform3fv(glGetUniformLocation(shader, "skinColor"), 1, glm::value_ptr(skinColor));
+            glUniform3fv(glGetUniformLocation(shader, "numeralColor"), 1, glm::value_ptr(numeralColor));
+        }
 
         glm::mat4 view; // position, target, up
         glm::vec3 viewPos = glm::vec3(0.5f, 0.0f, 1.25f);
@@ -1428,73 +1253,787 @@ int main()
         glm::mat4 persp = glm::mat4(1.0f);
         persp = glm::perspective(90.0f, 1.0f, 0.1f, 100.0f);
 
-        mat = persp * view * mat;
+        glm::mat4 viewProj = persp * view;
+
+        // list the point lights of every cluster (in parallel depth slices) and hand the lists to the shaders
+        double lightBuildMs = 0.0;
+        if (pointLights.Count() > 0)
+        {
+            TraceScope lightScope("build light clusters");
+            auto lightStart = std::chrono::steady_clock::now();
+            lightClusters.SetProjection(persp);
+            lightClusters.Build(pointLights, view, jobSystem);
+            UploadClusterTextures(clusterTextures, pointLights, lightClusters);
+            lightBuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lightStart).count();
+        }
 
-        glUniformMatrix4fv(glGetUniformLocation(program, "persp"), 1, GL_FALSE, glm::value_ptr(persp));
-        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniform3fv(glGetUniformLocation(program, "viewPos"), 1, glm::value_ptr(viewPos));
+        // (the view depth of a point is minus its z in view space)
+        glm::vec4 depthPlane = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
 
-        GLint uniformLocation = glGetUniformLocation(program, "mat");
-        glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, glm::value_ptr(mat));
+        // the light circles around the scene at its starting distance and height while O is on
+        glm::vec3 lightPos = glm::vec3(-20.0f, 10.0f, -10.0f);
+        lightPos = glm::vec3(glm::rotate(glm::mat4(1.0f), (float)lightAngle, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightPos, 1.0f));
+        shadowMaps.SetLight(spotShadows ? ShadowLightType::Spot : ShadowLightType::Directional, lightPos, shadowCenter, shadowRadius);
+
+        // the camera and lights go into the FrameData block that both programs read
+        size_t frameDataOffset;
+        FrameData* frameData = static_cast<FrameData*>(stream.Map(sizeof(FrameData), uniformAlignment, frameDataOffset));
+        if (frameData != nullptr)
+        {
+            frameData->viewProj = viewProj;
+            frameData->viewPos = glm::vec4(viewPos, 1.0f);
+            frameData->lightPos = glm::vec4(lightPos, 1.0f);
+            // (the color of the ambient light now comes from the environment, this only scales it)
+            frameData->ambientLight = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+            frameData->diffuseLight = glm::vec4(diffX, diffY, diffZ, 0.0f);
+            frameData->specularLight = glm::vec4(specX, specY, specZ, 0.0f);
+            frameData->depthPlane = depthPlane;
+            frameData->clusterParams = lightClusters.GetShaderParams(dynamicResolution.RenderWidth(), dynamicResolution.RenderHeight());
+            frameData->shadowMatrix = shadowMaps.ShadowMatrix();
+            stream.Unmap();
+            glBindBufferRange(GL_UNIFORM_BUFFER, frameDataBinding, stream.Buffer(), frameDataOffset, sizeof(FrameData));
+        }
 
-        glBindVertexArray(0);
-        glBindVertexArray(vao);
+        // bring the cached world matrices of the scene nodes up to date (only moved nodes and their children are redone)
+        scene.UpdateWorld();
 
-        // Draw the 3 vertices using triangle primitives
-        glDrawArrays(GL_TRIANGLES, 0, 60);
+        // resting dice that moved with their node have to be drawn into the cached shadow map again
+        if (!restingDice.empty() && scene.DiceMoved())
+        {
+            restingCastersValid = false;
+            shadowMaps.InvalidateStaticMap();
+        }
 
-        // "Unuse" the vertex array object
-        glBindVertexArray(0);
-        
-        // NOW DRAWING THE BIG, TRANSLUCENT D20
+        // In GPU spin mode the dice are not culled, sorted or composed at all: the vertex shader spins every die from
+        // the static instances and the time uniform, so the CPU does nothing per die. The rotations then only exist
+        // on the GPU, so recording and replaying (which need them on the CPU) stay on the CPU path.
+        bool spinOnGpu = gpuSpinEnabled && !replaying && !recorder.IsOpen();
+        if (!spinOnGpu)
+        {
+            spinInstancesValid = false;
+        }
+        else if (!spinInstancesValid || scene.DiceMoved())
+        {
+            std::vector<SpinInstance> spinInstances(transforms.Count());
+            scene.ComposeSpinDice(transforms, 0, transforms.Count(), spinInstances.data());
+            glBindBuffer(GL_ARRAY_BUFFER, spinVbo);
+            glBufferData(GL_ARRAY_BUFFER, spinInstances.size() * sizeof(SpinInstance), spinInstances.data(), GL_STATIC_DRAW);
+            SetGlResourceBytes(GlResourceType::Buffer, spinVbo, spinInstances.size() * sizeof(SpinInstance));
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            spinInstancesValid = true;
+
+            // the survivors culled so far are copies of the old instances
+            gpuCuller.Invalidate();
+        }
 
-        glm::mat4 mat1 = glm::mat4(1.0f);
-        mat1 = glm::translate(mat1, glm::vec3(-0.5f, 0.0f, -0.0f));
-        mat1 = glm::rotate(mat1, (float)glfwGetTime(), glm::vec3(-1.0f, 1.0f, 1.0f));
-        mat1 = glm::scale(mat1, glm::vec3(0.9f, 0.9f, 0.9f));
+        jobSystem.BeginFrame();
+        float time = (float)animationTime;
+
+        // test the bounding sphere of every die against the view frustum (in parallel chunks of dice)
+        TraceScope cullScope("cull + sort dice");
+        auto cullStart = std::chrono::steady_clock::now();
+        Frustum frustum = ExtractFrustum(viewProj);
+
+        // then pick a detail level for every visible die from how many pixels it covers at the resolution
+        // the scene is drawn at
+        int renderHeight = dynamicResolution.RenderHeight();
+        bool useImpostors = impostorsEnabled && impostorAtlas.coverage != 0;
+        float radiusPerDepth[levelCount - 1];
+        for (int level = 0; level < d20LodCount - 1; level++)
+        {
+            radiusPerDepth[level] = GetRadiusPerDepth(persp, renderHeight, d20LodPixelRadius[level]);
+        }
+        // the plainest mesh keeps every die that is too big for an impostor (or all of them, with impostors off)
+        radiusPerDepth[d20LodCount - 1] = useImpostors ? GetRadiusPerDepth(persp, renderHeight, impostorPixelRadius) : 0.0f;
+
+        uint32_t* visibleDice = frameArena.AllocateArray<uint32_t>(transforms.Count());
+        uint32_t* levelDice[levelCount];
+        for (int level = 0; level < levelCount; level++)
+        {
+            levelDice[level] = frameArena.AllocateArray<uint32_t>(transforms.Count());
+        }
+        FrameVector<size_t> chunkLevelCount(cullChunkCount * levelCount, 0, FrameAllocator<size_t>(frameArena));
+        FrameVector<size_t> chunkFirstInstance(cullChunkCount * levelCount, 0, FrameAllocator<size_t>(frameArena));
+        bool occlusionCulling = occlusionCullingEnabled && !spinOnGpu;
+        glm::vec4* diceSpheres = occlusionCulling ? frameArena.AllocateArray<glm::vec4>(transforms.Count()) : nullptr;
+
+        // (GPU spin mode leaves every count at 0, so nothing is composed or drawn from the stream buffer)
+        jobSystem.ParallelFor("cull", spinOnGpu ? 0 : transforms.Count(), cullGrainSize, [&](size_t begin, size_t end)
+        {
+            size_t chunk = begin / cullGrainSize;
+            size_t visible = scene.CullDice(frustum, transforms, begin, end, visibleDice + begin);
+            if (occlusionCulling)
+            {
+                scene.GetBoundingSpheres(transforms, begin, end, diceSpheres + begin);
+            }
+
+            uint32_t* levels[levelCount];
+            size_t* counts = chunkLevelCount.data() + chunk * levelCount;
+            for (int level = 0; level < levelCount; level++)
+            {
+                levels[level] = levelDice[level] + begin;
+                counts[level] = 0;
+            }
+            scene.SortDiceByScreenSize(transforms, depthPlane, radiusPerDepth, levelCount, visibleDice + begin, visible, levels, counts);
+        });
+
+        // Occlusion culling, all of it on the worker threads while the GPU is still busy with the frames before
+        // (nothing waits for it until the instances are written into the stream buffer).
+        // The spheres ignore the spin, so the occluders and the tests do not have to wait for the dice to be spun.
+        size_t occludedCount = 0;
+        if (occlusionCulling && transforms.Count() > 0)
+        {
+            TraceScope occlusionScope("occlusion cull");
+            occlusionBuffer.Begin(viewProj);
+            occlusionBuffer.AddMesh(trayMesh.vertices.data(), trayMesh.indices.data(), trayMesh.indices.size(), scene.World(trayNode));
+
+            // the occluders are taken level by level, i.e. from the biggest dice on screen down
+            // (not the big die while it is translucent, since the dice behind it show through)
+            size_t dieOccluders = 0;
+            for (int level = 0; level < d20LodCount && dieOccluders < maxDieOccluders; level++)
+            {
+                for (size_t chunk = 0; chunk < cullChunkCount && dieOccluders < maxDieOccluders; chunk++)
+                {
+                    const uint32_t* indices = levelDice[level] + chunk * cullGrainSize;
+                    size_t count = chunkLevelCount[chunk * levelCount + level];
+                    for (size_t i = 0; i < count && dieOccluders < maxDieOccluders; i++)
+                    {
+                        if ((indices[i] != bigDie || current == 0) && occlusionBuffer.AddDie(diceSpheres[indices[i]]))
+                        {
+                            dieOccluders++;
+                        }
+                    }
+                }
+            }
+
+            size_t testedCount = std::accumulate(chunkLevelCount.begin(), chunkLevelCount.end(), size_t(0));
+            jobSystem.ParallelFor("draw occluders", occlusionBufferHeight, occlusionBandRows, [&](size_t begin, size_t end)
+            {
+                occlusionBuffer.Rasterize(static_cast<int>(begin), static_cast<int>(end));
+            });
+            jobSystem.ParallelFor("test occlusion", cullChunkCount, 1, [&](size_t begin, size_t end)
+            {
+                for (size_t chunk = begin; chunk < end; chunk++)
+                {
+                    for (int level = 0; level < levelCount; level++)
+                    {
+                        size_t& count = chunkLevelCount[chunk * levelCount + level];
+                        count = occlusionBuffer.CullOccluded(diceSpheres, levelDice[level] + chunk * cullGrainSize, count);
+                    }
+                }
+            });
+            occludedCount = testedCount - std::accumulate(chunkLevelCount.begin(), chunkLevelCount.end(), size_t(0));
+        }
 
-        mat1 = persp * view * mat1;
+        // work out where each chunk's survivors go, so that the instance buffer has no gaps:
+        // level by level, and chunk by chunk within a level
+        size_t levelFirstInstance[levelCount], levelInstanceCount[levelCount];
+        size_t visibleCount = 0;
+        for (int level = 0; level < levelCount; level++)
+        {
+            levelFirstInstance[level] = visibleCount;
+            for (size_t chunk = 0; chunk < cullChunkCount; chunk++)
+            {
+                chunkFirstInstance[chunk * levelCount + level] = visibleCount;
+                visibleCount += chunkLevelCount[chunk * levelCount + level];
+            }
+            levelInstanceCount[level] = visibleCount - levelFirstInstance[level];
+        }
+        size_t impostorCount = levelInstanceCount[impostorLevel];
+        double cullMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cullStart).count();
+        cullScope.End();
+
+        // GPU culling: pick up the tray dice that survived culling gpuCullLatency frames ago (their query results are
+        // in by now, so nothing waits for the GPU), and queue this frame's passes. Without a result every die is drawn.
+        // (The frames in between only see the dice that were in view back then, which the spin does not move.)
+        GpuCullResult gpuCull;
+        bool gpuCulled = false;
+        if (spinOnGpu && gpuCullingEnabled && transforms.Count() > firstTrayDie)
+        {
+            TraceScope gpuCullScope("GPU cull dice");
+            gpuCulled = gpuCuller.FetchResult(gpuCull);
+            gpuCuller.Cull(spinVbo, firstTrayDie, transforms.Count() - firstTrayDie, viewProj, depthPlane, radiusPerDepth);
+        }
+        else
+        {
+            gpuCuller.Invalidate();
+        }
 
-        glUniformMatrix4fv(glGetUniformLocation(program, "persp"), 1, GL_FALSE, glm::value_ptr(persp));
-        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        // spin the visible dice, then build their model and MVP matrices straight into the stream buffer
+        // (split into chunks of dice that run in parallel on the worker threads).
+        // The range is aligned to whole instances, so the draws below only have to shift their first instance.
+        size_t instanceOffset = 0;
+        DieInstance* instances = static_cast<DieInstance*>(stream.Map(visibleCount * sizeof(DieInstance), sizeof(DieInstance), instanceOffset));
+        for (int level = 0; level < levelCount; level++)
+        {
+            levelFirstInstance[level] += instanceOffset / sizeof(DieInstance);
+        }
+        // With resting dice in the scene, every chunk also picks out its visible spinning dice (into its own slice),
+        // which are the only ones drawn into the shadow map every frame (see the shadow passes below)
+        uint32_t* spinningVisibleDice = nullptr;
+        FrameVector<size_t> chunkSpinningCount(cullChunkCount, 0, FrameAllocator<size_t>(frameArena));
+        if (!restingDice.empty())
+        {
+            spinningVisibleDice = frameArena.AllocateArray<uint32_t>(transforms.Count());
+        }
+        if (instances != nullptr)
+        {
+            TraceScope composeScope("spin + compose dice");
+            jobSystem.ParallelFor("spin + compose", cullChunkCount, 1, [&](size_t begin, size_t end)
+            {
+                for (size_t chunk = begin; chunk < end; chunk++)
+                {
+                    size_t spinningCount = 0;
+                    for (int level = 0; level < levelCount; level++)
+                    {
+                        const uint32_t* indices = levelDice[level] + chunk * cullGrainSize;
+                        size_t count = chunkLevelCount[chunk * levelCount + level];
+                        if (!replaying)
+                        {
+                            transforms.UpdateSpinIndexed(time, indices, count);
+                        }
+                        scene.ComposeVisibleDice(transforms, viewProj, indices, count, instances + chunkFirstInstance[chunk * levelCount + level]);
+
+                        if (spinningVisibleDice != nullptr)
+                        {
+                            for (size_t i = 0; i < count; i++)
+                            {
+                                if (!dieRests[indices[i]])
+                                {
+                                    spinningVisibleDice[chunk * cullGrainSize + spinningCount++] = indices[i];
+                                }
+                            }
+                        }
+                    }
+                    chunkSpinningCount[chunk] = spinningCount;
+                }
+            });
+            stream.Unmap();
+        }
+        else
+        {
+            // nothing was written, so there is nothing to draw
+            std::fill(levelInstanceCount, levelInstanceCount + levelCount, 0);
+            impostorCount = 0;
+        }
 
-        uniformLocation = glGetUniformLocation(program, "mat");
-        glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, glm::value_ptr(mat1));
+        // then their instances for the shadow map, one after the other (already spun above)
+        size_t shadowCasterFirstInstance = 0, shadowCasterInstanceCount = 0;
+        if (spinningVisibleDice != nullptr)
+        {
+            FrameVector<size_t> chunkFirstCaster(cullChunkCount, 0, FrameAllocator<size_t>(frameArena));
+            for (size_t chunk = 0; chunk < cullChunkCount; chunk++)
+            {
+                chunkFirstCaster[chunk] = shadowCasterInstanceCount;
+                shadowCasterInstanceCount += chunkSpinningCount[chunk];
+            }
+
+            size_t casterOffset = 0;
+            DieInstance* casters = shadowCasterInstanceCount > 0 ? static_cast<DieInstance*>(stream.Map(
+                shadowCasterInstanceCount * sizeof(DieInstance), sizeof(DieInstance), casterOffset)) : nullptr;
+            if (casters != nullptr)
+            {
+                jobSystem.ParallelFor("compose shadow casters", cullChunkCount, 1, [&](size_t begin, size_t end)
+                {
+                    for (size_t chunk = begin; chunk < end; chunk++)
+                    {
+                        scene.ComposeVisibleDice(transforms, viewProj, spinningVisibleDice + chunk * cullGrainSize,
+                            chunkSpinningCount[chunk], casters + chunkFirstCaster[chunk]);
+                    }
+                });
+                stream.Unmap();
+                shadowCasterFirstInstance = casterOffset / sizeof(DieInstance);
+            }
+            else
+            {
+                shadowCasterInstanceCount = 0;
+            }
+        }
 
-        glBindVertexArray(0);
+        // record the frame as it is about to be drawn
+        if (recorder.IsOpen())
+        {
+            TraceScope recordScope("record frame");
+
+            // only the dice that survived culling were spun above, but the recording holds every die
+            // (a replay already set them all)
+            if (!replaying)
+            {
+                jobSystem.ParallelFor("spin all dice", transforms.Count(), cullGrainSize, [&](size_t begin, size_t end)
+                {
+                    transforms.UpdateSpin(time, begin, end);
+                });
+            }
+            RecordedInput input = { time, static_cast<float>(lightAngle), { specX, specY, specZ }, { diffX, diffY, diffZ },
+                { bgc_r, bgc_g, bgc_b, bgc_a }, static_cast<uint8_t>(current), spotShadows, impostorsEnabled, animationPaused };
+            recorder.RecordFrame(input, transforms);
+        }
+
+        // keep the picking tree around the dice as they are drawn this frame (only the visible dice were spun, but
+        // a ray through the window cannot reach the others anyway)
+        // (in GPU spin mode the CPU rotations are only brought up to date when a click needs them)
+        TraceScope pickerScope("update picking tree");
+        if (spinOnGpu && pickRequested)
+        {
+            transforms.UpdateSpin(time, 0, transforms.Count());
+        }
+        if (!spinOnGpu || pickRequested)
+        {
+            picker.Update(scene, transforms, jobSystem);
+        }
+        pickerScope.End();
+        if (pickRequested)
+        {
+            pickRequested = false;
+
+            // the projection fills the whole window, so the cursor maps straight to normalized device coordinates
+            int windowWidth, windowHeight;
+            glfwGetWindowSize(window, &windowWidth, &windowHeight);
+            glm::vec2 ndc = glm::vec2(2.0f * static_cast<float>(pickCursorX) / std::max(windowWidth, 1) - 1.0f,
+                1.0f - 2.0f * static_cast<float>(pickCursorY) / std::max(windowHeight, 1));
+            glm::vec3 rayOrigin, rayDirection;
+            GetCameraRay(view, persp, ndc, rayOrigin, rayDirection);
+
+            auto pickStart = std::chrono::steady_clock::now();
+            PickResult pick = picker.Pick(scene, transforms, rayOrigin, rayDirection);
+            double pickUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - pickStart).count();
+            if (pick.hit)
+            {
+                std::cout << "picked die " << pick.die << ", face " << pick.face << " showing " << pick.number
+                    << " (" << pickUs << " us)" << std::endl;
+            }
+            else
+            {
+                std::cout << "picked nothing (" << pickUs << " us)" << std::endl;
+            }
+        }
+
+        // The survivors keep their order, so if the big die survived it is the first instance of its level
+        // (a big die shrunk down to an impostor is simply drawn opaque with the others). It is in chunk 0, so only
+        // look at the first slot when chunk 0 kept a die of that level: otherwise the slot still holds a die from
+        // an earlier frame, which could be a tray die that would be drawn as the translucent one.
+        int bigDieLevel = -1;
+        for (int level = 0; level < d20LodCount; level++)
+        {
+            // chunk 0's counts come first
+            bool chunk0Survivors = chunkLevelCount[level] > 0;
+            if (chunk0Survivors && levelDice[level][0] == bigDie)
+            {
+                bigDieLevel = level;
+            }
+        }
+
+        // the tray is one more instance, placed at its node
+        size_t trayInstanceOffset = 0;
+        DieInstance* trayInstance = static_cast<DieInstance*>(stream.Map(sizeof(DieInstance), sizeof(DieInstance), trayInstanceOffset));
+        if (trayInstance != nullptr)
+        {
+            trayInstance->model = scene.World(trayNode);
+            trayInstance->mvp = viewProj * trayInstance->model;
+            trayInstance->material = 0;
+            stream.Unmap();
+        }
+        size_t trayFirstInstance = trayInstanceOffset / sizeof(DieInstance);
+
+        // NOW DRAWING THE SHADOW MAPS
+
+        TraceScope shadowScope("draw shadow maps");
+        glUseProgram(shadowProgram);
+        glUniformMatrix4fv(glGetUniformLocation(shadowProgram, "lightViewProj"), 1, GL_FALSE, glm::value_ptr(shadowMaps.LightViewProj()));
+
+        // the tray and the resting dice only when the light moved (or the first time)
+        if (shadowMaps.StaticMapDirty() && trayInstance != nullptr)
+        {
+            if (!restingCastersValid && !restingDice.empty())
+            {
+                // the rotation of a resting die is the same at any time
+                transforms.UpdateSpinIndexed(0.0f, restingDice.data(), restingDice.size());
+                std::vector<DieInstance> restingInstances(restingDice.size());
+                scene.ComposeVisibleDice(transforms, glm::mat4(1.0f), restingDice.data(), restingDice.size(), restingInstances.data());
+                glBindBuffer(GL_ARRAY_BUFFER, restingCasterVbo);
+                glBufferData(GL_ARRAY_BUFFER, restingInstances.size() * sizeof(DieInstance), restingInstances.data(), GL_STATIC_DRAW);
+                SetGlResourceBytes(GlResourceType::Buffer, restingCasterVbo, restingInstances.size() * sizeof(DieInstance));
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                restingCastersValid = true;
+            }
+
+            shadowMaps.BeginStaticPass();
+            glBindVertexArray(trayVao);
+            BindInstanceAttributes(instanceVbo, trayFirstInstance);
+            glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)trayMesh.indices.size(), GL_UNSIGNED_SHORT, (void*)0, 1);
+            if (!restingDice.empty())
+            {
+                // every resting die, not only the ones in view, since the map is kept while the camera moves
+                const D20LodRange& lod = lodMesh.lods[d20LodCount - 1];
+                glBindVertexArray(vao);
+                BindInstanceAttributes(restingCasterVbo, 0);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_SHORT,
+                    (void*)(lod.firstIndex * sizeof(GLushort)), (GLsizei)restingDice.size(), lod.baseVertex);
+            }
+            shadowMaps.EndPass();
+        }
+
+        // Then the spinning dice on top of a copy of it, every frame, with the plainest mesh (shadows do not need the detail).
+        // Only dice in view cast shadows; the camera and the light look at the same tray, so little is missed.
+        // (The same goes for the dice hidden by occlusion culling: their shadows mostly fall behind the same occluders.)
+        // Without resting dice, all the levels lie one after the other in the instance buffer, so a single draw covers
+        // them; otherwise the spinning ones were gathered into instances of their own.
+        size_t shadowCasterCount = shadowCasterInstanceCount;
+        size_t shadowCasterFirst = shadowCasterFirstInstance;
+        if (restingDice.empty())
+        {
+            shadowCasterCount = 0;
+            for (int level = 0; level < levelCount; level++)
+            {
+                shadowCasterCount += levelInstanceCount[level];
+            }
+            shadowCasterFirst = levelFirstInstance[0];
+        }
+        shadowMaps.BeginDynamicPass();
+        if (shadowCasterCount > 0)
+        {
+            const D20LodRange& lod = lodMesh.lods[d20LodCount - 1];
+            glBindVertexArray(vao);
+            BindInstanceAttributes(instanceVbo, shadowCasterFirst);
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_SHORT,
+                (void*)(lod.firstIndex * sizeof(GLushort)), (GLsizei)shadowCasterCount, lod.baseVertex);
+        }
+        if (spinOnGpu)
+        {
+            // every spinning die casts a shadow, spun by the shadow vertex shader the same way as in main.vsh
+            const D20LodRange& lod = lodMesh.lods[d20LodCount - 1];
+            glUniform1i(glGetUniformLocation(shadowProgram, "gpuSpin"), 1);
+            glUniform1f(glGetUniformLocation(shadowProgram, "time"), time);
+            glBindVertexArray(spinVao);
+            shadowCasterCount = 0;
+            for (const std::pair<size_t, size_t>& run : spinningDiceRuns)
+            {
+                BindSpinAttributes(spinVbo, run.first);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_SHORT,
+                    (void*)(lod.firstIndex * sizeof(GLushort)), (GLsizei)(run.second - run.first), lod.baseVertex);
+                shadowCasterCount += run.second - run.first;
+            }
+            glUniform1i(glGetUniformLocation(shadowProgram, "gpuSpin"), 0);
+        }
+        shadowMaps.EndPass();
+        shadowScope.End();
+
+        // back to the scene
+        TraceScope drawScope("draw scene");
+        dynamicResolution.Bind();
+        glUseProgram(program);
+
+        // the dice and the tray are closed, so their back faces are always hidden behind their front faces
+        if (backFaceCulling)
+        {
+            glEnable(GL_CULL_FACE);
+            glCullFace(GL_BACK);
+        }
+
+        // NOW DRAWING THE TRAY (opaque, plain skin: white skin color, so only its vertex colors show)
+
+        if (trayInstance != nullptr)
+        {
+            glBindVertexArray(trayVao);
+            BindInstanceAttributes(instanceVbo, trayFirstInstance);
+            glUniform1f(glGetUniformLocation(program, "skinAlpha"), 1.0f);
+            glUniform3f(glGetUniformLocation(program, "skinColor"), 1.0f, 1.0f, 1.0f);
+            glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)trayMesh.indices.size(), GL_UNSIGNED_SHORT, (void*)0, 1);
+            glUniform3fv(glGetUniformLocation(program, "skinColor"), 1, glm::value_ptr(skinColor));
+        }
+
+        // Use the vertex array object that we created
         glBindVertexArray(vao);
 
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, tex1);
-        glUniform1i(glGetUniformLocation(program, "tex0"), current);
+        // NOW DRAWING THE SMALL, OPAQUE D20 (and the tray of dice, which are opaque too)
+
+        glUniform1f(glGetUniformLocation(program, "skinAlpha"), 1.0f);
+
+        // one instanced draw per detail level, each with its own range of the shared index buffer
+        for (int level = 0; level < d20LodCount; level++)
+        {
+            size_t skip = level == bigDieLevel ? 1 : 0;
+            if (levelInstanceCount[level] > skip)
+            {
+                const D20LodRange& lod = lodMesh.lods[level];
+                BindInstanceAttributes(instanceVbo, levelFirstInstance[level] + skip);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_SHORT,
+                    (void*)(lod.firstIndex * sizeof(GLushort)), (GLsizei)(levelInstanceCount[level] - skip), lod.baseVertex);
+            }
+        }
+
+        // In GPU spin mode nothing is sorted by size on screen on the CPU, so the small hero die gets the finest mesh
+        // and the tray dice a middle one (unless GPU culling sorted them)
+        if (spinOnGpu)
+        {
+            glBindVertexArray(spinVao);
+            glUniform1i(glGetUniformLocation(program, "gpuSpin"), 1);
+            glUniform1f(glGetUniformLocation(program, "time"), time);
+
+            const D20LodRange& heroLod = lodMesh.lods[0];
+            BindSpinAttributes(spinVbo, smallDie);
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, heroLod.indexCount, GL_UNSIGNED_SHORT,
+                (void*)(heroLod.firstIndex * sizeof(GLushort)), (GLsizei)(firstTrayDie - smallDie), heroLod.baseVertex);
+
+            if (gpuCulled)
+            {
+                // the survivors, level by level, straight from the buffer the culling passes wrote
+                for (int level = 0; level < d20LodCount; level++)
+                {
+                    if (gpuCull.levelInstanceCount[level] == 0)
+                    {
+                        continue;
+                    }
+                    const D20LodRange& lod = lodMesh.lods[level];
+                    BindSpinAttributes(gpuCull.buffer, gpuCull.levelFirstInstance[level]);
+                    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_SHORT,
+                        (void*)(lod.firstIndex * sizeof(GLushort)), (GLsizei)gpuCull.levelInstanceCount[level], lod.baseVertex);
+                }
+            }
+            else if (transforms.Count() > firstTrayDie)
+            {
+                const D20LodRange& trayLod = lodMesh.lods[d20LodCount - 2];
+                BindSpinAttributes(spinVbo, firstTrayDie);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, trayLod.indexCount, GL_UNSIGNED_SHORT,
+                    (void*)(trayLod.firstIndex * sizeof(GLushort)), (GLsizei)(transforms.Count() - firstTrayDie), trayLod.baseVertex);
+            }
+
+            glUniform1i(glGetUniformLocation(program, "gpuSpin"), 0);
+            glBindVertexArray(vao);
+        }
 
-        // Draw the 3 vertices using triangle primitives
-        glDrawArrays(GL_TRIANGLES, 0, 60);
+        // NOW DRAWING THE FAR-AWAY DICE AS IMPOSTORS (opaque too, so before the translucent die)
+
+        if (impostorCount > 0)
+        {
+            glUseProgram(impostorProgram);
+            glUniform1i(glGetUniformLocation(impostorProgram, "gridSize"), impostorAtlas.gridSize);
+            glUniform1f(glGetUniformLocation(impostorProgram, "frameRadius"), impostorAtlas.frameRadius);
+
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, impostorAtlas.coverage);
+            glUniform1i(glGetUniformLocation(impostorProgram, "impostorCoverage"), 1);
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, impostorAtlas.normalDepth);
+            glUniform1i(glGetUniformLocation(impostorProgram, "impostorNormalDepth"), 2);
+            glActiveTexture(GL_TEXTURE0);
+
+            glBindVertexArray(impostorVao);
+            BindInstanceAttributes(instanceVbo, levelFirstInstance[impostorLevel]);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)impostorCount);
+
+            glBindVertexArray(vao);
+            glUseProgram(program);
+        }
+
+        // NOW DRAWING THE BIG, TRANSLUCENT D20
+
+        // the big d20 uses the same numeral atlas, and turns translucent when SPACE is pressed
+        glUniform1f(glGetUniformLocation(program, "skinAlpha"), current == 1 ? translucentSkinAlpha : 1.0f);
+
+        // While translucent it is drawn twice, culling one side each time: first its back faces (the far half, seen
+        // from inside), then its front faces over them. A convex die never has a front face behind one of its own
+        // back faces, so everything blends in the right order without sorting a single triangle.
+        int translucentPassCount = backFaceCulling && current == 1 ? 2 : 1;
+        for (int pass = 0; pass < translucentPassCount; pass++)
+        {
+            glCullFace(pass + 1 < translucentPassCount ? GL_FRONT : GL_BACK);
+            if (bigDieLevel >= 0)
+            {
+                const D20LodRange& lod = lodMesh.lods[bigDieLevel];
+                BindInstanceAttributes(instanceVbo, levelFirstInstance[bigDieLevel]);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_SHORT,
+                    (void*)(lod.firstIndex * sizeof(GLushort)), 1, lod.baseVertex);
+            }
+            else if (spinOnGpu)
+            {
+                const D20LodRange& lod = lodMesh.lods[0];
+                glBindVertexArray(spinVao);
+                glUniform1i(glGetUniformLocation(program, "gpuSpin"), 1);
+                BindSpinAttributes(spinVbo, bigDie);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_SHORT,
+                    (void*)(lod.firstIndex * sizeof(GLushort)), 1, lod.baseVertex);
+                glUniform1i(glGetUniformLocation(program, "gpuSpin"), 0);
+            }
+        }
+        glDisable(GL_CULL_FACE);
 
         // "Unuse" the vertex array object
         glBindVertexArray(0);
 
+        // every draw reading this frame's part of the stream buffer has been issued
+        stream.EndFrame();
+        drawScope.End();
+
+        // scale the offscreen image up to the window
+        TraceScope upscaleScope("upscale");
+        dynamicResolution.EndFrame();
+        upscaleScope.End();
+
+        statsFrames++;
+        size_t gpuVisibleCount = transforms.Count();
+        if (gpuCulled)
+        {
+            gpuVisibleCount = firstTrayDie;
+            for (int level = 0; level < d20LodCount; level++)
+            {
+                gpuVisibleCount += gpuCull.levelInstanceCount[level];
+            }
+            statsGpuCullMs += gpuCull.gpuMs;
+            statsGpuCullFrames++;
+        }
+        statsVisible += spinOnGpu ? gpuVisibleCount : visibleCount;
+        statsImpostors += impostorCount;
+        statsOccluded += occludedCount;
+        statsCullMs += cullMs;
+        statsHeapAllocations += GetHeapAllocationCount() - frameStartAllocations;
+        statsStreamedBytes += stream.BytesStreamed();
+        statsFenceWaitMs += stream.FenceWaitMs();
+        statsLightBuildMs += lightBuildMs;
+        statsShadowCasters += shadowCasterCount;
+        for (uint16_t count : lightClusters.Counts())
+        {
+            statsLitClusters += count > 0 ? 1 : 0;
+            statsClusterLights += count;
+        }
+        if (glfwGetTime() - statsStartTime >= 1.0)
+        {
+            if (printCullingStats)
+            {
+                std::cout << "frame arena: " << frameArena.BytesUsed() / 1024 << " KB used, "
+                    << frameArena.HighWaterMark() / 1024 << " KB high-water mark of " << frameArena.Capacity() / 1024 << " KB, "
+                    << frameArena.OverflowBytes() / 1024 << " KB overflowed to the heap" << std::endl;
+                std::cout << "streaming: " << statsStreamedBytes / statsFrames / 1024 << " KB per frame, "
+                    << statsFenceWaitMs / statsFrames << " ms fence wait per frame, ";
+                if (stream.IsPersistent())
+                {
+                    std::cout << "persistent mapping" << std::endl;
+                }
+                else
+                {
+                    std::cout << "unsynchronized mapping, " << stream.OrphanCount() << " orphans so far" << std::endl;
+                }
+#ifndef NDEBUG
+                std::cout << "heap allocations: " << statsHeapAllocations << " in the last " << statsFrames << " frames" << std::endl;
+#endif
+                size_t averageVisible = statsVisible / statsFrames;
+                std::cout << "culling: " << averageVisible << " visible (" << statsImpostors / statsFrames << " as impostors), "
+                    << transforms.Count() - averageVisible << " culled (" << statsOccluded / statsFrames << " of them hidden behind occluders), "
+                    << statsCullMs / statsFrames << " ms per frame (average of " << statsFrames << " frames)" << std::endl;
+                if (statsGpuCullFrames > 0)
+                {
+                    std::cout << "GPU culling: " << statsGpuCullMs / statsGpuCullFrames << " ms of GPU time per frame, "
+                        << statsFrames - statsGpuCullFrames << " frames drew every die" << std::endl;
+                }
+                std::cout << "lights: " << pointLights.Count() << " point lights, clusters built in "
+                    << statsLightBuildMs / statsFrames << " ms per frame, "
+                    << (statsLitClusters > 0 ? double(statsClusterLights) / statsLitClusters : 0.0) << " lights per lit cluster, "
+                    << lightClusters.DroppedLights() << " dropped from full clusters" << std::endl;
+                std::cout << "shadows: " << (spotShadows ? "spot" : "directional") << " light, "
+                    << statsShadowCasters / statsFrames << " moving casters per frame, " << restingDice.size()
+                    << " resting dice in the static map, static map drawn " << shadowMaps.StaticRedrawCount() << " times so far" << std::endl;
+            }
+            statsFrames = 0;
+            statsVisible = 0;
+            statsImpostors = 0;
+            statsOccluded = 0;
+            statsCullMs = 0.0;
+            statsGpuCullMs = 0.0;
+            statsGpuCullFrames = 0;
+            statsHeapAllocations = 0;
+            statsStreamedBytes = 0;
+            statsFenceWaitMs = 0.0;
+            statsLightBuildMs = 0.0;
+            statsLitClusters = 0;
+            statsClusterLights = 0;
+            statsShadowCasters = 0;
+            statsStartTime = glfwGetTime();
+        }
+
+        if (printJobTimings)
+        {
+            jobSystem.PrintTimings(std::cout);
+            printJobTimings = false;
+        }
+
+        if (printGlResources)
+        {
+            PrintGlResourceSummary(std::cout);
+            printGlResources = false;
+        }
+
         // Tell GLFW to swap the screen buffer with the offscreen buffer
+        TraceScope swapScope("glfwSwapBuffers");
         glfwSwapBuffers(window);
+        swapScope.End();
+
+        // the first frame is on screen, which is where startup ends (later frames do nothing here)
+        startupScope.End();
 
         // Tell GLFW to process window events (e.g., input events, window closed events, etc.)
+        TraceScope pollScope("glfwPollEvents");
         glfwPollEvents();
+        pollScope.End();
     }
 
     // --- Cleanup ---
 
-    // Make sure to delete the shader program
-    glDeleteProgram(program);
-
-    // Delete the VBO that contains our vertices
-    glDeleteBuffers(1, &vbo);
+    // Finish writing the recording
+    if (recorder.IsOpen())
+    {
+        recorder.Close();
+        std::cout << "recording: " << recorder.FrameCount() << " frames, " << recorder.BytesWritten() / (1024.0 * 1024.0) << " MB, "
+            << recorder.StallCount() << " frames waited for the writer" << std::endl;
+    }
 
-    // Delete the vertex array object
-    glDeleteVertexArrays(1, &vao);
+    // Make sure to delete the shader programs
+    DeleteGlResource(GlResourceType::Program, program);
+    DeleteGlResource(GlResourceType::Program, impostorProgram);
+    DeleteGlResource(GlResourceType::Program, shadowProgram);
+    DeleteGlResource(GlResourceType::Program, cullProgram);
+
+    // Delete the VBO that contains our vertices, the IBO with their indices, and the stream buffer with the instances
+    DeleteGlResource(GlResourceType::Buffer, vbo);
+    DeleteGlResource(GlResourceType::Buffer, ibo);
+    stream.Delete();
+    DeleteGlResource(GlResourceType::Buffer, impostorVbo);
+    DeleteGlResource(GlResourceType::Buffer, trayVbo);
+    DeleteGlResource(GlResourceType::Buffer, trayIbo);
+    DeleteGlResource(GlResourceType::Buffer, ambientShBuffer);
+    DeleteGlResource(GlResourceType::Buffer, materialBuffer);
+    DeleteGlResource(GlResourceType::Buffer, spinVbo);
+    DeleteGlResource(GlResourceType::Buffer, restingCasterVbo);
+
+    // Delete the vertex array objects
+    DeleteGlResource(GlResourceType::VertexArray, vao);
+    DeleteGlResource(GlResourceType::VertexArray, impostorVao);
+    DeleteGlResource(GlResourceType::VertexArray, trayVao);
+    DeleteGlResource(GlResourceType::VertexArray, spinVao);
+
+    // Delete the numeral atlas
+    DeleteGlResource(GlResourceType::Texture, tex0);
+    DeleteImpostorAtlas(impostorAtlas);
+
+    // Delete the offscreen framebuffer and the GPU timers
+    dynamicResolution.Delete();
+    gpuCuller.Delete();
+
+    // Delete the point light texture buffers and the shadow maps
+    DeleteClusterTextures(clusterTextures);
+    shadowMaps.Delete();
+
+    // anything the registry still knows about at this point was forgotten above
+    ReportGlResourceLeaks(std::cout);
 
     // Remember to tell GLFW to clean itself up before exiting the application
     glfwTerminate();
 
+    // write the trace if one is still being recorded
+    if (IsTracing())
+    {
+        StopTracing(tracePath);
+    }
+
     return 0;
 }
 
@@ -1506,10 +2045,11 @@ int main()
 /// <returns>OpenGL handle to the created shader program</returns>
 GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath)
 {
+    TraceScope scope("CreateShaderProgram");
     GLuint vertexShader = CreateShaderFromFile(GL_VERTEX_SHADER, vertexShaderFilePath);
     GLuint fragmentShader = CreateShaderFromFile(GL_FRAGMENT_SHADER, fragmentShaderFilePath);
 
-    GLuint program = glCreateProgram();
+    GLuint program = CreateGlResource(GlResourceType::Program, vertexShaderFilePath + " + " + fragmentShaderFilePath);
     glAttachShader(program, vertexShader);
     glAttachShader(program, fragmentShader);
 
@@ -1533,6 +2073,48 @@ GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::s
     return program;
 }
 
+/// <summary>
+/// Creates a shader program that draws nothing and writes the outputs of its geometry shader into buffers instead
+/// (transform feedback), interleaved in the given order.
+/// </summary>
+/// <param name="vertexShaderFilePath">Vertex shader file path</param>
+/// <param name="geometryShaderFilePath">Geometry shader file path</param>
+/// <param name="varyings">Names of the geometry shader outputs to capture</param>
+/// <param name="varyingCount">Number of names</param>
+/// <returns>OpenGL handle to the created shader program</returns>
+GLuint CreateFeedbackProgram(const std::string& vertexShaderFilePath, const std::string& geometryShaderFilePath,
+    const char* const* varyings, int varyingCount)
+{
+    TraceScope scope("CreateFeedbackProgram");
+    GLuint vertexShader = CreateShaderFromFile(GL_VERTEX_SHADER, vertexShaderFilePath);
+    GLuint geometryShader = CreateShaderFromFile(GL_GEOMETRY_SHADER, geometryShaderFilePath);
+
+    GLuint program = CreateGlResource(GlResourceType::Program, vertexShaderFilePath + " + " + geometryShaderFilePath);
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, geometryShader);
+
+    // which outputs get captured is part of linking, so it has to be set before
+    glTransformFeedbackVaryings(program, varyingCount, varyings, GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(program);
+
+    glDetachShader(program, vertexShader);
+    glDeleteShader(vertexShader);
+    glDetachShader(program, geometryShader);
+    glDeleteShader(geometryShader);
+
+    // Check shader program link status
+    GLint linkStatus;
+    glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+    if (linkStatus != GL_TRUE) {
+        char infoLog[512];
+        GLsizei infoLogLen = sizeof(infoLog);
+        glGetProgramInfoLog(program, infoLogLen, &infoLogLen, infoLog);
+        std::cerr << "program link error: " << infoLog << std::endl;
+    }
+
+    return program;
+}
+
 /// <summary>
 /// Creates a shader based on the provided shader type and the path to the file containing the shader source.
 /// </summary>
@@ -1599,4 +2181,169 @@ void FramebufferSizeChangedCallback(GLFWwindow* window, int width, int height)
     // Whenever the size of the framebuffer changed (due to window resizing, etc.),
     // update the dimensions of the region to the new size
     glViewport(0, 0, width, height);
+
+    // and draw the frame again at the new size, even while idle
+    redrawRequested = true;
+}
+
+/// <summary>
+/// Function for handling the event when the contents of the window were damaged and need to be drawn again.
+/// </summary>
+/// <param name="window">Reference to the window</param>
+void WindowRefreshCallback(GLFWwindow* window)
+{
+    redrawRequested = true;
+}
+
+/// <summary>
+/// Function for handling mouse button presses: a left click asks the next frame to pick the die under the cursor.
+/// </summary>
+/// <param name="window">Reference to the window</param>
+/// <param name="button">Mouse button</param>
+/// <param name="action">Pressed or released</param>
+/// <param name="mods">Modifier keys held down</param>
+void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+{
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+    {
+        glfwGetCursorPos(window, &pickCursorX, &pickCursorY);
+        pickRequested = true;
+        redrawRequested = true;
+    }
+}
+
+/// <summary>
+/// Points the per-instance vertex attributes (locations 4 to 12) of the currently bound vertex array object
+/// at the instance buffer, starting from the given instance.
+/// (OpenGL 3.3 has no base instance for instanced draws, so a draw that starts in the middle of the buffer
+/// moves the attribute offsets instead.)
+/// </summary>
+/// <param name="instanceVbo">Buffer containing one DieInstance per die</param>
+/// <param name="firstInstance">Index of the instance the next draw should start from</param>
+void BindInstanceAttributes(GLuint instanceVbo, size_t firstInstance)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+
+    size_t base = firstInstance * sizeof(DieInstance);
+    for (GLuint column = 0; column < 4; column++)
+    {
+        size_t columnOffset = column * sizeof(glm::vec4);
+        glVertexAttribPointer(4 + column, 4, GL_FLOAT, GL_FALSE, sizeof(DieInstance),
+            (void*)(base + offsetof(DieInstance, mvp) + columnOffset));
+        glVertexAttribPointer(8 + column, 4, GL_FLOAT, GL_FALSE, sizeof(DieInstance),
+            (void*)(base + offsetof(DieInstance, model) + columnOffset));
+    }
+
+    // the material is an integer, so it has to stay one on its way to the shader
+    glVertexAttribIPointer(12, 1, GL_UNSIGNED_INT, sizeof(DieInstance), (void*)(base + offsetof(DieInstance, material)));
+}
+
+/// <summary>
+/// Same as BindInstanceAttributes(), but for the static buffer of GPU spin mode (locations 8 to 14).
+/// </summary>
+/// <param name="spinVbo">Buffer containing one SpinInstance per die</param>
+/// <param name="firstInstance">Index of the instance the next draw should start from</param>
+void BindSpinAttributes(GLuint spinVbo, size_t firstInstance)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, spinVbo);
+
+    size_t base = firstInstance * sizeof(SpinInstance);
+    for (GLuint column = 0; column < 4; column++)
+    {
+        glVertexAttribPointer(8 + column, 4, GL_FLOAT, GL_FALSE, sizeof(SpinInstance),
+            (void*)(base + offsetof(SpinInstance, base) + column * sizeof(glm::vec4)));
+    }
+    glVertexAttribIPointer(12, 1, GL_UNSIGNED_INT, sizeof(SpinInstance), (void*)(base + offsetof(SpinInstance, material)));
+    glVertexAttribPointer(13, 4, GL_FLOAT, GL_FALSE, sizeof(SpinInstance), (void*)(base + offsetof(SpinInstance, spin)));
+    glVertexAttribPointer(14, 1, GL_FLOAT, GL_FALSE, sizeof(SpinInstance), (void*)(base + offsetof(SpinInstance, spinPhase)));
+}
+
+/// <summary>
+/// Adds a grid of small spinning dice (a "tray"), laid out around the origin of the tray node.
+/// </summary>
+/// <param name="transforms">Transform system to add the dice to</param>
+/// <param name="count">Number of dice to add</param>
+/// <param name="materialCount">Number of materials the dice take turns using</param>
+void AddTrayDice(TransformSystem& transforms, int count, int materialCount)
+{
+    // fixed seed, so the tray looks the same every run
+    std::mt19937 random(20);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    int columns = 1;
+    while (columns * columns < count)
+    {
+        columns++;
+    }
+
+    const float spacing = 0.3f;
+    for (int i = 0; i < count; i++)
+    {
+        int column = i % columns;
+        int row = i / columns;
+        glm::vec3 position = glm::vec3((column - 0.5f * (columns - 1)) * spacing, 0.0f, -row * spacing);
+        glm::vec3 axis = glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.0f, 0.0f, 0.01f);
+        transforms.Add(position, 0.1f, axis, 0.5f + unit(random), 3.14159265f * unit(random), i % materialCount);
+    }
+}
+
+/// <summary>
+/// Same as AddTrayDice(), but the dice are scattered over the area of the grid, at rest, instead of lined up.
+/// </summary>
+/// <param name="transforms">Transform system to add the dice to</param>
+/// <param name="count">Number of dice to add</param>
+/// <param name="materialCount">Number of materials the dice take turns using</param>
+/// <param name="jobSystem">Job system to spawn the dice on</param>
+void AddScatteredTrayDice(TransformSystem& transforms, int count, int materialCount, JobSystem& jobSystem)
+{
+    int columns = 1;
+    while (columns * columns < count)
+    {
+        columns++;
+    }
+    int rows = (count + columns - 1) / columns;
+
+    // The same area the grid of AddTrayDice() covers, so that the tray under it fits either way. The grid leaves
+    // about three times the width of a die between dice, so there is plenty of room and every die finds a place.
+    const float spacing = 0.3f;
+    SpawnSettings settings;
+    settings.regionMin = glm::vec3(-0.5f * (columns - 1) * spacing, 0.0f, -(rows - 1) * spacing);
+    settings.regionMax = glm::vec3(0.5f * (columns - 1) * spacing, 0.0f, 0.0f);
+    settings.scale = 0.1f;
+    settings.clearance = 0.01f;
+    settings.seed = 20;
+    std::vector<SpawnedDie> dice = SpawnDice(settings, count, jobSystem);
+    if (dice.size() < static_cast<size_t>(count))
+    {
+        std::cerr << "Failed to scatter every die: only " << dice.size() << " of " << count << " found a place!" << std::endl;
+    }
+
+    // a speed of 0 keeps every die at the rotation it was spawned with (its phase around its axis)
+    for (size_t i = 0; i < dice.size(); i++)
+    {
+        transforms.Add(dice[i].position, settings.scale, dice[i].spinAxis, 0.0f, dice[i].spinPhase, static_cast<uint32_t>(i % materialCount));
+    }
+}
+
+/// <summary>
+/// Scatters small colored point lights over and around the tray of dice.
+/// </summary>
+/// <param name="lights">Light list to add the lights to</param>
+/// <param name="count">Number of lights to add</param>
+void AddTableLights(PointLights& lights, int count)
+{
+    // fixed seed, so the lights are in the same places every run
+    std::mt19937 random(37);
+    std::uniform_real_distribution<float> across(-2.0f, 2.0f);
+    std::uniform_real_distribution<float> height(-1.0f, 0.5f);
+    std::uniform_real_distribution<float> along(-6.0f, 0.5f);
+    std::uniform_real_distribution<float> size(0.3f, 0.8f);
+    std::uniform_real_distribution<float> hue(0.2f, 1.0f);
+
+    for (int i = 0; i < count; i++)
+    {
+        glm::vec3 position = glm::vec3(across(random), height(random), along(random));
+        glm::vec3 color = glm::vec3(hue(random), hue(random), hue(random));
+        lights.Add(position, size(random), color);
+    }
 }
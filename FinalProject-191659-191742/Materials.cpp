@@ -0,0 +1,69 @@
+#include "Materials.h"
+#include "GlResources.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+/// <summary>
+/// Builds the built-in materials: resin (the look every die had before there were materials), metal and bone,
+/// followed by variants that blend two of them and tint the result, until there are count materials.
+/// </summary>
+/// <param name="count">Number of materials, from 1 to maxMaterials</param>
+/// <returns>Materials, indexed by the material of a die</returns>
+std::vector<Material> BuildMaterialLibrary(int count)
+{
+    count = std::min(std::max(count, 1), maxMaterials);
+
+    // resin: dull diffuse, strong broad highlight
+    // metal: almost no diffuse, tinted tight highlight
+    // bone: bright warm diffuse, faint highlight
+    const Material base[3] = {
+        { glm::vec4(0.1f, 0.1f, 0.1f, 0.0f), glm::vec4(0.2f, 0.2f, 0.2f, 0.0f), glm::vec4(2.0f, 2.0f, 2.0f, 1.5f) },
+        { glm::vec4(0.15f, 0.14f, 0.12f, 0.0f), glm::vec4(0.05f, 0.05f, 0.05f, 0.0f), glm::vec4(3.0f, 2.7f, 2.2f, 32.0f) },
+        { glm::vec4(0.2f, 0.19f, 0.16f, 0.0f), glm::vec4(0.6f, 0.55f, 0.45f, 0.0f), glm::vec4(0.3f, 0.3f, 0.3f, 4.0f) }
+    };
+
+    std::vector<Material> materials(base, base + std::min(count, 3));
+
+    // fixed seed, so a die gets the same variant every run
+    std::mt19937 random(45);
+    std::uniform_int_distribution<int> pick(0, 2);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    while (static_cast<int>(materials.size()) < count)
+    {
+        const Material& a = base[pick(random)];
+        const Material& b = base[pick(random)];
+        float t = unit(random);
+        glm::vec4 tint = glm::vec4(0.6f + 0.4f * unit(random), 0.6f + 0.4f * unit(random), 0.6f + 0.4f * unit(random), 1.0f);
+
+        Material variant;
+        variant.ambient = glm::mix(a.ambient, b.ambient, t) * tint;
+        variant.diffuse = glm::mix(a.diffuse, b.diffuse, t) * tint;
+        variant.specular = glm::mix(a.specular, b.specular, t);
+        // shininess blends in log space, so halfway between 1.5 and 32 is about 7 rather than 17
+        variant.specular.w = a.specular.w * std::pow(b.specular.w / a.specular.w, t);
+        materials.push_back(variant);
+    }
+    return materials;
+}
+
+/// <summary>
+/// Creates the uniform buffer holding the MaterialTable block. Entries past the given materials repeat the first one,
+/// so an out of range index still reads a valid material.
+/// </summary>
+/// <param name="materials">Materials, at most maxMaterials of them</param>
+/// <returns>OpenGL handle to the uniform buffer</returns>
+GLuint CreateMaterialBuffer(const std::vector<Material>& materials)
+{
+    // the block always has maxMaterials entries, and the buffer has to be at least as big as the block
+    std::vector<Material> block(maxMaterials, materials.empty() ? BuildMaterialLibrary(1)[0] : materials[0]);
+    std::copy(materials.begin(), materials.begin() + std::min<size_t>(materials.size(), maxMaterials), block.begin());
+
+    GLuint buffer = CreateGlResource(GlResourceType::Buffer, "material table");
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, block.size() * sizeof(Material), block.data(), GL_STATIC_DRAW);
+    SetGlResourceBytes(GlResourceType::Buffer, buffer, block.size() * sizeof(Material));
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return buffer;
+}
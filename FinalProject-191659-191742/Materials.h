@@ -0,0 +1,37 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Size of the MaterialTable uniform block (must match maxMaterials in main.fsh and impostor.fsh).
+// 256 materials of 48 bytes take 12 KB, under the 16 KB every OpenGL 3.3 driver allows for a uniform block.
+const int maxMaterials = 256;
+
+/// <summary>
+/// Struct containing the lighting response of one material, laid out like the Material struct of the
+/// MaterialTable uniform block (std140: three vec4s)
+/// </summary>
+struct Material
+{
+    glm::vec4 ambient;      // rgb, a is unused
+    glm::vec4 diffuse;      // rgb, a is unused
+    glm::vec4 specular;     // rgb, a is the shininess (specular exponent)
+};
+
+/// <summary>
+/// Builds the built-in materials: resin (the look every die had before there were materials), metal and bone,
+/// followed by variants that blend two of them and tint the result, until there are count materials.
+/// </summary>
+/// <param name="count">Number of materials, from 1 to maxMaterials</param>
+/// <returns>Materials, indexed by the material of a die</returns>
+std::vector<Material> BuildMaterialLibrary(int count);
+
+/// <summary>
+/// Creates the uniform buffer holding the MaterialTable block. Entries past the given materials repeat the first one,
+/// so an out of range index still reads a valid material.
+/// </summary>
+/// <param name="materials">Materials, at most maxMaterials of them</param>
+/// <returns>OpenGL handle to the uniform buffer</returns>
+GLuint CreateMaterialBuffer(const std::vector<Material>& materials);
@@ -0,0 +1,554 @@
+#include "OcclusionCulling.h"
+#include "FrustumCulling.h"
+#include "Simd.h"
+#include "TransformSystem.h"
+#include "Tray.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// Anything closer to the camera than this (in clip w, i.e. view depth) counts as reaching it:
+// occluder triangles are clipped there, and spheres reaching it are never hidden.
+static const float occlusionNearDepth = 0.01f;
+
+// x of the pixel centers of the lanes, relative to the first pixel of a batch
+static const float laneCenters[8] = { 0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f };
+
+/// <summary>
+/// Returns the pixel a coordinate falls into, clamped to the buffer. Also works for coordinates far outside of it
+/// (such as those of points just in front of the near plane), which would overflow an int.
+/// </summary>
+/// <param name="coordinate">Pixel coordinate (pixel i covers i to i + 1)</param>
+/// <param name="size">Width or height of the buffer</param>
+static int ClampToPixel(float coordinate, int size)
+{
+    coordinate = std::min(std::max(coordinate, 0.0f), static_cast<float>(size - 1));
+    return static_cast<int>(std::floor(coordinate));
+}
+
+/// <summary>
+/// Returns the radius of the insphere of the d20 divided by the radius of its circumsphere. The rounded edges of the
+/// close-up mesh are pulled in from the corners and edges only, so the insphere stays inside every detail level.
+/// </summary>
+static float GetD20InradiusRatio()
+{
+    float inradius = glm::dot(glm::normalize(GetD20FaceNormal(0)), GetD20Corner(d20FaceIndices[0][0]));
+    return inradius / glm::length(GetD20Corner(0));
+}
+
+OcclusionBuffer::OcclusionBuffer()
+    : viewProj(1.0f), depth(occlusionBufferWidth * occlusionBufferHeight, 0.0f)
+{
+    rowLengths[0] = rowLengths[1] = rowLengths[2] = rowLengths[3] = 0.0f;
+    diskLengths[0] = diskLengths[1] = 0.0f;
+}
+
+/// <summary>
+/// Starts a frame: forgets the occluders of the last one.
+/// </summary>
+/// <param name="viewProj">Projection matrix multiplied by the view matrix (the view has to be rigid, as from lookAt)</param>
+void OcclusionBuffer::Begin(const glm::mat4& viewProj)
+{
+    this->viewProj = viewProj;
+    triangles.clear();
+    rects.clear();
+
+    // (glm stores columns, so row i is viewProj[0][i], viewProj[1][i], ...)
+    glm::vec3 rows[4];
+    for (int i = 0; i < 4; i++)
+    {
+        rows[i] = glm::vec3(viewProj[0][i], viewProj[1][i], viewProj[2][i]);
+        rowLengths[i] = glm::length(rows[i]);
+    }
+
+    // Clip w is the view depth, so its row points along the view direction. Moving across it leaves w alone, and x and y
+    // change only by the part of their rows that is across it (all of it, unless the projection is off-center).
+    glm::vec3 forward = rows[3] / std::max(rowLengths[3], 1e-20f);
+    for (int i = 0; i < 2; i++)
+    {
+        diskLengths[i] = glm::length(rows[i] - glm::dot(rows[i], forward) * forward);
+    }
+}
+
+/// <summary>
+/// Adds the front-facing triangles of an indexed mesh as occluders. The parts in front of the near plane are clipped away.
+/// </summary>
+/// <param name="vertices">Vertices the indices point into</param>
+/// <param name="indices">Three indices per triangle, counter-clockwise seen from the front</param>
+/// <param name="indexCount">Number of indices</param>
+/// <param name="model">World matrix of the mesh</param>
+void OcclusionBuffer::AddMesh(const Vertex* vertices, const GLushort* indices, size_t indexCount, const glm::mat4& model)
+{
+    glm::mat4 mvp = viewProj * model;
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        glm::vec4 corners[3];
+        for (int k = 0; k < 3; k++)
+        {
+            const Vertex& v = vertices[indices[i + k]];
+            corners[k] = mvp * glm::vec4(v.x, v.y, v.z, 1.0f);
+        }
+
+        // cut off the part in front of the near plane (what is left has up to four corners), then fan it into triangles
+        glm::vec4 clipped[4];
+        int clippedCount = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            const glm::vec4& p = corners[k];
+            const glm::vec4& q = corners[(k + 1) % 3];
+            float pDistance = p.w - occlusionNearDepth;
+            float qDistance = q.w - occlusionNearDepth;
+            if (pDistance >= 0.0f)
+            {
+                clipped[clippedCount++] = p;
+            }
+            if ((pDistance >= 0.0f) != (qDistance >= 0.0f))
+            {
+                clipped[clippedCount++] = p + (q - p) * (pDistance / (pDistance - qDistance));
+            }
+        }
+        for (int k = 1; k + 1 < clippedCount; k++)
+        {
+            AddTriangle(clipped[0], clipped[k], clipped[k + 1]);
+        }
+    }
+}
+
+/// <summary>
+/// Sets up a triangle given in clip space (in front of the near plane) for drawing, unless it faces away or covers no pixel center.
+/// </summary>
+void OcclusionBuffer::AddTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+{
+    const glm::vec4* corners[3] = { &a, &b, &c };
+    float x[3], y[3], inverseDepth[3];
+    for (int k = 0; k < 3; k++)
+    {
+        inverseDepth[k] = 1.0f / corners[k]->w;
+        x[k] = (corners[k]->x * inverseDepth[k] * 0.5f + 0.5f) * occlusionBufferWidth;
+        y[k] = (corners[k]->y * inverseDepth[k] * 0.5f + 0.5f) * occlusionBufferHeight;
+    }
+
+    // counter-clockwise on screen means facing the camera (this also drops triangles with no area, and NaNs)
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (!(area > 0.0f))
+    {
+        return;
+    }
+
+    // the pixels whose centers lie within the bounding box
+    OccluderTriangle triangle;
+    triangle.minX = ClampToPixel(std::ceil(std::min(x[0], std::min(x[1], x[2])) - 0.5f), occlusionBufferWidth);
+    triangle.maxX = ClampToPixel(std::floor(std::max(x[0], std::max(x[1], x[2])) - 0.5f), occlusionBufferWidth);
+    triangle.minY = ClampToPixel(std::ceil(std::min(y[0], std::min(y[1], y[2])) - 0.5f), occlusionBufferHeight);
+    triangle.maxY = ClampToPixel(std::floor(std::max(y[0], std::max(y[1], y[2])) - 0.5f), occlusionBufferHeight);
+    if (std::max(x[0], std::max(x[1], x[2])) < 0.5f || std::min(x[0], std::min(x[1], x[2])) > occlusionBufferWidth - 0.5f
+        || std::max(y[0], std::max(y[1], y[2])) < 0.5f || std::min(y[0], std::min(y[1], y[2])) > occlusionBufferHeight - 0.5f)
+    {
+        return;
+    }
+
+    // Edge k is the one across from corner k, scaled so that it is 1 at corner k and 0 on the edge: the barycentric
+    // coordinate of corner k. A pixel is covered where all three are positive.
+    triangle.depth[0] = triangle.depth[1] = triangle.depth[2] = 0.0f;
+    for (int k = 0; k < 3; k++)
+    {
+        int j = (k + 1) % 3;
+        int l = (k + 2) % 3;
+        float edgeA = -(y[l] - y[j]) / area;
+        float edgeB = (x[l] - x[j]) / area;
+        triangle.edges[k][0] = edgeA;
+        triangle.edges[k][1] = edgeB;
+        triangle.edges[k][2] = -(edgeA * x[j] + edgeB * y[j]);
+
+        // 1 / depth is linear on screen, so it is the barycentric blend of the corners' values
+        for (int i = 0; i < 3; i++)
+        {
+            triangle.depth[i] += triangle.edges[k][i] * inverseDepth[k];
+        }
+    }
+
+    // The pixel stands for its whole square, so it gets the farthest depth the plane reaches within half a pixel
+    // of the center, but never farther than the farthest corner.
+    triangle.depth[2] -= 0.5f * (std::abs(triangle.depth[0]) + std::abs(triangle.depth[1]));
+    triangle.minDepth = std::min(inverseDepth[0], std::min(inverseDepth[1], inverseDepth[2]));
+    triangles.push_back(triangle);
+}
+
+/// <summary>
+/// Adds a die as an occluder, as the square of pixels inside the projection of its insphere.
+/// </summary>
+/// <param name="boundingSphere">World space bounding sphere of the die (center in xyz, circumradius in w)</param>
+/// <returns>Whether it covers at least one whole pixel (and was added)</returns>
+bool OcclusionBuffer::AddDie(const glm::vec4& boundingSphere)
+{
+    static const float inradiusRatio = GetD20InradiusRatio();
+    float radius = boundingSphere.w * inradiusRatio;
+    glm::vec4 center = viewProj * glm::vec4(glm::vec3(boundingSphere), 1.0f);
+    if (center.w - radius * rowLengths[3] <= occlusionNearDepth)
+    {
+        return false;
+    }
+
+    // The disk through the center of the insphere, across the view direction, lies at the depth of the center and
+    // projects to an ellipse around the projected center. Every ray through that ellipse passes through the die
+    // before it gets deeper than the center, so whatever lies deeper there is hidden. The square of pixels inside
+    // the ellipse is drawn at the depth of the center.
+    float inverseDepth = 1.0f / center.w;
+    float halfWidth = radius * diskLengths[0] * inverseDepth * 0.70710678f * 0.5f * occlusionBufferWidth;
+    float halfHeight = radius * diskLengths[1] * inverseDepth * 0.70710678f * 0.5f * occlusionBufferHeight;
+    float centerX = (center.x * inverseDepth * 0.5f + 0.5f) * occlusionBufferWidth;
+    float centerY = (center.y * inverseDepth * 0.5f + 0.5f) * occlusionBufferHeight;
+
+    // only the pixels that lie inside the square completely
+    float left = std::ceil(centerX - halfWidth), right = std::floor(centerX + halfWidth) - 1.0f;
+    float bottom = std::ceil(centerY - halfHeight), top = std::floor(centerY + halfHeight) - 1.0f;
+    if (left > right || bottom > top || right < 0.0f || left > occlusionBufferWidth - 1
+        || top < 0.0f || bottom > occlusionBufferHeight - 1)
+    {
+        return false;
+    }
+
+    OccluderRect rect;
+    rect.minX = ClampToPixel(left, occlusionBufferWidth);
+    rect.maxX = ClampToPixel(right, occlusionBufferWidth);
+    rect.minY = ClampToPixel(bottom, occlusionBufferHeight);
+    rect.maxY = ClampToPixel(top, occlusionBufferHeight);
+    rect.depth = inverseDepth;
+    rects.push_back(rect);
+    return true;
+}
+
+/// <summary>
+/// Clears a band of rows and draws every occluder into it, SIMD_WIDTH pixels at a time.
+/// Different bands can be drawn at the same time on different threads.
+/// </summary>
+/// <param name="rowBegin">First row</param>
+/// <param name="rowEnd">One past the last row</param>
+void OcclusionBuffer::Rasterize(int rowBegin, int rowEnd)
+{
+#if SIMD_WIDTH > 1
+    std::fill(depth.begin() + rowBegin * occlusionBufferWidth, depth.begin() + rowEnd * occlusionBufferWidth, 0.0f);
+
+    // A batch covers SIMD_WIDTH pixels of a row, starting at a multiple of SIMD_WIDTH (so it never runs off the row).
+    // Nothing is ever drawn behind the cleared value of 0, so a lane that is not covered can simply draw 0:
+    // the covered value is masked with the comparison, and kept with max(), which also keeps the nearest occluder.
+    const SimdFloat lanes = SimdLoad(laneCenters);
+    const SimdFloat zero = SimdSet(0.0f);
+
+    for (const OccluderTriangle& triangle : triangles)
+    {
+        int minY = std::max(triangle.minY, rowBegin);
+        int maxY = std::min(triangle.maxY, rowEnd - 1);
+        int firstX = triangle.minX & ~(SIMD_WIDTH - 1);
+
+        SimdFloat edgeA[3];
+        for (int k = 0; k < 3; k++)
+        {
+            edgeA[k] = SimdSet(triangle.edges[k][0]);
+        }
+        SimdFloat depthA = SimdSet(triangle.depth[0]);
+        SimdFloat minDepth = SimdSet(triangle.minDepth);
+
+        for (int y = minY; y <= maxY; y++)
+        {
+            // everything that does not change along the row
+            float centerY = y + 0.5f;
+            SimdFloat edgeRow[3];
+            for (int k = 0; k < 3; k++)
+            {
+                edgeRow[k] = SimdSet(triangle.edges[k][1] * centerY + triangle.edges[k][2]);
+            }
+            SimdFloat depthRow = SimdSet(triangle.depth[1] * centerY + triangle.depth[2]);
+
+            float* row = &depth[y * occlusionBufferWidth];
+            for (int x = firstX; x <= triangle.maxX; x += SIMD_WIDTH)
+            {
+                SimdFloat centerX = SimdAdd(SimdSet(static_cast<float>(x)), lanes);
+                SimdFloat inside = SimdMin(SimdMulAdd(edgeA[0], centerX, edgeRow[0]),
+                    SimdMin(SimdMulAdd(edgeA[1], centerX, edgeRow[1]), SimdMulAdd(edgeA[2], centerX, edgeRow[2])));
+                SimdFloat pixelDepth = SimdMax(SimdMulAdd(depthA, centerX, depthRow), minDepth);
+                SimdStore(row + x, SimdMax(SimdLoad(row + x), SimdAnd(SimdLess(zero, inside), pixelDepth)));
+            }
+        }
+    }
+
+    for (const OccluderRect& rect : rects)
+    {
+        int minY = std::max(rect.minY, rowBegin);
+        int maxY = std::min(rect.maxY, rowEnd - 1);
+        int firstX = rect.minX & ~(SIMD_WIDTH - 1);
+        SimdFloat left = SimdSet(static_cast<float>(rect.minX));
+        SimdFloat right = SimdSet(static_cast<float>(rect.maxX + 1));
+        SimdFloat rectDepth = SimdSet(rect.depth);
+
+        for (int y = minY; y <= maxY; y++)
+        {
+            float* row = &depth[y * occlusionBufferWidth];
+            for (int x = firstX; x <= rect.maxX; x += SIMD_WIDTH)
+            {
+                SimdFloat centerX = SimdAdd(SimdSet(static_cast<float>(x)), lanes);
+                SimdFloat inside = SimdAnd(SimdLess(left, centerX), SimdLess(centerX, right));
+                SimdStore(row + x, SimdMax(SimdLoad(row + x), SimdAnd(inside, rectDepth)));
+            }
+        }
+    }
+#else
+    RasterizeScalar(rowBegin, rowEnd);
+#endif
+}
+
+/// <summary>
+/// Same as Rasterize(), but always uses plain scalar code. Used as a reference.
+/// </summary>
+void OcclusionBuffer::RasterizeScalar(int rowBegin, int rowEnd)
+{
+    std::fill(depth.begin() + rowBegin * occlusionBufferWidth, depth.begin() + rowEnd * occlusionBufferWidth, 0.0f);
+
+    for (const OccluderTriangle& triangle : triangles)
+    {
+        for (int y = std::max(triangle.minY, rowBegin); y <= std::min(triangle.maxY, rowEnd - 1); y++)
+        {
+            float centerY = y + 0.5f;
+            float* row = &depth[y * occlusionBufferWidth];
+            for (int x = triangle.minX; x <= triangle.maxX; x++)
+            {
+                float centerX = x + 0.5f;
+                float inside = std::min(triangle.edges[0][0] * centerX + (triangle.edges[0][1] * centerY + triangle.edges[0][2]),
+                    std::min(triangle.edges[1][0] * centerX + (triangle.edges[1][1] * centerY + triangle.edges[1][2]),
+                        triangle.edges[2][0] * centerX + (triangle.edges[2][1] * centerY + triangle.edges[2][2])));
+                if (inside > 0.0f)
+                {
+                    float pixelDepth = triangle.depth[0] * centerX + (triangle.depth[1] * centerY + triangle.depth[2]);
+                    row[x] = std::max(row[x], std::max(pixelDepth, triangle.minDepth));
+                }
+            }
+        }
+    }
+
+    for (const OccluderRect& rect : rects)
+    {
+        for (int y = std::max(rect.minY, rowBegin); y <= std::min(rect.maxY, rowEnd - 1); y++)
+        {
+            float* row = &depth[y * occlusionBufferWidth];
+            for (int x = rect.minX; x <= rect.maxX; x++)
+            {
+                row[x] = std::max(row[x], rect.depth);
+            }
+        }
+    }
+}
+
+/// <summary>
+/// Returns whether a sphere is hidden for sure: every pixel its screen rectangle touches holds an occluder
+/// nearer than the nearest point of the sphere. Spheres reaching the near plane never are.
+/// </summary>
+/// <param name="sphere">World space sphere (center in xyz, radius in w)</param>
+bool OcclusionBuffer::IsOccluded(const glm::vec4& sphere) const
+{
+    glm::vec4 center = viewProj * glm::vec4(glm::vec3(sphere), 1.0f);
+    float nearDepth = center.w - sphere.w * rowLengths[3];
+    float farDepth = center.w + sphere.w * rowLengths[3];
+    if (nearDepth <= occlusionNearDepth)
+    {
+        return false;
+    }
+
+    // Every point of the sphere has its clip x within radius * rowLengths[0] of the center's (and so on), so the screen
+    // rectangle is bounded by the smallest and largest x / w over those ranges: with w as small as possible when that
+    // makes the quotient more extreme, and as large as possible when not.
+    float radiusX = sphere.w * rowLengths[0];
+    float radiusY = sphere.w * rowLengths[1];
+    auto lowest = [&](float v) { return v / (v < 0.0f ? nearDepth : farDepth); };
+    auto highest = [&](float v) { return v / (v > 0.0f ? nearDepth : farDepth); };
+    float left = (lowest(center.x - radiusX) * 0.5f + 0.5f) * occlusionBufferWidth;
+    float right = (highest(center.x + radiusX) * 0.5f + 0.5f) * occlusionBufferWidth;
+    float bottom = (lowest(center.y - radiusY) * 0.5f + 0.5f) * occlusionBufferHeight;
+    float top = (highest(center.y + radiusY) * 0.5f + 0.5f) * occlusionBufferHeight;
+
+    // grown by a pixel: every point of the rectangle has the four pixel centers around it tested
+    int minX = ClampToPixel(left - 0.5f, occlusionBufferWidth);
+    int maxX = ClampToPixel(right - 0.5f + 1.0f, occlusionBufferWidth);
+    int minY = ClampToPixel(bottom - 0.5f, occlusionBufferHeight);
+    int maxY = ClampToPixel(top - 0.5f + 1.0f, occlusionBufferHeight);
+
+    // hidden where the occluder is nearer (larger) than the nearest point of the sphere
+    float nearest = 1.0f / nearDepth;
+#if SIMD_WIDTH > 1
+    const SimdFloat nearestLanes = SimdSet(nearest);
+    const int allLanes = (1 << SIMD_WIDTH) - 1;
+    for (int y = minY; y <= maxY; y++)
+    {
+        const float* row = &depth[y * occlusionBufferWidth];
+        for (int x = minX & ~(SIMD_WIDTH - 1); x <= maxX; x += SIMD_WIDTH)
+        {
+            // only the lanes within the rectangle count
+            int lanes = allLanes;
+            if (x < minX)
+            {
+                lanes &= allLanes << (minX - x);
+            }
+            if (x + SIMD_WIDTH - 1 > maxX)
+            {
+                lanes &= allLanes >> (x + SIMD_WIDTH - 1 - maxX);
+            }
+            int hidden = SimdMoveMask(SimdLess(nearestLanes, SimdLoad(row + x)));
+            if ((hidden & lanes) != lanes)
+            {
+                return false;
+            }
+        }
+    }
+#else
+    for (int y = minY; y <= maxY; y++)
+    {
+        const float* row = &depth[y * occlusionBufferWidth];
+        for (int x = minX; x <= maxX; x++)
+        {
+            if (!(nearest < row[x]))
+            {
+                return false;
+            }
+        }
+    }
+#endif
+    return true;
+}
+
+/// <summary>
+/// Removes the hidden dice from a list of dice, keeping the order of the rest.
+/// </summary>
+/// <param name="spheres">Bounding sphere of every die, indexed by die</param>
+/// <param name="indices">List of dice, overwritten with the dice that are not hidden</param>
+/// <param name="count">Number of dice in the list</param>
+/// <returns>Number of dice left in the list</returns>
+size_t OcclusionBuffer::CullOccluded(const glm::vec4* spheres, uint32_t* indices, size_t count) const
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t die = indices[i];
+        if (!IsOccluded(spheres[die]))
+        {
+            indices[kept++] = die;
+        }
+    }
+    return kept;
+}
+
+/// <summary>
+/// Measures the cost of drawing the occluders (SIMD and scalar) and of testing a tray of dice seen from low above
+/// its surface, checks that both ways of drawing agree, and prints how many dice were hidden.
+/// </summary>
+/// <param name="diceCount">Number of dice in the tray</param>
+void RunOcclusionBenchmark(int diceCount)
+{
+    const int iterations = 50;
+    const size_t maxDieOccluders = 512;
+    diceCount = std::max(diceCount, 1);
+
+    // the same square grid as the tray of dice in the scene, on the same tray
+    int columns = 1;
+    while (columns * columns < diceCount)
+    {
+        columns++;
+    }
+    int rows = (diceCount + columns - 1) / columns;
+    TransformSystem transforms;
+    for (int i = 0; i < diceCount; i++)
+    {
+        glm::vec3 position = glm::vec3((i % columns - 0.5f * (columns - 1)) * 0.3f, 0.0f, -(i / columns) * 0.3f);
+        transforms.Add(position, 0.1f, glm::vec3(0.0f, 1.0f, 0.0f), 1.0f, 0.0f);
+    }
+    float halfWidth = std::max(0.5f * (columns - 1) * 0.3f + 0.3f, 1.5f);
+    TrayMesh tray = BuildTrayMesh(glm::vec2(-halfWidth, -(rows - 1) * 0.3f - 0.3f), glm::vec2(halfWidth, 0.5f), -0.1f);
+
+    // seen from just above the front rim, looking along the rows, so that every row hides much of the ones behind it
+    glm::mat4 view = glm::lookAt(glm::vec3(0.1f, 0.02f, 1.0f), glm::vec3(0.0f, 0.0f, -3.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 persp = glm::perspective(glm::radians(60.0f), 2.0f, 0.1f, 100.0f);
+    glm::mat4 viewProj = persp * view;
+    glm::vec4 depthPlane = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+
+    std::vector<uint32_t> visible(diceCount);
+    size_t visibleCount = CullDice(ExtractFrustum(viewProj), transforms, glm::mat4(1.0f), 0, transforms.Count(), visible.data());
+    float radius = 0.1f * glm::length(GetD20Corner(0));
+    std::vector<glm::vec4> spheres(diceCount);
+    for (int i = 0; i < diceCount; i++)
+    {
+        spheres[i] = glm::vec4(transforms.posX[i], transforms.posY[i], transforms.posZ[i], radius);
+    }
+
+    // the nearest dice are the occluders (all of them are the same size, so they are also the biggest on screen)
+    std::vector<uint32_t> occluders(visible.begin(), visible.begin() + visibleCount);
+    size_t occluderCount = std::min(occluders.size(), maxDieOccluders);
+    std::partial_sort(occluders.begin(), occluders.begin() + occluderCount, occluders.end(), [&](uint32_t a, uint32_t b)
+    {
+        return glm::dot(depthPlane, glm::vec4(glm::vec3(spheres[a]), 1.0f)) < glm::dot(depthPlane, glm::vec4(glm::vec3(spheres[b]), 1.0f));
+    });
+
+    OcclusionBuffer buffer;
+    auto setupStart = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        buffer.Begin(viewProj);
+        buffer.AddMesh(tray.vertices.data(), tray.indices.data(), tray.indices.size(), glm::mat4(1.0f));
+        for (size_t i = 0; i < occluderCount; i++)
+        {
+            buffer.AddDie(spheres[occluders[i]]);
+        }
+    }
+    auto scalarStart = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        buffer.RasterizeScalar(0, occlusionBufferHeight);
+    }
+    std::vector<float> scalarDepth(buffer.Depth(), buffer.Depth() + occlusionBufferWidth * occlusionBufferHeight);
+    auto simdStart = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        buffer.Rasterize(0, occlusionBufferHeight);
+    }
+    auto testStart = std::chrono::steady_clock::now();
+    std::vector<uint32_t> kept;
+    size_t keptCount = 0;
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        kept.assign(visible.begin(), visible.begin() + visibleCount);
+        keptCount = buffer.CullOccluded(spheres.data(), kept.data(), kept.size());
+    }
+    auto testEnd = std::chrono::steady_clock::now();
+
+    // (FMA and the order of the additions may move a value by a rounding error, or a pixel center on an edge in or out)
+    size_t differentPixels = 0;
+    float maxDifference = 0.0f;
+    for (int i = 0; i < occlusionBufferWidth * occlusionBufferHeight; i++)
+    {
+        float difference = std::abs(buffer.Depth()[i] - scalarDepth[i]);
+        maxDifference = std::max(maxDifference, difference);
+        differentPixels += difference > 1e-4f * std::max(scalarDepth[i], 1e-3f) ? 1 : 0;
+    }
+
+    auto toMs = [&](std::chrono::steady_clock::duration duration)
+    {
+        return std::chrono::duration<double, std::milli>(duration).count() / iterations;
+    };
+    double scalarMs = toMs(simdStart - scalarStart);
+    double simdMs = toMs(testStart - simdStart);
+
+    std::cout << "occlusion benchmark: " << diceCount << " dice, " << visibleCount << " in view, "
+        << occlusionBufferWidth << "x" << occlusionBufferHeight << " depth buffer, " << buffer.OccluderCount()
+        << " occluders (tray triangles and the " << occluderCount << " nearest dice)" << std::endl;
+    std::cout << "  hidden: " << visibleCount - keptCount << " of the dice in view ("
+        << (visibleCount > 0 ? 100.0 * (visibleCount - keptCount) / visibleCount : 0.0) << "%)" << std::endl;
+    std::cout << "  adding the occluders: " << toMs(scalarStart - setupStart) << " ms" << std::endl;
+    std::cout << "  drawing them: scalar " << scalarMs << " ms, SIMD " << simdMs << " ms (" << scalarMs / simdMs << "x, "
+        << SIMD_WIDTH << " pixels per batch)" << std::endl;
+    std::cout << "  testing the dice in view: " << toMs(testEnd - testStart) << " ms ("
+        << 1e6 * toMs(testEnd - testStart) / std::max<size_t>(visibleCount, 1) << " ns per die)" << std::endl;
+    std::cout << "  depth buffers " << (differentPixels == 0 ? "match" : "DO NOT match") << " (" << differentPixels
+        << " pixels differ, by at most " << maxDifference << ")" << std::endl;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "D20.h"
+
+// size of the depth buffer the occluders are drawn into (the width is a multiple of every SIMD_WIDTH)
+const int occlusionBufferWidth = 256;
+const int occlusionBufferHeight = 128;
+
+/// <summary>
+/// Software occlusion culling: a few large occluders (the tray, the dice nearest the camera) are drawn into a small
+/// depth buffer on the CPU, and every die's screen rectangle is then tested against it, so that dice hidden behind
+/// them never reach the instance buffer.
+/// The buffer holds 1 / view depth (0 where nothing was drawn), so nearer is larger, and it only ever errs on the side
+/// of keeping a die: the dice are drawn as a square inside the projection of their insphere, at the depth of its
+/// center, and the tested rectangle is grown by a pixel, which makes up for the triangles only covering the pixels
+/// whose centers they contain.
+/// Usage every frame: Begin(), add the occluders, Rasterize() every row (bands of rows may run in parallel),
+/// then IsOccluded() or CullOccluded() from any number of threads.
+/// </summary>
+class OcclusionBuffer
+{
+public:
+    OcclusionBuffer();
+
+    /// <summary>
+    /// Starts a frame: forgets the occluders of the last one.
+    /// </summary>
+    /// <param name="viewProj">Projection matrix multiplied by the view matrix (the view has to be rigid, as from lookAt)</param>
+    void Begin(const glm::mat4& viewProj);
+
+    /// <summary>
+    /// Adds the front-facing triangles of an indexed mesh as occluders. The parts in front of the near plane are clipped away.
+    /// </summary>
+    /// <param name="vertices">Vertices the indices point into</param>
+    /// <param name="indices">Three indices per triangle, counter-clockwise seen from the front</param>
+    /// <param name="indexCount">Number of indices</param>
+    /// <param name="model">World matrix of the mesh</param>
+    void AddMesh(const Vertex* vertices, const GLushort* indices, size_t indexCount, const glm::mat4& model);
+
+    /// <summary>
+    /// Adds a die as an occluder, as the square of pixels inside the projection of its insphere.
+    /// </summary>
+    /// <param name="boundingSphere">World space bounding sphere of the die (center in xyz, circumradius in w)</param>
+    /// <returns>Whether it covers at least one whole pixel (and was added)</returns>
+    bool AddDie(const glm::vec4& boundingSphere);
+
+    /// <summary>
+    /// Clears a band of rows and draws every occluder into it, SIMD_WIDTH pixels at a time.
+    /// Different bands can be drawn at the same time on different threads.
+    /// </summary>
+    /// <param name="rowBegin">First row</param>
+    /// <param name="rowEnd">One past the last row</param>
+    void Rasterize(int rowBegin, int rowEnd);
+
+    /// <summary>
+    /// Same as Rasterize(), but always uses plain scalar code. Used as a reference.
+    /// </summary>
+    void RasterizeScalar(int rowBegin, int rowEnd);
+
+    /// <summary>
+    /// Returns whether a sphere is hidden for sure: every pixel its screen rectangle touches holds an occluder
+    /// nearer than the nearest point of the sphere. Spheres reaching the near plane never are.
+    /// </summary>
+    /// <param name="sphere">World space sphere (center in xyz, radius in w)</param>
+    bool IsOccluded(const glm::vec4& sphere) const;
+
+    /// <summary>
+    /// Removes the hidden dice from a list of dice, keeping the order of the rest.
+    /// </summary>
+    /// <param name="spheres">Bounding sphere of every die, indexed by die</param>
+    /// <param name="indices">List of dice, overwritten with the dice that are not hidden</param>
+    /// <param name="count">Number of dice in the list</param>
+    /// <returns>Number of dice left in the list</returns>
+    size_t CullOccluded(const glm::vec4* spheres, uint32_t* indices, size_t count) const;
+
+    /// <summary>
+    /// Returns the number of occluders added since Begin() (triangles after clipping, and dice).
+    /// </summary>
+    size_t OccluderCount() const { return triangles.size() + rects.size(); }
+
+    /// <summary>
+    /// Returns the depth buffer (1 / view depth), row by row from the bottom of the screen.
+    /// </summary>
+    const float* Depth() const { return depth.data(); }
+
+private:
+    /// <summary>
+    /// Struct containing a triangle set up for drawing: three edge functions and the 1 / depth plane,
+    /// all as a * x + b * y + c of the pixel position, and the pixels it may cover
+    /// </summary>
+    struct OccluderTriangle
+    {
+        float edges[3][3];
+        float depth[3];
+        float minDepth; // 1 / depth of its farthest corner
+        int minX, minY, maxX, maxY;
+    };
+
+    /// <summary>
+    /// Struct containing a rectangle of pixels (inclusive) covered at one depth
+    /// </summary>
+    struct OccluderRect
+    {
+        int minX, minY, maxX, maxY;
+        float depth; // 1 / depth
+    };
+
+    void AddTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+
+    glm::mat4 viewProj;
+    float rowLengths[4];    // how fast each clip coordinate changes per world unit
+    float diskLengths[2];   // how fast clip x and y change per world unit across the view direction
+
+    std::vector<OccluderTriangle> triangles;
+    std::vector<OccluderRect> rects;
+    std::vector<float> depth;
+};
+
+/// <summary>
+/// Measures the cost of drawing the occluders (SIMD and scalar) and of testing a tray of dice seen from low above
+/// its surface, checks that both ways of drawing agree, and prints how many dice were hidden.
+/// </summary>
+/// <param name="diceCount">Number of dice in the tray</param>
+void RunOcclusionBenchmark(int diceCount);
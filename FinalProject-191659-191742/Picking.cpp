@@ -0,0 +1,426 @@
+#include "Picking.h"
+#include "D20.h"
+#include "JobSystem.h"
+#include "SceneGraph.h"
+#include "TransformSystem.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <thread>
+
+// most dice a leaf holds
+static const uint32_t maxLeafSize = 4;
+
+// the tree is rebuilt once refitting has grown the root box's surface area by this factor
+static const float rebuildAreaGrowth = 2.0f;
+
+/// <summary>
+/// Returns the surface area of a box (the chance a random ray hits it grows with it).
+/// </summary>
+static float GetSurfaceArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    glm::vec3 size = boundsMax - boundsMin;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+/// <summary>
+/// Returns how far along the ray it enters a box, or FLT_MAX if it misses it.
+/// </summary>
+static float IntersectBox(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& origin, const glm::vec3& inverseDirection)
+{
+    // slab test: the ray is inside the box where it is between the two planes of every axis at once
+    glm::vec3 t1 = (boundsMin - origin) * inverseDirection;
+    glm::vec3 t2 = (boundsMax - origin) * inverseDirection;
+    float tEnter = std::max(std::max(std::min(t1.x, t2.x), std::min(t1.y, t2.y)), std::max(std::min(t1.z, t2.z), 0.0f));
+    float tExit = std::min(std::min(std::max(t1.x, t2.x), std::max(t1.y, t2.y)), std::max(t1.z, t2.z));
+    return tExit >= tEnter ? tEnter : FLT_MAX;
+}
+
+/// <summary>
+/// Brings the tree up to date with the dice: rebuilds it if the number of dice changed (or it got too loose),
+/// refits it otherwise. Call after the scene's world matrices and the spin of the dice were updated.
+/// </summary>
+/// <param name="scene">Scene the dice are attached to</param>
+/// <param name="transforms">Transform system holding the dice</param>
+/// <param name="jobSystem">Job system to compute the bounding spheres on</param>
+void DicePicker::Update(const SceneGraph& scene, const TransformSystem& transforms, JobSystem& jobSystem)
+{
+    spheres.resize(transforms.Count());
+    jobSystem.ParallelFor("pick bounds", spheres.size(), 4096, [&](size_t begin, size_t end)
+    {
+        scene.GetBoundingSpheres(transforms, begin, end, spheres.data() + begin);
+    });
+
+    if (order.size() != spheres.size())
+    {
+        Build();
+        return;
+    }
+
+    Refit();
+    if (!nodes.empty() && GetSurfaceArea(nodes[0].boundsMin, nodes[0].boundsMax) > builtRootArea * rebuildAreaGrowth)
+    {
+        Build();
+    }
+}
+
+/// <summary>
+/// Builds the tree from scratch over the current spheres.
+/// </summary>
+void DicePicker::Build()
+{
+    order.resize(spheres.size());
+    std::iota(order.begin(), order.end(), 0u);
+    nodes.clear();
+    buildCount++;
+    if (order.empty())
+    {
+        return;
+    }
+
+    // a binary tree with leaves of at least maxLeafSize / 2 dice has fewer than this many nodes
+    nodes.reserve(2 * (order.size() / (maxLeafSize / 2) + 1));
+    nodes.push_back(BvhNode());
+    BuildNode(0, 0, static_cast<uint32_t>(order.size()));
+
+    Refit();
+    builtRootArea = GetSurfaceArea(nodes[0].boundsMin, nodes[0].boundsMax);
+}
+
+/// <summary>
+/// Splits the dice order[begin, end) into two halves at the median of their centers, along the axis the centers
+/// spread the most, until few enough are left for a leaf. Only sets up the structure, Refit() fills in the boxes.
+/// </summary>
+void DicePicker::BuildNode(uint32_t node, uint32_t begin, uint32_t end)
+{
+    if (end - begin <= maxLeafSize)
+    {
+        nodes[node].leftOrFirst = begin;
+        nodes[node].count = end - begin;
+        return;
+    }
+
+    glm::vec3 centerMin = glm::vec3(spheres[order[begin]]), centerMax = centerMin;
+    for (uint32_t i = begin + 1; i < end; i++)
+    {
+        glm::vec3 center = glm::vec3(spheres[order[i]]);
+        centerMin = glm::vec3(std::min(centerMin.x, center.x), std::min(centerMin.y, center.y), std::min(centerMin.z, center.z));
+        centerMax = glm::vec3(std::max(centerMax.x, center.x), std::max(centerMax.y, center.y), std::max(centerMax.z, center.z));
+    }
+    glm::vec3 extent = centerMax - centerMin;
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+    uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+        [&](uint32_t a, uint32_t b) { return spheres[a][axis] < spheres[b][axis]; });
+
+    // the children sit next to each other, after their parent
+    uint32_t left = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(BvhNode());
+    nodes.push_back(BvhNode());
+    nodes[node].leftOrFirst = left;
+    nodes[node].count = 0;
+
+    BuildNode(left, begin, middle);
+    BuildNode(left + 1, middle, end);
+}
+
+/// <summary>
+/// Recomputes every box around the current spheres, keeping the structure of the tree.
+/// </summary>
+void DicePicker::Refit()
+{
+    // children always come after their parent, so going backwards finishes both children before the parent
+    for (size_t n = nodes.size(); n-- > 0;)
+    {
+        BvhNode& node = nodes[n];
+        if (node.count > 0)
+        {
+            glm::vec3 boundsMin = glm::vec3(FLT_MAX), boundsMax = glm::vec3(-FLT_MAX);
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+            {
+                const glm::vec4& sphere = spheres[order[i]];
+                boundsMin = glm::vec3(std::min(boundsMin.x, sphere.x - sphere.w), std::min(boundsMin.y, sphere.y - sphere.w),
+                    std::min(boundsMin.z, sphere.z - sphere.w));
+                boundsMax = glm::vec3(std::max(boundsMax.x, sphere.x + sphere.w), std::max(boundsMax.y, sphere.y + sphere.w),
+                    std::max(boundsMax.z, sphere.z + sphere.w));
+            }
+            node.boundsMin = boundsMin;
+            node.boundsMax = boundsMax;
+        }
+        else
+        {
+            const BvhNode& left = nodes[node.leftOrFirst];
+            const BvhNode& right = nodes[node.leftOrFirst + 1];
+            node.boundsMin = glm::vec3(std::min(left.boundsMin.x, right.boundsMin.x), std::min(left.boundsMin.y, right.boundsMin.y),
+                std::min(left.boundsMin.z, right.boundsMin.z));
+            node.boundsMax = glm::vec3(std::max(left.boundsMax.x, right.boundsMax.x), std::max(left.boundsMax.y, right.boundsMax.y),
+                std::max(left.boundsMax.z, right.boundsMax.z));
+        }
+    }
+}
+
+/// <summary>
+/// Tests one die: first its bounding sphere, then the 20 faces of the icosahedron in the die's own space.
+/// Replaces best if a face is hit closer than it.
+/// </summary>
+/// <returns>Whether best was replaced</returns>
+bool DicePicker::TestDie(const SceneGraph& scene, const TransformSystem& transforms, uint32_t die,
+    const glm::vec3& origin, const glm::vec3& direction, PickResult& best) const
+{
+    // the sphere first: most dice the ray comes near are missed by it, or are behind the best hit so far
+    const glm::vec4& sphere = spheres[die];
+    glm::vec3 toOrigin = origin - glm::vec3(sphere);
+    float b = glm::dot(toOrigin, direction);
+    float c = glm::dot(toOrigin, toOrigin) - sphere.w * sphere.w;
+    float discriminant = b * b - c;
+    if (discriminant < 0.0f || (c > 0.0f && b > 0.0f) || -b - std::sqrt(discriminant) >= best.distance)
+    {
+        return false;
+    }
+
+    // the same model matrix the die is drawn with
+    DieInstance instance;
+    scene.ComposeVisibleDice(transforms, glm::mat4(1.0f), &die, 1, &instance);
+
+    // The model matrix is a translation, a rotation and a uniform scale s, so its inverse is the transposed rotation
+    // divided by s. Both the point and the direction are taken into the die's space the same way,
+    // so a distance along the local ray is the same distance along the world ray.
+    glm::mat3 rotationScale = glm::mat3(instance.model);
+    glm::mat3 inverseRotation = glm::transpose(rotationScale);
+    float inverseScaleSq = 1.0f / glm::dot(rotationScale[0], rotationScale[0]);
+    glm::vec3 localOrigin = inverseRotation * (origin - glm::vec3(instance.model[3])) * inverseScaleSq;
+    glm::vec3 localDirection = inverseRotation * direction * inverseScaleSq;
+
+    static glm::vec3 corners[d20CornerCount];
+    static bool cornersReady = [] { for (int i = 0; i < d20CornerCount; i++) { corners[i] = GetD20Corner(i); } return true; }();
+    (void)cornersReady;
+
+    bool replaced = false;
+    for (int face = 0; face < d20FaceCount; face++)
+    {
+        // Moller-Trumbore, only for faces turned towards the ray (the ray cannot reach a back face first)
+        const glm::vec3& a = corners[d20FaceIndices[face][0]];
+        glm::vec3 edge1 = corners[d20FaceIndices[face][1]] - a;
+        glm::vec3 edge2 = corners[d20FaceIndices[face][2]] - a;
+        glm::vec3 p = glm::cross(localDirection, edge2);
+        float determinant = glm::dot(edge1, p);
+        if (determinant <= 1e-12f)
+        {
+            continue;
+        }
+
+        float inverseDeterminant = 1.0f / determinant;
+        glm::vec3 s = localOrigin - a;
+        float u = glm::dot(s, p) * inverseDeterminant;
+        if (u < 0.0f || u > 1.0f)
+        {
+            continue;
+        }
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = glm::dot(localDirection, q) * inverseDeterminant;
+        if (v < 0.0f || u + v > 1.0f)
+        {
+            continue;
+        }
+
+        float t = glm::dot(edge2, q) * inverseDeterminant;
+        if (t > 0.0f && t < best.distance)
+        {
+            best.hit = true;
+            best.die = die;
+            best.face = face;
+            best.number = d20FaceNumbers[face];
+            best.distance = t;
+            replaced = true;
+        }
+    }
+    return replaced;
+}
+
+/// <summary>
+/// Returns the closest die face hit by a ray.
+/// </summary>
+/// <param name="scene">Scene the dice are attached to</param>
+/// <param name="transforms">Transform system holding the dice</param>
+/// <param name="origin">Start of the ray, in world space</param>
+/// <param name="direction">Direction of the ray (unit length)</param>
+PickResult DicePicker::Pick(const SceneGraph& scene, const TransformSystem& transforms, const glm::vec3& origin, const glm::vec3& direction) const
+{
+    PickResult best;
+    best.distance = FLT_MAX;
+    if (nodes.empty())
+    {
+        return best;
+    }
+
+    glm::vec3 inverseDirection = glm::vec3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+    // nodes still to visit, with the distance at which the ray enters their box;
+    // a node whose box starts behind the best hit so far can be skipped
+    struct Entry
+    {
+        uint32_t node;
+        float distance;
+    };
+    Entry stack[64];
+    int stackSize = 0;
+
+    float rootDistance = IntersectBox(nodes[0].boundsMin, nodes[0].boundsMax, origin, inverseDirection);
+    if (rootDistance != FLT_MAX)
+    {
+        stack[stackSize++] = { 0, rootDistance };
+    }
+
+    while (stackSize > 0)
+    {
+        Entry entry = stack[--stackSize];
+        if (entry.distance >= best.distance)
+        {
+            continue;
+        }
+
+        const BvhNode& node = nodes[entry.node];
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+            {
+                TestDie(scene, transforms, order[i], origin, direction, best);
+            }
+            continue;
+        }
+
+        // push the farther child first, so the nearer one is visited next and can shorten the ray early
+        uint32_t left = node.leftOrFirst, right = left + 1;
+        float leftDistance = IntersectBox(nodes[left].boundsMin, nodes[left].boundsMax, origin, inverseDirection);
+        float rightDistance = IntersectBox(nodes[right].boundsMin, nodes[right].boundsMax, origin, inverseDirection);
+        if (leftDistance > rightDistance)
+        {
+            std::swap(left, right);
+            std::swap(leftDistance, rightDistance);
+        }
+        if (rightDistance < best.distance)
+        {
+            stack[stackSize++] = { right, rightDistance };
+        }
+        if (leftDistance < best.distance)
+        {
+            stack[stackSize++] = { left, leftDistance };
+        }
+    }
+
+    return best;
+}
+
+/// <summary>
+/// Same as Pick(), but tests every die without the tree. Used as a reference.
+/// </summary>
+PickResult DicePicker::PickBruteForce(const SceneGraph& scene, const TransformSystem& transforms, const glm::vec3& origin, const glm::vec3& direction) const
+{
+    PickResult best;
+    best.distance = FLT_MAX;
+    for (uint32_t die = 0; die < spheres.size(); die++)
+    {
+        TestDie(scene, transforms, die, origin, direction, best);
+    }
+    return best;
+}
+
+/// <summary>
+/// Returns the ray from the camera through a point on the screen.
+/// </summary>
+/// <param name="view">View matrix</param>
+/// <param name="persp">Projection matrix (perspective)</param>
+/// <param name="ndc">Point on the screen in normalized device coordinates (-1 to 1, y up)</param>
+/// <param name="origin">Receives the camera position</param>
+/// <param name="direction">Receives the unit direction of the ray</param>
+void GetCameraRay(const glm::mat4& view, const glm::mat4& persp, const glm::vec2& ndc, glm::vec3& origin, glm::vec3& direction)
+{
+    // the view matrix only rotates and moves, so its inverse rotation is the transpose
+    glm::mat3 cameraToWorld = glm::transpose(glm::mat3(view));
+    origin = -(cameraToWorld * glm::vec3(view[3]));
+
+    // in view space the point lies on the plane one unit in front of the camera
+    glm::vec3 viewDirection = glm::vec3(ndc.x / persp[0][0], ndc.y / persp[1][1], -1.0f);
+    direction = glm::normalize(cameraToWorld * viewDirection);
+}
+
+/// <summary>
+/// Scatters dice in front of the camera, then measures building and refitting the tree and casting rays through
+/// random points of the screen, checks every pick against the brute force one, and prints the results.
+/// </summary>
+/// <param name="diceCount">Number of dice</param>
+void RunPickingBenchmark(int diceCount)
+{
+    const int refitIterations = 20;
+    const int pickCount = 1000;
+
+    std::mt19937 random(40);
+    std::uniform_real_distribution<float> across(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> along(-30.0f, 0.0f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    TransformSystem transforms;
+    for (int i = 0; i < diceCount; i++)
+    {
+        glm::vec3 axis = glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.0f, 0.0f, 0.01f);
+        transforms.Add(glm::vec3(across(random), across(random), along(random)), 0.1f, axis, 1.0f, 3.14159265f * unit(random));
+    }
+    transforms.UpdateSpin(1.0f, 0, transforms.Count());
+
+    SceneGraph scene;
+    int node = scene.AddNode(SceneGraph::noParent, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, -1.0f)));
+    scene.AttachDice(node, 0, transforms.Count());
+    scene.UpdateWorld();
+
+    JobSystem jobSystem(std::max(1, static_cast<int>(std::thread::hardware_concurrency())));
+    DicePicker picker;
+
+    auto buildStart = std::chrono::steady_clock::now();
+    picker.Update(scene, transforms, jobSystem);
+    auto buildEnd = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < refitIterations; iteration++)
+    {
+        picker.Update(scene, transforms, jobSystem);
+    }
+    auto refitEnd = std::chrono::steady_clock::now();
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.5f, 0.0f, 1.25f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 persp = glm::perspective(90.0f, 1.0f, 0.1f, 100.0f);
+
+    double totalUs = 0.0, worstUs = 0.0;
+    int hits = 0, mismatches = 0;
+    for (int pick = 0; pick < pickCount; pick++)
+    {
+        glm::vec3 origin, direction;
+        GetCameraRay(view, persp, glm::vec2(unit(random), unit(random)), origin, direction);
+
+        auto pickStart = std::chrono::steady_clock::now();
+        PickResult result = picker.Pick(scene, transforms, origin, direction);
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - pickStart).count();
+        totalUs += us;
+        worstUs = std::max(worstUs, us);
+        hits += result.hit ? 1 : 0;
+
+        PickResult reference = picker.PickBruteForce(scene, transforms, origin, direction);
+        if (result.hit != reference.hit || (result.hit && (result.die != reference.die || result.face != reference.face)))
+        {
+            mismatches++;
+        }
+    }
+
+    std::cout << "picking benchmark: " << diceCount << " dice, " << picker.NodeCount() << " tree nodes" << std::endl;
+    std::cout << "  build: " << std::chrono::duration<double, std::milli>(buildEnd - buildStart).count() << " ms" << std::endl;
+    std::cout << "  refit: " << std::chrono::duration<double, std::milli>(refitEnd - buildEnd).count() / refitIterations
+        << " ms (including the bounding spheres)" << std::endl;
+    std::cout << "  pick: " << totalUs / pickCount << " us average, " << worstUs << " us worst, "
+        << hits << " of " << pickCount << " rays hit a die" << std::endl;
+    std::cout << "  results " << (mismatches == 0 ? "match" : "DO NOT match") << " brute force"
+        << (mismatches == 0 ? "" : " (" + std::to_string(mismatches) + " picks differ)") << std::endl;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+class SceneGraph;
+class TransformSystem;
+
+/// <summary>
+/// Struct containing what a ray hit
+/// </summary>
+struct PickResult
+{
+    bool hit = false;
+    size_t die = 0;         // index in the transform system
+    int face = -1;          // index into d20FaceIndices
+    int number = 0;         // number printed on the face
+    float distance = 0.0f;  // along the ray, in world units
+};
+
+/// <summary>
+/// Finds the die (and the face of it) under a ray, such as the one through the mouse cursor.
+/// Keeps a bounding volume hierarchy of axis-aligned boxes over the bounding spheres of all dice: it is built once,
+/// and every frame only the boxes are refitted around the moved spheres (and it is rebuilt if refitting
+/// made it much looser). A pick walks the tree nearest box first, and only tests the dice whose sphere the ray passes
+/// through, exactly, against the 20 triangles of the icosahedron in the die's own space.
+/// </summary>
+class DicePicker
+{
+public:
+    /// <summary>
+    /// Brings the tree up to date with the dice: rebuilds it if the number of dice changed (or it got too loose),
+    /// refits it otherwise. Call after the scene's world matrices and the spin of the dice were updated.
+    /// </summary>
+    /// <param name="scene">Scene the dice are attached to</param>
+    /// <param name="transforms">Transform system holding the dice</param>
+    /// <param name="jobSystem">Job system to compute the bounding spheres on</param>
+    void Update(const SceneGraph& scene, const TransformSystem& transforms, JobSystem& jobSystem);
+
+    /// <summary>
+    /// Returns the closest die face hit by a ray.
+    /// </summary>
+    /// <param name="scene">Scene the dice are attached to</param>
+    /// <param name="transforms">Transform system holding the dice</param>
+    /// <param name="origin">Start of the ray, in world space</param>
+    /// <param name="direction">Direction of the ray (unit length)</param>
+    PickResult Pick(const SceneGraph& scene, const TransformSystem& transforms, const glm::vec3& origin, const glm::vec3& direction) const;
+
+    /// <summary>
+    /// Same as Pick(), but tests every die without the tree. Used as a reference.
+    /// </summary>
+    PickResult PickBruteForce(const SceneGraph& scene, const TransformSystem& transforms, const glm::vec3& origin, const glm::vec3& direction) const;
+
+    /// <summary>
+    /// Returns the number of nodes of the tree.
+    /// </summary>
+    size_t NodeCount() const { return nodes.size(); }
+
+    /// <summary>
+    /// Returns how many times the tree has been built from scratch.
+    /// </summary>
+    uint64_t BuildCount() const { return buildCount; }
+
+private:
+    /// <summary>
+    /// Struct containing a node of the tree: a leaf holds count dice starting at order[first],
+    /// an inner node (count 0) has its two children at left and left + 1
+    /// </summary>
+    struct BvhNode
+    {
+        glm::vec3 boundsMin;
+        uint32_t leftOrFirst;
+        glm::vec3 boundsMax;
+        uint32_t count;
+    };
+
+    void Build();
+    void BuildNode(uint32_t node, uint32_t begin, uint32_t end);
+    void Refit();
+    bool TestDie(const SceneGraph& scene, const TransformSystem& transforms, uint32_t die,
+        const glm::vec3& origin, const glm::vec3& direction, PickResult& best) const;
+
+    std::vector<glm::vec4> spheres;     // world space bounding sphere of every die (center, radius)
+    std::vector<uint32_t> order;        // dice in leaf order
+    std::vector<BvhNode> nodes;
+    float builtRootArea = 0.0f;         // surface area of the root box right after the last build
+    uint64_t buildCount = 0;
+};
+
+/// <summary>
+/// Returns the ray from the camera through a point on the screen.
+/// </summary>
+/// <param name="view">View matrix</param>
+/// <param name="persp">Projection matrix (perspective)</param>
+/// <param name="ndc">Point on the screen in normalized device coordinates (-1 to 1, y up)</param>
+/// <param name="origin">Receives the camera position</param>
+/// <param name="direction">Receives the unit direction of the ray</param>
+void GetCameraRay(const glm::mat4& view, const glm::mat4& persp, const glm::vec2& ndc, glm::vec3& origin, glm::vec3& direction);
+
+/// <summary>
+/// Scatters dice in front of the camera, then measures building and refitting the tree and casting rays through
+/// random points of the screen, checks every pick against the brute force one, and prints the results.
+/// </summary>
+/// <param name="diceCount">Number of dice</param>
+void RunPickingBenchmark(int diceCount);
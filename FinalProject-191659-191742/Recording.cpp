@@ -0,0 +1,848 @@
+#include "Recording.h"
+#include "D20.h"
+#include "FrustumCulling.h"
+#include "Trace.h"
+#include "TransformSystem.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+// File layout (little endian, as written by the machine that recorded it):
+//   RecordingHeader
+//   RecordedDie for every die
+//   every frame: uint32 payload size, then the payload:
+//     RecordedInput
+//     keyframe: the number on top of every die (one byte each)
+//     other frames: varint count of dice whose number changed, then per die a varint index gap and the new number
+//     4 zigzag varints per die (x, y, z, w of the quantized rotation): the values on a keyframe, otherwise the value
+//     minus the prediction (last value + last change)
+//   uint64 file offset of every frame (the index, written when the recording is closed)
+
+static const char recordingMagic[8] = { 'D', '2', '0', 'R', 'E', 'C', '\r', '\n' };
+static const uint32_t recordingVersion = 1;
+
+// quaternion components are stored as value * quaternionScale, rounded
+static const float quaternionScale = 32767.0f;
+
+/// <summary>
+/// Struct containing the start of a recording file
+/// </summary>
+struct RecordingHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t diceCount;
+    uint32_t keyframeInterval;
+    uint32_t inputSize;     // sizeof(RecordedInput) when recorded
+    uint64_t frameCount;    // 0 until the recording is closed
+    uint64_t indexOffset;   // where the frame index starts, 0 until the recording is closed
+};
+
+/// <summary>
+/// Struct containing everything about a die that does not change while recording
+/// </summary>
+struct RecordedDie
+{
+    float position[3];
+    float scale;
+    float spinAxis[3];
+    float spinSpeed;
+    float spinPhase;
+};
+
+// most bytes a varint of a 32-bit value takes
+static const size_t maxVarintBytes = 5;
+
+/// <summary>
+/// Writes an unsigned integer 7 bits per byte, low bits first, with the top bit set on every byte but the last.
+/// </summary>
+static void WriteVarint(uint8_t*& out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<uint8_t>(value);
+}
+
+/// <summary>
+/// Reads an integer written by WriteVarint(), without reading past end.
+/// </summary>
+static bool ReadVarint(const uint8_t*& p, const uint8_t* end, uint32_t& value)
+{
+    // nearly every value in a recording fits in one byte
+    if (p < end && *p < 0x80)
+    {
+        value = *p++;
+        return true;
+    }
+
+    value = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7)
+    {
+        uint8_t byte = *p++;
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+/// Maps signed integers to unsigned ones so that small values of either sign stay small (0, -1, 1, -2 -> 0, 1, 2, 3).
+/// </summary>
+static uint32_t ZigZag(int32_t value)
+{
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+/// <summary>
+/// Undoes ZigZag().
+/// </summary>
+static int32_t UnZigZag(uint32_t value)
+{
+    return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+/// <summary>
+/// Returns a quaternion component stored in 16 bits.
+/// </summary>
+static int16_t QuantizeComponent(float value)
+{
+    return static_cast<int16_t>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * quaternionScale));
+}
+
+/// <summary>
+/// Closes the file if it is still open.
+/// </summary>
+RecordingWriter::~RecordingWriter()
+{
+    Close();
+}
+
+/// <summary>
+/// Creates the file, writes the header and the dice, and starts the writer thread.
+/// </summary>
+/// <param name="path">Path to the recording file</param>
+/// <param name="transforms">Transform system holding the dice (only their count may not change while recording)</param>
+/// <param name="keyframeInterval">Every how many frames the rotations are stored in full</param>
+/// <returns>Whether the file could be created</returns>
+bool RecordingWriter::Open(const std::string& path, const TransformSystem& transforms, int keyframeInterval)
+{
+    Close();
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "Failed to create recording " << path << "!" << std::endl;
+        return false;
+    }
+
+    diceCount = transforms.Count();
+    this->keyframeInterval = std::max(keyframeInterval, 1);
+
+    RecordingHeader header = {};
+    std::memcpy(header.magic, recordingMagic, sizeof(header.magic));
+    header.version = recordingVersion;
+    header.diceCount = static_cast<uint32_t>(diceCount);
+    header.keyframeInterval = static_cast<uint32_t>(this->keyframeInterval);
+    header.inputSize = sizeof(RecordedInput);
+
+    std::vector<RecordedDie> dice(diceCount);
+    for (size_t i = 0; i < diceCount; i++)
+    {
+        dice[i] = { { transforms.posX[i], transforms.posY[i], transforms.posZ[i] }, transforms.scale[i],
+            { transforms.spinX[i], transforms.spinY[i], transforms.spinZ[i] }, transforms.spinSpeed[i], transforms.spinPhase[i] };
+    }
+    std::fwrite(&header, sizeof(header), 1, file);
+    std::fwrite(dice.data(), sizeof(RecordedDie), dice.size(), file);
+    bytesWritten = sizeof(header) + dice.size() * sizeof(RecordedDie);
+
+    // everything the frames need is allocated here, so recording does not allocate per frame
+    // (apart from the frame index, which grows by 8 bytes per frame)
+    for (int i = 0; i < snapshotCount; i++)
+    {
+        snapshots[i].rotX.resize(diceCount);
+        snapshots[i].rotY.resize(diceCount);
+        snapshots[i].rotZ.resize(diceCount);
+        snapshots[i].rotW.resize(diceCount);
+        freeSnapshots[i] = &snapshots[i];
+    }
+    freeCount = snapshotCount;
+    queueHead = queuedCount = 0;
+    previous.assign(4 * diceCount, 0);
+    previousDelta.assign(4 * diceCount, 0);
+    previousTopFaces.assign(diceCount, 0);
+    encoded.resize(4 + sizeof(RecordedInput) + maxVarintBytes + diceCount * (maxVarintBytes + 1) + 4 * diceCount * maxVarintBytes);
+    outcomeChanges.resize(diceCount * (maxVarintBytes + 1));
+    frameOffsets.clear();
+    framesQueued = framesWritten = stalls = 0;
+    closing = false;
+
+    writer = std::thread(&RecordingWriter::WriterLoop, this);
+    return true;
+}
+
+/// <summary>
+/// Hands a frame to the writer thread. Blocks only if the writer has fallen behind by more than a few frames.
+/// </summary>
+/// <param name="input">Input state of the frame</param>
+/// <param name="transforms">Transform system holding the rotations the frame was drawn with</param>
+void RecordingWriter::RecordFrame(const RecordedInput& input, const TransformSystem& transforms)
+{
+    if (file == nullptr)
+    {
+        return;
+    }
+
+    Snapshot* snapshot;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (freeCount == 0)
+        {
+            stalls++;
+            snapshotFreed.wait(lock, [this] { return freeCount > 0; });
+        }
+        snapshot = freeSnapshots[--freeCount];
+    }
+
+    // a plain copy, the encoding happens on the writer thread
+    snapshot->input = input;
+    std::copy(transforms.rotX.begin(), transforms.rotX.begin() + diceCount, snapshot->rotX.begin());
+    std::copy(transforms.rotY.begin(), transforms.rotY.begin() + diceCount, snapshot->rotY.begin());
+    std::copy(transforms.rotZ.begin(), transforms.rotZ.begin() + diceCount, snapshot->rotZ.begin());
+    std::copy(transforms.rotW.begin(), transforms.rotW.begin() + diceCount, snapshot->rotW.begin());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queuedSnapshots[(queueHead + queuedCount) % snapshotCount] = snapshot;
+        queuedCount++;
+        framesQueued++;
+    }
+    snapshotQueued.notify_one();
+}
+
+/// <summary>
+/// Returns the number of bytes written so far (as of the last frame the writer thread finished).
+/// </summary>
+uint64_t RecordingWriter::BytesWritten() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytesWritten;
+}
+
+/// <summary>
+/// Runs on the writer thread: encodes and writes the queued frames in order until Close() is called and none are left.
+/// </summary>
+void RecordingWriter::WriterLoop()
+{
+    SetTraceThreadName("recording writer");
+    for (;;)
+    {
+        Snapshot* snapshot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            snapshotQueued.wait(lock, [this] { return queuedCount > 0 || closing; });
+            if (queuedCount == 0)
+            {
+                return;
+            }
+            snapshot = queuedSnapshots[queueHead];
+            queueHead = (queueHead + 1) % snapshotCount;
+            queuedCount--;
+        }
+
+        TraceScope scope("encode + write frame");
+        size_t frameBytes = EncodeFrame(*snapshot, framesWritten % keyframeInterval == 0);
+        std::fwrite(encoded.data(), 1, frameBytes, file);
+        frameOffsets.push_back(bytesWritten);
+        scope.End();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            bytesWritten += frameBytes;
+            framesWritten++;
+            freeSnapshots[freeCount++] = snapshot;
+        }
+        snapshotFreed.notify_one();
+    }
+}
+
+/// <summary>
+/// Encodes a frame into encoded, against the frames before it unless it is a keyframe.
+/// </summary>
+/// <returns>Size of the encoded frame in bytes</returns>
+size_t RecordingWriter::EncodeFrame(const Snapshot& snapshot, bool keyframe)
+{
+    // the payload size goes in front, filled in at the end
+    uint8_t* out = encoded.data() + 4;
+    std::memcpy(out, &snapshot.input, sizeof(RecordedInput));
+    out += sizeof(RecordedInput);
+
+    // roll outcomes: all of them on a keyframe, otherwise only the dice that show a new number
+    uint8_t* changes = outcomeChanges.data();
+    uint32_t changeCount = 0;
+    size_t lastChanged = 0;
+    for (size_t i = 0; i < diceCount; i++)
+    {
+        int face = GetD20TopFace(GetD20Up(snapshot.rotX[i], snapshot.rotY[i], snapshot.rotZ[i], snapshot.rotW[i]), previousTopFaces[i]);
+        uint8_t number = static_cast<uint8_t>(d20FaceNumbers[face]);
+        if (keyframe)
+        {
+            *out++ = number;
+        }
+        else if (face != previousTopFaces[i])
+        {
+            WriteVarint(changes, static_cast<uint32_t>(i - lastChanged));
+            *changes++ = number;
+            lastChanged = i;
+            changeCount++;
+        }
+        previousTopFaces[i] = static_cast<uint8_t>(face);
+    }
+    if (!keyframe)
+    {
+        WriteVarint(out, changeCount);
+        size_t changeBytes = changes - outcomeChanges.data();
+        std::memcpy(out, outcomeChanges.data(), changeBytes);
+        out += changeBytes;
+    }
+
+    // Rotations: a die spinning at a few radians per second moves each component by a few hundred steps per frame,
+    // but by about the same amount every frame, so predicting it moves on by what it moved the frame before leaves
+    // a remainder of a few steps, which takes a single byte. The quaternions are stored as they are, not flipped to one
+    // hemisphere, so that a steady spin never jumps. A keyframe forgets the last change, so the frame after it
+    // predicts no movement.
+    for (size_t i = 0; i < diceCount; i++)
+    {
+        int16_t q[4] = { QuantizeComponent(snapshot.rotX[i]), QuantizeComponent(snapshot.rotY[i]),
+            QuantizeComponent(snapshot.rotZ[i]), QuantizeComponent(snapshot.rotW[i]) };
+        int16_t* last = &previous[4 * i];
+        int32_t* lastDelta = &previousDelta[4 * i];
+        for (int k = 0; k < 4; k++)
+        {
+            if (keyframe)
+            {
+                WriteVarint(out, ZigZag(q[k]));
+                lastDelta[k] = 0;
+            }
+            else
+            {
+                WriteVarint(out, ZigZag(q[k] - (last[k] + lastDelta[k])));
+                lastDelta[k] = q[k] - last[k];
+            }
+            last[k] = q[k];
+        }
+    }
+
+    size_t frameBytes = out - encoded.data();
+    uint32_t payloadSize = static_cast<uint32_t>(frameBytes - 4);
+    std::memcpy(encoded.data(), &payloadSize, 4);
+    return frameBytes;
+}
+
+/// <summary>
+/// Writes the frames still queued, then the frame index, and closes the file.
+/// </summary>
+void RecordingWriter::Close()
+{
+    if (file == nullptr)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    snapshotQueued.notify_all();
+    writer.join();
+
+    // the index goes at the end, and the header is patched to point at it
+    uint64_t indexOffset = bytesWritten;
+    uint64_t frameCount = frameOffsets.size();
+    std::fwrite(frameOffsets.data(), sizeof(uint64_t), frameOffsets.size(), file);
+    std::fseek(file, offsetof(RecordingHeader, frameCount), SEEK_SET);
+    std::fwrite(&frameCount, sizeof(frameCount), 1, file);
+    std::fwrite(&indexOffset, sizeof(indexOffset), 1, file);
+
+    if (std::ferror(file))
+    {
+        std::cerr << "Failed to write the recording!" << std::endl;
+    }
+    std::fclose(file);
+    file = nullptr;
+}
+
+/// <summary>
+/// Checks that every frame of an index starts after the end of the frame before it, and that its size and payload
+/// lie entirely before the end of the frames, so that decoding a frame never reads past the mapping.
+/// </summary>
+/// <param name="data">The mapped file</param>
+/// <param name="framesOffset">Where the first frame starts</param>
+/// <param name="framesEnd">Where the frames end (the start of the index)</param>
+/// <param name="frameOffsets">Where every frame starts, from the index</param>
+/// <returns>Whether every entry is valid</returns>
+static bool ValidateFrameIndex(const uint8_t* data, size_t framesOffset, size_t framesEnd, const std::vector<uint64_t>& frameOffsets)
+{
+    uint64_t previousEnd = framesOffset;
+    for (uint64_t offset : frameOffsets)
+    {
+        if (offset < previousEnd || offset > framesEnd || framesEnd - offset < 4)
+        {
+            return false;
+        }
+        uint32_t payloadSize;
+        std::memcpy(&payloadSize, data + offset, 4);
+        if (framesEnd - offset - 4 < payloadSize)
+        {
+            return false;
+        }
+        previousEnd = offset + 4 + payloadSize;
+    }
+    return true;
+}
+
+/// <summary>
+/// Unmaps the file if it is still mapped.
+/// </summary>
+RecordingReader::~RecordingReader()
+{
+    Close();
+}
+
+/// <summary>
+/// Maps a recording into memory and reads its index. A recording that was not closed (e.g. the program crashed)
+/// has no index, and one whose index is damaged cannot trust it, so their frames are found by walking through them once.
+/// </summary>
+/// <param name="path">Path to the recording file</param>
+/// <returns>Whether the file is a readable recording</returns>
+bool RecordingReader::Open(const std::string& path)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE fileHandleWin = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER fileSize;
+    if (fileHandleWin == INVALID_HANDLE_VALUE || !GetFileSizeEx(fileHandleWin, &fileSize) || fileSize.QuadPart == 0)
+    {
+        if (fileHandleWin != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(fileHandleWin);
+        }
+        std::cerr << "Failed to open recording " << path << "!" << std::endl;
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(fileHandleWin, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (view == nullptr)
+    {
+        if (mapping != nullptr)
+        {
+            CloseHandle(mapping);
+        }
+        CloseHandle(fileHandleWin);
+        std::cerr << "Failed to map recording " << path << "!" << std::endl;
+        return false;
+    }
+    fileHandle = fileHandleWin;
+    mappingHandle = mapping;
+    data = static_cast<const uint8_t*>(view);
+    size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0 || status.st_size == 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        std::cerr << "Failed to open recording " << path << "!" << std::endl;
+        return false;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+    {
+        std::cerr << "Failed to map recording " << path << "!" << std::endl;
+        return false;
+    }
+    data = static_cast<const uint8_t*>(view);
+    size = static_cast<size_t>(status.st_size);
+#endif
+
+    RecordingHeader header;
+    if (size < sizeof(header))
+    {
+        std::cerr << path << " is not a recording!" << std::endl;
+        Close();
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, recordingMagic, sizeof(header.magic)) != 0 || header.version != recordingVersion
+        || header.inputSize != sizeof(RecordedInput) || header.keyframeInterval == 0
+        || size < sizeof(header) + static_cast<uint64_t>(header.diceCount) * sizeof(RecordedDie))
+    {
+        std::cerr << path << " is not a recording of this version!" << std::endl;
+        Close();
+        return false;
+    }
+
+    diceCount = header.diceCount;
+    keyframeInterval = static_cast<int>(header.keyframeInterval);
+    diceOffset = sizeof(header);
+    size_t framesOffset = diceOffset + diceCount * sizeof(RecordedDie);
+
+    // the index has to fit between the frames and the end of the file, and every entry has to point at a whole frame
+    frameOffsets.clear();
+    bool indexFits = header.indexOffset != 0 && header.indexOffset >= framesOffset && header.indexOffset <= size
+        && (size - header.indexOffset) / sizeof(uint64_t) >= header.frameCount;
+    bool indexValid = false;
+    if (indexFits)
+    {
+        frameOffsets.resize(header.frameCount);
+        std::memcpy(frameOffsets.data(), data + header.indexOffset, frameOffsets.size() * sizeof(uint64_t));
+        indexValid = ValidateFrameIndex(data, framesOffset, header.indexOffset, frameOffsets);
+    }
+    if (!indexValid)
+    {
+        // Every frame starts with its size, so they can be walked (a frame cut off at the end is dropped).
+        // The frames of a closed recording end where its index starts.
+        size_t framesEnd = indexFits ? header.indexOffset : size;
+        frameOffsets.clear();
+        size_t offset = framesOffset;
+        uint32_t payloadSize;
+        while (offset + 4 <= framesEnd && (std::memcpy(&payloadSize, data + offset, 4), framesEnd - offset - 4 >= payloadSize))
+        {
+            frameOffsets.push_back(offset);
+            offset += 4 + static_cast<size_t>(payloadSize);
+        }
+        std::cout << "recording: " << path << (header.indexOffset == 0 ? " was not closed" : " has a damaged index")
+            << ", found " << frameOffsets.size() << " frames" << std::endl;
+    }
+
+    current.assign(4 * diceCount, 0);
+    currentDelta.assign(4 * diceCount, 0);
+    outcomes.assign(diceCount, 0);
+    decodedFrame = UINT64_MAX;
+    return true;
+}
+
+/// <summary>
+/// Unmaps the file.
+/// </summary>
+void RecordingReader::Close()
+{
+    if (data == nullptr)
+    {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(static_cast<HANDLE>(mappingHandle));
+    CloseHandle(static_cast<HANDLE>(fileHandle));
+    mappingHandle = fileHandle = nullptr;
+#else
+    munmap(const_cast<uint8_t*>(data), size);
+#endif
+    data = nullptr;
+    size = 0;
+    frameOffsets.clear();
+}
+
+/// <summary>
+/// Puts back the position, scale and spin of every recorded die.
+/// </summary>
+/// <param name="transforms">Transform system with the same number of dice as the recording</param>
+/// <returns>Whether the number of dice matched</returns>
+bool RecordingReader::RestoreDice(TransformSystem& transforms) const
+{
+    if (transforms.Count() != diceCount)
+    {
+        std::cerr << "The recording has " << diceCount << " dice, the scene " << transforms.Count() << "!" << std::endl;
+        return false;
+    }
+
+    for (size_t i = 0; i < diceCount; i++)
+    {
+        RecordedDie die;
+        std::memcpy(&die, data + diceOffset + i * sizeof(RecordedDie), sizeof(die));
+        transforms.posX[i] = die.position[0];
+        transforms.posY[i] = die.position[1];
+        transforms.posZ[i] = die.position[2];
+        transforms.scale[i] = die.scale;
+        transforms.spinX[i] = die.spinAxis[0];
+        transforms.spinY[i] = die.spinAxis[1];
+        transforms.spinZ[i] = die.spinAxis[2];
+        transforms.spinSpeed[i] = die.spinSpeed;
+        transforms.spinPhase[i] = die.spinPhase;
+    }
+    return true;
+}
+
+/// <summary>
+/// Decodes one frame into current, outcomes and currentInput. The frame before it must be the last decoded one,
+/// unless it is a keyframe.
+/// </summary>
+bool RecordingReader::DecodeFrame(uint64_t frame)
+{
+    const uint8_t* p = data + frameOffsets[frame];
+    uint32_t payloadSize;
+    std::memcpy(&payloadSize, p, 4);
+    p += 4;
+    const uint8_t* end = p + payloadSize;
+    if (payloadSize < sizeof(RecordedInput))
+    {
+        return false;
+    }
+    std::memcpy(&currentInput, p, sizeof(RecordedInput));
+    p += sizeof(RecordedInput);
+
+    bool keyframe = frame % keyframeInterval == 0;
+    if (keyframe)
+    {
+        if (static_cast<size_t>(end - p) < diceCount)
+        {
+            return false;
+        }
+        std::memcpy(outcomes.data(), p, diceCount);
+        p += diceCount;
+    }
+    else
+    {
+        uint32_t changeCount;
+        if (!ReadVarint(p, end, changeCount))
+        {
+            return false;
+        }
+        size_t die = 0;
+        for (uint32_t change = 0; change < changeCount; change++)
+        {
+            uint32_t gap;
+            if (!ReadVarint(p, end, gap) || p >= end || die + gap >= diceCount)
+            {
+                return false;
+            }
+            die += gap;
+            outcomes[die] = *p++;
+        }
+    }
+
+    int16_t* q = current.data();
+    int32_t* delta = currentDelta.data();
+    const size_t componentCount = current.size();
+    uint32_t value;
+    if (keyframe)
+    {
+        for (size_t i = 0; i < componentCount; i++)
+        {
+            if (!ReadVarint(p, end, value))
+            {
+                return false;
+            }
+            q[i] = static_cast<int16_t>(UnZigZag(value));
+            delta[i] = 0;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < componentCount; i++)
+        {
+            if (!ReadVarint(p, end, value))
+            {
+                return false;
+            }
+            int16_t next = static_cast<int16_t>(q[i] + delta[i] + UnZigZag(value));
+            delta[i] = next - q[i];
+            q[i] = next;
+        }
+    }
+
+    decodedFrame = frame;
+    return true;
+}
+
+/// <summary>
+/// Decodes a frame: sets the rotation of every die and returns the input state it was drawn with.
+/// </summary>
+/// <param name="frame">Frame to decode (any frame, but the one after the last decoded one is the cheapest)</param>
+/// <param name="transforms">Transform system to write the rotations to</param>
+/// <param name="input">Receives the input state</param>
+/// <returns>Whether the frame exists and could be decoded</returns>
+bool RecordingReader::ReadFrame(uint64_t frame, TransformSystem& transforms, RecordedInput& input)
+{
+    if (frame >= frameOffsets.size() || transforms.Count() != diceCount)
+    {
+        return false;
+    }
+
+    // carry on from the last decoded frame if it lies between the keyframe and the frame, otherwise start at the keyframe
+    uint64_t keyframe = frame - frame % keyframeInterval;
+    uint64_t start = decodedFrame != UINT64_MAX && decodedFrame >= keyframe && decodedFrame <= frame ? decodedFrame + 1 : keyframe;
+    for (uint64_t f = start; f <= frame; f++)
+    {
+        if (!DecodeFrame(f))
+        {
+            std::cerr << "The recording is damaged at frame " << f << "!" << std::endl;
+            decodedFrame = UINT64_MAX;
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < diceCount; i++)
+    {
+        const int16_t* q = &current[4 * i];
+        glm::vec4 rotation = glm::vec4(q[0], q[1], q[2], q[3]);
+        float length = glm::length(rotation);
+        rotation = length > 0.0f ? rotation / length : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        transforms.rotX[i] = rotation.x;
+        transforms.rotY[i] = rotation.y;
+        transforms.rotZ[i] = rotation.z;
+        transforms.rotW[i] = rotation.w;
+    }
+    input = currentInput;
+    return true;
+}
+
+/// <summary>
+/// Records a session of spinning dice into a temporary file the way the frame loop does (a camera culls some of the
+/// dice, only the visible ones are spun for drawing, and every die is brought up to date before the frame is recorded),
+/// then measures replaying it frame by frame and seeking to random frames, checks the decoded rotations of every die
+/// (the culled ones too) against the rotations spun from scratch, and prints the results.
+/// </summary>
+/// <param name="diceCount">Number of dice</param>
+void RunRecordingBenchmark(int diceCount)
+{
+    const int frameCount = 600;
+    const int keyframeInterval = 30;
+    const int seekCount = 100;
+    const char* path = "bench_recording.d20rec";
+
+    std::mt19937 random(41);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    TransformSystem transforms;
+    for (int i = 0; i < diceCount; i++)
+    {
+        glm::vec3 axis = glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.0f, 0.0f, 0.01f);
+        transforms.Add(glm::vec3(unit(random), unit(random), unit(random)) * 10.0f, 0.1f, axis, 2.0f + unit(random), 3.14159265f * unit(random));
+    }
+
+    // a camera that only sees part of the field, as the window would (the dice do not move, so neither does what it sees)
+    glm::mat4 viewProj = glm::perspective(glm::radians(30.0f), 1.0f, 0.1f, 100.0f)
+        * glm::lookAt(glm::vec3(0.0f, 0.0f, 25.0f), glm::vec3(5.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    std::vector<uint32_t> visible(transforms.Count());
+    size_t visibleCount = CullDice(ExtractFrustum(viewProj), transforms, glm::mat4(1.0f), 0, transforms.Count(), visible.data());
+    std::vector<uint8_t> culled(transforms.Count(), 1);
+    for (size_t v = 0; v < visibleCount; v++)
+    {
+        culled[visible[v]] = 0;
+    }
+
+    // record 10 seconds at 60 frames per second, as fast as the writer thread can take them
+    RecordingWriter writer;
+    if (!writer.Open(path, transforms, keyframeInterval))
+    {
+        return;
+    }
+    RecordedInput input = {};
+    auto recordStart = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frameCount; frame++)
+    {
+        input.time = frame / 60.0f;
+        transforms.UpdateSpinIndexed(input.time, visible.data(), visibleCount);
+        transforms.UpdateSpin(input.time, 0, transforms.Count());
+        writer.RecordFrame(input, transforms);
+    }
+    writer.Close();
+    double recordSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - recordStart).count();
+
+    RecordingReader reader;
+    if (!reader.Open(path))
+    {
+        return;
+    }
+    uint64_t fileBytes = writer.BytesWritten() + frameCount * sizeof(uint64_t);
+
+    // play every frame in order
+    TransformSystem replayed = transforms;
+    auto replayStart = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frameCount; frame++)
+    {
+        reader.ReadFrame(frame, replayed, input);
+    }
+    double replayMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - replayStart).count() / frameCount;
+
+    // jump to random frames, and compare each with the rotations spun again from scratch
+    std::uniform_int_distribution<int> anyFrame(0, frameCount - 1);
+    double seekTotalMs = 0.0, seekWorstMs = 0.0;
+    float maxError = 0.0f, culledMaxError = 0.0f;
+    int outcomeMismatches = 0;
+    for (int seek = 0; seek < seekCount; seek++)
+    {
+        int frame = anyFrame(random);
+        auto seekStart = std::chrono::steady_clock::now();
+        bool read = reader.ReadFrame(frame, replayed, input);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - seekStart).count();
+        seekTotalMs += ms;
+        seekWorstMs = std::max(seekWorstMs, ms);
+
+        transforms.UpdateSpin(frame / 60.0f, 0, transforms.Count());
+        for (int i = 0; i < diceCount; i++)
+        {
+            float error = std::max({ std::fabs(replayed.rotX[i] - transforms.rotX[i]), std::fabs(replayed.rotY[i] - transforms.rotY[i]),
+                std::fabs(replayed.rotZ[i] - transforms.rotZ[i]), std::fabs(replayed.rotW[i] - transforms.rotW[i]) });
+            maxError = std::max(maxError, error);
+            culledMaxError = culled[i] ? std::max(culledMaxError, error) : culledMaxError;
+            // Checked against all 20 faces, not just the neighbors the writer looks at. A die balanced on an edge
+            // may come out either way depending on rounding, so the recorded face only has to point up as much as the best.
+            glm::vec3 up = GetD20Up(transforms.rotX[i], transforms.rotY[i], transforms.rotZ[i], transforms.rotW[i]);
+            float topDot = -2.0f, recordedDot = -2.0f;
+            for (int face = 0; face < d20FaceCount; face++)
+            {
+                float d = glm::dot(glm::normalize(GetD20FaceNormal(face)), up);
+                topDot = std::max(topDot, d);
+                recordedDot = d20FaceNumbers[face] == reader.Outcome(i) ? d : recordedDot;
+            }
+            if (!read || recordedDot < topDot - 1e-5f)
+            {
+                outcomeMismatches++;
+            }
+        }
+    }
+    reader.Close();
+    std::remove(path);
+
+    double rawBytesPerFrame = diceCount * 4.0 * sizeof(float);
+    std::cout << "recording benchmark: " << diceCount << " dice (" << transforms.Count() - visibleCount << " culled by the camera), "
+        << frameCount << " frames, keyframe every " << keyframeInterval << std::endl;
+    std::cout << "  record: the writer thread keeps up with " << frameCount / recordSeconds << " frames per second ("
+        << writer.StallCount() << " frames waited for it)" << std::endl;
+    std::cout << "  size: " << fileBytes / 1024.0 / frameCount << " KB per frame (" << 100.0 * fileBytes / frameCount / rawBytesPerFrame
+        << "% of float quaternions), " << fileBytes / (1024.0 * 1024.0) << " MB in all" << std::endl;
+    std::cout << "  replay: " << replayMs << " ms per frame in order" << std::endl;
+    std::cout << "  seek: " << seekTotalMs / seekCount << " ms average, " << seekWorstMs << " ms worst to a random frame" << std::endl;
+    std::cout << "  rotations within " << maxError << " of the recorded ones (" << culledMaxError << " for the culled dice), outcomes "
+        << (outcomeMismatches == 0 ? "match" : "DO NOT match") << std::endl;
+}
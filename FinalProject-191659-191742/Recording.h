@@ -0,0 +1,215 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TransformSystem;
+
+/// <summary>
+/// Struct containing the state the user controls that changes what a frame looks like, recorded with every frame
+/// (stored in the file as it is, so only add fields at the end and bump recordingVersion)
+/// </summary>
+struct RecordedInput
+{
+    float time;             // animation time the dice were spun to
+    float lightAngle;       // angle of the orbiting light
+    float specular[3];
+    float diffuse[3];
+    float background[4];
+    uint8_t skin;           // 0 = opaque, 1 = translucent
+    uint8_t spotShadows;
+    uint8_t impostors;
+    uint8_t paused;
+};
+
+/// <summary>
+/// Records a session into a compact binary file: the dice (once), then per frame the input state, the rotation of
+/// every die and the numbers that came up. Rotations are quantized to 16 bits per quaternion component and delta encoded:
+/// each frame stores, as small varints, how far every component is off from where it would be had it kept moving like it
+/// did the frame before. Every keyframeInterval-th frame (a keyframe) stores them in full, so that replay can start there. RecordFrame() only copies the rotations; a background thread encodes and writes them.
+/// </summary>
+class RecordingWriter
+{
+public:
+    RecordingWriter() = default;
+    RecordingWriter(const RecordingWriter&) = delete;
+    RecordingWriter& operator=(const RecordingWriter&) = delete;
+    ~RecordingWriter();
+
+    /// <summary>
+    /// Creates the file, writes the header and the dice, and starts the writer thread.
+    /// </summary>
+    /// <param name="path">Path to the recording file</param>
+    /// <param name="transforms">Transform system holding the dice (only their count may not change while recording)</param>
+    /// <param name="keyframeInterval">Every how many frames the rotations are stored in full</param>
+    /// <returns>Whether the file could be created</returns>
+    bool Open(const std::string& path, const TransformSystem& transforms, int keyframeInterval = 30);
+
+    /// <summary>
+    /// Hands a frame to the writer thread. Blocks only if the writer has fallen behind by more than a few frames.
+    /// </summary>
+    /// <param name="input">Input state of the frame</param>
+    /// <param name="transforms">Transform system holding the rotations the frame was drawn with</param>
+    void RecordFrame(const RecordedInput& input, const TransformSystem& transforms);
+
+    /// <summary>
+    /// Writes the frames still queued, then the frame index, and closes the file.
+    /// </summary>
+    void Close();
+
+    /// <summary>
+    /// Returns whether a file is open.
+    /// </summary>
+    bool IsOpen() const { return file != nullptr; }
+
+    /// <summary>
+    /// Returns the number of frames handed to RecordFrame().
+    /// </summary>
+    uint64_t FrameCount() const { return framesQueued; }
+
+    /// <summary>
+    /// Returns the number of bytes written so far (as of the last frame the writer thread finished).
+    /// </summary>
+    uint64_t BytesWritten() const;
+
+    /// <summary>
+    /// Returns how many times RecordFrame() had to wait for the writer thread.
+    /// </summary>
+    uint64_t StallCount() const { return stalls; }
+
+private:
+    /// <summary>
+    /// Struct containing a frame waiting to be encoded
+    /// </summary>
+    struct Snapshot
+    {
+        RecordedInput input;
+        std::vector<float> rotX, rotY, rotZ, rotW;
+    };
+
+    void WriterLoop();
+    size_t EncodeFrame(const Snapshot& snapshot, bool keyframe);
+
+    std::FILE* file = nullptr;
+    size_t diceCount = 0;
+    int keyframeInterval = 30;
+
+    // snapshots cycle from free to queued (RecordFrame) and back (writer thread), without allocating; guarded by mutex
+    static const int snapshotCount = 3;
+    Snapshot snapshots[snapshotCount];
+    Snapshot* freeSnapshots[snapshotCount];
+    int freeCount = 0;
+    Snapshot* queuedSnapshots[snapshotCount];   // ring, oldest at queueHead
+    int queueHead = 0, queuedCount = 0;
+    mutable std::mutex mutex;
+    std::condition_variable snapshotFreed, snapshotQueued;
+    bool closing = false;
+    std::thread writer;
+
+    uint64_t framesQueued = 0;
+    uint64_t stalls = 0;
+
+    // only touched by the writer thread (bytesWritten is also read under the mutex)
+    std::vector<int16_t> previous;          // quantized rotations of the last frame, 4 per die
+    std::vector<int32_t> previousDelta;     // how much they changed from the frame before that
+    std::vector<uint8_t> previousTopFaces;  // face on top of every die in the last frame
+    std::vector<uint8_t> encoded;           // the frame being encoded, big enough for any frame
+    std::vector<uint8_t> outcomeChanges;    // the dice whose number changed, while they are counted
+    std::vector<uint64_t> frameOffsets;     // where every frame starts in the file
+    uint64_t bytesWritten = 0;
+    uint64_t framesWritten = 0;
+};
+
+/// <summary>
+/// Plays back a recording. The file is memory-mapped, and the frame index at its end gives the offset of every frame,
+/// so seeking to any frame jumps to the keyframe at or before it and decodes at most keyframeInterval - 1 frames on from
+/// there, however long the session is. Playing frame after frame only decodes one delta per frame.
+/// </summary>
+class RecordingReader
+{
+public:
+    RecordingReader() = default;
+    RecordingReader(const RecordingReader&) = delete;
+    RecordingReader& operator=(const RecordingReader&) = delete;
+    ~RecordingReader();
+
+    /// <summary>
+    /// Maps a recording into memory and reads its index. A recording that was not closed (e.g. the program crashed)
+    /// has no index, so its frames are found by walking through them once.
+    /// </summary>
+    /// <param name="path">Path to the recording file</param>
+    /// <returns>Whether the file is a readable recording</returns>
+    bool Open(const std::string& path);
+
+    /// <summary>
+    /// Unmaps the file.
+    /// </summary>
+    void Close();
+
+    /// <summary>
+    /// Returns the number of dice in the recording.
+    /// </summary>
+    size_t DiceCount() const { return diceCount; }
+
+    /// <summary>
+    /// Returns the number of frames in the recording.
+    /// </summary>
+    uint64_t FrameCount() const { return frameOffsets.size(); }
+
+    /// <summary>
+    /// Puts back the position, scale and spin of every recorded die.
+    /// </summary>
+    /// <param name="transforms">Transform system with the same number of dice as the recording</param>
+    /// <returns>Whether the number of dice matched</returns>
+    bool RestoreDice(TransformSystem& transforms) const;
+
+    /// <summary>
+    /// Decodes a frame: sets the rotation of every die and returns the input state it was drawn with.
+    /// </summary>
+    /// <param name="frame">Frame to decode (any frame, but the one after the last decoded one is the cheapest)</param>
+    /// <param name="transforms">Transform system to write the rotations to</param>
+    /// <param name="input">Receives the input state</param>
+    /// <returns>Whether the frame exists and could be decoded</returns>
+    bool ReadFrame(uint64_t frame, TransformSystem& transforms, RecordedInput& input);
+
+    /// <summary>
+    /// Returns the number on top of a die in the last decoded frame.
+    /// </summary>
+    int Outcome(size_t die) const { return outcomes[die]; }
+
+private:
+    bool DecodeFrame(uint64_t frame);
+
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+
+    size_t diceCount = 0;
+    int keyframeInterval = 1;
+    size_t diceOffset = 0;
+    std::vector<uint64_t> frameOffsets;
+
+    std::vector<int16_t> current;   // quantized rotations of the last decoded frame, 4 per die
+    std::vector<int32_t> currentDelta;
+    std::vector<uint8_t> outcomes;
+    RecordedInput currentInput = {};
+    uint64_t decodedFrame = UINT64_MAX;
+};
+
+/// <summary>
+/// Records a session of spinning dice into a temporary file the way the frame loop does (a camera culls some of the
+/// dice, only the visible ones are spun for drawing, and every die is brought up to date before the frame is recorded),
+/// then measures replaying it frame by frame and seeking to random frames, checks the decoded rotations of every die
+/// (the culled ones too) against the rotations spun from scratch, and prints the results.
+/// </summary>
+/// <param name="diceCount">Number of dice</param>
+void RunRecordingBenchmark(int diceCount);
@@ -0,0 +1,739 @@
+#include "RollServer.h"
+#include "D20.h"
+#include "JobSystem.h"
+
+#ifdef __linux__
+#include <csignal>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+static_assert(sizeof(RollRequest) == 24, "RollRequest is sent as it is, it must not have padding");
+static_assert(sizeof(RollResultHeader) == 16, "RollResultHeader is sent as it is, it must not have padding");
+
+// most rolls in one result block, and per job
+static const uint32_t rollBlockSize = 4096;
+
+// most rolls rolled in one batch; bigger requests are rolled and streamed over several batches
+static const size_t maxBatchRolls = 1 << 20;
+
+// a client with more results than this waiting to be sent is not read from, and its requests are not rolled,
+// until they drain
+static const size_t maxPendingOutput = 8 << 20;
+
+// frames a tumbling die is simulated for (at 60 frames per second)
+static const int tumbleSteps = 90;
+
+static const float pi = 3.14159265f;
+
+/// <summary>
+/// Returns the next value of a splitmix64 sequence (a fast generator whose outputs for consecutive states are independent).
+/// </summary>
+static uint64_t SplitMix64(uint64_t& state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/// <summary>
+/// Returns a float from 0 (inclusive) to 1 (exclusive) made from the top 24 bits.
+/// </summary>
+static float ToUnitFloat(uint64_t bits)
+{
+    return static_cast<float>(bits >> 40) * (1.0f / 16777216.0f);
+}
+
+/// <summary>
+/// Returns a uniformly distributed random rotation (x, y, z, w), with Shoemake's method.
+/// </summary>
+static glm::vec4 GetRandomRotation(uint64_t& state)
+{
+    float u1 = ToUnitFloat(SplitMix64(state));
+    float u2 = 2.0f * pi * ToUnitFloat(SplitMix64(state));
+    float u3 = 2.0f * pi * ToUnitFloat(SplitMix64(state));
+    float a = std::sqrt(1.0f - u1), b = std::sqrt(u1);
+    return glm::vec4(a * std::sin(u2), a * std::cos(u2), b * std::sin(u3), b * std::cos(u3));
+}
+
+/// <summary>
+/// Returns a random unit vector.
+/// </summary>
+static glm::vec3 GetRandomDirection(uint64_t& state)
+{
+    float z = 2.0f * ToUnitFloat(SplitMix64(state)) - 1.0f;
+    float angle = 2.0f * pi * ToUnitFloat(SplitMix64(state));
+    float r = std::sqrt(std::max(1.0f - z * z, 0.0f));
+    return glm::vec3(r * std::cos(angle), r * std::sin(angle), z);
+}
+
+/// <summary>
+/// Returns the product a * b of two quaternions stored as (x, y, z, w): the rotation b followed by a.
+/// </summary>
+static glm::vec4 MultiplyQuaternions(const glm::vec4& a, const glm::vec4& b)
+{
+    return glm::vec4(
+        a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+        a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+        a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+        a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z);
+}
+
+/// <summary>
+/// Returns one roll. Rolls only depend on the seed and their index, so any part of a request can be rolled on any thread.
+/// </summary>
+/// <param name="seed">Seed of the request</param>
+/// <param name="index">Index of the roll in the request</param>
+/// <param name="sides">Number of sides of the die</param>
+/// <param name="mode">Random number or tumbling d20</param>
+/// <returns>Number rolled, from 1 to sides</returns>
+uint8_t RollDie(uint64_t seed, uint64_t index, int sides, RollMode mode)
+{
+    // the index-th value of the seed's sequence, without going through the ones before it
+    uint64_t state = seed + index * 0x9E3779B97F4A7C15ull;
+    uint64_t bits = SplitMix64(state);
+    if (mode == RollMode::Random)
+    {
+        // the top 32 bits scaled to [0, sides) (the bias is below one in 2^27)
+        return static_cast<uint8_t>(1 + (((bits >> 32) * static_cast<uint64_t>(sides)) >> 32));
+    }
+
+    // Tumbling: the die starts out in any orientation, spinning fast about a random axis. Every frame it turns by its
+    // speed, the table slows it down, and every quarter second a bounce knocks the axis somewhere else. Where it ends up
+    // decides the face on top, like for the dice on screen.
+    state = bits;
+    glm::vec4 rotation = GetRandomRotation(state);
+    glm::vec3 axis = GetRandomDirection(state);
+    float speed = 15.0f + 25.0f * ToUnitFloat(SplitMix64(state));
+    const float frameTime = 1.0f / 60.0f;
+    for (int step = 0; step < tumbleSteps; step++)
+    {
+        float halfAngle = 0.5f * speed * frameTime;
+        float s = std::sin(halfAngle);
+        rotation = MultiplyQuaternions(glm::vec4(axis * s, std::cos(halfAngle)), rotation);
+        speed *= 0.93f;
+        if (step % 15 == 14)
+        {
+            axis = glm::normalize(axis + 0.75f * GetRandomDirection(state) + glm::vec3(0.0f, 1e-3f, 0.0f));
+        }
+    }
+    rotation = glm::normalize(rotation);
+    return static_cast<uint8_t>(d20FaceNumbers[GetD20TopFace(GetD20Up(rotation.x, rotation.y, rotation.z, rotation.w))]);
+}
+
+/// <summary>
+/// Returns whether a request can be served.
+/// </summary>
+static bool IsValidRequest(const RollRequest& request)
+{
+    bool knownDie = request.sides == 4 || request.sides == 6 || request.sides == 8 || request.sides == 10
+        || request.sides == 12 || request.sides == 20;
+    bool knownMode = request.mode == static_cast<uint8_t>(RollMode::Random)
+        || (request.mode == static_cast<uint8_t>(RollMode::Tumble) && request.sides == 20);
+    return knownDie && knownMode && request.count > 0 && request.count <= maxRollsPerRequest;
+}
+
+#ifdef __linux__
+
+// set by SIGINT / SIGTERM, makes the event loop stop
+static volatile std::sig_atomic_t rollServerStopping = 0;
+
+/// <summary>
+/// Signal handler that asks the roll service to stop.
+/// </summary>
+static void StopRollServer(int)
+{
+    rollServerStopping = 1;
+}
+
+/// <summary>
+/// Struct containing a client connection of the roll service
+/// </summary>
+struct RollConnection
+{
+    int fd = -1;
+    std::vector<uint8_t> input;     // received bytes not yet parsed, from inputStart on
+    size_t inputStart = 0;
+    std::vector<uint8_t> output;    // results not yet sent, from outputSent on
+    size_t outputSent = 0;
+    size_t queuedRequests = 0;      // requests in the queue not rolled to the end yet
+    uint32_t interest = 0;          // epoll events currently asked for
+    bool peerClosed = false;        // the client sent everything it will, it still gets what it asked for
+};
+
+/// <summary>
+/// Struct containing a request waiting to be rolled
+/// </summary>
+struct QueuedRoll
+{
+    uint64_t connection;
+    RollRequest request;
+    uint32_t rolled;                // rolls already rolled and queued for sending
+};
+
+/// <summary>
+/// Struct containing the part of a queued request rolled in the current batch
+/// </summary>
+struct BatchRange
+{
+    size_t queued;                  // index in the queue
+    uint32_t first, count;          // rolls of the request
+    size_t resultOffset;            // where they go in the batch results
+};
+
+/// <summary>
+/// Returns the number of result bytes of a connection not sent yet.
+/// </summary>
+static size_t PendingOutput(const RollConnection& connection)
+{
+    return connection.output.size() - connection.outputSent;
+}
+
+/// <summary>
+/// Returns whether a client that closed its side has been sent everything it asked for (and can be closed).
+/// </summary>
+static bool IsFinished(const RollConnection& connection)
+{
+    return connection.peerClosed && connection.queuedRequests == 0 && PendingOutput(connection) == 0 &&
+        connection.input.size() - connection.inputStart < sizeof(RollRequest);
+}
+
+/// <summary>
+/// Asks epoll for reads unless the client closed its side or has too many results waiting, and for writes while
+/// results are waiting.
+/// </summary>
+static void UpdateInterest(int epollFd, uint64_t id, RollConnection& connection)
+{
+    size_t pending = PendingOutput(connection);
+    bool reading = !connection.peerClosed && pending < maxPendingOutput;
+    uint32_t interest = (reading ? EPOLLIN | EPOLLRDHUP : 0u) | (pending > 0 ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    if (interest != connection.interest)
+    {
+        epoll_event event = {};
+        event.events = interest;
+        event.data.u64 = id;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.interest = interest;
+    }
+}
+
+/// <summary>
+/// Sends as much of the waiting results as the socket takes without blocking.
+/// </summary>
+/// <returns>False if the connection failed</returns>
+static bool FlushConnection(RollConnection& connection)
+{
+    while (connection.outputSent < connection.output.size())
+    {
+        ssize_t sent = send(connection.fd, connection.output.data() + connection.outputSent,
+            connection.output.size() - connection.outputSent, MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            connection.outputSent += static_cast<size_t>(sent);
+        }
+        else if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // drop what went out, so a client that keeps up does not grow the buffer
+            connection.output.erase(connection.output.begin(), connection.output.begin() + connection.outputSent);
+            connection.outputSent = 0;
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    connection.output.clear();
+    connection.outputSent = 0;
+    return true;
+}
+
+/// <summary>
+/// Appends a block of results (or a refusal, with no results) to a connection's output.
+/// </summary>
+static void AppendResults(RollConnection& connection, const RollRequest& request, uint32_t first, uint32_t count,
+    uint8_t status, const uint8_t* results)
+{
+    RollResultHeader header = {};
+    header.requestId = request.requestId;
+    header.first = first;
+    header.count = count;
+    header.status = status;
+    header.last = status != rollStatusOk || first + count == request.count ? 1 : 0;
+    const uint8_t* headerBytes = reinterpret_cast<const uint8_t*>(&header);
+    connection.output.insert(connection.output.end(), headerBytes, headerBytes + sizeof(header));
+    connection.output.insert(connection.output.end(), results, results + count);
+}
+
+/// <summary>
+/// Reads what a client sent into its input. When the client closes its side, the connection is marked, not closed.
+/// </summary>
+/// <returns>False if the connection failed</returns>
+static bool ReceiveRequests(RollConnection& connection)
+{
+    uint8_t buffer[64 * 1024];
+    for (;;)
+    {
+        ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (received > 0)
+        {
+            connection.input.insert(connection.input.end(), buffer, buffer + received);
+            continue;
+        }
+        if (received == 0)
+        {
+            connection.peerClosed = true;
+            return true;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+}
+
+/// <summary>
+/// Queues the complete requests in a client's input (refusing the invalid ones right away). Stops while the client
+/// has too many results waiting; the rest stays in the input until they drain.
+/// </summary>
+static void ParseRequests(RollConnection& connection, uint64_t id, std::deque<QueuedRoll>& queue, uint64_t& requestCount)
+{
+    while (connection.input.size() - connection.inputStart >= sizeof(RollRequest) && PendingOutput(connection) < maxPendingOutput)
+    {
+        RollRequest request;
+        std::memcpy(&request, connection.input.data() + connection.inputStart, sizeof(request));
+        connection.inputStart += sizeof(request);
+        requestCount++;
+        if (IsValidRequest(request))
+        {
+            queue.push_back({ id, request, 0 });
+            connection.queuedRequests++;
+        }
+        else
+        {
+            AppendResults(connection, request, 0, 0, rollStatusBadRequest, nullptr);
+        }
+    }
+    connection.input.erase(connection.input.begin(), connection.input.begin() + connection.inputStart);
+    connection.inputStart = 0;
+}
+
+/// <summary>
+/// Runs the roll service without a window until interrupted (Ctrl+C or SIGTERM): listens on a Unix domain socket,
+/// collects the requests of every client that arrive together into one batch, rolls the batch on the job system,
+/// and streams the results back in blocks. Linux only (epoll).
+/// </summary>
+/// <param name="socketPath">Path of the socket to listen on (replaced if it exists)</param>
+/// <param name="threadCount">Number of threads rolling dice, including the one running the event loop</param>
+/// <returns>Exit code for main()</returns>
+int RunRollServer(const std::string& socketPath, int threadCount)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Socket path " << socketPath << " is too long!" << std::endl;
+        return 1;
+    }
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(socketPath.c_str());
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listenFd, SOMAXCONN) != 0)
+    {
+        std::cerr << "Failed to listen on " << socketPath << ": " << std::strerror(errno) << "!" << std::endl;
+        if (listenFd >= 0)
+        {
+            close(listenFd);
+        }
+        return 1;
+    }
+
+    // the listening socket is id 0, clients count up from 1 (ids are never reused, unlike file descriptors)
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event listenEvent = {};
+    listenEvent.events = EPOLLIN;
+    listenEvent.data.u64 = 0;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &listenEvent);
+
+    rollServerStopping = 0;
+    std::signal(SIGINT, StopRollServer);
+    std::signal(SIGTERM, StopRollServer);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    JobSystem jobSystem(std::max(threadCount, 1));
+    std::cout << "roll service: listening on " << socketPath << " with " << jobSystem.ThreadCount() << " threads" << std::endl;
+
+    std::unordered_map<uint64_t, RollConnection> connections;
+    uint64_t nextConnection = 1;
+    std::deque<QueuedRoll> queue;
+    std::vector<BatchRange> batch;
+    std::vector<uint8_t> results;
+    uint64_t requestCount = 0, rollCount = 0, batchCount = 0;
+    bool queueStalled = false;      // every queued request belongs to a client with too many results waiting
+    epoll_event events[64];
+
+    auto closeConnection = [&](uint64_t id)
+    {
+        auto found = connections.find(id);
+        if (found != connections.end())
+        {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, found->second.fd, nullptr);
+            close(found->second.fd);
+            connections.erase(found);
+        }
+    };
+
+    // after sending: parses what waited for the results to drain, then closes the connection if it failed or is done
+    auto settleConnection = [&](uint64_t id, RollConnection& connection, bool open)
+    {
+        if (open)
+        {
+            ParseRequests(connection, id, queue, requestCount);
+            open = FlushConnection(connection);
+        }
+        if (open && !IsFinished(connection))
+        {
+            UpdateInterest(epollFd, id, connection);
+        }
+        else
+        {
+            closeConnection(id);
+        }
+    };
+
+    while (!rollServerStopping)
+    {
+        // with rolls queued, only pick up what has already arrived before rolling the next batch
+        // (unless none of them can be rolled until some client takes its results)
+        int eventCount = epoll_wait(epollFd, events, 64, queue.empty() || queueStalled ? 500 : 0);
+        if (eventCount < 0 && errno != EINTR)
+        {
+            std::cerr << "epoll_wait failed: " << std::strerror(errno) << "!" << std::endl;
+            break;
+        }
+
+        for (int e = 0; e < eventCount; e++)
+        {
+            uint64_t id = events[e].data.u64;
+            if (id == 0)
+            {
+                int fd;
+                while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                {
+                    RollConnection& connection = connections[nextConnection];
+                    connection.fd = fd;
+                    connection.interest = EPOLLIN | EPOLLRDHUP;
+                    epoll_event event = {};
+                    event.events = connection.interest;
+                    event.data.u64 = nextConnection++;
+                    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+                }
+                continue;
+            }
+
+            auto found = connections.find(id);
+            if (found == connections.end())
+            {
+                continue;
+            }
+            RollConnection& connection = found->second;
+            bool open = (events[e].events & EPOLLERR) == 0;
+            if (open && (events[e].events & EPOLLOUT) != 0)
+            {
+                open = FlushConnection(connection);
+            }
+            if (open && !connection.peerClosed && (events[e].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) != 0)
+            {
+                open = ReceiveRequests(connection);
+            }
+
+            // refusals are answered right away, the rest is rolled below
+            settleConnection(id, connection, open);
+        }
+
+        if (queue.empty())
+        {
+            continue;
+        }
+
+        // Batch: the requests at the front of the queue, whichever clients they came from, up to maxBatchRolls rolls.
+        // A request too big for what is left of the batch is cut, and carries on in the next batch.
+        batch.clear();
+        size_t batchRolls = 0;
+        for (size_t q = 0; q < queue.size() && batchRolls < maxBatchRolls; q++)
+        {
+            QueuedRoll& queued = queue[q];
+            auto found = connections.find(queued.connection);
+            if (found == connections.end())
+            {
+                queued.rolled = queued.request.count;   // the client is gone, drop it
+                continue;
+            }
+            if (queued.rolled == queued.request.count || PendingOutput(found->second) >= maxPendingOutput)
+            {
+                continue;   // done, or waiting behind a stalled request at the front; or its client is not keeping up
+            }
+            uint32_t count = static_cast<uint32_t>(std::min<size_t>(queued.request.count - queued.rolled, maxBatchRolls - batchRolls));
+            batch.push_back({ q, queued.rolled, count, batchRolls });
+            batchRolls += count;
+        }
+        queueStalled = batchRolls == 0;
+        if (queueStalled)
+        {
+            while (!queue.empty() && queue.front().rolled == queue.front().request.count)
+            {
+                queue.pop_front();
+            }
+            continue;
+        }
+        results.resize(batchRolls);
+
+        // every job rolls rollBlockSize consecutive results, which may span several requests
+        jobSystem.BeginFrame();
+        jobSystem.ParallelFor("roll", batchRolls, rollBlockSize, [&](size_t begin, size_t end)
+        {
+            auto range = std::upper_bound(batch.begin(), batch.end(), begin,
+                [](size_t offset, const BatchRange& r) { return offset < r.resultOffset; }) - 1;
+            for (size_t i = begin; i < end; i++)
+            {
+                while (i >= range->resultOffset + range->count)
+                {
+                    ++range;
+                }
+                const RollRequest& request = queue[range->queued].request;
+                results[i] = RollDie(request.seed, range->first + (i - range->resultOffset), request.sides, static_cast<RollMode>(request.mode));
+            }
+        });
+        batchCount++;
+        rollCount += batchRolls;
+
+        for (const BatchRange& range : batch)
+        {
+            QueuedRoll& queued = queue[range.queued];
+            RollConnection& connection = connections[queued.connection];
+            for (uint32_t block = 0; block < range.count; block += rollBlockSize)
+            {
+                uint32_t count = std::min(rollBlockSize, range.count - block);
+                AppendResults(connection, queued.request, range.first + block, count, rollStatusOk, results.data() + range.resultOffset + block);
+            }
+            queued.rolled += range.count;
+            if (queued.rolled == queued.request.count)
+            {
+                connection.queuedRequests--;
+            }
+        }
+        while (!queue.empty() && queue.front().rolled == queue.front().request.count)
+        {
+            queue.pop_front();
+        }
+
+        // send what fits now, epoll reports when the rest can go
+        for (auto it = connections.begin(); it != connections.end();)
+        {
+            RollConnection& connection = it->second;
+            uint64_t connectionId = it->first;
+            ++it;
+            if (PendingOutput(connection) > 0)
+            {
+                settleConnection(connectionId, connection, FlushConnection(connection));
+            }
+        }
+    }
+
+    for (auto& entry : connections)
+    {
+        close(entry.second.fd);
+    }
+    close(listenFd);
+    close(epollFd);
+    unlink(socketPath.c_str());
+    std::cout << "roll service: stopped after " << requestCount << " requests, " << rollCount << " rolls in "
+        << batchCount << " batches" << std::endl;
+    return 0;
+}
+
+/// <summary>
+/// Sends or receives exactly size bytes on a blocking socket.
+/// </summary>
+/// <returns>False if the connection failed or was closed</returns>
+static bool TransferAll(int fd, void* data, size_t size, bool sending)
+{
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    while (size > 0)
+    {
+        ssize_t done = sending ? send(fd, bytes, size, MSG_NOSIGNAL) : recv(fd, bytes, size, 0);
+        if (done <= 0)
+        {
+            if (done < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        bytes += done;
+        size -= static_cast<size_t>(done);
+    }
+    return true;
+}
+
+/// <summary>
+/// Load generator for the roll service: every client connects on its own thread and sends one request after the
+/// other, waiting for all results of each. Checks every result against RollDie() and prints the throughput
+/// and the request latencies.
+/// </summary>
+/// <param name="socketPath">Path of the socket the service listens on</param>
+/// <param name="clientCount">Number of clients at once</param>
+/// <param name="requestsPerClient">Number of requests each client sends</param>
+/// <param name="rollsPerRequest">Number of rolls per request</param>
+/// <param name="mode">Random number or tumbling d20</param>
+/// <returns>Exit code for main()</returns>
+int RunRollLoadGenerator(const std::string& socketPath, int clientCount, int requestsPerClient, int rollsPerRequest, RollMode mode)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Socket path " << socketPath << " is too long!" << std::endl;
+        return 1;
+    }
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    clientCount = std::max(clientCount, 1);
+    rollsPerRequest = static_cast<int>(std::min<uint32_t>(std::max(rollsPerRequest, 1), maxRollsPerRequest));
+    std::vector<std::vector<double>> latencies(clientCount);
+    std::atomic<uint64_t> mismatches{ 0 };
+    std::atomic<int> failedClients{ 0 };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (int client = 0; client < clientCount; client++)
+    {
+        clients.emplace_back([&, client]
+        {
+            int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+            {
+                failedClients++;
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+                return;
+            }
+
+            std::vector<uint8_t> rolls(rollsPerRequest);
+            latencies[client].reserve(requestsPerClient);
+            for (int r = 0; r < requestsPerClient; r++)
+            {
+                RollRequest request = {};
+                request.requestId = static_cast<uint32_t>(r);
+                request.count = static_cast<uint32_t>(rollsPerRequest);
+                request.seed = (static_cast<uint64_t>(client) << 32) | static_cast<uint64_t>(r);
+                request.sides = 20;
+                request.mode = static_cast<uint8_t>(mode);
+
+                auto sent = std::chrono::steady_clock::now();
+                if (!TransferAll(fd, &request, sizeof(request), true))
+                {
+                    failedClients++;
+                    break;
+                }
+
+                RollResultHeader header = {};
+                bool ok = true;
+                do
+                {
+                    ok = TransferAll(fd, &header, sizeof(header), false) && header.requestId == request.requestId
+                        && header.status == rollStatusOk && header.first + header.count <= request.count
+                        && TransferAll(fd, rolls.data() + header.first, header.count, false);
+                } while (ok && !header.last);
+                if (!ok)
+                {
+                    failedClients++;
+                    break;
+                }
+                latencies[client].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sent).count());
+
+                // checking every tumble would cost the client as much as the service, so only the start of each request
+                int checked = mode == RollMode::Random ? rollsPerRequest : std::min(rollsPerRequest, 8);
+                for (int i = 0; i < checked; i++)
+                {
+                    if (rolls[i] != RollDie(request.seed, i, request.sides, mode))
+                    {
+                        mismatches++;
+                    }
+                }
+            }
+            close(fd);
+        });
+    }
+    for (std::thread& client : clients)
+    {
+        client.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    for (const std::vector<double>& clientLatencies : latencies)
+    {
+        all.insert(all.end(), clientLatencies.begin(), clientLatencies.end());
+    }
+    if (all.empty())
+    {
+        std::cerr << "No request got through to " << socketPath << "!" << std::endl;
+        return 1;
+    }
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double p) { return all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+
+    std::cout << "roll load: " << clientCount << " clients, " << all.size() << " requests of " << rollsPerRequest << " "
+        << (mode == RollMode::Random ? "random" : "tumbled") << " d20 rolls in " << seconds << " s" << std::endl;
+    std::cout << "  throughput: " << all.size() / seconds << " requests/s, " << all.size() * rollsPerRequest / seconds << " rolls/s" << std::endl;
+    std::cout << "  latency: p50 " << percentile(0.5) << " us, p99 " << percentile(0.99) << " us, max " << all.back() << " us" << std::endl;
+    std::cout << "  results " << (mismatches == 0 ? "match" : "DO NOT match") << " RollDie()"
+        << (failedClients > 0 ? ", " + std::to_string(failedClients.load()) + " clients failed" : "") << std::endl;
+    return mismatches == 0 && failedClients == 0 ? 0 : 1;
+}
+
+#else
+
+/// <summary>
+/// Runs the roll service without a window until interrupted. Linux only (epoll).
+/// </summary>
+int RunRollServer(const std::string& socketPath, int threadCount)
+{
+    std::cerr << "The roll service needs epoll and Unix domain sockets (Linux)!" << std::endl;
+    return 1;
+}
+
+/// <summary>
+/// Load generator for the roll service. Linux only (Unix domain sockets are used like the service does).
+/// </summary>
+int RunRollLoadGenerator(const std::string& socketPath, int clientCount, int requestsPerClient, int rollsPerRequest, RollMode mode)
+{
+    std::cerr << "The roll load generator needs Unix domain sockets (Linux)!" << std::endl;
+    return 1;
+}
+
+#endif
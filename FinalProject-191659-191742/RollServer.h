@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Wire format of the roll service (little endian, no padding between messages):
+// a client sends RollRequests, and gets back for every request one or more result blocks, each a RollResultHeader
+// followed by count bytes (one result per roll), in roll order. The block with last set ends the request.
+
+/// <summary>
+/// How the service decides a roll
+/// </summary>
+enum class RollMode : uint8_t
+{
+    Random = 0,     // a uniform random number from 1 to sides
+    Tumble = 1      // a d20 is spun and slowed down until it stops, and the face on top is read (d20 only)
+};
+
+/// <summary>
+/// Struct containing a request for count rolls of one die. The same seed always gives the same results.
+/// </summary>
+struct RollRequest
+{
+    uint32_t requestId;     // echoed back in the results, chosen by the client
+    uint32_t count;         // number of rolls, from 1 to maxRollsPerRequest
+    uint64_t seed;
+    uint8_t sides;          // 4, 6, 8, 10, 12 or 20
+    uint8_t mode;           // a RollMode
+    uint8_t reserved[6];
+};
+
+/// <summary>
+/// Struct containing the header of a block of results, followed by count result bytes
+/// </summary>
+struct RollResultHeader
+{
+    uint32_t requestId;
+    uint32_t first;         // index of the first roll in the block
+    uint32_t count;
+    uint8_t status;         // rollStatusOk, or why the request was refused (then count is 0)
+    uint8_t last;           // 1 on the last block of the request
+    uint8_t reserved[2];
+};
+
+const uint8_t rollStatusOk = 0;
+const uint8_t rollStatusBadRequest = 1;
+
+const uint32_t maxRollsPerRequest = 1u << 24;
+
+/// <summary>
+/// Returns one roll. Rolls only depend on the seed and their index, so any part of a request can be rolled on any thread.
+/// </summary>
+/// <param name="seed">Seed of the request</param>
+/// <param name="index">Index of the roll in the request</param>
+/// <param name="sides">Number of sides of the die</param>
+/// <param name="mode">Random number or tumbling d20</param>
+/// <returns>Number rolled, from 1 to sides</returns>
+uint8_t RollDie(uint64_t seed, uint64_t index, int sides, RollMode mode);
+
+/// <summary>
+/// Runs the roll service without a window until interrupted (Ctrl+C or SIGTERM): listens on a Unix domain socket,
+/// collects the requests of every client that arrive together into one batch, rolls the batch on the job system,
+/// and streams the results back in blocks. Linux only (epoll).
+/// </summary>
+/// <param name="socketPath">Path of the socket to listen on (replaced if it exists)</param>
+/// <param name="threadCount">Number of threads rolling dice, including the one running the event loop</param>
+/// <returns>Exit code for main()</returns>
+int RunRollServer(const std::string& socketPath, int threadCount);
+
+/// <summary>
+/// Load generator for the roll service: every client connects on its own thread and sends one request after the
+/// other, waiting for all results of each. Checks every result against RollDie() and prints the throughput
+/// and the request latencies.
+/// </summary>
+/// <param name="socketPath">Path of the socket the service listens on</param>
+/// <param name="clientCount">Number of clients at once</param>
+/// <param name="requestsPerClient">Number of requests each client sends</param>
+/// <param name="rollsPerRequest">Number of rolls per request</param>
+/// <param name="mode">Random number or tumbling d20</param>
+/// <returns>Exit code for main()</returns>
+int RunRollLoadGenerator(const std::string& socketPath, int clientCount, int requestsPerClient, int rollsPerRequest, RollMode mode);
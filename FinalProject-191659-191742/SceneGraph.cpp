@@ -0,0 +1,373 @@
+#include "SceneGraph.h"
+#include "D20Lod.h"
+
+#include <algorithm>
+#include <cstdint>
+
+const int SceneGraph::noParent;
+
+/// <summary>
+/// Adds a node.
+/// </summary>
+/// <param name="parent">Index of the parent node, or noParent for a root node</param>
+/// <param name="local">Transform of the node relative to its parent</param>
+/// <returns>Index of the new node</returns>
+int SceneGraph::AddNode(int parent, const glm::mat4& local)
+{
+    // the parent always comes first, which is what lets UpdateWorld() get away with a single pass
+    int node = static_cast<int>(parents.size());
+    parents.push_back(parent < node ? parent : noParent);
+    locals.push_back(local);
+    worlds.push_back(local);
+    dirty.push_back(1);
+    changed.push_back(0);
+
+    firstDirty = std::min(firstDirty, static_cast<size_t>(node));
+    return node;
+}
+
+/// <summary>
+/// Changes the transform of a node relative to its parent, and marks it (and with it its whole subtree) dirty.
+/// </summary>
+/// <param name="node">Node to move</param>
+/// <param name="local">New transform relative to the parent</param>
+void SceneGraph::SetLocal(int node, const glm::mat4& local)
+{
+    locals[node] = local;
+    dirty[node] = 1;
+    firstDirty = std::min(firstDirty, static_cast<size_t>(node));
+}
+
+/// <summary>
+/// Recomputes the world matrices of every dirty node and of every node below a dirty node.
+/// Clean nodes keep their cached world matrix.
+/// </summary>
+/// <returns>Number of world matrices that were recomputed</returns>
+size_t SceneGraph::UpdateWorld()
+{
+    std::fill(changed.begin(), changed.end(), 0);
+
+    // Parents are always updated before their children, so a node only has to look at its own dirty flag
+    // and at whether its parent changed in this pass to know if it is part of a dirty subtree.
+    size_t updated = 0;
+    for (size_t i = firstDirty; i < parents.size(); i++)
+    {
+        int parent = parents[i];
+        bool parentChanged = parent != noParent && changed[parent] != 0;
+        if (dirty[i] == 0 && !parentChanged)
+        {
+            continue;
+        }
+
+        worlds[i] = parent == noParent ? locals[i] : worlds[parent] * locals[i];
+        dirty[i] = 0;
+        changed[i] = 1;
+        updated++;
+    }
+
+    firstDirty = parents.size();
+    return updated;
+}
+
+/// <summary>
+/// Attaches a run of dice to a node, so that they follow it around.
+/// Runs should be attached in the order the dice were added to the transform system.
+/// </summary>
+/// <param name="node">Node the dice are attached to</param>
+/// <param name="begin">First die of the run</param>
+/// <param name="end">One past the last die of the run</param>
+void SceneGraph::AttachDice(int node, size_t begin, size_t end)
+{
+    if (begin >= end)
+    {
+        return;
+    }
+
+    AttachedDice run = { node, begin, end };
+    auto position = std::upper_bound(attachedDice.begin(), attachedDice.end(), run,
+        [](const AttachedDice& a, const AttachedDice& b) { return a.begin < b.begin; });
+    attachedDice.insert(position, run);
+}
+
+/// <summary>
+/// Builds the model and MVP matrices for a range of dice, using the world matrix of the node
+/// each die is attached to as its parent. The range may span several attached runs.
+/// </summary>
+/// <param name="transforms">Transform system holding the dice</param>
+/// <param name="viewProj">Projection matrix multiplied by the view matrix</param>
+/// <param name="begin">First die to compose</param>
+/// <param name="end">One past the last die to compose</param>
+/// <param name="out">Destination, receives (end - begin) instances</param>
+void SceneGraph::ComposeDice(const TransformSystem& transforms, const glm::mat4& viewProj, size_t begin, size_t end, DieInstance* out) const
+{
+    const glm::mat4 identity = glm::mat4(1.0f);
+    size_t i = begin;
+
+    // every run is composed in one go with its node's world matrix, so the SIMD path keeps full batches
+    for (const AttachedDice& run : attachedDice)
+    {
+        if (run.end <= i)
+        {
+            continue;
+        }
+        if (run.begin >= end)
+        {
+            break;
+        }
+
+        // dice that are not attached to any node sit directly in world space
+        if (run.begin > i)
+        {
+            transforms.Compose(viewProj, identity, i, run.begin, out + (i - begin));
+            i = run.begin;
+        }
+
+        size_t runEnd = std::min(run.end, end);
+        transforms.Compose(viewProj, worlds[run.node], i, runEnd, out + (i - begin));
+        i = runEnd;
+    }
+
+    if (i < end)
+    {
+        transforms.Compose(viewProj, identity, i, end, out + (i - begin));
+    }
+}
+
+/// <summary>
+/// Same as ComposeDice(), but writes what the vertex shader needs to spin the dice by itself (GPU spin mode).
+/// </summary>
+/// <param name="transforms">Transform system holding the dice</param>
+/// <param name="begin">First die to write</param>
+/// <param name="end">One past the last die to write</param>
+/// <param name="out">Destination, receives (end - begin) instances</param>
+void SceneGraph::ComposeSpinDice(const TransformSystem& transforms, size_t begin, size_t end, SpinInstance* out) const
+{
+    const glm::mat4 identity = glm::mat4(1.0f);
+    size_t i = begin;
+
+    for (const AttachedDice& run : attachedDice)
+    {
+        if (run.end <= i)
+        {
+            continue;
+        }
+        if (run.begin >= end)
+        {
+            break;
+        }
+
+        // dice that are not attached to any node sit directly in world space
+        if (run.begin > i)
+        {
+            transforms.ComposeSpin(identity, i, run.begin, out + (i - begin));
+            i = run.begin;
+        }
+
+        size_t runEnd = std::min(run.end, end);
+        transforms.ComposeSpin(worlds[run.node], i, runEnd, out + (i - begin));
+        i = runEnd;
+    }
+
+    if (i < end)
+    {
+        transforms.ComposeSpin(identity, i, end, out + (i - begin));
+    }
+}
+
+/// <summary>
+/// Returns whether the last UpdateWorld() moved a node that has dice attached to it.
+/// </summary>
+bool SceneGraph::DiceMoved() const
+{
+    for (const AttachedDice& run : attachedDice)
+    {
+        if (changed[run.node] != 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+/// Frustum culls a range of dice, using the world matrix of the node each die is attached to.
+/// </summary>
+/// <param name="frustum">Frustum in world space</param>
+/// <param name="transforms">Transform system holding the dice</param>
+/// <param name="begin">First die to test</param>
+/// <param name="end">One past the last die to test</param>
+/// <param name="visible">Receives the indices of the visible dice in increasing order, needs room for (end - begin)</param>
+/// <returns>Number of visible dice</returns>
+size_t SceneGraph::CullDice(const Frustum& frustum, const TransformSystem& transforms, size_t begin, size_t end, uint32_t* visible) const
+{
+    const glm::mat4 identity = glm::mat4(1.0f);
+    size_t i = begin;
+    size_t count = 0;
+
+    // same walk over the attached runs as ComposeDice()
+    for (const AttachedDice& run : attachedDice)
+    {
+        if (run.end <= i)
+        {
+            continue;
+        }
+        if (run.begin >= end)
+        {
+            break;
+        }
+
+        if (run.begin > i)
+        {
+            count += ::CullDice(frustum, transforms, identity, i, run.begin, visible + count);
+            i = run.begin;
+        }
+
+        size_t runEnd = std::min(run.end, end);
+        count += ::CullDice(frustum, transforms, worlds[run.node], i, runEnd, visible + count);
+        i = runEnd;
+    }
+
+    if (i < end)
+    {
+        count += ::CullDice(frustum, transforms, identity, i, end, visible + count);
+    }
+
+    return count;
+}
+
+/// <summary>
+/// Writes the world space bounding spheres of a range of dice that share a parent.
+/// </summary>
+static void GetBoundingSpheres(const TransformSystem& transforms, const glm::mat4& parent, size_t begin, size_t end, glm::vec4* spheres)
+{
+    // same sphere as the frustum culling: the d20 circumradius, times the scale of the die and of its parent
+    float parentScale = std::max(glm::length(glm::vec3(parent[0])),
+        std::max(glm::length(glm::vec3(parent[1])), glm::length(glm::vec3(parent[2]))));
+    float radiusScale = glm::length(GetD20Corner(0)) * parentScale;
+
+    for (size_t i = begin; i < end; i++)
+    {
+        glm::vec4 center = parent * glm::vec4(transforms.posX[i], transforms.posY[i], transforms.posZ[i], 1.0f);
+        spheres[i - begin] = glm::vec4(glm::vec3(center), transforms.scale[i] * radiusScale);
+    }
+}
+
+/// <summary>
+/// Works out the world space bounding sphere (the circumsphere of the d20) of a range of dice,
+/// using the world matrix of the node each die is attached to.
+/// </summary>
+/// <param name="transforms">Transform system holding the dice</param>
+/// <param name="begin">First die</param>
+/// <param name="end">One past the last die</param>
+/// <param name="spheres">Receives (end - begin) spheres: center in xyz, radius in w</param>
+void SceneGraph::GetBoundingSpheres(const TransformSystem& transforms, size_t begin, size_t end, glm::vec4* spheres) const
+{
+    const glm::mat4 identity = glm::mat4(1.0f);
+    size_t i = begin;
+
+    // same walk over the attached runs as ComposeDice()
+    for (const AttachedDice& run : attachedDice)
+    {
+        if (run.end <= i)
+        {
+            continue;
+        }
+        if (run.begin >= end)
+        {
+            break;
+        }
+
+        if (run.begin > i)
+        {
+            ::GetBoundingSpheres(transforms, identity, i, run.begin, spheres + (i - begin));
+            i = run.begin;
+        }
+
+        size_t runEnd = std::min(run.end, end);
+        ::GetBoundingSpheres(transforms, worlds[run.node], i, runEnd, spheres + (i - begin));
+        i = runEnd;
+    }
+
+    if (i < end)
+    {
+        ::GetBoundingSpheres(transforms, identity, i, end, spheres + (i - begin));
+    }
+}
+
+/// <summary>
+/// Splits a sorted list of dice into slices of dice that share a parent, and calls function(parent, begin, end) for each slice,
+/// where begin and end are positions in the list.
+/// </summary>
+template <typename SliceFunction>
+void SceneGraph::ForEachSlice(const uint32_t* indices, size_t count, SliceFunction function) const
+{
+    const glm::mat4 identity = glm::mat4(1.0f);
+    std::vector<AttachedDice>::const_iterator run = attachedDice.begin();
+
+    size_t n = 0;
+    while (n < count)
+    {
+        uint32_t first = indices[n];
+        while (run != attachedDice.end() && run->end <= first)
+        {
+            ++run;
+        }
+
+        const glm::mat4* parent = &identity;
+        size_t sliceEnd = SIZE_MAX;
+        if (run != attachedDice.end())
+        {
+            if (run->begin <= first)
+            {
+                parent = &worlds[run->node];
+                sliceEnd = run->end;
+            }
+            else
+            {
+                // not attached to any node, up to the start of the next run
+                sliceEnd = run->begin;
+            }
+        }
+
+        size_t m = std::lower_bound(indices + n, indices + count, sliceEnd) - indices;
+        function(*parent, n, m);
+        n = m;
+    }
+}
+
+/// <summary>
+/// Same as ComposeDice(), but for a list of dice (as written by CullDice()), which are written out one after the other.
+/// </summary>
+/// <param name="transforms">Transform system holding the dice</param>
+/// <param name="viewProj">Projection matrix multiplied by the view matrix</param>
+/// <param name="indices">Indices of the dice to compose, in increasing order</param>
+/// <param name="count">Number of indices</param>
+/// <param name="out">Destination, receives count instances</param>
+void SceneGraph::ComposeVisibleDice(const TransformSystem& transforms, const glm::mat4& viewProj, const uint32_t* indices, size_t count, DieInstance* out) const
+{
+    ForEachSlice(indices, count, [&](const glm::mat4& parent, size_t begin, size_t end)
+    {
+        transforms.ComposeIndexed(viewProj, parent, indices + begin, end - begin, out + begin);
+    });
+}
+
+/// <summary>
+/// Sorts a list of dice (as written by CullDice()) into detail levels by how large they look on screen,
+/// using the world matrix of the node each die is attached to. See SortDiceByScreenSize().
+/// </summary>
+/// <param name="transforms">Transform system holding the dice</param>
+/// <param name="depthPlane">Plane whose equation gives the view depth of a world space point</param>
+/// <param name="radiusPerDepth">Smallest ratio of bounding radius to view depth for each level but the last</param>
+/// <param name="levelCount">Number of levels</param>
+/// <param name="indices">Indices of the dice to sort, in increasing order</param>
+/// <param name="count">Number of indices</param>
+/// <param name="levels">One list per level, the dice are appended in increasing order</param>
+/// <param name="levelCounts">Number of dice in each list, incremented as dice are appended</param>
+void SceneGraph::SortDiceByScreenSize(const TransformSystem& transforms, const glm::vec4& depthPlane, const float* radiusPerDepth, int levelCount,
+    const uint32_t* indices, size_t count, uint32_t* const* levels, size_t* levelCounts) const
+{
+    ForEachSlice(indices, count, [&](const glm::mat4& parent, size_t begin, size_t end)
+    {
+        ::SortDiceByScreenSize(transforms, parent, depthPlane, radiusPerDepth, levelCount, indices + begin, end - begin, levels, levelCounts);
+    });
+}
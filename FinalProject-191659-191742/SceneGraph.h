@@ -0,0 +1,175 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "FrustumCulling.h"
+#include "TransformSystem.h"
+
+/// <summary>
+/// Struct containing a run of dice (from the transform system) that are attached to the same scene node
+/// </summary>
+struct AttachedDice
+{
+    int node;
+    size_t begin, end;
+};
+
+/// <summary>
+/// Flat scene hierarchy. Every node stores the index of its parent, and a node can only be added after its parent,
+/// so walking the arrays front to back always visits parents before children (topological order).
+/// World matrices are cached and only recomputed for nodes whose local matrix, or the local matrix
+/// of one of their ancestors, changed since the last update.
+/// </summary>
+class SceneGraph
+{
+public:
+    static const int noParent = -1;
+
+    /// <summary>
+    /// Adds a node.
+    /// </summary>
+    /// <param name="parent">Index of the parent node, or noParent for a root node</param>
+    /// <param name="local">Transform of the node relative to its parent</param>
+    /// <returns>Index of the new node</returns>
+    int AddNode(int parent, const glm::mat4& local);
+
+    /// <summary>
+    /// Returns how many nodes are stored.
+    /// </summary>
+    size_t Count() const { return parents.size(); }
+
+    /// <summary>
+    /// Returns the index of the parent of a node, or noParent for a root node.
+    /// </summary>
+    int Parent(int node) const { return parents[node]; }
+
+    /// <summary>
+    /// Changes the transform of a node relative to its parent, and marks it (and with it its whole subtree) dirty.
+    /// </summary>
+    /// <param name="node">Node to move</param>
+    /// <param name="local">New transform relative to the parent</param>
+    void SetLocal(int node, const glm::mat4& local);
+
+    /// <summary>
+    /// Returns the transform of a node relative to its parent.
+    /// </summary>
+    const glm::mat4& Local(int node) const { return locals[node]; }
+
+    /// <summary>
+    /// Returns the cached world matrix of a node, as of the last UpdateWorld().
+    /// </summary>
+    const glm::mat4& World(int node) const { return worlds[node]; }
+
+    /// <summary>
+    /// Returns whether the world matrix of a node was recomputed by the last UpdateWorld().
+    /// </summary>
+    bool WorldChanged(int node) const { return changed[node] != 0; }
+
+    /// <summary>
+    /// Recomputes the world matrices of every dirty node and of every node below a dirty node.
+    /// Clean nodes keep their cached world matrix.
+    /// </summary>
+    /// <returns>Number of world matrices that were recomputed</returns>
+    size_t UpdateWorld();
+
+    /// <summary>
+    /// Attaches a run of dice to a node, so that they follow it around.
+    /// Runs should be attached in the order the dice were added to the transform system.
+    /// </summary>
+    /// <param name="node">Node the dice are attached to</param>
+    /// <param name="begin">First die of the run</param>
+    /// <param name="end">One past the last die of the run</param>
+    void AttachDice(int node, size_t begin, size_t end);
+
+    /// <summary>
+    /// Builds the model and MVP matrices for a range of dice, using the world matrix of the node
+    /// each die is attached to as its parent. The range may span several attached runs.
+    /// </summary>
+    /// <param name="transforms">Transform system holding the dice</param>
+    /// <param name="viewProj">Projection matrix multiplied by the view matrix</param>
+    /// <param name="begin">First die to compose</param>
+    /// <param name="end">One past the last die to compose</param>
+    /// <param name="out">Destination, receives (end - begin) instances</param>
+    void ComposeDice(const TransformSystem& transforms, const glm::mat4& viewProj, size_t begin, size_t end, DieInstance* out) const;
+
+    /// <summary>
+    /// Same as ComposeDice(), but writes what the vertex shader needs to spin the dice by itself (GPU spin mode).
+    /// </summary>
+    /// <param name="transforms">Transform system holding the dice</param>
+    /// <param name="begin">First die to write</param>
+    /// <param name="end">One past the last die to write</param>
+    /// <param name="out">Destination, receives (end - begin) instances</param>
+    void ComposeSpinDice(const TransformSystem& transforms, size_t begin, size_t end, SpinInstance* out) const;
+
+    /// <summary>
+    /// Returns whether the last UpdateWorld() moved a node that has dice attached to it.
+    /// </summary>
+    bool DiceMoved() const;
+
+    /// <summary>
+    /// Frustum culls a range of dice, using the world matrix of the node each die is attached to.
+    /// </summary>
+    /// <param name="frustum">Frustum in world space</param>
+    /// <param name="transforms">Transform system holding the dice</param>
+    /// <param name="begin">First die to test</param>
+    /// <param name="end">One past the last die to test</param>
+    /// <param name="visible">Receives the indices of the visible dice in increasing order, needs room for (end - begin)</param>
+    /// <returns>Number of visible dice</returns>
+    size_t CullDice(const Frustum& frustum, const TransformSystem& transforms, size_t begin, size_t end, uint32_t* visible) const;
+
+    /// <summary>
+    /// Works out the world space bounding sphere (the circumsphere of the d20) of a range of dice,
+    /// using the world matrix of the node each die is attached to.
+    /// </summary>
+    /// <param name="transforms">Transform system holding the dice</param>
+    /// <param name="begin">First die</param>
+    /// <param name="end">One past the last die</param>
+    /// <param name="spheres">Receives (end - begin) spheres: center in xyz, radius in w</param>
+    void GetBoundingSpheres(const TransformSystem& transforms, size_t begin, size_t end, glm::vec4* spheres) const;
+
+    /// <summary>
+    /// Same as ComposeDice(), but for a list of dice (as written by CullDice()), which are written out one after the other.
+    /// </summary>
+    /// <param name="transforms">Transform system holding the dice</param>
+    /// <param name="viewProj">Projection matrix multiplied by the view matrix</param>
+    /// <param name="indices">Indices of the dice to compose, in increasing order</param>
+    /// <param name="count">Number of indices</param>
+    /// <param name="out">Destination, receives count instances</param>
+    void ComposeVisibleDice(const TransformSystem& transforms, const glm::mat4& viewProj, const uint32_t* indices, size_t count, DieInstance* out) const;
+
+    /// <summary>
+    /// Sorts a list of dice (as written by CullDice()) into detail levels by how large they look on screen,
+    /// using the world matrix of the node each die is attached to. See SortDiceByScreenSize().
+    /// </summary>
+    /// <param name="transforms">Transform system holding the dice</param>
+    /// <param name="depthPlane">Plane whose equation gives the view depth of a world space point</param>
+    /// <param name="radiusPerDepth">Smallest ratio of bounding radius to view depth for each level but the last</param>
+    /// <param name="levelCount">Number of levels</param>
+    /// <param name="indices">Indices of the dice to sort, in increasing order</param>
+    /// <param name="count">Number of indices</param>
+    /// <param name="levels">One list per level, the dice are appended in increasing order</param>
+    /// <param name="levelCounts">Number of dice in each list, incremented as dice are appended</param>
+    void SortDiceByScreenSize(const TransformSystem& transforms, const glm::vec4& depthPlane, const float* radiusPerDepth, int levelCount,
+        const uint32_t* indices, size_t count, uint32_t* const* levels, size_t* levelCounts) const;
+
+private:
+    template <typename SliceFunction>
+    void ForEachSlice(const uint32_t* indices, size_t count, SliceFunction function) const;
+
+    // one entry per node, in topological order
+    std::vector<int> parents;
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds;
+    std::vector<uint8_t> dirty;
+    std::vector<uint8_t> changed;
+
+    // lowest index of a dirty node, so that the update can skip the clean front of the arrays
+    size_t firstDirty = 0;
+
+    // runs of dice attached to each node, sorted by first die
+    std::vector<AttachedDice> attachedDice;
+};
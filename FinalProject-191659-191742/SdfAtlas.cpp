@@ -0,0 +1,168 @@
+#include "SdfAtlas.h"
+
+#include <algorithm>
+#include <cmath>
+
+// corners of the face triangle inside a cell, in cell-space (0 to 1) coordinates
+// the triangle is equilateral and leaves a margin so that filtering never bleeds into a neighbour
+static const glm::vec2 cellTriangle[3] = {
+    glm::vec2(0.5f, 0.95f),     // top
+    glm::vec2(0.05f, 0.1706f),  // bottom left
+    glm::vec2(0.95f, 0.1706f)   // bottom right
+};
+
+// numerals are centered on the incircle of the triangle
+static const glm::vec2 glyphCenter = glm::vec2(0.5f, 0.4304f);
+static const float glyphHeight = 0.28f;   // height of a digit in cell-space
+static const float glyphAdvance = 0.75f;  // distance between two digits, relative to the height
+static const float strokeWidth = 0.16f;   // thickness of the pen, relative to the height
+static const float sdfSpread = 4.0f;      // texels covered by the distance ramp on each side of an edge
+
+/// <summary>
+/// Returns the polylines that draw a digit, in a box that is 0.6 wide and 1 tall.
+/// </summary>
+/// <param name="digit">Digit, from 0 to 9</param>
+/// <returns>List of polylines</returns>
+static std::vector<std::vector<glm::vec2>> GetDigitStrokes(int digit)
+{
+    typedef glm::vec2 P;
+    switch (digit)
+    {
+    case 0:
+        return { { P(0.15f, 1.0f), P(0.45f, 1.0f), P(0.6f, 0.85f), P(0.6f, 0.15f), P(0.45f, 0.0f),
+                   P(0.15f, 0.0f), P(0.0f, 0.15f), P(0.0f, 0.85f), P(0.15f, 1.0f) } };
+    case 1:
+        return { { P(0.1f, 0.8f), P(0.3f, 1.0f), P(0.3f, 0.0f) },
+                 { P(0.1f, 0.0f), P(0.5f, 0.0f) } };
+    case 2:
+        return { { P(0.0f, 0.8f), P(0.15f, 1.0f), P(0.45f, 1.0f), P(0.6f, 0.85f), P(0.6f, 0.6f),
+                   P(0.0f, 0.0f), P(0.6f, 0.0f) } };
+    case 3:
+        return { { P(0.0f, 0.9f), P(0.1f, 1.0f), P(0.5f, 1.0f), P(0.6f, 0.9f), P(0.6f, 0.6f),
+                   P(0.5f, 0.5f), P(0.2f, 0.5f) },
+                 { P(0.5f, 0.5f), P(0.6f, 0.4f), P(0.6f, 0.1f), P(0.5f, 0.0f), P(0.1f, 0.0f), P(0.0f, 0.1f) } };
+    case 4:
+        return { { P(0.45f, 0.0f), P(0.45f, 1.0f), P(0.0f, 0.3f), P(0.6f, 0.3f) } };
+    case 5:
+        return { { P(0.6f, 1.0f), P(0.0f, 1.0f), P(0.0f, 0.55f), P(0.45f, 0.6f), P(0.6f, 0.45f),
+                   P(0.6f, 0.15f), P(0.45f, 0.0f), P(0.0f, 0.0f) } };
+    case 6:
+        return { { P(0.55f, 1.0f), P(0.2f, 1.0f), P(0.0f, 0.75f), P(0.0f, 0.15f), P(0.15f, 0.0f),
+                   P(0.45f, 0.0f), P(0.6f, 0.15f), P(0.6f, 0.4f), P(0.45f, 0.55f), P(0.15f, 0.55f), P(0.0f, 0.4f) } };
+    case 7:
+        return { { P(0.0f, 1.0f), P(0.6f, 1.0f), P(0.2f, 0.0f) } };
+    case 8:
+        return { { P(0.15f, 0.55f), P(0.05f, 0.65f), P(0.05f, 0.9f), P(0.15f, 1.0f), P(0.45f, 1.0f),
+                   P(0.55f, 0.9f), P(0.55f, 0.65f), P(0.45f, 0.55f), P(0.15f, 0.55f) },
+                 { P(0.15f, 0.55f), P(0.0f, 0.4f), P(0.0f, 0.15f), P(0.15f, 0.0f), P(0.45f, 0.0f),
+                   P(0.6f, 0.15f), P(0.6f, 0.4f), P(0.45f, 0.55f) } };
+    default:
+        return { { P(0.05f, 0.0f), P(0.4f, 0.0f), P(0.6f, 0.25f), P(0.6f, 0.85f), P(0.45f, 1.0f),
+                   P(0.15f, 1.0f), P(0.0f, 0.85f), P(0.0f, 0.6f), P(0.15f, 0.45f), P(0.45f, 0.45f), P(0.6f, 0.6f) } };
+    }
+}
+
+/// <summary>
+/// Returns the distance between a point and a line segment.
+/// </summary>
+static float DistanceToSegment(const glm::vec2& p, const glm::vec2& a, const glm::vec2& b)
+{
+    glm::vec2 ab = b - a;
+    glm::vec2 ap = p - a;
+    float t = glm::clamp(glm::dot(ap, ab) / glm::dot(ab, ab), 0.0f, 1.0f);
+    return glm::length(ap - ab * t);
+}
+
+/// <summary>
+/// Builds a single-channel signed distance field atlas of the numerals 1 to 20.
+/// A texel value of 128 lies on the outline of a numeral, larger values are inside the stroke
+/// and smaller values are outside, so the fragment shader can rebuild sharp edges at any scale.
+/// </summary>
+/// <param name="cellSize">Width and height of one numeral cell in texels</param>
+/// <param name="atlasWidth">Will contain the width of the atlas in texels</param>
+/// <param name="atlasHeight">Will contain the height of the atlas in texels</param>
+/// <returns>One byte per texel, rows ordered bottom to top like OpenGL expects</returns>
+std::vector<unsigned char> BuildNumeralSdfAtlas(int cellSize, int& atlasWidth, int& atlasHeight)
+{
+    atlasWidth = sdfAtlasColumns * cellSize;
+    atlasHeight = sdfAtlasRows * cellSize;
+    std::vector<unsigned char> atlas(atlasWidth * atlasHeight, 0);
+
+    // distance (in cell-space) over which the field goes from fully outside to fully inside
+    float spread = sdfSpread / cellSize;
+    float halfStroke = 0.5f * strokeWidth * glyphHeight;
+
+    for (int number = 1; number <= 20; number++)
+    {
+        // lay out the segments of every digit of the number in cell-space
+        std::vector<glm::vec2> segments;
+        int digits[2] = { number / 10, number % 10 };
+        int firstDigit = number < 10 ? 1 : 0;
+        int digitCount = 2 - firstDigit;
+        float width = (0.6f + (digitCount - 1) * glyphAdvance) * glyphHeight;
+        glm::vec2 origin = glyphCenter - glm::vec2(0.5f * width, 0.5f * glyphHeight);
+
+        for (int i = firstDigit; i < 2; i++)
+        {
+            glm::vec2 digitOrigin = origin + glm::vec2((i - firstDigit) * glyphAdvance * glyphHeight, 0.0f);
+            for (const std::vector<glm::vec2>& stroke : GetDigitStrokes(digits[i]))
+            {
+                for (size_t p = 0; p + 1 < stroke.size(); p++)
+                {
+                    segments.push_back(digitOrigin + stroke[p] * glyphHeight);
+                    segments.push_back(digitOrigin + stroke[p + 1] * glyphHeight);
+                }
+            }
+        }
+
+        // underline 6 and 9 so that they can be told apart on the die
+        if (number == 6 || number == 9)
+        {
+            segments.push_back(origin + glm::vec2(0.0f, -0.2f) * glyphHeight);
+            segments.push_back(origin + glm::vec2(0.6f, -0.2f) * glyphHeight);
+        }
+
+        int cellX = (number - 1) % sdfAtlasColumns;
+        int cellY = (number - 1) / sdfAtlasColumns;
+
+        for (int y = 0; y < cellSize; y++)
+        {
+            for (int x = 0; x < cellSize; x++)
+            {
+                glm::vec2 p((x + 0.5f) / cellSize, (y + 0.5f) / cellSize);
+
+                float distance = 1.0f;
+                for (size_t s = 0; s < segments.size(); s += 2)
+                {
+                    distance = std::min(distance, DistanceToSegment(p, segments[s], segments[s + 1]));
+                }
+
+                // positive inside the stroke, negative outside, remapped so that 0.5 is the edge
+                float value = 0.5f + 0.5f * (halfStroke - distance) / spread;
+                value = glm::clamp(value, 0.0f, 1.0f);
+
+                int texel = (cellY * cellSize + y) * atlasWidth + cellX * cellSize + x;
+                atlas[texel] = static_cast<unsigned char>(value * 255.0f + 0.5f);
+            }
+        }
+    }
+
+    return atlas;
+}
+
+/// <summary>
+/// Returns the UV coordinate of one corner of the triangle that holds a numeral in the atlas.
+/// The numeral stands upright with its top pointing at corner 0.
+/// </summary>
+/// <param name="number">Numeral, from 1 to 20</param>
+/// <param name="corner">Corner of the triangle, 0 (top), 1 (bottom left) or 2 (bottom right)</param>
+/// <returns>UV coordinate in the atlas</returns>
+glm::vec2 GetNumeralTriangleUV(int number, int corner)
+{
+    int cellX = (number - 1) % sdfAtlasColumns;
+    int cellY = (number - 1) / sdfAtlasColumns;
+    glm::vec2 cellOrigin(static_cast<float>(cellX), static_cast<float>(cellY));
+
+    glm::vec2 uv = cellOrigin + cellTriangle[corner];
+    return glm::vec2(uv.x / sdfAtlasColumns, uv.y / sdfAtlasRows);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// the atlas is a grid of square cells, one cell per numeral from 1 to 20
+const int sdfAtlasColumns = 5;
+const int sdfAtlasRows = 4;
+
+/// <summary>
+/// Builds a single-channel signed distance field atlas of the numerals 1 to 20.
+/// A texel value of 128 lies on the outline of a numeral, larger values are inside the stroke
+/// and smaller values are outside, so the fragment shader can rebuild sharp edges at any scale.
+/// </summary>
+/// <param name="cellSize">Width and height of one numeral cell in texels</param>
+/// <param name="atlasWidth">Will contain the width of the atlas in texels</param>
+/// <param name="atlasHeight">Will contain the height of the atlas in texels</param>
+/// <returns>One byte per texel, rows ordered bottom to top like OpenGL expects</returns>
+std::vector<unsigned char> BuildNumeralSdfAtlas(int cellSize, int& atlasWidth, int& atlasHeight);
+
+/// <summary>
+/// Returns the UV coordinate of one corner of the triangle that holds a numeral in the atlas.
+/// The numeral stands upright with its top pointing at corner 0.
+/// </summary>
+/// <param name="number">Numeral, from 1 to 20</param>
+/// <param name="corner">Corner of the triangle, 0 (top), 1 (bottom left) or 2 (bottom right)</param>
+/// <returns>UV coordinate in the atlas</returns>
+glm::vec2 GetNumeralTriangleUV(int number, int corner);
@@ -0,0 +1,163 @@
+#include "Shadows.h"
+#include "GlResources.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+/// <summary>
+/// Creates a depth texture with a framebuffer that draws into it.
+/// </summary>
+static void CreateDepthTarget(int size, const char* label, GLuint& framebuffer, GLuint& texture)
+{
+    texture = CreateGlResource(GlResourceType::Texture, label);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+    SetGlResourceBytes(GlResourceType::Texture, texture, GetGlTextureBytes(GL_DEPTH_COMPONENT24, size, size, false));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // linear filtering on a comparison sampler blends the results of the four nearest texels (cheap soft edges)
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    framebuffer = CreateGlResource(GlResourceType::Framebuffer, label);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "Failed to create the shadow map framebuffer!" << std::endl;
+    }
+
+    // start out with nothing in the way of the light
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/// <summary>
+/// Creates both depth maps and their framebuffers.
+/// </summary>
+/// <param name="size">Width and height of the shadow maps in texels</param>
+ShadowMaps::ShadowMaps(int size)
+    : size(size), lightViewProj(1.0f)
+{
+    CreateDepthTarget(size, "static shadow map", staticFramebuffer, staticDepth);
+    CreateDepthTarget(size, "shadow map", dynamicFramebuffer, dynamicDepth);
+}
+
+/// <summary>
+/// Deletes the depth maps and the framebuffers. Must be called while the context is still current.
+/// </summary>
+void ShadowMaps::Delete()
+{
+    DeleteGlResource(GlResourceType::Framebuffer, staticFramebuffer);
+    DeleteGlResource(GlResourceType::Framebuffer, dynamicFramebuffer);
+    DeleteGlResource(GlResourceType::Texture, staticDepth);
+    DeleteGlResource(GlResourceType::Texture, dynamicDepth);
+}
+
+/// <summary>
+/// Points the light at a bounding sphere around the shadow receivers. If the projection changes,
+/// the static map is marked for redrawing.
+/// </summary>
+/// <param name="type">Directional or spot light</param>
+/// <param name="lightPos">Position of the light (for a directional light, only the direction towards the center counts)</param>
+/// <param name="center">Center of the region that receives shadows</param>
+/// <param name="radius">Radius of the region that receives shadows</param>
+void ShadowMaps::SetLight(ShadowLightType type, const glm::vec3& lightPos, const glm::vec3& center, float radius)
+{
+    glm::vec3 toCenter = center - lightPos;
+    float distance = std::max(glm::length(toCenter), 1e-3f);
+    glm::vec3 direction = toCenter / distance;
+
+    // any up vector works, as long as it is not parallel to the light direction
+    glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+    glm::mat4 projection, view;
+    if (type == ShadowLightType::Directional)
+    {
+        // a box just around the sphere, looking along the light direction, so no texel is spent outside of it
+        view = glm::lookAt(center - direction * radius * 2.0f, center, up);
+        projection = glm::ortho(-radius, radius, -radius, radius, radius, radius * 3.0f);
+    }
+    else
+    {
+        // a cone from the light that just holds the sphere (if the light is inside the sphere, a wide cone over what
+        // is in front of it)
+        view = glm::lookAt(lightPos, center, up);
+        float zNear = std::max(distance - radius, 0.05f);
+        float zFar = distance + radius;
+        float halfWidth = distance > radius ? zNear * radius / std::sqrt(distance * distance - radius * radius) : zNear * 2.0f;
+        projection = glm::frustum(-halfWidth, halfWidth, -halfWidth, halfWidth, zNear, zFar);
+    }
+
+    glm::mat4 newViewProj = projection * view;
+    if (newViewProj != lightViewProj)
+    {
+        staticDirty = true;
+    }
+    lightViewProj = newViewProj;
+}
+
+/// <summary>
+/// Binds one of the maps with the state both passes use.
+/// </summary>
+void ShadowMaps::BeginPass(GLuint framebuffer)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, size, size);
+
+    // push the stored depths back a little, so that a lit surface does not shadow itself ("shadow acne")
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+}
+
+/// <summary>
+/// Binds the static map for drawing and clears it. Draw the static casters with the shadow program, then call EndPass().
+/// </summary>
+void ShadowMaps::BeginStaticPass()
+{
+    BeginPass(staticFramebuffer);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    staticDirty = false;
+    staticRedraws++;
+}
+
+/// <summary>
+/// Copies the static map into the per-frame map and binds that for drawing. Draw the moving casters, then call EndPass().
+/// </summary>
+void ShadowMaps::BeginDynamicPass()
+{
+    // a copy on the GPU, its cost only depends on the size of the map
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, staticFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dynamicFramebuffer);
+    glBlitFramebuffer(0, 0, size, size, 0, 0, size, size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    BeginPass(dynamicFramebuffer);
+}
+
+/// <summary>
+/// Ends a pass. Leaves the default framebuffer bound, so the caller has to bind its own framebuffer and viewport again.
+/// </summary>
+void ShadowMaps::EndPass()
+{
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/// <summary>
+/// Returns the matrix that takes a world space position to shadow map coordinates (0 to 1 on every axis).
+/// </summary>
+glm::mat4 ShadowMaps::ShadowMatrix() const
+{
+    // from -1..1 (normalized device coordinates) to 0..1 (texture coordinates and depth)
+    glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+    return bias * lightViewProj;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+/// <summary>
+/// How the light casting shadows projects them
+/// </summary>
+enum class ShadowLightType
+{
+    Directional,    // parallel rays coming from the direction of the light (orthographic projection)
+    Spot            // rays spreading out from the light position (perspective projection)
+};
+
+/// <summary>
+/// Shadow map for one light, split into a cached part for the static geometry and a per-frame part for the moving dice.
+/// The static casters are drawn into their own depth map only when the light (or the region it covers) changes.
+/// Every frame, that map is copied into the per-frame map and only the moving casters are drawn on top,
+/// so the per-frame cost follows the number of moving casters and not the size of the static scene.
+/// </summary>
+class ShadowMaps
+{
+public:
+    /// <summary>
+    /// Creates both depth maps and their framebuffers.
+    /// </summary>
+    /// <param name="size">Width and height of the shadow maps in texels</param>
+    explicit ShadowMaps(int size);
+
+    ShadowMaps(const ShadowMaps&) = delete;
+    ShadowMaps& operator=(const ShadowMaps&) = delete;
+
+    /// <summary>
+    /// Deletes the depth maps and the framebuffers. Must be called while the context is still current.
+    /// </summary>
+    void Delete();
+
+    /// <summary>
+    /// Points the light at a bounding sphere around the shadow receivers. If the projection changes,
+    /// the static map is marked for redrawing.
+    /// </summary>
+    /// <param name="type">Directional or spot light</param>
+    /// <param name="lightPos">Position of the light (for a directional light, only the direction towards the center counts)</param>
+    /// <param name="center">Center of the region that receives shadows</param>
+    /// <param name="radius">Radius of the region that receives shadows</param>
+    void SetLight(ShadowLightType type, const glm::vec3& lightPos, const glm::vec3& center, float radius);
+
+    /// <summary>
+    /// Returns whether the static casters have to be drawn again (with BeginStaticPass()) before this frame's shadows.
+    /// </summary>
+    bool StaticMapDirty() const { return staticDirty; }
+
+    /// <summary>
+    /// Marks the static map for redrawing, e.g. because a static caster moved.
+    /// </summary>
+    void InvalidateStaticMap() { staticDirty = true; }
+
+    /// <summary>
+    /// Binds the static map for drawing and clears it. Draw the static casters with the shadow program, then call EndPass().
+    /// </summary>
+    void BeginStaticPass();
+
+    /// <summary>
+    /// Copies the static map into the per-frame map and binds that for drawing. Draw the moving casters, then call EndPass().
+    /// </summary>
+    void BeginDynamicPass();
+
+    /// <summary>
+    /// Ends a pass. Leaves the default framebuffer bound, so the caller has to bind its own framebuffer and viewport again.
+    /// </summary>
+    void EndPass();
+
+    /// <summary>
+    /// Returns the light's view projection matrix, for the shadow program.
+    /// </summary>
+    const glm::mat4& LightViewProj() const { return lightViewProj; }
+
+    /// <summary>
+    /// Returns the matrix that takes a world space position to shadow map coordinates (0 to 1 on every axis).
+    /// </summary>
+    glm::mat4 ShadowMatrix() const;
+
+    /// <summary>
+    /// Returns the per-frame depth map, set up for depth comparison (sampler2DShadow).
+    /// </summary>
+    GLuint Texture() const { return dynamicDepth; }
+
+    /// <summary>
+    /// Returns how many times the static map has been drawn.
+    /// </summary>
+    uint64_t StaticRedrawCount() const { return staticRedraws; }
+
+private:
+    void BeginPass(GLuint framebuffer);
+
+    int size;
+    GLuint staticFramebuffer = 0, staticDepth = 0;
+    GLuint dynamicFramebuffer = 0, dynamicDepth = 0;
+
+    glm::mat4 lightViewProj;
+    bool staticDirty = true;
+    uint64_t staticRedraws = 0;
+};
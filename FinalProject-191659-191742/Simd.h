@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+
+// Thin wrappers over the SIMD instructions shared by the transform and culling code.
+// Every SimdFloat holds SIMD_WIDTH floats, usually the same value for SIMD_WIDTH different dice.
+
+// Pick the widest instruction set the compiler is allowed to use.
+// (MSVC: /arch:AVX2 defines __AVX2__, and SSE2 is always available on x64)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+#else
+#define SIMD_WIDTH 1
+#endif
+
+#if SIMD_WIDTH == 8
+
+typedef __m256 SimdFloat;
+
+static inline SimdFloat SimdLoad(const float* p) { return _mm256_loadu_ps(p); }
+static inline SimdFloat SimdSet(float v) { return _mm256_set1_ps(v); }
+static inline SimdFloat SimdAdd(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a, b); }
+static inline SimdFloat SimdSub(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a, b); }
+static inline SimdFloat SimdMul(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a, b); }
+#if defined(__FMA__)
+static inline SimdFloat SimdMulAdd(SimdFloat a, SimdFloat b, SimdFloat c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+static inline SimdFloat SimdMulAdd(SimdFloat a, SimdFloat b, SimdFloat c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+
+// comparisons return a mask with all bits set in the lanes where the comparison holds
+static inline SimdFloat SimdLess(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline SimdFloat SimdOr(SimdFloat a, SimdFloat b) { return _mm256_or_ps(a, b); }
+static inline SimdFloat SimdAnd(SimdFloat a, SimdFloat b) { return _mm256_and_ps(a, b); }
+static inline SimdFloat SimdMin(SimdFloat a, SimdFloat b) { return _mm256_min_ps(a, b); }
+static inline SimdFloat SimdMax(SimdFloat a, SimdFloat b) { return _mm256_max_ps(a, b); }
+
+// one bit per lane, taken from the sign bit (so from a comparison mask)
+static inline int SimdMoveMask(SimdFloat a) { return _mm256_movemask_ps(a); }
+
+// loads p[indices[0]], p[indices[1]], ... into the lanes
+static inline SimdFloat SimdGather(const float* p, const uint32_t* indices)
+{
+    return _mm256_i32gather_ps(p, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices)), 4);
+}
+
+/// <summary>
+/// Transposes 8 registers of 8 floats, so that register i ends up holding lane i of every input register.
+/// </summary>
+static inline void SimdTranspose(SimdFloat r[8])
+{
+    __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+    __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+    __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+    __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+    __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+    __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+    __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+    __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+    r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+static inline void SimdStore(float* p, SimdFloat v) { _mm256_storeu_ps(p, v); }
+
+#elif SIMD_WIDTH == 4
+
+typedef __m128 SimdFloat;
+
+static inline SimdFloat SimdLoad(const float* p) { return _mm_loadu_ps(p); }
+static inline SimdFloat SimdSet(float v) { return _mm_set1_ps(v); }
+static inline SimdFloat SimdAdd(SimdFloat a, SimdFloat b) { return _mm_add_ps(a, b); }
+static inline SimdFloat SimdSub(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a, b); }
+static inline SimdFloat SimdMul(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a, b); }
+static inline SimdFloat SimdMulAdd(SimdFloat a, SimdFloat b, SimdFloat c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+
+// comparisons return a mask with all bits set in the lanes where the comparison holds
+static inline SimdFloat SimdLess(SimdFloat a, SimdFloat b) { return _mm_cmplt_ps(a, b); }
+static inline SimdFloat SimdOr(SimdFloat a, SimdFloat b) { return _mm_or_ps(a, b); }
+static inline SimdFloat SimdAnd(SimdFloat a, SimdFloat b) { return _mm_and_ps(a, b); }
+static inline SimdFloat SimdMin(SimdFloat a, SimdFloat b) { return _mm_min_ps(a, b); }
+static inline SimdFloat SimdMax(SimdFloat a, SimdFloat b) { return _mm_max_ps(a, b); }
+
+// one bit per lane, taken from the sign bit (so from a comparison mask)
+static inline int SimdMoveMask(SimdFloat a) { return _mm_movemask_ps(a); }
+
+// loads p[indices[0]], p[indices[1]], ... into the lanes (SSE has no gather instruction)
+static inline SimdFloat SimdGather(const float* p, const uint32_t* indices)
+{
+    return _mm_setr_ps(p[indices[0]], p[indices[1]], p[indices[2]], p[indices[3]]);
+}
+
+/// <summary>
+/// Transposes 4 registers of 4 floats, so that register i ends up holding lane i of every input register.
+/// </summary>
+static inline void SimdTranspose(SimdFloat r[4])
+{
+    _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+}
+
+static inline void SimdStore(float* p, SimdFloat v) { _mm_storeu_ps(p, v); }
+
+#endif
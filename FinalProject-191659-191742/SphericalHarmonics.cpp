@@ -0,0 +1,284 @@
+#include "SphericalHarmonics.h"
+#include "GlResources.h"
+#include "JobSystem.h"
+#include "Simd.h"
+
+// the only user of stb_image, so its implementation is compiled here
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+static const float pi = 3.14159265f;
+
+// constant factors of the basis functions: Y00, Y1m, Y2-2/Y2-1/Y21, Y20, Y22
+static const float shK0 = 0.282095f;
+static const float shK1 = 0.488603f;
+static const float shK2 = 1.092548f;
+static const float shK3 = 0.315392f;
+static const float shK4 = 0.546274f;
+
+// rows per job of the projection
+static const size_t shRowsPerJob = 8;
+
+/// <summary>
+/// Loads an environment image with stb_image (an HDR file as it is, an LDR file converted to linear color).
+/// </summary>
+/// <param name="path">Path to the image file</param>
+/// <param name="image">Receives the image</param>
+/// <returns>Whether the image could be loaded</returns>
+bool LoadEnvironmentImage(const std::string& path, EnvironmentImage& image)
+{
+    int width, height, channels;
+    float* data = stbi_loadf(path.c_str(), &width, &height, &channels, 3);
+    if (data == nullptr)
+    {
+        std::cerr << "Failed to load environment image " << path << "!" << std::endl;
+        return false;
+    }
+
+    // split the channels into their own planes, so the projection can load several pixels of one channel at once
+    image.width = width;
+    image.height = height;
+    image.r.resize(static_cast<size_t>(width) * height);
+    image.g.resize(image.r.size());
+    image.b.resize(image.r.size());
+    for (size_t i = 0; i < image.r.size(); i++)
+    {
+        image.r[i] = data[3 * i];
+        image.g[i] = data[3 * i + 1];
+        image.b[i] = data[3 * i + 2];
+    }
+    stbi_image_free(data);
+    return true;
+}
+
+/// <summary>
+/// Returns the direction a pixel of an equirectangular image looks at (+y is up).
+/// </summary>
+static glm::vec3 GetPixelDirection(int x, int y, int width, int height)
+{
+    float theta = pi * (y + 0.5f) / height;
+    float phi = 2.0f * pi * (x + 0.5f) / width;
+    return glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+}
+
+/// <summary>
+/// Builds a simple environment to use when no image is given: a blue sky fading into a warm floor,
+/// with a bright window on one side.
+/// </summary>
+/// <param name="width">Width of the image</param>
+/// <param name="height">Height of the image</param>
+EnvironmentImage BuildDefaultEnvironment(int width, int height)
+{
+    EnvironmentImage image;
+    image.width = width;
+    image.height = height;
+    image.r.resize(static_cast<size_t>(width) * height);
+    image.g.resize(image.r.size());
+    image.b.resize(image.r.size());
+
+    glm::vec3 zenith = glm::vec3(0.25f, 0.45f, 0.9f);
+    glm::vec3 horizon = glm::vec3(0.8f, 0.75f, 0.85f);
+    glm::vec3 floor = glm::vec3(0.35f, 0.2f, 0.12f);
+    glm::vec3 window = glm::vec3(4.0f, 3.6f, 3.0f);
+    glm::vec3 windowDirection = glm::normalize(glm::vec3(-0.6f, 0.4f, -0.7f));
+
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            glm::vec3 direction = GetPixelDirection(x, y, width, height);
+            glm::vec3 color = direction.y > 0.0f
+                ? horizon + (zenith - horizon) * std::sqrt(direction.y)
+                : horizon + (floor - horizon) * std::min(-direction.y * 4.0f, 1.0f);
+            if (glm::dot(direction, windowDirection) > 0.95f)
+            {
+                color = window;
+            }
+
+            size_t i = static_cast<size_t>(y) * width + x;
+            image.r[i] = color.x;
+            image.g[i] = color.y;
+            image.b[i] = color.z;
+        }
+    }
+    return image;
+}
+
+/// <summary>
+/// Projects the environment onto the 9 spherical harmonics basis functions (the integral of the radiance times each
+/// basis function over the sphere). Rows are spread over the job system, every job sums its rows SIMD_WIDTH pixels at a time,
+/// and the partial sums are added up in a fixed order, so the result does not depend on the number of threads.
+/// </summary>
+/// <param name="image">Environment image</param>
+/// <param name="jobSystem">Job system to run the rows on</param>
+/// <returns>Radiance coefficients</returns>
+ShCoefficients ProjectEnvironmentToSh(const EnvironmentImage& image, JobSystem& jobSystem)
+{
+    const int width = image.width;
+    const int height = image.height;
+
+    // every pixel of a row has the same height on the sphere, so only the angle around it changes along the row
+    std::vector<float> cosPhi(width), sinPhi(width);
+    for (int x = 0; x < width; x++)
+    {
+        float phi = 2.0f * pi * (x + 0.5f) / width;
+        cosPhi[x] = std::cos(phi);
+        sinPhi[x] = std::sin(phi);
+    }
+
+    // 9 coefficients times 3 channels per job, summed in double so that big images do not lose the small rows
+    const int sumCount = shCoefficientCount * 3;
+    size_t jobCount = (height + shRowsPerJob - 1) / shRowsPerJob;
+    std::vector<double> jobSums(jobCount * sumCount, 0.0);
+
+    jobSystem.ParallelFor("sh projection", height, shRowsPerJob, [&](size_t begin, size_t end)
+    {
+        double* sums = jobSums.data() + (begin / shRowsPerJob) * sumCount;
+        for (size_t y = begin; y < end; y++)
+        {
+            float theta = pi * (y + 0.5f) / height;
+            float sinTheta = std::sin(theta);
+            float cosTheta = std::cos(theta);
+            const float* r = image.r.data() + y * width;
+            const float* g = image.g.data() + y * width;
+            const float* b = image.b.data() + y * width;
+
+            // sums of the row, before they are weighted by the solid angle its pixels cover
+            float rowSums[shCoefficientCount * 3] = {};
+            int x = 0;
+
+#if SIMD_WIDTH > 1
+            SimdFloat accumulators[shCoefficientCount * 3];
+            for (SimdFloat& accumulator : accumulators)
+            {
+                accumulator = SimdSet(0.0f);
+            }
+
+            const SimdFloat k0 = SimdSet(shK0), k1 = SimdSet(shK1), k2 = SimdSet(shK2), k3 = SimdSet(shK3), k4 = SimdSet(shK4);
+            const SimdFloat three = SimdSet(3.0f), one = SimdSet(1.0f);
+            const SimdFloat rowY = SimdSet(cosTheta), rowSin = SimdSet(sinTheta);
+            for (; x + SIMD_WIDTH <= width; x += SIMD_WIDTH)
+            {
+                SimdFloat dx = SimdMul(rowSin, SimdLoad(&cosPhi[x]));
+                SimdFloat dz = SimdMul(rowSin, SimdLoad(&sinPhi[x]));
+                SimdFloat dy = rowY;
+
+                SimdFloat basis[shCoefficientCount] = {
+                    k0,
+                    SimdMul(k1, dy),
+                    SimdMul(k1, dz),
+                    SimdMul(k1, dx),
+                    SimdMul(k2, SimdMul(dx, dy)),
+                    SimdMul(k2, SimdMul(dy, dz)),
+                    SimdMul(k3, SimdSub(SimdMul(three, SimdMul(dz, dz)), one)),
+                    SimdMul(k2, SimdMul(dx, dz)),
+                    SimdMul(k4, SimdSub(SimdMul(dx, dx), SimdMul(dy, dy)))
+                };
+
+                SimdFloat colorR = SimdLoad(r + x), colorG = SimdLoad(g + x), colorB = SimdLoad(b + x);
+                for (int i = 0; i < shCoefficientCount; i++)
+                {
+                    accumulators[3 * i] = SimdMulAdd(colorR, basis[i], accumulators[3 * i]);
+                    accumulators[3 * i + 1] = SimdMulAdd(colorG, basis[i], accumulators[3 * i + 1]);
+                    accumulators[3 * i + 2] = SimdMulAdd(colorB, basis[i], accumulators[3 * i + 2]);
+                }
+            }
+
+            for (int i = 0; i < sumCount; i++)
+            {
+                float lanes[SIMD_WIDTH];
+                SimdStore(lanes, accumulators[i]);
+                for (float lane : lanes)
+                {
+                    rowSums[i] += lane;
+                }
+            }
+#endif
+
+            // the pixels left over at the end of the row (all of them without SIMD)
+            for (; x < width; x++)
+            {
+                float dx = sinTheta * cosPhi[x], dy = cosTheta, dz = sinTheta * sinPhi[x];
+                float basis[shCoefficientCount] = {
+                    shK0, shK1 * dy, shK1 * dz, shK1 * dx, shK2 * dx * dy, shK2 * dy * dz,
+                    shK3 * (3.0f * dz * dz - 1.0f), shK2 * dx * dz, shK4 * (dx * dx - dy * dy)
+                };
+                for (int i = 0; i < shCoefficientCount; i++)
+                {
+                    rowSums[3 * i] += r[x] * basis[i];
+                    rowSums[3 * i + 1] += g[x] * basis[i];
+                    rowSums[3 * i + 2] += b[x] * basis[i];
+                }
+            }
+
+            // solid angle of one pixel of this row: it shrinks towards the poles
+            double solidAngle = (2.0 * pi / width) * (pi / height) * sinTheta;
+            for (int i = 0; i < sumCount; i++)
+            {
+                sums[i] += rowSums[i] * solidAngle;
+            }
+        }
+    });
+
+    ShCoefficients radiance;
+    double totals[shCoefficientCount * 3] = {};
+    for (size_t job = 0; job < jobCount; job++)
+    {
+        for (int i = 0; i < sumCount; i++)
+        {
+            totals[i] += jobSums[job * sumCount + i];
+        }
+    }
+    for (int i = 0; i < shCoefficientCount; i++)
+    {
+        radiance.c[i] = glm::vec3(static_cast<float>(totals[3 * i]), static_cast<float>(totals[3 * i + 1]), static_cast<float>(totals[3 * i + 2]));
+    }
+    return radiance;
+}
+
+/// <summary>
+/// Turns radiance coefficients into the coefficients of the light a diffuse surface reflects (irradiance / pi),
+/// with the basis function constants folded in, so a shader evaluates it for a normal n with a handful of multiply-adds:
+/// c0 + c1 n.y + c2 n.z + c3 n.x + c4 n.x n.y + c5 n.y n.z + c6 (3 n.z^2 - 1) + c7 n.x n.z + c8 (n.x^2 - n.y^2).
+/// </summary>
+/// <param name="radiance">Radiance coefficients from ProjectEnvironmentToSh()</param>
+/// <returns>Coefficients ready for the AmbientSH uniform block</returns>
+ShCoefficients GetShaderIrradiance(const ShCoefficients& radiance)
+{
+    // Convolving with the cosine lobe scales band l by pi, 2 pi / 3 and pi / 4 (Ramamoorthi and Hanrahan),
+    // and a diffuse surface reflects irradiance / pi, so the pis cancel out.
+    const float bandScale[shCoefficientCount] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+    const float basisScale[shCoefficientCount] = { shK0, shK1, shK1, shK1, shK2, shK2, shK3, shK2, shK4 };
+
+    ShCoefficients irradiance;
+    for (int i = 0; i < shCoefficientCount; i++)
+    {
+        irradiance.c[i] = radiance.c[i] * (bandScale[i] * basisScale[i]);
+    }
+    return irradiance;
+}
+
+/// <summary>
+/// Creates the uniform buffer holding the AmbientSH block (one vec4 per coefficient, std140).
+/// </summary>
+/// <param name="irradiance">Coefficients from GetShaderIrradiance()</param>
+/// <returns>OpenGL handle to the uniform buffer</returns>
+GLuint CreateAmbientShBuffer(const ShCoefficients& irradiance)
+{
+    glm::vec4 block[shCoefficientCount];
+    for (int i = 0; i < shCoefficientCount; i++)
+    {
+        block[i] = glm::vec4(irradiance.c[i], 0.0f);
+    }
+
+    GLuint buffer = CreateGlResource(GlResourceType::Buffer, "ambient SH");
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(block), block, GL_STATIC_DRAW);
+    SetGlResourceBytes(GlResourceType::Buffer, buffer, sizeof(block));
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return buffer;
+}
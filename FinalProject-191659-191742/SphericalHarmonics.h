@@ -0,0 +1,73 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+class JobSystem;
+
+// number of coefficients of a 3-band (l = 0, 1, 2) spherical harmonics expansion
+const int shCoefficientCount = 9;
+
+/// <summary>
+/// Struct containing an equirectangular (latitude-longitude) environment image in linear color, one plane per channel.
+/// Row 0 looks straight up (+y), the last row straight down, and the columns go once around the horizon.
+/// </summary>
+struct EnvironmentImage
+{
+    int width = 0, height = 0;
+    std::vector<float> r, g, b;
+};
+
+/// <summary>
+/// Struct containing the 9 coefficients of a function on the sphere, one RGB value each,
+/// in the order (l, m) = (0, 0), (1, -1), (1, 0), (1, 1), (2, -2), (2, -1), (2, 0), (2, 1), (2, 2)
+/// </summary>
+struct ShCoefficients
+{
+    glm::vec3 c[shCoefficientCount];
+};
+
+/// <summary>
+/// Loads an environment image with stb_image (an HDR file as it is, an LDR file converted to linear color).
+/// </summary>
+/// <param name="path">Path to the image file</param>
+/// <param name="image">Receives the image</param>
+/// <returns>Whether the image could be loaded</returns>
+bool LoadEnvironmentImage(const std::string& path, EnvironmentImage& image);
+
+/// <summary>
+/// Builds a simple environment to use when no image is given: a blue sky fading into a warm floor,
+/// with a bright window on one side.
+/// </summary>
+/// <param name="width">Width of the image</param>
+/// <param name="height">Height of the image</param>
+EnvironmentImage BuildDefaultEnvironment(int width, int height);
+
+/// <summary>
+/// Projects the environment onto the 9 spherical harmonics basis functions (the integral of the radiance times each
+/// basis function over the sphere). Rows are spread over the job system, every job sums its rows SIMD_WIDTH pixels at a time,
+/// and the partial sums are added up in a fixed order, so the result does not depend on the number of threads.
+/// </summary>
+/// <param name="image">Environment image</param>
+/// <param name="jobSystem">Job system to run the rows on</param>
+/// <returns>Radiance coefficients</returns>
+ShCoefficients ProjectEnvironmentToSh(const EnvironmentImage& image, JobSystem& jobSystem);
+
+/// <summary>
+/// Turns radiance coefficients into the coefficients of the light a diffuse surface reflects (irradiance / pi),
+/// with the basis function constants folded in, so a shader evaluates it for a normal n with a handful of multiply-adds:
+/// c0 + c1 n.y + c2 n.z + c3 n.x + c4 n.x n.y + c5 n.y n.z + c6 (3 n.z^2 - 1) + c7 n.x n.z + c8 (n.x^2 - n.y^2).
+/// </summary>
+/// <param name="radiance">Radiance coefficients from ProjectEnvironmentToSh()</param>
+/// <returns>Coefficients ready for the AmbientSH uniform block</returns>
+ShCoefficients GetShaderIrradiance(const ShCoefficients& radiance);
+
+/// <summary>
+/// Creates the uniform buffer holding the AmbientSH block (one vec4 per coefficient, std140).
+/// </summary>
+/// <param name="irradiance">Coefficients from GetShaderIrradiance()</param>
+/// <returns>OpenGL handle to the uniform buffer</returns>
+GLuint CreateAmbientShBuffer(const ShCoefficients& irradiance);
@@ -0,0 +1,211 @@
+#include "StreamBuffer.h"
+#include "GlResources.h"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// buffer storage is core in 4.4, so a 3.3 loader does not know about it
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+typedef void (APIENTRYP BufferStorageFunction)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+/// <summary>
+/// Returns glBufferStorage() if the current context has it, or null.
+/// </summary>
+static BufferStorageFunction GetBufferStorage()
+{
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major > 4 || (major == 4 && minor >= 4) || glfwExtensionSupported("GL_ARB_buffer_storage"))
+    {
+        return reinterpret_cast<BufferStorageFunction>(glfwGetProcAddress("glBufferStorage"));
+    }
+    return nullptr;
+}
+
+/// <summary>
+/// Creates the buffer.
+/// </summary>
+/// <param name="segmentSize">Bytes that can be written per frame</param>
+/// <param name="segmentCount">Number of frames that can be in flight at once</param>
+/// <param name="allowPersistent">Whether to use a persistent mapping when the context supports it</param>
+StreamBuffer::StreamBuffer(size_t segmentSize, int segmentCount, bool allowPersistent)
+    : segmentSize((segmentSize + 255) / 256 * 256), // keeps every segment aligned for uniform blocks
+    segmentCount(std::min(std::max(segmentCount, 1), 8))
+{
+    size_t totalSize = this->segmentSize * this->segmentCount;
+
+    // a binding point nothing else uses, so creating and mapping the buffer does not disturb the other bindings
+    buffer = CreateGlResource(GlResourceType::Buffer, "stream buffer");
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+
+    BufferStorageFunction bufferStorage = allowPersistent ? GetBufferStorage() : nullptr;
+    if (bufferStorage != nullptr)
+    {
+        // coherent, so the GPU sees the writes without flushing; the fences are all the synchronization needed
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        bufferStorage(GL_COPY_WRITE_BUFFER, totalSize, nullptr, flags);
+        persistent = static_cast<char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, totalSize, flags));
+        if (persistent == nullptr)
+        {
+            std::cerr << "Failed to map the stream buffer persistently, using orphaning instead" << std::endl;
+            DeleteGlResource(GlResourceType::Buffer, buffer);
+            buffer = CreateGlResource(GlResourceType::Buffer, "stream buffer");
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        }
+    }
+    if (persistent == nullptr)
+    {
+        glBufferData(GL_COPY_WRITE_BUFFER, totalSize, nullptr, GL_STREAM_DRAW);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    SetGlResourceBytes(GlResourceType::Buffer, buffer, totalSize);
+}
+
+/// <summary>
+/// Deletes the buffer and the fences. Must be called while the context is still current.
+/// </summary>
+void StreamBuffer::Delete()
+{
+    for (GLsync& fence : fences)
+    {
+        if (fence != nullptr)
+        {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+
+    // deleting the buffer also ends a persistent mapping
+    DeleteGlResource(GlResourceType::Buffer, buffer);
+    persistent = nullptr;
+}
+
+/// <summary>
+/// Moves on to the next segment, and makes sure the GPU is done with what was written there segmentCount frames ago.
+/// </summary>
+void StreamBuffer::BeginFrame()
+{
+    currentSegment = (currentSegment + 1) % segmentCount;
+    segmentUsed = 0;
+    fenceWaitMs = 0.0;
+
+    GLsync& fence = fences[currentSegment];
+    if (fence == nullptr)
+    {
+        return;
+    }
+
+    if (persistent != nullptr)
+    {
+        // the mapping cannot be swapped for fresh storage, so wait (flushing once, so the fence is sure to be reached)
+        auto waitStart = std::chrono::steady_clock::now();
+        GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while (result == GL_TIMEOUT_EXPIRED)
+        {
+            result = glClientWaitSync(fence, 0, 1000000); // 1 ms
+        }
+        if (result == GL_WAIT_FAILED)
+        {
+            std::cerr << "Failed to wait for the stream buffer fence!" << std::endl;
+        }
+        fenceWaitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+    }
+    else if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+    {
+        // The GPU is still reading this segment. Rather than wait, orphan the buffer: the driver keeps the old
+        // storage alive for the draws that still need it and gives us new storage, which nothing is reading yet.
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, segmentSize * segmentCount, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        orphanCount++;
+
+        for (GLsync& other : fences)
+        {
+            if (other != nullptr && other != fence)
+            {
+                glDeleteSync(other);
+                other = nullptr;
+            }
+        }
+    }
+
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+/// <summary>
+/// Returns memory to write bytes of data into, from the current segment. Only one range can be mapped at a time,
+/// and it has to be unmapped before drawing. Worker threads may write to the memory, but only this thread may map.
+/// </summary>
+/// <param name="bytes">Number of bytes to write</param>
+/// <param name="alignment">Alignment of the offset in the buffer (e.g. GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT)</param>
+/// <param name="offset">Receives the offset of the range in the buffer</param>
+/// <returns>Pointer to write to, or null if the segment is full</returns>
+void* StreamBuffer::Map(size_t bytes, size_t alignment, size_t& offset)
+{
+    if (bytes == 0 || mapped)
+    {
+        return nullptr;
+    }
+
+    size_t segmentStart = currentSegment * segmentSize;
+    size_t start = (segmentStart + segmentUsed + alignment - 1) / alignment * alignment;
+    if (start + bytes > segmentStart + segmentSize)
+    {
+        if (!reportedFull)
+        {
+            std::cerr << "Stream buffer segment is full (" << segmentSize << " bytes per frame)!" << std::endl;
+            reportedFull = true;
+        }
+        return nullptr;
+    }
+
+    offset = start;
+    segmentUsed = start + bytes - segmentStart;
+
+    if (persistent != nullptr)
+    {
+        return persistent + start;
+    }
+
+    // the fences already guarantee the GPU is done with this range, so the driver does not need to check
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    void* data = glMapBufferRange(GL_COPY_WRITE_BUFFER, start, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    mapped = data != nullptr;
+    return data;
+}
+
+/// <summary>
+/// Ends the write started with Map().
+/// </summary>
+void StreamBuffer::Unmap()
+{
+    if (mapped)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        mapped = false;
+    }
+}
+
+/// <summary>
+/// Places the fence that guards the current segment. Call after the last draw that reads from it.
+/// </summary>
+void StreamBuffer::EndFrame()
+{
+    fences[currentSegment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
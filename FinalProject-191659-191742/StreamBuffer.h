@@ -0,0 +1,98 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+
+/// <summary>
+/// Buffer for data that is rewritten every frame (instance matrices, uniform blocks).
+/// The buffer is split into segmentCount segments used in turn, one per frame, and each segment is guarded by a fence
+/// placed after the frame's draws, so the CPU never writes over data the GPU has not read yet.
+/// On GL 4.4 (or with ARB_buffer_storage) the whole buffer stays mapped for its lifetime (persistent, coherent).
+/// Otherwise every write maps its range unsynchronized, and if the GPU is still behind when a segment comes around,
+/// the buffer is orphaned instead of waited on, so the driver hands out fresh storage.
+/// </summary>
+class StreamBuffer
+{
+public:
+    /// <summary>
+    /// Creates the buffer.
+    /// </summary>
+    /// <param name="segmentSize">Bytes that can be written per frame</param>
+    /// <param name="segmentCount">Number of frames that can be in flight at once</param>
+    /// <param name="allowPersistent">Whether to use a persistent mapping when the context supports it</param>
+    StreamBuffer(size_t segmentSize, int segmentCount = 3, bool allowPersistent = true);
+
+    StreamBuffer(const StreamBuffer&) = delete;
+    StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+    /// <summary>
+    /// Deletes the buffer and the fences. Must be called while the context is still current.
+    /// </summary>
+    void Delete();
+
+    /// <summary>
+    /// Returns the OpenGL handle of the buffer (it never changes, so vertex array objects can keep pointing at it).
+    /// </summary>
+    GLuint Buffer() const { return buffer; }
+
+    /// <summary>
+    /// Returns whether the buffer is persistently mapped.
+    /// </summary>
+    bool IsPersistent() const { return persistent != nullptr; }
+
+    /// <summary>
+    /// Moves on to the next segment, and makes sure the GPU is done with what was written there segmentCount frames ago.
+    /// </summary>
+    void BeginFrame();
+
+    /// <summary>
+    /// Returns memory to write bytes of data into, from the current segment. Only one range can be mapped at a time,
+    /// and it has to be unmapped before drawing. Worker threads may write to the memory, but only this thread may map.
+    /// </summary>
+    /// <param name="bytes">Number of bytes to write</param>
+    /// <param name="alignment">Alignment of the offset in the buffer (e.g. GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT)</param>
+    /// <param name="offset">Receives the offset of the range in the buffer</param>
+    /// <returns>Pointer to write to, or null if the segment is full</returns>
+    void* Map(size_t bytes, size_t alignment, size_t& offset);
+
+    /// <summary>
+    /// Ends the write started with Map().
+    /// </summary>
+    void Unmap();
+
+    /// <summary>
+    /// Places the fence that guards the current segment. Call after the last draw that reads from it.
+    /// </summary>
+    void EndFrame();
+
+    /// <summary>
+    /// Returns the bytes written in the current frame.
+    /// </summary>
+    size_t BytesStreamed() const { return segmentUsed; }
+
+    /// <summary>
+    /// Returns the milliseconds BeginFrame() spent waiting for the GPU in the current frame.
+    /// </summary>
+    double FenceWaitMs() const { return fenceWaitMs; }
+
+    /// <summary>
+    /// Returns how many times the buffer was orphaned because the GPU was behind (only without a persistent mapping).
+    /// </summary>
+    uint64_t OrphanCount() const { return orphanCount; }
+
+private:
+    GLuint buffer = 0;
+    size_t segmentSize;
+    int segmentCount;
+    int currentSegment = 0;
+    size_t segmentUsed = 0;         // bytes handed out from the current segment
+    char* persistent = nullptr;     // the whole buffer, when it is persistently mapped
+    bool mapped = false;
+    bool reportedFull = false;      // the segment running full is only reported once
+    GLsync fences[8] = {};          // one per segment, null once the GPU is known to be done with it
+
+    double fenceWaitMs = 0.0;
+    uint64_t orphanCount = 0;
+};
@@ -0,0 +1,338 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+std::atomic<bool> traceRecording{ false };
+
+// the clock starts when the program is loaded, so the startup phases show up from (almost) zero
+static const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+/// <summary>
+/// Struct containing one finished scope
+/// </summary>
+struct TraceEvent
+{
+    const char* name;
+    uint64_t start, end;
+};
+
+/// <summary>
+/// Struct containing a block of events of one thread. Only the owning thread appends, and it publishes every event
+/// by bumping count afterwards, so the thread writing the trace can read up to count at any time without a lock.
+/// </summary>
+struct TraceChunk
+{
+    static const size_t capacity = 4096;
+
+    TraceEvent events[capacity];
+    std::atomic<size_t> count{ 0 };
+    std::atomic<TraceChunk*> next{ nullptr };   // chunks are only ever added to the end, never removed
+};
+
+/// <summary>
+/// Struct containing the events of one thread
+/// </summary>
+struct TraceThread
+{
+    TraceChunk* first = nullptr;
+    std::atomic<TraceChunk*> current{ nullptr };    // chunk being appended to
+    size_t chunkCount = 0;                          // only touched by the owning thread
+    std::atomic<uint64_t> dropped{ 0 };             // events that did not fit into maxTraceChunks
+    int id = 0;
+    std::string name;                               // guarded by traceThreadsMutex
+};
+
+// Every thread that ever recorded an event, in the order they first did. The buffers are kept (and reused by the next
+// recording) even after their thread ends, so that the events of short-lived threads still make it into the trace.
+static std::mutex traceThreadsMutex;
+static std::vector<TraceThread*> traceThreads;
+static thread_local TraceThread* currentTraceThread = nullptr;
+
+static const size_t maxTraceChunks = 256;   // per thread and recording, i.e. about a million events (24 MB)
+static std::atomic<uint64_t> traceStartTime{ 0 };
+
+/// <summary>
+/// Returns nanoseconds since the process started, from a monotonic clock (the clock every trace event uses).
+/// </summary>
+uint64_t TraceNow()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - traceEpoch).count());
+}
+
+/// <summary>
+/// Returns the buffer of the calling thread, creating it the first time the thread records something.
+/// </summary>
+static TraceThread* GetTraceThread()
+{
+    if (currentTraceThread == nullptr)
+    {
+        TraceThread* thread = new TraceThread();
+        thread->first = new TraceChunk();
+        thread->current.store(thread->first, std::memory_order_relaxed);
+        thread->chunkCount = 1;
+
+        std::lock_guard<std::mutex> lock(traceThreadsMutex);
+        thread->id = static_cast<int>(traceThreads.size()) + 1;
+        thread->name = "thread " + std::to_string(thread->id);
+        traceThreads.push_back(thread);
+        currentTraceThread = thread;
+    }
+    return currentTraceThread;
+}
+
+/// <summary>
+/// Names the calling thread's lane in the trace.
+/// </summary>
+/// <param name="name">Name of the thread</param>
+void SetTraceThreadName(const std::string& name)
+{
+    TraceThread* thread = GetTraceThread();
+    std::lock_guard<std::mutex> lock(traceThreadsMutex);
+    thread->name = name;
+}
+
+/// <summary>
+/// Starts recording scopes, on every thread. Events from an earlier recording are forgotten.
+/// </summary>
+void StartTracing()
+{
+    if (IsTracing())
+    {
+        return;
+    }
+
+    // Empty every buffer, keeping its chunks for this recording. Nobody is appending while recording is off
+    // (except a scope that was already past its check when the last recording stopped, long ago by now).
+    {
+        std::lock_guard<std::mutex> lock(traceThreadsMutex);
+        for (TraceThread* thread : traceThreads)
+        {
+            for (TraceChunk* chunk = thread->first; chunk != nullptr; chunk = chunk->next.load(std::memory_order_acquire))
+            {
+                chunk->count.store(0, std::memory_order_relaxed);
+            }
+            thread->current.store(thread->first, std::memory_order_relaxed);
+            thread->dropped.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    traceStartTime.store(TraceNow(), std::memory_order_relaxed);
+    traceRecording.store(true, std::memory_order_release);
+}
+
+/// <summary>
+/// Appends a finished scope to the calling thread's buffer. Takes no lock: every thread only ever writes to its own buffer.
+/// Does nothing while not recording.
+/// </summary>
+/// <param name="name">Name of the scope, must stay alive until the trace is written (e.g. a string literal)</param>
+/// <param name="start">When the scope began (TraceNow())</param>
+/// <param name="end">When the scope ended (TraceNow())</param>
+void RecordTraceEvent(const char* name, uint64_t start, uint64_t end)
+{
+    if (!IsTracing())
+    {
+        return;
+    }
+
+    TraceThread* thread = GetTraceThread();
+    TraceChunk* chunk = thread->current.load(std::memory_order_relaxed);
+    size_t count = chunk->count.load(std::memory_order_relaxed);
+    if (count == TraceChunk::capacity)
+    {
+        // move on to the next chunk, left over from an earlier recording or new
+        TraceChunk* next = chunk->next.load(std::memory_order_relaxed);
+        if (next == nullptr)
+        {
+            if (thread->chunkCount == maxTraceChunks)
+            {
+                thread->dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            next = new TraceChunk();
+            thread->chunkCount++;
+            chunk->next.store(next, std::memory_order_release);
+        }
+        thread->current.store(next, std::memory_order_relaxed);
+        chunk = next;
+        count = 0;
+    }
+
+    chunk->events[count] = { name, start, end };
+    chunk->count.store(count + 1, std::memory_order_release);
+}
+
+/// <summary>
+/// Writes a string as a JSON string literal.
+/// </summary>
+static void WriteJsonString(std::FILE* file, const char* text)
+{
+    std::fputc('"', file);
+    for (const char* c = text; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            std::fputc('\\', file);
+            std::fputc(*c, file);
+        }
+        else if (static_cast<unsigned char>(*c) < 0x20)
+        {
+            std::fprintf(file, "\\u%04x", static_cast<unsigned>(*c));
+        }
+        else
+        {
+            std::fputc(*c, file);
+        }
+    }
+    std::fputc('"', file);
+}
+
+/// <summary>
+/// Stops recording and writes everything recorded since StartTracing() as Chrome trace-event JSON,
+/// which chrome://tracing and ui.perfetto.dev open (one lane per thread).
+/// </summary>
+/// <param name="path">Path to the JSON file</param>
+/// <returns>Whether the file could be written</returns>
+bool StopTracing(const std::string& path)
+{
+    if (!traceRecording.exchange(false, std::memory_order_acq_rel))
+    {
+        return false;
+    }
+
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "Failed to create trace file " << path << "!" << std::endl;
+        return false;
+    }
+
+    // Every scope becomes a complete ("X") event, with its start and duration in microseconds since the program started.
+    // A scope that began before the recording did (and ended during it) is left out.
+    uint64_t startTime = traceStartTime.load(std::memory_order_relaxed);
+    size_t eventCount = 0;
+    uint64_t droppedCount = 0;
+
+    std::lock_guard<std::mutex> lock(traceThreadsMutex);
+    std::fputs("{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Rolling D20s\"}}", file);
+    for (TraceThread* thread : traceThreads)
+    {
+        std::fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", thread->id);
+        WriteJsonString(file, thread->name.c_str());
+        std::fputs("}}", file);
+
+        for (TraceChunk* chunk = thread->first; chunk != nullptr; chunk = chunk->next.load(std::memory_order_acquire))
+        {
+            size_t count = chunk->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; i++)
+            {
+                const TraceEvent& event = chunk->events[i];
+                if (event.start < startTime)
+                {
+                    continue;
+                }
+                std::fputs(",\n{\"name\":", file);
+                WriteJsonString(file, event.name);
+                // (printed as whole microseconds and nanoseconds, which is much faster than printing doubles)
+                uint64_t duration = event.end - event.start;
+                std::fprintf(file, ",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":1,\"tid\":%d}",
+                    static_cast<unsigned long long>(event.start / 1000), static_cast<unsigned>(event.start % 1000),
+                    static_cast<unsigned long long>(duration / 1000), static_cast<unsigned>(duration % 1000), thread->id);
+                eventCount++;
+            }
+        }
+        droppedCount += thread->dropped.load(std::memory_order_relaxed);
+    }
+    std::fputs("\n],\"displayTimeUnit\":\"ms\"}\n", file);
+
+    bool written = std::ferror(file) == 0;
+    written = std::fclose(file) == 0 && written;
+    if (!written)
+    {
+        std::cerr << "Failed to write trace file " << path << "!" << std::endl;
+        return false;
+    }
+
+    std::cout << "trace: wrote " << eventCount << " events from " << traceThreads.size() << " threads to " << path;
+    if (droppedCount > 0)
+    {
+        std::cout << " (" << droppedCount << " dropped from full buffers)";
+    }
+    std::cout << ", open it in chrome://tracing or ui.perfetto.dev" << std::endl;
+    return true;
+}
+
+/// <summary>
+/// Measures what a scope costs with tracing off and on, and how long writing the trace takes, and prints the results.
+/// </summary>
+/// <param name="scopeCount">Number of scopes to time</param>
+void RunTraceBenchmark(int scopeCount)
+{
+    const char* path = "bench_trace.json";
+    scopeCount = std::max(scopeCount, 1);
+
+    // the work inside the scopes, so that the loop cannot be thrown away
+    volatile uint64_t sink = 0;
+    auto timeScopes = [&](int count)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++)
+        {
+            TraceScope scope("bench scope");
+            sink = sink + 1;
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+    };
+
+    // no scopes at all, for comparison
+    auto baselineStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < scopeCount; i++)
+    {
+        sink = sink + 1;
+    }
+    double baselineNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - baselineStart).count() / scopeCount;
+
+    double offNs = timeScopes(scopeCount);
+
+    // on, first from this thread alone (no more scopes than fit into its buffer), then from every hardware thread at once (each appending to its own buffer)
+    int onCount = static_cast<int>(std::min<size_t>(scopeCount, maxTraceChunks * TraceChunk::capacity));
+    StartTracing();
+    double onNs = timeScopes(onCount);
+    int threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    std::vector<double> threadNs(threadCount);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++)
+    {
+        threads.emplace_back([&, t]()
+        {
+            SetTraceThreadName("bench " + std::to_string(t));
+            threadNs[t] = timeScopes((onCount + threadCount - 1) / threadCount);
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    double parallelNs = 0.0;
+    for (double ns : threadNs)
+    {
+        parallelNs = std::max(parallelNs, ns);
+    }
+
+    auto writeStart = std::chrono::steady_clock::now();
+    StopTracing(path);
+    double writeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - writeStart).count();
+    std::remove(path);
+
+    std::cout << "trace: " << scopeCount << " scopes, loop alone " << baselineNs << " ns per iteration" << std::endl;
+    std::cout << "  tracing off: " << offNs - baselineNs << " ns per scope" << std::endl;
+    std::cout << "  tracing on:  " << onNs - baselineNs << " ns per scope on one thread, "
+        << parallelNs - baselineNs << " ns per scope on each of " << threadCount << " threads at once" << std::endl;
+    std::cout << "  writing the trace: " << writeMs << " ms" << std::endl;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// whether scopes are being recorded right now (read on every scope, so it stays a plain flag)
+extern std::atomic<bool> traceRecording;
+
+/// <summary>
+/// Returns whether scopes are being recorded.
+/// </summary>
+inline bool IsTracing()
+{
+    return traceRecording.load(std::memory_order_relaxed);
+}
+
+/// <summary>
+/// Returns nanoseconds since the process started, from a monotonic clock (the clock every trace event uses).
+/// </summary>
+uint64_t TraceNow();
+
+/// <summary>
+/// Starts recording scopes, on every thread. Events from an earlier recording are forgotten.
+/// </summary>
+void StartTracing();
+
+/// <summary>
+/// Stops recording and writes everything recorded since StartTracing() as Chrome trace-event JSON,
+/// which chrome://tracing and ui.perfetto.dev open (one lane per thread).
+/// </summary>
+/// <param name="path">Path to the JSON file</param>
+/// <returns>Whether the file could be written</returns>
+bool StopTracing(const std::string& path);
+
+/// <summary>
+/// Appends a finished scope to the calling thread's buffer. Takes no lock: every thread only ever writes to its own buffer.
+/// Does nothing while not recording.
+/// </summary>
+/// <param name="name">Name of the scope, must stay alive until the trace is written (e.g. a string literal)</param>
+/// <param name="start">When the scope began (TraceNow())</param>
+/// <param name="end">When the scope ended (TraceNow())</param>
+void RecordTraceEvent(const char* name, uint64_t start, uint64_t end);
+
+/// <summary>
+/// Names the calling thread's lane in the trace.
+/// </summary>
+/// <param name="name">Name of the thread</param>
+void SetTraceThreadName(const std::string& name);
+
+/// <summary>
+/// Records the time from its construction to its destruction (or End()) as one event on the calling thread.
+/// While not recording, it costs a single relaxed load and no clock reads.
+/// </summary>
+class TraceScope
+{
+public:
+    /// <summary>
+    /// Starts the scope, if recording.
+    /// </summary>
+    /// <param name="name">Name of the scope, must stay alive until the trace is written (e.g. a string literal)</param>
+    explicit TraceScope(const char* name)
+        : name(IsTracing() ? name : nullptr), start(this->name != nullptr ? TraceNow() : 0)
+    {
+    }
+
+    ~TraceScope()
+    {
+        End();
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    /// <summary>
+    /// Ends the scope before it goes out of scope. Calling it again does nothing.
+    /// </summary>
+    void End()
+    {
+        if (name != nullptr)
+        {
+            RecordTraceEvent(name, start, TraceNow());
+            name = nullptr;
+        }
+    }
+
+private:
+    const char* name;
+    uint64_t start;
+};
+
+/// <summary>
+/// Measures what a scope costs with tracing off and on, and how long writing the trace takes, and prints the results.
+/// </summary>
+/// <param name="scopeCount">Number of scopes to time</param>
+void RunTraceBenchmark(int scopeCount);
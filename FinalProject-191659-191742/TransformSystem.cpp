@@ -0,0 +1,481 @@
+#include "TransformSystem.h"
+#include "Simd.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+// number of floats in the matrices of a DieInstance (two 4x4 matrices; the material index after them is copied separately)
+static const int instanceFloatCount = 2 * 16;
+
+#if SIMD_WIDTH > 1
+
+/// <summary>
+/// Builds the matrices of SIMD_WIDTH dice at once, from their rotation, scale and position (one die per lane).
+/// Every register holds the same matrix element for all the dice, so no shuffling is needed
+/// until the end, where the registers are transposed back into one DieInstance per die.
+/// </summary>
+/// <param name="x">Rotation quaternion, x component</param>
+/// <param name="y">Rotation quaternion, y component</param>
+/// <param name="z">Rotation quaternion, z component</param>
+/// <param name="w">Rotation quaternion, w component</param>
+/// <param name="s">Uniform scale</param>
+/// <param name="position">Position (3 registers: x, y, z)</param>
+/// <param name="vpp">viewProj * parent, broadcast (16 registers)</param>
+/// <param name="parent">parent, broadcast (16 registers)</param>
+/// <param name="out">Destination, receives SIMD_WIDTH instances</param>
+static inline void ComposeLanes(SimdFloat x, SimdFloat y, SimdFloat z, SimdFloat w, SimdFloat s, const SimdFloat position[3],
+    const SimdFloat vpp[16], const SimdFloat parent[16], DieInstance* out)
+{
+    const SimdFloat two = SimdSet(2.0f);
+    SimdFloat s2 = SimdMul(s, two);
+
+    SimdFloat xx = SimdMul(x, x), yy = SimdMul(y, y), zz = SimdMul(z, z);
+    SimdFloat xy = SimdMul(x, y), xz = SimdMul(x, z), yz = SimdMul(y, z);
+    SimdFloat wx = SimdMul(w, x), wy = SimdMul(w, y), wz = SimdMul(w, z);
+
+    // local = translate * rotate * scale, as 3 scaled rotation columns plus the translation
+    SimdFloat local[12];
+    local[0] = SimdSub(s, SimdMul(s2, SimdAdd(yy, zz)));
+    local[1] = SimdMul(s2, SimdAdd(xy, wz));
+    local[2] = SimdMul(s2, SimdSub(xz, wy));
+    local[3] = SimdMul(s2, SimdSub(xy, wz));
+    local[4] = SimdSub(s, SimdMul(s2, SimdAdd(xx, zz)));
+    local[5] = SimdMul(s2, SimdAdd(yz, wx));
+    local[6] = SimdMul(s2, SimdAdd(xz, wy));
+    local[7] = SimdMul(s2, SimdSub(yz, wx));
+    local[8] = SimdSub(s, SimdMul(s2, SimdAdd(xx, yy)));
+    local[9] = position[0];
+    local[10] = position[1];
+    local[11] = position[2];
+
+    // build the instance SIMD_WIDTH floats at a time (rows[j] holds float block + j of every die),
+    // then transpose the block and write it out, so only a few registers are live at once
+    for (int block = 0; block < instanceFloatCount; block += SIMD_WIDTH)
+    {
+        SimdFloat rows[SIMD_WIDTH];
+        for (int j = 0; j < SIMD_WIDTH; j++)
+        {
+            // the first matrix is the MVP (viewProj * parent * local), the second one is the model (parent * local)
+            int k = block + j;
+            const SimdFloat* p = k < 16 ? vpp : parent;
+            int column = (k % 16) / 4;
+            int row = k % 4;
+
+            if (column < 3)
+            {
+                rows[j] = SimdMulAdd(p[row], local[column * 3],
+                    SimdMulAdd(p[4 + row], local[column * 3 + 1], SimdMul(p[8 + row], local[column * 3 + 2])));
+            }
+            else
+            {
+                rows[j] = SimdMulAdd(p[row], local[9],
+                    SimdMulAdd(p[4 + row], local[10], SimdMulAdd(p[8 + row], local[11], p[12 + row])));
+            }
+        }
+
+        SimdTranspose(rows);
+        for (int lane = 0; lane < SIMD_WIDTH; lane++)
+        {
+            SimdStore(reinterpret_cast<float*>(out + lane) + block, rows[lane]);
+        }
+    }
+}
+
+/// <summary>
+/// Builds the matrices of SIMD_WIDTH consecutive dice at once.
+/// </summary>
+/// <param name="ts">Dice transforms</param>
+/// <param name="i">First die of the batch</param>
+/// <param name="vpp">viewProj * parent, broadcast (16 registers)</param>
+/// <param name="parent">parent, broadcast (16 registers)</param>
+/// <param name="out">Destination, receives SIMD_WIDTH instances</param>
+static inline void ComposeBatch(const TransformSystem& ts, size_t i, const SimdFloat vpp[16], const SimdFloat parent[16], DieInstance* out)
+{
+    SimdFloat position[3] = { SimdLoad(&ts.posX[i]), SimdLoad(&ts.posY[i]), SimdLoad(&ts.posZ[i]) };
+    ComposeLanes(SimdLoad(&ts.rotX[i]), SimdLoad(&ts.rotY[i]), SimdLoad(&ts.rotZ[i]), SimdLoad(&ts.rotW[i]),
+        SimdLoad(&ts.scale[i]), position, vpp, parent, out);
+    for (int lane = 0; lane < SIMD_WIDTH; lane++)
+    {
+        out[lane].material = ts.material[i + lane];
+    }
+}
+
+/// <summary>
+/// Builds the matrices of SIMD_WIDTH dice picked from anywhere in the transform system.
+/// </summary>
+/// <param name="ts">Dice transforms</param>
+/// <param name="indices">Indices of the dice in the batch (SIMD_WIDTH of them)</param>
+/// <param name="vpp">viewProj * parent, broadcast (16 registers)</param>
+/// <param name="parent">parent, broadcast (16 registers)</param>
+/// <param name="out">Destination, receives SIMD_WIDTH instances</param>
+static inline void ComposeGatheredBatch(const TransformSystem& ts, const uint32_t* indices, const SimdFloat vpp[16], const SimdFloat parent[16], DieInstance* out)
+{
+    SimdFloat position[3] = { SimdGather(ts.posX.data(), indices), SimdGather(ts.posY.data(), indices), SimdGather(ts.posZ.data(), indices) };
+    ComposeLanes(SimdGather(ts.rotX.data(), indices), SimdGather(ts.rotY.data(), indices), SimdGather(ts.rotZ.data(), indices),
+        SimdGather(ts.rotW.data(), indices), SimdGather(ts.scale.data(), indices), position, vpp, parent, out);
+    for (int lane = 0; lane < SIMD_WIDTH; lane++)
+    {
+        out[lane].material = ts.material[indices[lane]];
+    }
+}
+
+#endif
+
+/// <summary>
+/// Adds a die that spins around a fixed axis.
+/// </summary>
+/// <param name="position">Position of the die, relative to its parent</param>
+/// <param name="scale">Uniform scale of the die</param>
+/// <param name="spinAxis">Axis the die spins around (does not need to be normalized)</param>
+/// <param name="spinSpeed">Spin speed in radians per second</param>
+/// <param name="spinPhase">Angle of the die at time 0, in radians</param>
+/// <param name="material">Index of the die's material in the material table</param>
+/// <returns>Index of the new die</returns>
+size_t TransformSystem::Add(const glm::vec3& position, float scale, const glm::vec3& spinAxis, float spinSpeed, float spinPhase, uint32_t material)
+{
+    // the axis never changes, so normalize it once here instead of every frame like glm::rotate() does
+    glm::vec3 axis = glm::normalize(spinAxis);
+
+    posX.push_back(position.x);
+    posY.push_back(position.y);
+    posZ.push_back(position.z);
+    rotX.push_back(0.0f);
+    rotY.push_back(0.0f);
+    rotZ.push_back(0.0f);
+    rotW.push_back(1.0f);
+    this->scale.push_back(scale);
+    spinX.push_back(axis.x);
+    spinY.push_back(axis.y);
+    spinZ.push_back(axis.z);
+    this->spinSpeed.push_back(spinSpeed);
+    this->spinPhase.push_back(spinPhase);
+    this->material.push_back(material);
+
+    return posX.size() - 1;
+}
+
+/// <summary>
+/// Sets the rotation of every die in a range from its spin axis, speed and phase.
+/// </summary>
+/// <param name="time">Time in seconds</param>
+/// <param name="begin">First die to update</param>
+/// <param name="end">One past the last die to update</param>
+void TransformSystem::UpdateSpin(float time, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        float halfAngle = 0.5f * (time * spinSpeed[i] + spinPhase[i]);
+        float s = std::sin(halfAngle);
+        rotX[i] = spinX[i] * s;
+        rotY[i] = spinY[i] * s;
+        rotZ[i] = spinZ[i] * s;
+        rotW[i] = std::cos(halfAngle);
+    }
+}
+
+/// <summary>
+/// Same as UpdateSpin(), but only for the dice in a list (e.g. the ones that survived culling).
+/// </summary>
+/// <param name="time">Time in seconds</param>
+/// <param name="indices">Indices of the dice to update</param>
+/// <param name="count">Number of indices</param>
+void TransformSystem::UpdateSpinIndexed(float time, const uint32_t* indices, size_t count)
+{
+    for (size_t n = 0; n < count; n++)
+    {
+        uint32_t i = indices[n];
+        float halfAngle = 0.5f * (time * spinSpeed[i] + spinPhase[i]);
+        float s = std::sin(halfAngle);
+        rotX[i] = spinX[i] * s;
+        rotY[i] = spinY[i] * s;
+        rotZ[i] = spinZ[i] * s;
+        rotW[i] = std::cos(halfAngle);
+    }
+}
+
+/// <summary>
+/// Builds the model and MVP matrices for a range of dice and writes them to an instance buffer, along with their materials.
+/// Uses AVX2 (8 dice per iteration) or SSE (4 dice per iteration) when the compiler targets them.
+/// </summary>
+/// <param name="viewProj">Projection matrix multiplied by the view matrix</param>
+/// <param name="parent">World matrix of the node the dice are attached to</param>
+/// <param name="begin">First die to compose</param>
+/// <param name="end">One past the last die to compose</param>
+/// <param name="out">Destination, receives (end - begin) instances</param>
+void TransformSystem::Compose(const glm::mat4& viewProj, const glm::mat4& parent, size_t begin, size_t end, DieInstance* out) const
+{
+    size_t i = begin;
+
+#if SIMD_WIDTH > 1
+    // the parent is the same for the whole range, so fold it into the view-projection once
+    glm::mat4 viewProjParent = viewProj * parent;
+
+    SimdFloat vpp[16], par[16];
+    for (int k = 0; k < 16; k++)
+    {
+        vpp[k] = SimdSet(viewProjParent[k / 4][k % 4]);
+        par[k] = SimdSet(parent[k / 4][k % 4]);
+    }
+
+    for (; i + SIMD_WIDTH <= end; i += SIMD_WIDTH)
+    {
+        ComposeBatch(*this, i, vpp, par, out + (i - begin));
+    }
+#endif
+
+    // leftover dice that do not fill a whole batch
+    ComposeScalar(viewProj, parent, i, end, out + (i - begin));
+}
+
+/// <summary>
+/// Same as Compose(), but for the dice in a list, which are written out one after the other.
+/// Used to only build the matrices of the dice that survived culling.
+/// </summary>
+/// <param name="viewProj">Projection matrix multiplied by the view matrix</param>
+/// <param name="parent">World matrix of the node the dice are attached to</param>
+/// <param name="indices">Indices of the dice to compose</param>
+/// <param name="count">Number of indices</param>
+/// <param name="out">Destination, receives count instances</param>
+void TransformSystem::ComposeIndexed(const glm::mat4& viewProj, const glm::mat4& parent, const uint32_t* indices, size_t count, DieInstance* out) const
+{
+    size_t n = 0;
+
+#if SIMD_WIDTH > 1
+    glm::mat4 viewProjParent = viewProj * parent;
+
+    SimdFloat vpp[16], par[16];
+    for (int k = 0; k < 16; k++)
+    {
+        vpp[k] = SimdSet(viewProjParent[k / 4][k % 4]);
+        par[k] = SimdSet(parent[k / 4][k % 4]);
+    }
+
+    for (; n + SIMD_WIDTH <= count; n += SIMD_WIDTH)
+    {
+        ComposeGatheredBatch(*this, indices + n, vpp, par, out + n);
+    }
+#endif
+
+    for (; n < count; n++)
+    {
+        ComposeDie(indices[n], viewProj, parent, out[n]);
+    }
+}
+
+/// <summary>
+/// Writes what the vertex shader needs to spin a range of dice by itself (GPU spin mode).
+/// Dice are only scaled uniformly, so the spin commutes with the scale and the model matrix is base * rotation.
+/// </summary>
+/// <param name="parent">World matrix of the node the dice are attached to</param>
+/// <param name="begin">First die to write</param>
+/// <param name="end">One past the last die to write</param>
+/// <param name="out">Destination, receives (end - begin) instances</param>
+void TransformSystem::ComposeSpin(const glm::mat4& parent, size_t begin, size_t end, SpinInstance* out) const
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        glm::mat4 local = glm::mat4(1.0f);
+        local[0][0] = scale[i];
+        local[1][1] = scale[i];
+        local[2][2] = scale[i];
+        local[3] = glm::vec4(posX[i], posY[i], posZ[i], 1.0f);
+
+        SpinInstance& instance = out[i - begin];
+        instance.base = parent * local;
+        instance.spin = glm::vec4(spinX[i], spinY[i], spinZ[i], spinSpeed[i]);
+        instance.spinPhase = spinPhase[i];
+        instance.material = material[i];
+    }
+}
+
+/// <summary>
+/// Same as Compose(), but always uses plain scalar code. Used as a reference and for leftover dice.
+/// </summary>
+void TransformSystem::ComposeScalar(const glm::mat4& viewProj, const glm::mat4& parent, size_t begin, size_t end, DieInstance* out) const
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        ComposeDie(i, viewProj, parent, out[i - begin]);
+    }
+}
+
+/// <summary>
+/// Builds the model and MVP matrices of a single die with plain scalar code, and copies its material.
+/// </summary>
+void TransformSystem::ComposeDie(size_t i, const glm::mat4& viewProj, const glm::mat4& parent, DieInstance& out) const
+{
+    glm::quat rotation(rotW[i], rotX[i], rotY[i], rotZ[i]);
+    glm::mat4 local = glm::mat4_cast(rotation);
+    local[0] *= scale[i];
+    local[1] *= scale[i];
+    local[2] *= scale[i];
+    local[3] = glm::vec4(posX[i], posY[i], posZ[i], 1.0f);
+
+    out.model = parent * local;
+    out.mvp = viewProj * out.model;
+    out.material = material[i];
+}
+
+/// <summary>
+/// Compares the time it takes to build the matrices of many dice with chained
+/// glm::translate / glm::rotate / glm::scale calls against TransformSystem::Compose(), and prints the result.
+/// </summary>
+/// <param name="diceCount">Number of dice to build matrices for</param>
+void RunTransformBenchmark(int diceCount)
+{
+    const int iterations = 50;
+
+    TransformSystem transforms;
+    std::vector<glm::vec3> axes;
+    for (int i = 0; i < diceCount; i++)
+    {
+        glm::vec3 axis = glm::vec3(1.0f, -1.0f, -1.0f + 2.0f * (i % 7) / 7.0f);
+        axes.push_back(axis);
+        transforms.Add(glm::vec3(0.01f * i, 0.0f, -1.0f), 0.4f, axis, 1.0f, 0.0f);
+    }
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.5f, 0.0f, 1.25f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 persp = glm::perspective(90.0f, 1.0f, 0.1f, 100.0f);
+    glm::mat4 viewProj = persp * view;
+
+    std::vector<DieInstance> glmInstances(diceCount);
+    std::vector<DieInstance> simdInstances(diceCount);
+
+    // the path the render loop used to take for every die
+    auto glmStart = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        float time = 0.01f * iteration;
+        for (int i = 0; i < diceCount; i++)
+        {
+            glm::mat4 mat = glm::mat4(1.0f);
+            mat = glm::translate(mat, glm::vec3(transforms.posX[i], transforms.posY[i], transforms.posZ[i]));
+            mat = glm::rotate(mat, time, axes[i]);
+            mat = glm::scale(mat, glm::vec3(transforms.scale[i]));
+            glmInstances[i].model = mat;
+            glmInstances[i].mvp = persp * view * mat;
+        }
+    }
+    auto glmEnd = std::chrono::steady_clock::now();
+
+    // spin and compose are timed separately, since sin/cos cost the same on both paths
+    std::chrono::steady_clock::duration spinTime(0), composeTime(0);
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        float time = 0.01f * iteration;
+        auto spinStart = std::chrono::steady_clock::now();
+        transforms.UpdateSpin(time, 0, transforms.Count());
+        auto composeStart = std::chrono::steady_clock::now();
+        transforms.Compose(viewProj, glm::mat4(1.0f), 0, transforms.Count(), simdInstances.data());
+        auto composeEnd = std::chrono::steady_clock::now();
+        spinTime += composeStart - spinStart;
+        composeTime += composeEnd - composeStart;
+    }
+
+    // both paths built the matrices of the last iteration, so they should agree
+    float maxError = 0.0f;
+    for (int i = 0; i < diceCount; i++)
+    {
+        const float* a = reinterpret_cast<const float*>(&glmInstances[i]);
+        const float* b = reinterpret_cast<const float*>(&simdInstances[i]);
+        for (int k = 0; k < instanceFloatCount; k++)
+        {
+            maxError = std::max(maxError, std::fabs(a[k] - b[k]));
+        }
+    }
+
+    double glmNs = std::chrono::duration<double, std::nano>(glmEnd - glmStart).count() / (double(iterations) * diceCount);
+    double spinNs = std::chrono::duration<double, std::nano>(spinTime).count() / (double(iterations) * diceCount);
+    double composeNs = std::chrono::duration<double, std::nano>(composeTime).count() / (double(iterations) * diceCount);
+
+    std::cout << "transform benchmark: " << diceCount << " dice, " << SIMD_WIDTH << " dice per batch" << std::endl;
+    std::cout << "  glm translate/rotate/scale: " << glmNs << " ns per die" << std::endl;
+    std::cout << "  TransformSystem: " << spinNs + composeNs << " ns per die (" << glmNs / (spinNs + composeNs) << "x)"
+        << ", of which spin " << spinNs << " ns and compose " << composeNs << " ns" << std::endl;
+    std::cout << "  max difference: " << maxError << std::endl;
+}
+
+/// <summary>
+/// Builds the model matrix of a die at a time from its SpinInstance, the same way main.vsh does in GPU spin mode.
+/// </summary>
+/// <param name="instance">Static data of the die</param>
+/// <param name="time">Time in seconds</param>
+/// <returns>Model matrix</returns>
+glm::mat4 GetSpinModel(const SpinInstance& instance, float time)
+{
+    // same angle as TransformSystem::UpdateSpin()
+    float halfAngle = 0.5f * (time * instance.spin.w + instance.spinPhase);
+    float s = std::sin(halfAngle);
+    glm::quat rotation(std::cos(halfAngle), instance.spin.x * s, instance.spin.y * s, instance.spin.z * s);
+    return instance.base * glm::mat4_cast(rotation);
+}
+
+/// <summary>
+/// Compares what animating many dice costs the CPU every frame on the CPU path (spin, compose and stream the
+/// instances) against GPU spin mode (one time uniform, the static instances uploaded once), checks that both give
+/// the same matrices, and prints the result.
+/// </summary>
+/// <param name="diceCount">Number of dice to animate</param>
+void RunSpinBenchmark(int diceCount)
+{
+    const int iterations = 50;
+    diceCount = std::max(diceCount, 1);
+
+    TransformSystem transforms;
+    for (int i = 0; i < diceCount; i++)
+    {
+        glm::vec3 axis = glm::vec3(1.0f, -1.0f, -1.0f + 2.0f * (i % 7) / 7.0f);
+        transforms.Add(glm::vec3(0.01f * i, 0.0f, -1.0f), 0.1f, axis, 0.5f + 0.01f * (i % 100), 0.1f * (i % 31));
+    }
+
+    glm::mat4 parent = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, -1.0f));
+    glm::mat4 view = glm::lookAt(glm::vec3(0.5f, 0.0f, 1.25f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 persp = glm::perspective(90.0f, 1.0f, 0.1f, 100.0f);
+    glm::mat4 viewProj = persp * view;
+
+    // CPU path: every frame spins every die and writes its matrices into the instance buffer
+    std::vector<DieInstance> instances(diceCount);
+    float time = 0.0f;
+    auto cpuStart = std::chrono::steady_clock::now();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        time = 0.01f * iteration;
+        transforms.UpdateSpin(time, 0, transforms.Count());
+        transforms.Compose(viewProj, parent, 0, transforms.Count(), instances.data());
+    }
+    auto cpuEnd = std::chrono::steady_clock::now();
+
+    // GPU path: the static instances are written once, after that a frame only sets the time
+    std::vector<SpinInstance> spinInstances(diceCount);
+    auto gpuStart = std::chrono::steady_clock::now();
+    transforms.ComposeSpin(parent, 0, transforms.Count(), spinInstances.data());
+    auto gpuEnd = std::chrono::steady_clock::now();
+
+    // what the vertex shader builds has to match what the CPU built for the last frame
+    float maxError = 0.0f;
+    for (int i = 0; i < diceCount; i++)
+    {
+        glm::mat4 model = GetSpinModel(spinInstances[i], time);
+        for (int column = 0; column < 4; column++)
+        {
+            for (int row = 0; row < 4; row++)
+            {
+                maxError = std::max(maxError, std::fabs(model[column][row] - instances[i].model[column][row]));
+            }
+        }
+    }
+
+    double cpuMs = std::chrono::duration<double, std::milli>(cpuEnd - cpuStart).count() / iterations;
+    double buildMs = std::chrono::duration<double, std::milli>(gpuEnd - gpuStart).count();
+
+    std::cout << "spin benchmark: " << diceCount << " dice" << std::endl;
+    std::cout << "  CPU spin: " << cpuMs << " ms per frame (" << cpuMs * 1e6 / diceCount << " ns per die), "
+        << diceCount * sizeof(DieInstance) / 1024 << " KB streamed per frame" << std::endl;
+    std::cout << "  GPU spin: static instances built once in " << buildMs << " ms (" << diceCount * sizeof(SpinInstance) / 1024
+        << " KB uploaded once), then " << sizeof(float) << " bytes (the time uniform) per frame" << std::endl;
+    std::cout << "  max difference of the model matrices: " << maxError << std::endl;
+}
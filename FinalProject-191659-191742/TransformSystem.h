@@ -0,0 +1,154 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// <summary>
+/// Struct containing the data the instanced draw reads for every die
+/// </summary>
+struct DieInstance
+{
+    glm::mat4 mvp;      // persp * view * model
+    glm::mat4 model;    // model matrix, used for lighting in world space
+    uint32_t material;  // index into the material table (see Materials.h)
+};
+
+/// <summary>
+/// Struct containing what the vertex shader needs to spin a die by itself (GPU spin mode, see main.vsh).
+/// It holds everything but the time, so a buffer of these only changes when dice are added or their parent nodes move.
+/// </summary>
+struct SpinInstance
+{
+    glm::mat4 base;     // parent * translate * scale: the model matrix without the spin
+    glm::vec4 spin;     // spin axis (xyz, normalized) and speed in radians per second (w)
+    float spinPhase;    // angle at time 0, in radians
+    uint32_t material;  // index into the material table (see Materials.h)
+};
+
+/// <summary>
+/// Stores the position, rotation, scale, spin and material of every die in separate arrays (structure of arrays),
+/// so that the model and MVP matrices of many dice can be built several dice at a time with SIMD.
+/// </summary>
+class TransformSystem
+{
+public:
+    /// <summary>
+    /// Adds a die that spins around a fixed axis.
+    /// </summary>
+    /// <param name="position">Position of the die, relative to its parent</param>
+    /// <param name="scale">Uniform scale of the die</param>
+    /// <param name="spinAxis">Axis the die spins around (does not need to be normalized)</param>
+    /// <param name="spinSpeed">Spin speed in radians per second</param>
+    /// <param name="spinPhase">Angle of the die at time 0, in radians</param>
+    /// <param name="material">Index of the die's material in the material table</param>
+    /// <returns>Index of the new die</returns>
+    size_t Add(const glm::vec3& position, float scale, const glm::vec3& spinAxis, float spinSpeed, float spinPhase, uint32_t material = 0);
+
+    /// <summary>
+    /// Returns how many dice are stored.
+    /// </summary>
+    size_t Count() const { return posX.size(); }
+
+    /// <summary>
+    /// Returns whether a die never spins (a speed of 0 keeps it at the rotation of its phase).
+    /// </summary>
+    bool IsResting(size_t i) const { return spinSpeed[i] == 0.0f; }
+
+    /// <summary>
+    /// Sets the rotation of every die in a range from its spin axis, speed and phase.
+    /// </summary>
+    /// <param name="time">Time in seconds</param>
+    /// <param name="begin">First die to update</param>
+    /// <param name="end">One past the last die to update</param>
+    void UpdateSpin(float time, size_t begin, size_t end);
+
+    /// <summary>
+    /// Same as UpdateSpin(), but only for the dice in a list (e.g. the ones that survived culling).
+    /// </summary>
+    /// <param name="time">Time in seconds</param>
+    /// <param name="indices">Indices of the dice to update</param>
+    /// <param name="count">Number of indices</param>
+    void UpdateSpinIndexed(float time, const uint32_t* indices, size_t count);
+
+    /// <summary>
+    /// Builds the model and MVP matrices for a range of dice and writes them to an instance buffer, along with their materials.
+    /// Uses AVX2 (8 dice per iteration) or SSE (4 dice per iteration) when the compiler targets them.
+    /// </summary>
+    /// <param name="viewProj">Projection matrix multiplied by the view matrix</param>
+    /// <param name="parent">World matrix of the node the dice are attached to</param>
+    /// <param name="begin">First die to compose</param>
+    /// <param name="end">One past the last die to compose</param>
+    /// <param name="out">Destination, receives (end - begin) instances</param>
+    void Compose(const glm::mat4& viewProj, const glm::mat4& parent, size_t begin, size_t end, DieInstance* out) const;
+
+    /// <summary>
+    /// Same as Compose(), but always uses plain scalar code. Used as a reference and for leftover dice.
+    /// </summary>
+    void ComposeScalar(const glm::mat4& viewProj, const glm::mat4& parent, size_t begin, size_t end, DieInstance* out) const;
+
+    /// <summary>
+    /// Same as Compose(), but for the dice in a list, which are written out one after the other.
+    /// Used to only build the matrices of the dice that survived culling.
+    /// </summary>
+    /// <param name="viewProj">Projection matrix multiplied by the view matrix</param>
+    /// <param name="parent">World matrix of the node the dice are attached to</param>
+    /// <param name="indices">Indices of the dice to compose</param>
+    /// <param name="count">Number of indices</param>
+    /// <param name="out">Destination, receives count instances</param>
+    void ComposeIndexed(const glm::mat4& viewProj, const glm::mat4& parent, const uint32_t* indices, size_t count, DieInstance* out) const;
+
+    /// <summary>
+    /// Writes what the vertex shader needs to spin a range of dice by itself (GPU spin mode).
+    /// Dice are only scaled uniformly, so the spin commutes with the scale and the model matrix is base * rotation.
+    /// </summary>
+    /// <param name="parent">World matrix of the node the dice are attached to</param>
+    /// <param name="begin">First die to write</param>
+    /// <param name="end">One past the last die to write</param>
+    /// <param name="out">Destination, receives (end - begin) instances</param>
+    void ComposeSpin(const glm::mat4& parent, size_t begin, size_t end, SpinInstance* out) const;
+
+    // position
+    std::vector<float> posX, posY, posZ;
+
+    // rotation (unit quaternion)
+    std::vector<float> rotX, rotY, rotZ, rotW;
+
+    // uniform scale
+    std::vector<float> scale;
+
+    // spin axis (normalized once when the die is added), speed and phase
+    std::vector<float> spinX, spinY, spinZ, spinSpeed, spinPhase;
+
+    // index into the material table, copied into every instance as it is
+    std::vector<uint32_t> material;
+
+private:
+    void ComposeDie(size_t i, const glm::mat4& viewProj, const glm::mat4& parent, DieInstance& out) const;
+};
+
+/// <summary>
+/// Compares the time it takes to build the matrices of many dice with chained
+/// glm::translate / glm::rotate / glm::scale calls against TransformSystem::Compose(), and prints the result.
+/// </summary>
+/// <param name="diceCount">Number of dice to build matrices for</param>
+void RunTransformBenchmark(int diceCount);
+
+/// <summary>
+/// Builds the model matrix of a die at a time from its SpinInstance, the same way main.vsh does in GPU spin mode.
+/// </summary>
+/// <param name="instance">Static data of the die</param>
+/// <param name="time">Time in seconds</param>
+/// <returns>Model matrix</returns>
+glm::mat4 GetSpinModel(const SpinInstance& instance, float time);
+
+/// <summary>
+/// Compares what animating many dice costs the CPU every frame on the CPU path (spin, compose and stream the
+/// instances) against GPU spin mode (one time uniform, the static instances uploaded once), checks that both give
+/// the same matrices, and prints the result.
+/// </summary>
+/// <param name="diceCount">Number of dice to animate</param>
+void RunSpinBenchmark(int diceCount);
@@ -0,0 +1,88 @@
+#include "Tray.h"
+#include "SdfAtlas.h"
+
+// thickness of the floor, and height and width of the rim
+static const float floorThickness = 0.05f;
+static const float rimHeight = 0.12f;
+static const float rimWidth = 0.06f;
+
+/// <summary>
+/// Adds an axis-aligned box, four vertices per side so that every side gets its own flat normal.
+/// </summary>
+static void AddBox(TrayMesh& mesh, const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& color)
+{
+    // the corner of the numeral triangle is far away from the numeral, so the atlas reads as plain skin there
+    glm::vec2 uv = GetNumeralTriangleUV(1, 1);
+
+    // outward normal of every side, and one direction along the side (the other one is n x a)
+    static const glm::vec3 normals[6] = {
+        glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1)
+    };
+    static const glm::vec3 sideA[6] = {
+        glm::vec3(0, 1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0)
+    };
+
+    glm::vec3 center = (boxMin + boxMax) * 0.5f;
+    glm::vec3 half = (boxMax - boxMin) * 0.5f;
+    for (int side = 0; side < 6; side++)
+    {
+        glm::vec3 n = normals[side];
+        glm::vec3 a = sideA[side];
+        glm::vec3 b = glm::cross(n, a);
+
+        GLushort first = static_cast<GLushort>(mesh.vertices.size());
+        const float corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+        for (const float* corner : corners)
+        {
+            glm::vec3 p = center + (n + a * corner[0] + b * corner[1]) * half;
+
+            Vertex vertex;
+            vertex.x = p.x;
+            vertex.y = p.y;
+            vertex.z = p.z;
+            vertex.r = static_cast<GLubyte>(color.x * 255.0f);
+            vertex.g = static_cast<GLubyte>(color.y * 255.0f);
+            vertex.b = static_cast<GLubyte>(color.z * 255.0f);
+            vertex.u = uv.x;
+            vertex.v = uv.y;
+            vertex.nx = n.x;
+            vertex.ny = n.y;
+            vertex.nz = n.z;
+            mesh.vertices.push_back(vertex);
+        }
+
+        // the corners go around counter-clockwise seen from outside, since a x b = n
+        GLushort quad[6] = { 0, 1, 2, 0, 2, 3 };
+        for (GLushort index : quad)
+        {
+            mesh.indices.push_back(first + index);
+        }
+    }
+}
+
+/// <summary>
+/// Builds a flat tray (a floor with a low rim around it) out of boxes with flat normals.
+/// The vertices use the same format as the dice, with their UVs on a part of the numeral atlas that holds no numeral,
+/// so the tray can be drawn with the same shaders.
+/// </summary>
+/// <param name="floorMin">Corner of the floor with the smallest x and z</param>
+/// <param name="floorMax">Corner of the floor with the largest x and z</param>
+/// <param name="floorY">Height of the top of the floor</param>
+/// <returns>The tray mesh, in the space of the node it hangs off</returns>
+TrayMesh BuildTrayMesh(const glm::vec2& floorMin, const glm::vec2& floorMax, float floorY)
+{
+    TrayMesh mesh;
+    glm::vec3 felt = glm::vec3(0.15f, 0.35f, 0.25f);
+    glm::vec3 wood = glm::vec3(0.45f, 0.28f, 0.15f);
+
+    AddBox(mesh, glm::vec3(floorMin.x, floorY - floorThickness, floorMin.y), glm::vec3(floorMax.x, floorY, floorMax.y), felt);
+
+    // the rim runs around the outside of the floor: two long sides, then two short ones between them
+    float rimBottom = floorY - floorThickness;
+    float rimTop = floorY + rimHeight;
+    AddBox(mesh, glm::vec3(floorMin.x - rimWidth, rimBottom, floorMin.y - rimWidth), glm::vec3(floorMax.x + rimWidth, rimTop, floorMin.y), wood);
+    AddBox(mesh, glm::vec3(floorMin.x - rimWidth, rimBottom, floorMax.y), glm::vec3(floorMax.x + rimWidth, rimTop, floorMax.y + rimWidth), wood);
+    AddBox(mesh, glm::vec3(floorMin.x - rimWidth, rimBottom, floorMin.y), glm::vec3(floorMin.x, rimTop, floorMax.y), wood);
+    AddBox(mesh, glm::vec3(floorMax.x, rimBottom, floorMin.y), glm::vec3(floorMax.x + rimWidth, rimTop, floorMax.y), wood);
+    return mesh;
+}
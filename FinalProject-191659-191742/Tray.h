@@ -0,0 +1,28 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "D20.h"
+
+/// <summary>
+/// Struct containing the vertices and indices of the tray the dice roll in
+/// </summary>
+struct TrayMesh
+{
+    std::vector<Vertex> vertices;
+    std::vector<GLushort> indices;
+};
+
+/// <summary>
+/// Builds a flat tray (a floor with a low rim around it) out of boxes with flat normals.
+/// The vertices use the same format as the dice, with their UVs on a part of the numeral atlas that holds no numeral,
+/// so the tray can be drawn with the same shaders.
+/// </summary>
+/// <param name="floorMin">Corner of the floor with the smallest x and z</param>
+/// <param name="floorMax">Corner of the floor with the largest x and z</param>
+/// <param name="floorY">Height of the top of the floor</param>
+/// <returns>The tray mesh, in the space of the node it hangs off</returns>
+TrayMesh BuildTrayMesh(const glm::vec2& floorMin, const glm::vec2& floorMax, float floorY);